@@ -4,6 +4,45 @@
 #include <map>        
 #include <utility>    
 #include <algorithm>   
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <memory>
+#include <cstdint>
+#include <cstdlib>
+#include <cmath>
+#include <thread>
+#include <atomic>
+#include <cstring>
+#include <cctype>
+#include <cerrno>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <csignal>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+// Engine instrumentation (per-verb counters, phase latency histograms, room visits).
+// Build with -DENGINE_STATS=0 to compile every probe out.
+#ifndef ENGINE_STATS
+#define ENGINE_STATS 1
+#endif
+#if ENGINE_STATS && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
 
 using std::string;
 using std::cout;
@@ -37,512 +76,10596 @@ namespace GameColors {
 
 using namespace std;  // Add this to resolve std namespace issues
 
-class Room;    // Main class for game locations
-class NPC;     // Non-Player Character class
+class World;   // Flat storage for every room, NPC and piece of text in the game
 class Player;  // Player character class
+class SaveSlot;  // Snapshot and turn journal a player's progress is saved to
+class ActorSimulation;  // NPCs that wander the world on their own
+class RenderCache;  // Rendered room text kept for reuse
+class TurnHistory;  // Earlier states of a player, for undo
+class MacroTable;  // Command sequences a player has named
 
-// Enumeration for cardinal directions, used for room connections
-enum Direction { NORTH = 0, EAST, SOUTH, WEST };  // Values auto-increment from 0
-
-// Enumeration for different types of items player can collect
-enum ItemType { NONE, SWORD, KEY, TREASURE };  // Values auto-increment from 0
+// Enumeration for directions, used for room connections
+enum Direction { NORTH = 0, EAST, SOUTH, WEST, UP, DOWN, DIRECTION_COUNT };  // Values auto-increment from 0
 
 // Enumeration for different types of NPCs in the game
 enum NPCType { NO_NPC, VILLAGER, MONSTER };    // Values auto-increment from 0
 
-// NPC (Non-Player Character) class definition
-class NPC {
-public:
-    NPCType type;        // Type of NPC (villager or monster)
-    bool isDefeated;     // Tracks if monster has been defeated
-    std::string dialogue;// Text displayed when player talks to NPC
+// Rooms, NPCs and items are addressed by their index in the World arrays
+typedef uint32_t RoomId;
+typedef uint32_t NpcId;
+typedef uint32_t ItemId;
+const RoomId NO_ROOM = 0xFFFFFFFFu;    // Marks a missing room
+const NpcId NO_NPC_ID = 0xFFFFFFFFu;   // Marks a room without an NPC
+const ItemId NO_ITEM = 0;              // Item 0 is a placeholder, so 0 marks "no item"
+const uint32_t NO_EDGE = 0xFFFFFFFFu;  // Marks a missing exit
 
-    // Constructor initializes NPC with type and dialogue
-    NPC(NPCType t, const std::string& d) : type(t), dialogue(d), isDefeated(false) {}
+// What an item does, stored with it in the item registry
+enum ItemFlags {
+    ITEM_WEAPON = 1,   // Holding it lets the player fight monsters
+    ITEM_GOAL = 2      // Taking it wins the game
 };
 
-// Room class represents a location in the game world
-class Room {
-private:
-    Room* connections[4];         // Array of pointers to connected rooms (NORTH, EAST, SOUTH, WEST)
-    std::string availablePaths[4]; // Array of direction names for available exits
-    int numPaths;                 // Number of available exits from this room
-    
-public:
-    std::string name;             // Display name of the room
-    std::string description;      // Short description shown on entry
-    std::string detailedDescription; // Longer description shown with 'look' command
-    ItemType item;                // Item present in the room (if any)
-    NPC* npc;                     // NPC present in the room (if any)
-    bool isLocked;                // Whether the room is currently accessible
+// Flags stored with each edge of the room graph
+enum EdgeFlags {
+    EDGE_HIDDEN = 1   // Is neither listed among the available paths nor walkable until a rule reveals it
+};
 
-    // Constructor initializes room with name and basic description
-    Room(const std::string& n, const std::string& desc) 
-        : name(n), description(desc), detailedDescription(""), item(NONE), npc(nullptr), isLocked(false), numPaths(0) {
-        // Initialize all connections to nullptr
-        for(int i = 0; i < 4; i++) {
-            connections[i] = nullptr;
-        }
-    }
+// Verbs a rule can be triggered by; the movement verbs share their values with Direction
+enum RuleVerb {
+    VERB_LOOK = DIRECTION_COUNT,
+    VERB_TALK,
+    VERB_FIGHT,
+    VERB_TAKE,
+    VERB_COUNT,
+    NO_RULE_VERB = 0xFF   // The verb cannot trigger rules
+};
+
+// Operations a rule is made of: its conditions come first, then its actions
+enum RuleOpCode {
+    RULE_HAS_ITEM = 0,    // Condition: the player holds item `value`
+    RULE_LACKS_ITEM,      // Condition: the player does not hold item `value`
+    RULE_ITEM_HERE,       // Condition: item `value` lies in the room
+    RULE_MONSTER_HERE,    // Condition: an undefeated monster is in the room
+    RULE_PRINT,           // Action: print `text` on a line of its own
+    RULE_GIVE_ITEM,       // Action: give the player item `value`
+    RULE_REVEAL_EXIT,     // Action: list the room's hidden exit in direction `value`
+    RULE_UNLOCK_ROOM,     // Action: unlock room `value`
+    RULE_DEFEAT_NPC,      // Action: defeat the NPC in the room
+    RULE_OP_COUNT
+};
+
+// Rule flags
+enum RuleFlags {
+    RULE_INSTEAD = 1      // The rule replaces the verb's usual handling instead of following it
+};
+
+// Layout of TextRef::packed
+const uint32_t TEXT_LENGTH_MASK = 0x00FFFFFFu;  // Body length; a single string is limited to 16 MiB
+const uint32_t TEXT_STYLE_SHIFT = 24;           // Style index (0 = none) in bits 24-30
+const uint32_t TEXT_STYLE_LIMIT = 127;          // Most styles a world can intern
+const uint32_t TEXT_RESET = 0x80000000u;        // The string ends with GameColors::reset
+
+// Location of a string inside the world's text store. Color codes are not stored
+// with each string: the escape sequences a string starts with are interned once as
+// a style, and a trailing reset is a flag, so the text store holds only the visible
+// body, which strings can share (a room's description is often the start of its detail).
+struct TextRef {
+    uint32_t offset;  // Index of the first character of the body
+    uint32_t packed;  // Body length, style index and reset flag (see TEXT_LENGTH_MASK)
 
-    // Getter methods for private members
-    Room** getConnections() { return connections; }
-    const Room* const* getConnections() const { return connections; }
-    std::string* getAvailablePaths() { return availablePaths; }
-    const std::string* getAvailablePaths() const { return availablePaths; }
-    int getNumPaths() const { return numPaths; }
+    uint32_t length() const { return packed & TEXT_LENGTH_MASK; }
+    uint32_t style() const { return (packed >> TEXT_STYLE_SHIFT) & TEXT_STYLE_LIMIT; }
+    bool endsWithReset() const { return (packed & TEXT_RESET) != 0; }
+};
+
+// One rule, stored with the other rules of its room sorted by verb
+struct Rule {
+    uint8_t verb;         // RuleVerb that triggers the rule
+    uint8_t flags;        // RuleFlags
+    uint16_t opCount;     // Number of operations
+    uint32_t firstOp;     // Index of the first operation in the rule operation table
+};
+
+// One condition or action of a rule
+struct RuleOp {
+    uint32_t code;        // RuleOpCode
+    uint32_t value;       // Item, direction or room the operation refers to
+    TextRef text;         // Text printed by RULE_PRINT
+};
+
+// One kind of item in the world's item registry
+struct ItemInfo {
+    TextRef name;         // Word the player refers to it by, e.g. "sword"
+    TextRef seen;         // Shown when it lies in the player's room
+    TextRef taken;        // Shown when the player takes it
+    TextRef refused;      // Shown when taking it needs an item the player lacks
+    ItemId needs;         // Item the player must hold to take it, or NO_ITEM
+    uint32_t flags;       // ItemFlags
+};
+
+// A number of items of one kind, lying in a room or held by the player
+struct ItemStack {
+    ItemId item;
+    uint32_t count;
+};
+
+// Vector of trivially copyable elements that keeps the first N inline and only
+// allocates once it grows beyond them, so short lists cost no heap allocation
+template <typename T, size_t N>
+class SmallVector {
+private:
+    T inlineItems[N];
+    T* heapItems;         // Elements once they no longer fit inline, or nullptr
+    uint32_t count;
+    uint32_t heapCapacity;
+
+    T* items() { return heapItems != nullptr ? heapItems : inlineItems; }
+    const T* items() const { return heapItems != nullptr ? heapItems : inlineItems; }
 
-    // Adds a new available direction to the room
-    void addPath(const std::string& path) {
-        if (numPaths < 4) {
-            availablePaths[numPaths++] = path;
+public:
+    SmallVector() : heapItems(nullptr), count(0), heapCapacity(0) {}
+    SmallVector(const SmallVector& other) : heapItems(nullptr), count(0), heapCapacity(0) { *this = other; }
+    SmallVector(SmallVector&& other) noexcept : heapItems(other.heapItems), count(other.count), heapCapacity(other.heapCapacity) {
+        if (heapItems == nullptr) {
+            std::memcpy(inlineItems, other.inlineItems, count * sizeof(T));
         }
+        other.heapItems = nullptr;
+        other.count = 0;
+        other.heapCapacity = 0;
     }
+    ~SmallVector() { delete[] heapItems; }
 
-    // Removes all available paths from the room
-    void clearPaths() {
-        numPaths = 0;
+    SmallVector& operator=(const SmallVector& other) {
+        if (this != &other) {
+            if (other.count <= N) {
+                delete[] heapItems;
+                heapItems = nullptr;
+                heapCapacity = 0;
+            }
+            count = 0;
+            reserve(other.count);
+            std::memcpy(items(), other.items(), other.count * sizeof(T));
+            count = other.count;
+        }
+        return *this;
     }
 
-    // Converts Direction enum to string representation
-    std::string directionToString(Direction dir) {
-        switch(dir) {
-            case NORTH: return std::string("north");
-            case SOUTH: return std::string("south");
-            case EAST: return std::string("east");
-            case WEST: return std::string("west");
-            default: return std::string("unknown");
+    SmallVector& operator=(SmallVector&& other) noexcept {
+        if (this != &other) {
+            delete[] heapItems;
+            if (other.heapItems == nullptr) {
+                std::memcpy(inlineItems, other.inlineItems, other.count * sizeof(T));
+            }
+            heapItems = other.heapItems;
+            count = other.count;
+            heapCapacity = other.heapCapacity;
+            other.heapItems = nullptr;
+            other.count = 0;
+            other.heapCapacity = 0;
         }
+        return *this;
     }
 
-    // Establishes a two-way connection between this room and another
-    void setConnection(Direction dir, Room* room) {
-        if (room == nullptr) {
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    bool onHeap() const { return heapItems != nullptr; }
+    T* begin() { return items(); }
+    T* end() { return items() + count; }
+    const T* begin() const { return items(); }
+    const T* end() const { return items() + count; }
+    T& operator[](size_t i) { return items()[i]; }
+    const T& operator[](size_t i) const { return items()[i]; }
+
+    void reserve(size_t wanted) {
+        if (wanted <= N || wanted <= heapCapacity) {
             return;
         }
-        
-        // Set connection in specified direction
-        connections[dir] = room;
-        addPath(directionToString(dir));
-        
-        // Set reverse connection automatically
-        Direction opposite;
-        switch(dir) {
-            case NORTH: opposite = SOUTH; break;
-            case SOUTH: opposite = NORTH; break;
-            case EAST: opposite = WEST; break;
-            case WEST: opposite = EAST; break;
-        }
-        
-        room->connections[opposite] = this;
-        room->addPath(directionToString(opposite));
+        uint32_t capacity = std::max<uint32_t>(static_cast<uint32_t>(wanted), heapCapacity * 2);
+        T* grown = new T[capacity];
+        std::memcpy(grown, items(), count * sizeof(T));
+        delete[] heapItems;
+        heapItems = grown;
+        heapCapacity = capacity;
+    }
+
+    // Inserts `value` before position `at`
+    void insert(size_t at, const T& value) {
+        reserve(count + 1);
+        T* data = items();
+        std::memmove(data + at + 1, data + at, (count - at) * sizeof(T));
+        data[at] = value;
+        count++;
     }
 
-    // Displays basic room information on entry
-    void describe() {
-        std::cout << "\nYou are in " << name << ". " << description << std::endl;
-        showAvailablePathsAndItems();
+    void push_back(const T& value) { insert(count, value); }
+
+    // Removes the element at position `at`
+    void erase(size_t at) {
+        T* data = items();
+        std::memmove(data + at, data + at + 1, (count - at - 1) * sizeof(T));
+        count--;
     }
 
-    // Displays detailed room information when looking
-    void describeLook() {
-        std::cout << "\nYou carefully examine " << name << ".\n" << detailedDescription << std::endl;
-        showAvailablePathsAndItems();
+    void clear() { count = 0; }
+};
+
+// Number of bits set in a word. Without a popcount instruction (-mpopcnt) the
+// compiler's builtin is a library call, so the bit-twiddling version is used instead.
+inline uint32_t popcount64(uint64_t word) {
+#ifdef __POPCNT__
+    return static_cast<uint32_t>(__builtin_popcountll(word));
+#else
+    word = word - ((word >> 1) & 0x5555555555555555ull);
+    word = (word & 0x3333333333333333ull) + ((word >> 2) & 0x3333333333333333ull);
+    word = (word + (word >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+    return static_cast<uint32_t>((word * 0x0101010101010101ull) >> 56);
+#endif
+}
+
+// Converts Direction enum to string representation
+const char* directionToString(Direction dir) {
+    static const char* const names[DIRECTION_COUNT] = { "north", "east", "south", "west", "up", "down" };
+    return dir >= NORTH && dir < DIRECTION_COUNT ? names[dir] : "unknown";
+}
+
+// Returns the direction that leads back the way a connection came; constexpr so
+// that worlds defined at compile time can check their connections
+constexpr Direction oppositeDirection(Direction dir) {
+    return dir < UP ? static_cast<Direction>((dir + 2) % 4) : dir == UP ? DOWN : UP;
+}
+
+// Sections of a compiled world image, in the order they are laid out
+enum WorldSection {
+    SECTION_EDGE_START = 0,   // uint32_t per room, plus one final entry
+    SECTION_EDGE_TARGET,      // RoomId per edge
+    SECTION_EDGE_DIRECTION,   // uint8_t per edge
+    SECTION_EDGE_FLAGS,       // uint8_t per edge
+    SECTION_EXIT_MASK,        // uint8_t per room
+    SECTION_ROOM_ITEM_START,  // uint32_t per room, plus one final entry
+    SECTION_ROOM_ITEM,        // ItemStack per stack lying in a room, grouped by room
+    SECTION_ROOM_LOCKED,      // uint8_t per room
+    SECTION_ROOM_NPC,         // NpcId per room
+    SECTION_ROOM_NAME,        // TextRef per room
+    SECTION_ROOM_DESCRIPTION, // TextRef per room
+    SECTION_ROOM_DETAIL,      // TextRef per room
+    SECTION_NPC_TYPE,         // uint8_t per NPC
+    SECTION_NPC_DIALOGUE,     // TextRef per NPC
+    SECTION_ITEM,             // ItemInfo per item kind, item 0 being a placeholder
+    SECTION_STYLE,            // TextRef per interned style prefix
+    SECTION_RULE_START,       // uint32_t per room, plus one final entry
+    SECTION_RULE,             // Rule per rule, grouped by room
+    SECTION_RULE_OP,          // RuleOp per rule operation
+    SECTION_ACTOR_HOME,       // RoomId per wandering actor
+    SECTION_ACTOR_NPC,        // NpcId per wandering actor
+    SECTION_TEXT,             // char per byte of text
+    SECTION_COUNT
+};
+
+const char WORLD_IMAGE_MAGIC[8] = { 'E', 'L', 'D', 'A', 'R', 'A', 'W', '\0' };
+const uint32_t WORLD_IMAGE_VERSION = 6;
+const uint32_t WORLD_IMAGE_ENDIAN_CHECK = 0x01020304u;  // Reads differently on a machine of the other byte order
+
+// Fixed header at the start of a world image. The sections follow it, each
+// aligned to 8 bytes, so every array can be used in place once the image is mapped.
+struct WorldImageHeader {
+    char magic[8];                        // WORLD_IMAGE_MAGIC
+    uint32_t version;                     // WORLD_IMAGE_VERSION
+    uint32_t endianCheck;                 // WORLD_IMAGE_ENDIAN_CHECK
+    uint64_t imageSize;                   // Size of the whole image in bytes
+    uint64_t checksum;                    // imageChecksum() of everything after the header
+    uint32_t roomCount;
+    uint32_t edgeCount;
+    uint32_t npcCount;
+    uint32_t textSize;
+    uint32_t startRoom;
+    uint32_t styleCount;
+    uint32_t ruleCount;
+    uint32_t ruleOpCount;
+    uint32_t actorCount;
+    uint32_t itemCount;
+    uint32_t roomItemCount;
+    uint32_t reserved;                    // Keeps the section tables 8-byte aligned
+    uint64_t sectionOffset[SECTION_COUNT]; // Byte offset of each section from the start of the image
+    uint64_t sectionSize[SECTION_COUNT];   // Byte size of each section
+};
+
+// 64-bit checksum used to detect corrupted images; reads eight bytes at a time
+uint64_t imageChecksum(const char* data, size_t size) {
+    uint64_t h = 0x9E3779B97F4A7C15ull ^ size;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        h = (h ^ word) * 0x100000001B3ull;
+        h ^= h >> 29;
     }
+    for (; i < size; ++i) {
+        h = (h ^ static_cast<unsigned char>(data[i])) * 0x100000001B3ull;
+    }
+    return h ^ (h >> 32);
+}
+
+// Collects rooms, NPCs, text and connections and turns them into a world image.
+// Adjacency is stored as a compressed edge table: the edges of room r are the
+// entries [edgeStart[r], edgeStart[r + 1]) of the edge arrays, so a room can have
+// any number of exits, including one-way and hidden ones.
+class WorldBuilder {
+private:
+    // Connection recorded by connect() until build() creates the edge table
+    struct PendingEdge {
+        RoomId from;
+        RoomId to;
+        uint8_t direction;
+        uint8_t flags;
+    };
+    std::vector<PendingEdge> pendingEdges;
+
+    // Rule recorded by addRule() until build() indexes it by room and verb
+    struct PendingRule {
+        RoomId room;
+        Rule rule;   // firstOp indexes pendingOps
+    };
+    std::vector<PendingRule> pendingRules;
+    std::vector<RuleOp> pendingOps;
+
+    // Items placed by placeItem() until build() groups them by room
+    struct PendingItem {
+        RoomId room;
+        ItemStack stack;
+    };
+    std::vector<PendingItem> pendingItems;
 
-    // Helper function to display paths, NPCs, and items
-    void showAvailablePathsAndItems() {
-        // Show available exits
-        if (getNumPaths() > 0) {
-            std::cout << GameColors::cyan << "Available paths lead: ";
-            for (int i = 0; i < getNumPaths(); ++i) {
-                std::cout << GameColors::yellow << getAvailablePaths()[i] << GameColors::cyan;
-                if (i < getNumPaths() - 1) {
-                    std::cout << ", ";
+    // Open-addressed table of every body in the text store, so identical strings are
+    // stored once. Kept in one flat array to avoid an allocation per string.
+    struct InternSlot {
+        uint64_t hash;
+        TextRef ref;   // offset == NO_TEXT marks an empty slot
+    };
+    static const uint32_t NO_TEXT = 0xFFFFFFFFu;
+    std::vector<InternSlot> internSlots;
+    size_t internCount;
+
+    // Finds an identical body already in the text store, or appends a new one
+    TextRef internBody(const char* body, size_t size) {
+        if ((internCount + 1) * 2 > internSlots.size()) {
+            std::vector<InternSlot> old;
+            old.swap(internSlots);
+            InternSlot empty = { 0, { NO_TEXT, 0 } };
+            internSlots.assign(std::max<size_t>(64, old.size() * 2), empty);
+            for (size_t i = 0; i < old.size(); ++i) {
+                if (old[i].ref.offset != NO_TEXT) {
+                    size_t slot = old[i].hash & (internSlots.size() - 1);
+                    while (internSlots[slot].ref.offset != NO_TEXT) {
+                        slot = (slot + 1) & (internSlots.size() - 1);
+                    }
+                    internSlots[slot] = old[i];
                 }
             }
-            std::cout << "." << GameColors::reset << std::endl;
         }
-
-        // Show NPCs if present
-        if (npc != nullptr && !npc->isDefeated) {
-            if (npc->type == NPCType::VILLAGER) {
-                std::cout << GameColors::bold << GameColors::cyan << "There is a villager here you can talk to." << GameColors::reset << std::endl;
-            } else if (npc->type == NPCType::MONSTER) {
-                std::cout << GameColors::bold << GameColors::red << "A fearsome monster blocks your path!" << GameColors::reset << std::endl;
+        uint64_t hash = imageChecksum(body, size);
+        size_t slot = hash & (internSlots.size() - 1);
+        for (; internSlots[slot].ref.offset != NO_TEXT; slot = (slot + 1) & (internSlots.size() - 1)) {
+            const InternSlot& candidate = internSlots[slot];
+            if (candidate.hash == hash && candidate.ref.length() == size
+                && std::memcmp(text.data() + candidate.ref.offset, body, size) == 0) {
+                return candidate.ref;
             }
         }
+        TextRef ref = { static_cast<uint32_t>(text.size()), static_cast<uint32_t>(size) };
+        text.append(body, size);
+        internSlots[slot].hash = hash;
+        internSlots[slot].ref = ref;
+        internCount++;
+        return ref;
+    }
 
-        // Show items if present
-        if (item != ItemType::NONE) {
-            switch(item) {
-                case ItemType::SWORD:
-                    std::cout << GameColors::bold << GameColors::green << "There is a sword here that you can take." << GameColors::reset << std::endl;
-                    break;
-                case ItemType::KEY:
-                    std::cout << GameColors::bold << GameColors::yellow << "There is a key here that you can take." << GameColors::reset << std::endl;
-                    break;
-                case ItemType::TREASURE:
-                    std::cout << GameColors::bold << GameColors::yellow << "There is a treasure chest here!" << GameColors::reset << std::endl;
-                    break;
-                default:
-                    break;
-            }
-        }
+    // Appends one section to the image, padded to 8 bytes, and records it in the header
+    static void appendSection(std::vector<char>& image, WorldSection section, const void* data, size_t size) {
+        WorldImageHeader* header = reinterpret_cast<WorldImageHeader*>(&image[0]);
+        header->sectionOffset[section] = image.size();
+        header->sectionSize[section] = size;
+        const char* bytes = static_cast<const char*>(data);
+        image.insert(image.end(), bytes, bytes + size);
+        image.resize((image.size() + 7) & ~static_cast<size_t>(7), '\0');
     }
 
-    // Checks if movement in a given direction is possible
-    bool canMove(Direction dir) {
-        return connections[dir] != nullptr;
+    template <typename T>
+    static void appendSection(std::vector<char>& image, WorldSection section, const std::vector<T>& values) {
+        appendSection(image, section, values.empty() ? nullptr : &values[0], values.size() * sizeof(T));
     }
-};
 
-// Player class manages the player's state and inventory
-class Player {
-private:
-    bool itemInventory[3];  // Fixed-size array tracking collected items (SWORD, KEY, TREASURE)
-    
 public:
-    Room* currentRoom;      // Pointer to the room player is currently in
-    bool hasTreasure;       // Flag indicating if player has found the treasure
-    int moveCount;          // Number of moves player has made
+    // Per-room data
+    std::vector<uint8_t> roomLocked;      // Whether each room is locked
+    std::vector<NpcId> roomNpc;           // NPC present in each room, or NO_NPC_ID
+    std::vector<TextRef> roomName;        // Display name of each room
+    std::vector<TextRef> roomDescription; // Short description shown on entry
+    std::vector<TextRef> roomDetail;      // Longer description shown with 'look' command
 
-    // Constructor initializes player at starting room with empty inventory
-    Player(Room* startingRoom) : currentRoom(startingRoom), hasTreasure(false), moveCount(0) {
-        itemInventory[SWORD-1] = false;
-        itemInventory[KEY-1] = false;
-        itemInventory[TREASURE-1] = false;
-    }
+    // Per-NPC data
+    std::vector<uint8_t> npcType;         // NPCType of each NPC
+    std::vector<TextRef> npcDialogue;     // Text displayed when player talks to each NPC
+
+    // Per-actor data: NPCs that wander instead of staying in one room
+    std::vector<RoomId> actorHome;        // Room each actor starts in (a monster's lair)
+    std::vector<NpcId> actorNpc;          // NPC record giving each actor's type and dialogue
+
+    // Item registry, indexed by ItemId; item 0 is the NO_ITEM placeholder
+    std::vector<ItemInfo> items;
 
-    // Checks if player has a specific item
-    bool hasItem(ItemType item) {
-        return item != NONE && itemInventory[item-1];
+    std::string text;                     // Every string body in the world, each stored once
+    std::vector<TextRef> styles;          // Interned style prefixes (style index i is styles[i - 1])
+    RoomId startRoom;                     // Room the player starts in
+
+    WorldBuilder() : internCount(0), startRoom(0) {
+        ItemInfo placeholder = { { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, NO_ITEM, 0 };
+        items.push_back(placeholder);
     }
 
-    // Adds an item to player's inventory
-    void addItem(ItemType item) {
-        if (item != NONE) {
-            itemInventory[item-1] = true;
-            if (item == TREASURE) {
-                hasTreasure = true;
+    // Number of rooms added so far
+    uint32_t roomCount() const { return static_cast<uint32_t>(roomLocked.size()); }
+
+    // Stores a string: its leading escape sequences become a style, a trailing reset
+    // becomes a flag, and the body is shared with an identical body stored earlier or,
+    // failing that, with any part of `within` (a longer string stored just before).
+    // Bodies known to be distinct, such as numbered room names, can skip the search
+    // for an identical one by passing `shared` = false.
+    TextRef addText(const std::string& s, const TextRef* within = nullptr, bool shared = true) {
+        size_t begin = 0;
+        while (begin + 1 < s.size() && s[begin] == '\033' && s[begin + 1] == '[') {
+            size_t end = begin + 2;
+            while (end < s.size() && !(s[end] >= '@' && s[end] <= '~')) {
+                ++end;
             }
+            begin = end + 1;
+        }
+        begin = std::min(begin, s.size());
+        size_t end = s.size();
+        uint32_t flags = 0;
+        const std::string& reset = GameColors::reset;
+        if (end - begin >= reset.size() && s.compare(end - reset.size(), reset.size(), reset) == 0) {
+            end -= reset.size();
+            flags |= TEXT_RESET;
         }
-    }
 
-    // Checks if player can engage in combat
-    bool canFight() {
-        return hasItem(SWORD);
+        if (begin > 0) {
+            // Worlds use a handful of styles, so a linear search is all the lookup needs
+            uint32_t style = 0;
+            for (size_t i = 0; i < styles.size() && style == 0; ++i) {
+                if (styles[i].length() == begin && std::memcmp(text.data() + styles[i].offset, s.data(), begin) == 0) {
+                    style = static_cast<uint32_t>(i + 1);
+                }
+            }
+            if (style == 0 && styles.size() < TEXT_STYLE_LIMIT) {
+                styles.push_back(internBody(s.data(), begin));
+                style = static_cast<uint32_t>(styles.size());
+            }
+            if (style != 0) {
+                flags |= style << TEXT_STYLE_SHIFT;
+            } else {
+                begin = 0;  // Out of style slots: keep the escape codes in the body
+            }
+        }
+
+        const char* body = s.data() + begin;
+        size_t size = end - begin;
+        TextRef ref;
+        const char* host = within != nullptr ? text.data() + within->offset : nullptr;
+        const char* found = host != nullptr ? std::search(host, host + within->length(), body, body + size) : nullptr;
+        if (found != nullptr && found != host + within->length()) {
+            ref.offset = static_cast<uint32_t>(found - text.data());
+            ref.packed = static_cast<uint32_t>(size);
+        } else if (!shared) {
+            ref.offset = static_cast<uint32_t>(text.size());
+            ref.packed = static_cast<uint32_t>(size);
+            text.append(body, size);
+        } else {
+            ref = internBody(body, size);
+        }
+        ref.packed |= flags;
+        return ref;
     }
-};
 
-int main() {
-    // Create styled room names with appropriate colors and formatting
-    std::string forestName = std::string(GameColors::forestColor) + GameColors::bold + "Forest" + GameColors::reset;  
-    std::string ruinsName = std::string(GameColors::ruinsColor) + GameColors::bold + "Ruins" + GameColors::reset;   
-    std::string caveName = std::string(GameColors::caveColor) + GameColors::bold + "Cave" + GameColors::reset;   
-    std::string mountainName = std::string(GameColors::mountainColor) + GameColors::bold + "\033[3m" + "Mountain" + GameColors::reset;  // Italicized
-    std::string valleyName = std::string("\033[38;5;106m") + GameColors::bold + "Valley" + GameColors::reset;  // Light green
-    std::string lakeName = std::string(GameColors::lakeColor) + GameColors::bold + "\033[3m" + "Lake" + GameColors::reset;  // Italicized
-    std::string villageName = std::string(GameColors::villageColor) + GameColors::bold + "Village" + GameColors::reset;
-    std::string hiddenRoomName = std::string(GameColors::hiddenRoomColor) + GameColors::bold + "Hidden Room" + GameColors::reset;
+    // Adds a room and returns its id
+    RoomId addRoom(const std::string& name, const std::string& description, const std::string& detail) {
+        TextRef detailRef = addText(detail);
+        return addRoom(addText(name), addText(description, &detailRef), detailRef);
+    }
 
-    // Create and initialize all rooms with their descriptions
-    // Forest - Starting Room
-    Room forest(forestName, std::string(GameColors::forestColor) + "A dark forest surrounds you. Ancient trees tower overhead, and the air is thick with the scent of pine." + GameColors::reset);
-    forest.detailedDescription = std::string(GameColors::forestColor) + "Ancient trees tower overhead, their branches swaying in the breeze. The air is thick with the scent of pine and wild mushrooms. Fallen leaves crunch beneath your feet, and somewhere in the distance, an owl hoots softly. The dense canopy above allows only occasional shafts of light to penetrate to the forest floor. You notice some old footprints leading east." + GameColors::reset;
-    
-    // Ruins - Ancient civilization remains
-    Room ruins(ruinsName, std::string(GameColors::ruinsColor).append("Crumbling stone walls and weathered pillars tell tales of an ancient civilization.").append(GameColors::reset));
-    ruins.detailedDescription = std::string(GameColors::ruinsColor).append("Crumbling stone walls and weathered pillars tell tales of an ancient civilization. Intricate carvings, though worn by time, still adorn the weathered stones. Vines and moss have claimed much of the architecture. Among the broken pottery shards, you spot what appears to be a map fragment showing a path leading south.").append(GameColors::reset);
-    
-    // Cave - Dark and mysterious location
-    Room cave(caveName, std::string(GameColors::caveColor).append("The damp cave walls glisten with moisture. Strange echoes bounce off the rocky surfaces.").append(GameColors::reset));
-    cave.detailedDescription = std::string(GameColors::caveColor).append("The damp cave walls glisten with moisture. Strange echoes bounce off the rocky surfaces, making it impossible to tell their source. Mineral formations catch what little light there is, creating an otherworldly atmosphere. The monster's presence makes it difficult to explore further, but you sense something valuable might be hidden here.").append(GameColors::reset);
-    
-    // Mountain - Elevated vantage point
-    Room mountain(mountainName, std::string(GameColors::mountainColor).append("The majestic mountain peak pierces the clouds above. The air is thin but crisp.").append(GameColors::reset));
-    mountain.detailedDescription = std::string(GameColors::mountainColor).append("The air is thin but crisp, and the view from here is breathtaking. Snow-capped peaks stretch into the distance, and the wind whistles through the rocky crags. Ancient runes are carved into some of the larger boulders. The eastern rock face seems unusually smooth compared to the rest.").append(GameColors::reset);
-    
-    // Valley - Peaceful transition area
-    Room valley(valleyName, std::string("\033[38;5;106m").append("A serene valley stretches between the mountains.").append(GameColors::reset));
-    valley.detailedDescription = std::string("\033[38;5;106m").append("Wildflowers dot the gentle slopes, creating a carpet of vibrant colors. A gentle breeze carries the sweet scent of mountain blooms, and butterflies dance among the flowers. Small streams trickle down from the heights, creating a peaceful melody. The path continues east towards what appears to be a large body of water.").append(GameColors::reset);
-    
-    // Lake - Reflective water body
-    Room lake(lakeName, std::string(GameColors::lakeColor).append("Crystal clear waters stretch before you, reflecting the sky like a mirror.").append(GameColors::reset));
-    lake.detailedDescription = std::string(GameColors::lakeColor).append("Crystal clear waters stretch before you, reflecting the sky like a mirror. The surface occasionally ripples as fish jump, creating expanding circles that distort the perfect reflection. The shoreline is dotted with smooth pebbles and tall reeds. Through the clear water, you can make out what looks like an old path leading south.").append(GameColors::reset);
-    
-    // Village - Inhabited settlement
-    Room village(villageName, std::string(GameColors::villageColor).append("A peaceful village with thatched-roof houses and cobblestone streets.").append(GameColors::reset));
-    village.detailedDescription = std::string(GameColors::villageColor).append("Thatched-roof houses line the cobblestone streets, smoke rising from their chimneys. The scent of hearth fires and cooking meals fills the air. Children play between the buildings while adults go about their daily tasks. You overhear villagers discussing local legends about hidden treasures and secret passages in the mountains.").append(GameColors::reset);
-    
-    // Hidden Room - Secret treasure location
-    Room hiddenRoom(hiddenRoomName, std::string(GameColors::hiddenRoomColor).append("This dusty chamber seems untouched for centuries. An ornate chest catches your eye.").append(GameColors::reset));
-    hiddenRoom.detailedDescription = std::string(GameColors::hiddenRoomColor).append("This dusty chamber seems untouched for centuries. An ornate chest catches your eye, its metalwork still gleaming despite its age. The walls are covered in elaborate tapestries depicting ancient battles and mystical creatures. Precious gems and metals are worked into the very structure of the room, creating a subtle sparkle in the dim light.").append(GameColors::reset);
+    // Adds a room whose texts are already stored, for many rooms sharing a description
+    RoomId addRoom(TextRef name, TextRef description, TextRef detail) {
+        RoomId id = roomCount();
+        roomLocked.push_back(0);
+        roomNpc.push_back(NO_NPC_ID);
+        roomName.push_back(name);
+        roomDescription.push_back(description);
+        roomDetail.push_back(detail);
+        return id;
+    }
 
-    // Add NPCs and items to specific rooms
-    village.npc = new NPC(VILLAGER, "Greetings traveler! Let me show you a map of the area:\n\n" 
-        + GameColors::bold + GameColors::blue + R"(
-    Village ─── Valley ─── Lake
-        │                    │
-        │                    │
-    Forest ─── Ruins         │
-                  │          │
-                  │          │
-                Cave         │
-                             │
-                         Mountain
-)" + GameColors::reset + "\n" + GameColors::cyan + "There are many interesting places to explore. I've heard whispers of ancient treasures hidden somewhere in these lands, but their location remains a mystery..." + GameColors::reset);
-    cave.npc = new NPC(MONSTER, "A fearsome monster guards a mysterious key!");
-    mountain.item = SWORD;
-    hiddenRoom.item = TREASURE;
-    hiddenRoom.isLocked = true;
+    // Adds an NPC record without placing it anywhere and returns its id
+    NpcId defineNPC(NPCType type, const std::string& dialogue) {
+        NpcId id = static_cast<NpcId>(npcType.size());
+        npcType.push_back(static_cast<uint8_t>(type));
+        npcDialogue.push_back(addText(dialogue));
+        return id;
+    }
 
-    // Setup room connections to create the game world layout
-    // Village area connections
-    village.setConnection(EAST, &valley);
-    village.setConnection(SOUTH, &forest);
+    // Places a new NPC in a room and returns its id
+    NpcId addNPC(RoomId room, NPCType type, const std::string& dialogue) {
+        NpcId id = defineNPC(type, dialogue);
+        roomNpc[room] = id;
+        return id;
+    }
 
-    // Valley connections
-    valley.setConnection(EAST, &lake);
+    // Adds an actor that starts in `home` and wanders; many actors can share one NPC record
+    void addActor(RoomId home, NpcId npc) {
+        actorHome.push_back(home);
+        actorNpc.push_back(npc);
+    }
 
-    // Forest connections
-    forest.setConnection(EAST, &ruins);
+    // Registers a kind of item and returns its id. Empty texts get plain defaults
+    // built from the name; `needs` is an item the player must hold to take it.
+    ItemId addItem(const std::string& name, const std::string& seen = std::string(), const std::string& taken = std::string(),
+                   const std::string& refused = std::string(), uint32_t flags = 0, ItemId needs = NO_ITEM) {
+        ItemInfo info;
+        info.name = addText(name);
+        info.seen = addText(seen.empty() ? "There is a " + name + " here." : seen);
+        info.taken = addText(taken.empty() ? "You take the " + name + "." : taken);
+        info.refused = addText(refused.empty() ? "You cannot take the " + name + " yet." : refused);
+        info.needs = needs;
+        info.flags = flags;
+        items.push_back(info);
+        return static_cast<ItemId>(items.size() - 1);
+    }
 
-    // Lake connections
-    lake.setConnection(SOUTH, &mountain);
+    // Puts `count` items of a kind in a room; placing the same kind twice adds to its stack
+    void placeItem(RoomId room, ItemId item, uint32_t count = 1) {
+        PendingItem pending = { room, { item, count } };
+        pendingItems.push_back(pending);
+    }
 
-    // Ruins connections
-    ruins.setConnection(SOUTH, &cave);
+    // Adds a one-way connection from one room to another
+    void connectOneWay(RoomId from, Direction dir, RoomId to, uint8_t flags = 0) {
+        PendingEdge edge = { from, to, static_cast<uint8_t>(dir), flags };
+        pendingEdges.push_back(edge);
+    }
 
-    // Mountain connections (including hidden path)
-    mountain.setConnection(EAST, &hiddenRoom);
+    // Establishes a two-way connection; `flags` apply to the forward edge only,
+    // so a hidden passage can still be seen from the other side
+    void connect(RoomId from, Direction dir, RoomId to, uint8_t flags = 0) {
+        connectOneWay(from, dir, to, flags);
+        connectOneWay(to, oppositeDirection(dir), from);
+    }
 
-    // Hide the east path from mountain to hidden room
-    mountain.clearPaths();  // Clear existing paths
-    if (mountain.getConnections()[NORTH] != nullptr) {
-        mountain.addPath(mountain.directionToString(NORTH));
+    // Starts a rule that fires when `verb` is used in `room`. Conditions and
+    // actions added afterwards belong to it; conditions must come first.
+    void addRule(RoomId room, RuleVerb verb, uint8_t flags = 0) {
+        PendingRule pending = { room, { static_cast<uint8_t>(verb), flags, 0, static_cast<uint32_t>(pendingOps.size()) } };
+        pendingRules.push_back(pending);
     }
-    if (mountain.getConnections()[SOUTH] != nullptr) {
-        mountain.addPath(mountain.directionToString(SOUTH));
+
+    // Adds a condition or action other than RULE_PRINT to the last rule
+    void addRuleOp(RuleOpCode code, uint32_t value = 0) {
+        RuleOp op = { static_cast<uint32_t>(code), value, { 0, 0 } };
+        pendingOps.push_back(op);
+        pendingRules.back().rule.opCount++;
     }
-    if (mountain.getConnections()[WEST] != nullptr) {
-        mountain.addPath(mountain.directionToString(WEST));
+
+    // Adds an action that prints `message` to the last rule
+    void addRulePrint(const std::string& message) {
+        RuleOp op = { RULE_PRINT, 0, addText(message) };
+        pendingOps.push_back(op);
+        pendingRules.back().rule.opCount++;
     }
 
-    // Initialize player at the starting location (forest)
-    Player player(&forest);
+    // Lays the world out as an image: header, then each section in WorldSection order
+    void build(std::vector<char>& image) const {
+        uint32_t rooms = roomCount();
+        uint32_t edges = static_cast<uint32_t>(pendingEdges.size());
 
-    // Display welcome banner using Unicode block characters
-    std::cout << GameColors::bold << GameColors::cyan;
-    std::cout << R"(
-█████╗    ██████╗  ██╗   ██╗ ███████╗ ███╗   ██╗ ████████╗ ██╗   ██╗ ██████╗  ███████╗
-██╔══██╗  ██╔══██╗ ██║   ██║ ██╔════╝ ████╗  ██║ ╚══██╔══╝ ██║   ██║ ██╔══██╗ ██╔════╝
-███████║  ██║  ██║ ██║   ██║ █████╗   ██╔██╗ ██║    ██║    ██║   ██║ ██████╔╝ █████╗  
-██╔══██║  ██║  ██║ ╚██╗ ██╔╝ ██╔══╝   ██║╚██╗██║    ██║    ██║   ██║ ██╔══██╗ ██╔══╝  
-██║  ██║  ██████╔╝  ╚████╔╝  ███████╗ ██║ ╚████║    ██║    ╚██████╔╝ ██║  ██║ ███████╗
-╚═╝  ╚═╝  ╚═════╝    ╚═══╝   ╚══════╝ ╚═╝  ╚═══╝    ╚═╝     ╚═════╝  ╚═╝  ╚═╝ ╚══════╝
-)" << GameColors::reset << std::endl;
+        // Counting sort by source room keeps each room's edges in the order they were added
+        std::vector<uint32_t> edgeStart(rooms + 1, 0);
+        for (uint32_t i = 0; i < edges; ++i) {
+            edgeStart[pendingEdges[i].from + 1]++;
+        }
+        for (uint32_t r = 0; r < rooms; ++r) {
+            edgeStart[r + 1] += edgeStart[r];
+        }
+        std::vector<uint32_t> cursor(edgeStart.begin(), edgeStart.end() - 1);
+        std::vector<RoomId> edgeTarget(edges);
+        std::vector<uint8_t> edgeDirection(edges);
+        std::vector<uint8_t> edgeFlags(edges);
+        std::vector<uint8_t> exitMask(rooms, 0);
+        for (uint32_t i = 0; i < edges; ++i) {
+            const PendingEdge& edge = pendingEdges[i];
+            uint32_t slot = cursor[edge.from]++;
+            edgeTarget[slot] = edge.to;
+            edgeDirection[slot] = edge.direction;
+            edgeFlags[slot] = edge.flags;
+            if ((edge.flags & EDGE_HIDDEN) == 0) {
+                exitMask[edge.from] |= static_cast<uint8_t>(1u << edge.direction);
+            }
+        }
 
-    // Display welcome message and game introduction
-    std::cout << GameColors::bold << GameColors::magenta << R"(
-╔═══════════════════════════════════════════╗
-║           Welcome to the Adventure!       ║
-╚═══════════════════════════════════════════╝
-)" << GameColors::reset << std::endl;
+        // Group rules by room and, within a room, by verb, keeping the order they were added in
+        std::vector<PendingRule> sortedRules(pendingRules);
+        std::stable_sort(sortedRules.begin(), sortedRules.end(), [](const PendingRule& a, const PendingRule& b) {
+            return a.room != b.room ? a.room < b.room : a.rule.verb < b.rule.verb;
+        });
+        std::vector<uint32_t> ruleStart(rooms + 1, 0);
+        std::vector<Rule> rules;
+        std::vector<RuleOp> ruleOps;
+        for (size_t i = 0; i < sortedRules.size(); ++i) {
+            ruleStart[sortedRules[i].room + 1]++;
+            Rule rule = sortedRules[i].rule;
+            rule.firstOp = static_cast<uint32_t>(ruleOps.size());
+            ruleOps.insert(ruleOps.end(), pendingOps.begin() + sortedRules[i].rule.firstOp,
+                           pendingOps.begin() + sortedRules[i].rule.firstOp + rule.opCount);
+            rules.push_back(rule);
+        }
+        for (uint32_t r = 0; r < rooms; ++r) {
+            ruleStart[r + 1] += ruleStart[r];
+        }
 
-    // Display story introduction with colored text
-    std::cout << GameColors::bold << GameColors::forestColor 
-         << "Welcome to the mystical realm of " << GameColors::cyan << "Eldara" << GameColors::forestColor 
-         << ", where ancient magic flows through emerald forests" << std::endl
-         << "and " << GameColors::lakeColor << "crystalline lakes shimmer with otherworldly light" << GameColors::forestColor << ". Hidden within this enchanted land lies a" << std::endl
-         << GameColors::yellow << "legendary treasure" << GameColors::forestColor << ", sought after by brave adventurers for centuries." << std::endl << std::endl
-         << "As you journey through the " << GameColors::forestColor << "whispering woods" << " and " << GameColors::ruinsColor << "crumbling ruins" << GameColors::forestColor << ", you'll encounter " << GameColors::villageColor << "friendly villagers" << std::endl 
-         << GameColors::forestColor << "who hold age-old secrets, and " << GameColors::red << "fearsome creatures" << GameColors::forestColor << " who guard sacred places. The very air tingles with" << std::endl
-         << GameColors::magenta << "arcane energy" << GameColors::forestColor << ", while " << GameColors::caveColor << "mysterious caves" << GameColors::forestColor << " and " << GameColors::mountainColor << "towering mountains" << GameColors::forestColor << " beckon you to explore their depths." << std::endl << std::endl
-         << "Your quest will test both your " << GameColors::red << "courage" << GameColors::forestColor << " and " << GameColors::blue << "wisdom" << GameColors::forestColor << " as you unravel the mysteries of this magical realm." << std::endl
-         << "The " << GameColors::yellow << "treasure" << GameColors::forestColor << " awaits those pure of heart and sharp of mind - will you be the one to discover its" << std::endl
-         << "resting place?" << GameColors::reset << std::endl;
-    
-    // Display command menu with colored formatting
-    std::cout << GameColors::bold 
-              << "┌─────────────── " 
-              << GameColors::yellow << "Commands" 
-              << GameColors::cyan << " ───────────────┐\n"
-              << "│ " << GameColors::green << "▶ n, s, e, w" 
-              << GameColors::cyan << ": Movement                │\n"
-              << "│ " << GameColors::yellow << "▶ take" 
-              << GameColors::cyan << ": Pick up items                 │\n"
-              << "│ " << GameColors::blue << "▶ look"
-              << GameColors::cyan << ": Look around the room         │\n"
-              << "│ " << GameColors::blue << "▶ talk" 
-              << GameColors::cyan << ": Speak with characters         │\n"
-              << "│ " << GameColors::red << "▶ fight" 
-              << GameColors::cyan << ": Battle monsters              │\n"
-              << "│ " << GameColors::magenta << "▶ help" 
-              << GameColors::cyan << ": Show commands                 │\n"
-              << "│ " << GameColors::yellow << "▶ quit" 
-              << GameColors::cyan << ": Exit game                     │\n"
-              << "└────────────────────────────────────────┘" 
-              << GameColors::reset << std::endl;
-
-    // Main game loop
-    std::string command;
-    while (true) {
-        // Display current room description unless using look command
-        if (command != "look") {
-            player.currentRoom->describe();
-        }
-        
-        // Display command prompt
-        std::cout << "\n" << GameColors::bold << GameColors::blue << "┌─────────────────────┐" << std::endl
-                 << "│  Enter a command:   │" << std::endl
-                 << "└─────────────────────┘" << GameColors::reset << std::endl;
-        std::getline(std::cin, command);
-
-        // Handle look command - shows detailed room description
-        if (command == "look") {
-            // Special case for Mountain room when player has the key
-            if (player.currentRoom->name.find("Mountain") != std::string::npos && player.hasItem(KEY)) {
-                std::cout << GameColors::bold << GameColors::cyan 
-                         << "\nAs you examine the area more carefully with your key in hand, you notice that some of the runes on the eastern rock face seem to form the outline of a doorway. Perhaps there's more here than meets the eye..." 
-                         << GameColors::reset << std::endl;
+        // Group items by room, one stack per kind, in the order the kinds were first placed
+        std::vector<PendingItem> sortedItems(pendingItems);
+        std::stable_sort(sortedItems.begin(), sortedItems.end(), [](const PendingItem& a, const PendingItem& b) {
+            return a.room < b.room;
+        });
+        std::vector<uint32_t> roomItemStart(rooms + 1, 0);
+        std::vector<ItemStack> roomItems;
+        for (size_t i = 0; i < sortedItems.size(); ++i) {
+            RoomId room = sortedItems[i].room;
+            size_t first = roomItems.size() - roomItemStart[room + 1];  // This room's stacks are the last ones
+            size_t j = first;
+            while (j < roomItems.size() && roomItems[j].item != sortedItems[i].stack.item) {
+                ++j;
+            }
+            if (j < roomItems.size()) {
+                roomItems[j].count += sortedItems[i].stack.count;
             } else {
-                player.currentRoom->describeLook();
+                roomItems.push_back(sortedItems[i].stack);
+                roomItemStart[room + 1]++;
             }
-            continue;
         }
-
-        // Handle help command - displays available commands
-        if (command == "help") {
-            std::cout << GameColors::bold 
-                      << "┌─────────────── " 
-                      << GameColors::yellow << "Commands" 
-                      << GameColors::cyan << " ───────────────┐\n"
-                      << "│ " << GameColors::green << "▶ n, s, e, w" 
-                      << GameColors::cyan << ": Movement                │\n"
-                      << "│ " << GameColors::yellow << "▶ take" 
-                      << GameColors::cyan << ": Pick up items                 │\n"
-                      << "│ " << GameColors::blue << "▶ talk" 
-                      << GameColors::cyan << ": Speak with characters         │\n"
-                      << "│ " << GameColors::red << "▶ fight" 
-                      << GameColors::cyan << ": Battle monsters              │\n"
-                      << "│ " << GameColors::magenta << "▶ help" 
-                      << GameColors::cyan << ": Show commands                 │\n"
-                      << "│ " << GameColors::yellow << "▶ quit" 
-                      << GameColors::cyan << ": Exit game                     │\n"
-                      << "└────────────────────────────────────────┘" 
-                      << GameColors::reset << std::endl;
-            continue;
+        for (uint32_t r = 0; r < rooms; ++r) {
+            roomItemStart[r + 1] += roomItemStart[r];
         }
 
-        // Handle quit command - exits the game
-        if (command == "quit") {
-            std::cout << GameColors::bold << GameColors::blue << R"(
-╔═══════════════════════════════════════════╗
-║          Thanks for playing!              ║
-╚═══════════════════════════════════════════╝
-)" << GameColors::reset << std::endl;
-            break;
+        image.assign(sizeof(WorldImageHeader), '\0');
+        WorldImageHeader* header = reinterpret_cast<WorldImageHeader*>(&image[0]);
+        std::memcpy(header->magic, WORLD_IMAGE_MAGIC, sizeof(header->magic));
+        header->version = WORLD_IMAGE_VERSION;
+        header->endianCheck = WORLD_IMAGE_ENDIAN_CHECK;
+        header->roomCount = rooms;
+        header->edgeCount = edges;
+        header->npcCount = static_cast<uint32_t>(npcType.size());
+        header->textSize = static_cast<uint32_t>(text.size());
+        header->startRoom = startRoom;
+        header->styleCount = static_cast<uint32_t>(styles.size());
+        header->ruleCount = static_cast<uint32_t>(rules.size());
+        header->ruleOpCount = static_cast<uint32_t>(ruleOps.size());
+        header->actorCount = static_cast<uint32_t>(actorHome.size());
+        header->itemCount = static_cast<uint32_t>(items.size());
+        header->roomItemCount = static_cast<uint32_t>(roomItems.size());
+
+        appendSection(image, SECTION_EDGE_START, edgeStart);
+        appendSection(image, SECTION_EDGE_TARGET, edgeTarget);
+        appendSection(image, SECTION_EDGE_DIRECTION, edgeDirection);
+        appendSection(image, SECTION_EDGE_FLAGS, edgeFlags);
+        appendSection(image, SECTION_EXIT_MASK, exitMask);
+        appendSection(image, SECTION_ROOM_ITEM_START, roomItemStart);
+        appendSection(image, SECTION_ROOM_ITEM, roomItems);
+        appendSection(image, SECTION_ROOM_LOCKED, roomLocked);
+        appendSection(image, SECTION_ROOM_NPC, roomNpc);
+        appendSection(image, SECTION_ROOM_NAME, roomName);
+        appendSection(image, SECTION_ROOM_DESCRIPTION, roomDescription);
+        appendSection(image, SECTION_ROOM_DETAIL, roomDetail);
+        appendSection(image, SECTION_NPC_TYPE, npcType);
+        appendSection(image, SECTION_NPC_DIALOGUE, npcDialogue);
+        appendSection(image, SECTION_ITEM, items);
+        appendSection(image, SECTION_STYLE, styles);
+        appendSection(image, SECTION_RULE_START, ruleStart);
+        appendSection(image, SECTION_RULE, rules);
+        appendSection(image, SECTION_RULE_OP, ruleOps);
+        appendSection(image, SECTION_ACTOR_HOME, actorHome);
+        appendSection(image, SECTION_ACTOR_NPC, actorNpc);
+        appendSection(image, SECTION_TEXT, text.data(), text.size());
+
+        header = reinterpret_cast<WorldImageHeader*>(&image[0]);
+        header->imageSize = image.size();
+        header->checksum = imageChecksum(&image[sizeof(WorldImageHeader)], image.size() - sizeof(WorldImageHeader));
+    }
+};
+
+class RoutePlanner;
+class TextIndex;
+
+// The arrays a World reads, wherever they live: in a world image, or in tables the
+// compiler built from a world defined in the program (see CompiledWorld)
+struct WorldTables {
+    const uint32_t* edgeStart;
+    const RoomId* edgeTarget;
+    const uint8_t* edgeDirection;
+    const uint8_t* edgeFlags;
+    const uint8_t* exitMask;
+    const uint32_t* roomItemStart;
+    const ItemStack* roomItems;
+    const uint8_t* roomLocked;
+    const NpcId* roomNpc;
+    const TextRef* roomName;
+    const TextRef* roomDescription;
+    const TextRef* roomDetail;
+    const uint8_t* npcType;
+    const TextRef* npcDialogue;
+    const ItemInfo* items;
+    const TextRef* styles;
+    const uint32_t* ruleStart;
+    const Rule* rules;
+    const RuleOp* ruleOps;
+    const RoomId* actorHome;
+    const NpcId* actorNpc;
+    const char* text;
+    RoomId startRoom;
+    uint32_t roomCount;
+    uint32_t edgeCount;
+    uint32_t npcCount;
+    uint32_t styleCount;
+    uint32_t ruleCount;
+    uint32_t actorCount;
+    uint32_t itemCount;
+    uint64_t bytes;      // Size of everything above
+    uint64_t checksum;   // Identifies the world a save belongs to
+};
+
+// World is a read-only view of a world image, shared by every player; each
+// player's changes live in their own WorldOverlay. Rooms and NPCs are parallel
+// arrays addressed by 32-bit ids; everything the game touches on every turn is
+// small and contiguous, while the text lives in a separate cold section that is
+// only read when something is printed. The image is either built in memory by a
+// WorldBuilder or mapped straight from a compiled world file, so loading a world
+// does no per-room parsing and no string construction.
+class World {
+private:
+    std::vector<char> ownedImage;  // Image built in memory (empty when the image is mapped)
+    void* mappedImage;             // Image mapped from a file, or nullptr
+    size_t mappedSize;             // Length of the mapping
+
+    // Points the arrays at the sections of a validated image
+    void bind(char* image) {
+        const WorldImageHeader* header = reinterpret_cast<const WorldImageHeader*>(image);
+        WorldTables tables;
+        tables.edgeStart = reinterpret_cast<const uint32_t*>(image + header->sectionOffset[SECTION_EDGE_START]);
+        tables.edgeTarget = reinterpret_cast<const RoomId*>(image + header->sectionOffset[SECTION_EDGE_TARGET]);
+        tables.edgeDirection = reinterpret_cast<const uint8_t*>(image + header->sectionOffset[SECTION_EDGE_DIRECTION]);
+        tables.edgeFlags = reinterpret_cast<const uint8_t*>(image + header->sectionOffset[SECTION_EDGE_FLAGS]);
+        tables.exitMask = reinterpret_cast<const uint8_t*>(image + header->sectionOffset[SECTION_EXIT_MASK]);
+        tables.roomItemStart = reinterpret_cast<const uint32_t*>(image + header->sectionOffset[SECTION_ROOM_ITEM_START]);
+        tables.roomItems = reinterpret_cast<const ItemStack*>(image + header->sectionOffset[SECTION_ROOM_ITEM]);
+        tables.roomLocked = reinterpret_cast<const uint8_t*>(image + header->sectionOffset[SECTION_ROOM_LOCKED]);
+        tables.roomNpc = reinterpret_cast<const NpcId*>(image + header->sectionOffset[SECTION_ROOM_NPC]);
+        tables.roomName = reinterpret_cast<const TextRef*>(image + header->sectionOffset[SECTION_ROOM_NAME]);
+        tables.roomDescription = reinterpret_cast<const TextRef*>(image + header->sectionOffset[SECTION_ROOM_DESCRIPTION]);
+        tables.roomDetail = reinterpret_cast<const TextRef*>(image + header->sectionOffset[SECTION_ROOM_DETAIL]);
+        tables.npcType = reinterpret_cast<const uint8_t*>(image + header->sectionOffset[SECTION_NPC_TYPE]);
+        tables.npcDialogue = reinterpret_cast<const TextRef*>(image + header->sectionOffset[SECTION_NPC_DIALOGUE]);
+        tables.items = reinterpret_cast<const ItemInfo*>(image + header->sectionOffset[SECTION_ITEM]);
+        tables.styles = reinterpret_cast<const TextRef*>(image + header->sectionOffset[SECTION_STYLE]);
+        tables.ruleStart = reinterpret_cast<const uint32_t*>(image + header->sectionOffset[SECTION_RULE_START]);
+        tables.rules = reinterpret_cast<const Rule*>(image + header->sectionOffset[SECTION_RULE]);
+        tables.ruleOps = reinterpret_cast<const RuleOp*>(image + header->sectionOffset[SECTION_RULE_OP]);
+        tables.actorHome = reinterpret_cast<const RoomId*>(image + header->sectionOffset[SECTION_ACTOR_HOME]);
+        tables.actorNpc = reinterpret_cast<const NpcId*>(image + header->sectionOffset[SECTION_ACTOR_NPC]);
+        tables.text = image + header->sectionOffset[SECTION_TEXT];
+        tables.startRoom = header->startRoom;
+        tables.roomCount = header->roomCount;
+        tables.edgeCount = header->edgeCount;
+        tables.npcCount = header->npcCount;
+        tables.styleCount = header->styleCount;
+        tables.ruleCount = header->ruleCount;
+        tables.actorCount = header->actorCount;
+        tables.itemCount = header->itemCount;
+        tables.bytes = header->imageSize;
+        tables.checksum = header->checksum;
+        attach(tables);
+    }
+
+    // Checks that every index and text reference in a sized and checksummed image
+    // stays in range, so no lookup during play has to. The counts in the header are
+    // not covered by the checksum, and this is what holds the tables to them.
+    static bool validateContents(const char* image, std::string& error) {
+        const WorldImageHeader* header = reinterpret_cast<const WorldImageHeader*>(image);
+        const uint64_t* offset = header->sectionOffset;
+        const uint32_t rooms = header->roomCount;
+        const uint32_t npcs = header->npcCount;
+        const uint32_t itemCount = header->itemCount;
+        std::ostringstream message;
+        // A text reference must lie inside the text section and use an interned style
+        auto textOk = [header](const TextRef& ref) {
+            return static_cast<uint64_t>(ref.offset) + ref.length() <= header->textSize && ref.style() <= header->styleCount;
+        };
+        // An offset table must start at 0, never decrease and end at `total`
+        auto startsOk = [rooms](const uint32_t* start, uint32_t total) {
+            if (start[0] != 0 || start[rooms] != total) {
+                return false;
+            }
+            for (uint32_t r = 0; r < rooms; ++r) {
+                if (start[r] > start[r + 1]) {
+                    return false;
+                }
+            }
+            return true;
+        };
+
+        if (header->styleCount > TEXT_STYLE_LIMIT) {
+            message << "image has " << header->styleCount << " styles, more than " << TEXT_STYLE_LIMIT;
+        }
+        const uint32_t* edgeStart = reinterpret_cast<const uint32_t*>(image + offset[SECTION_EDGE_START]);
+        const RoomId* edgeTarget = reinterpret_cast<const RoomId*>(image + offset[SECTION_EDGE_TARGET]);
+        const uint8_t* edgeDirection = reinterpret_cast<const uint8_t*>(image + offset[SECTION_EDGE_DIRECTION]);
+        if (message.tellp() == 0 && !startsOk(edgeStart, header->edgeCount)) {
+            message << "edge offsets are out of order or do not add up to " << header->edgeCount << " edges";
+        }
+        for (uint32_t e = 0; e < header->edgeCount && message.tellp() == 0; ++e) {
+            if (edgeTarget[e] >= rooms || edgeDirection[e] >= DIRECTION_COUNT) {
+                message << "edge " << e << " leads to a missing room or in no direction";
+            }
+        }
+        // Movement takes a room's first exit in a direction, so a second one could never be used
+        for (uint32_t r = 0; r < rooms && message.tellp() == 0; ++r) {
+            uint32_t directions = 0;
+            for (uint32_t e = edgeStart[r]; e < edgeStart[r + 1] && message.tellp() == 0; ++e) {
+                if ((directions & (1u << edgeDirection[e])) != 0) {
+                    message << "room " << r << " has two exits " << directionToString(static_cast<Direction>(edgeDirection[e]));
+                }
+                directions |= 1u << edgeDirection[e];
+            }
+        }
+        const uint32_t* roomItemStart = reinterpret_cast<const uint32_t*>(image + offset[SECTION_ROOM_ITEM_START]);
+        const ItemStack* roomItems = reinterpret_cast<const ItemStack*>(image + offset[SECTION_ROOM_ITEM]);
+        if (message.tellp() == 0 && !startsOk(roomItemStart, header->roomItemCount)) {
+            message << "room item offsets are out of order or do not add up to " << header->roomItemCount << " stacks";
+        }
+        for (uint32_t i = 0; i < header->roomItemCount && message.tellp() == 0; ++i) {
+            if (roomItems[i].item == NO_ITEM || roomItems[i].item >= itemCount) {
+                message << "item stack " << i << " holds a missing item";
+            }
+        }
+        const NpcId* roomNpc = reinterpret_cast<const NpcId*>(image + offset[SECTION_ROOM_NPC]);
+        const TextRef* roomTexts[] = {
+            reinterpret_cast<const TextRef*>(image + offset[SECTION_ROOM_NAME]),
+            reinterpret_cast<const TextRef*>(image + offset[SECTION_ROOM_DESCRIPTION]),
+            reinterpret_cast<const TextRef*>(image + offset[SECTION_ROOM_DETAIL])
+        };
+        for (uint32_t r = 0; r < rooms && message.tellp() == 0; ++r) {
+            if (roomNpc[r] != NO_NPC_ID && roomNpc[r] >= npcs) {
+                message << "room " << r << " holds a missing NPC";
+            } else if (!textOk(roomTexts[0][r]) || !textOk(roomTexts[1][r]) || !textOk(roomTexts[2][r])) {
+                message << "text of room " << r << " lies outside the text section";
+            }
+        }
+        const uint8_t* npcType = reinterpret_cast<const uint8_t*>(image + offset[SECTION_NPC_TYPE]);
+        const TextRef* npcDialogue = reinterpret_cast<const TextRef*>(image + offset[SECTION_NPC_DIALOGUE]);
+        for (uint32_t n = 0; n < npcs && message.tellp() == 0; ++n) {
+            if ((npcType[n] != VILLAGER && npcType[n] != MONSTER) || !textOk(npcDialogue[n])) {
+                message << "NPC " << n << " has an unknown type or text outside the text section";
+            }
+        }
+        const ItemInfo* items = reinterpret_cast<const ItemInfo*>(image + offset[SECTION_ITEM]);
+        for (uint32_t i = 0; i < itemCount && message.tellp() == 0; ++i) {
+            if (items[i].needs >= itemCount || !textOk(items[i].name) || !textOk(items[i].seen)
+                || !textOk(items[i].taken) || !textOk(items[i].refused)) {
+                message << "item " << i << " needs a missing item or has text outside the text section";
+            }
+        }
+        const TextRef* styles = reinterpret_cast<const TextRef*>(image + offset[SECTION_STYLE]);
+        for (uint32_t i = 0; i < header->styleCount && message.tellp() == 0; ++i) {
+            if (styles[i].offset + static_cast<uint64_t>(styles[i].length()) > header->textSize) {
+                message << "style " << i << " lies outside the text section";
+            }
+        }
+        const uint32_t* ruleStart = reinterpret_cast<const uint32_t*>(image + offset[SECTION_RULE_START]);
+        const Rule* rules = reinterpret_cast<const Rule*>(image + offset[SECTION_RULE]);
+        const RuleOp* ruleOps = reinterpret_cast<const RuleOp*>(image + offset[SECTION_RULE_OP]);
+        if (message.tellp() == 0 && !startsOk(ruleStart, header->ruleCount)) {
+            message << "rule offsets are out of order or do not add up to " << header->ruleCount << " rules";
+        }
+        for (uint32_t r = 0; r < rooms && message.tellp() == 0; ++r) {
+            for (uint32_t i = ruleStart[r]; i < ruleStart[r + 1] && message.tellp() == 0; ++i) {
+                const Rule& rule = rules[i];
+                if (rule.verb >= VERB_COUNT || (i > ruleStart[r] && rules[i - 1].verb > rule.verb)
+                    || static_cast<uint64_t>(rule.firstOp) + rule.opCount > header->ruleOpCount) {
+                    message << "rule " << i << " has an unknown verb, is out of order or has missing operations";
+                }
+            }
+        }
+        for (uint32_t i = 0; i < header->ruleOpCount && message.tellp() == 0; ++i) {
+            const RuleOp& op = ruleOps[i];
+            bool valid = op.code < RULE_OP_COUNT && textOk(op.text);
+            if (op.code == RULE_HAS_ITEM || op.code == RULE_LACKS_ITEM || op.code == RULE_ITEM_HERE || op.code == RULE_GIVE_ITEM) {
+                valid = valid && op.value != NO_ITEM && op.value < itemCount;
+            } else if (op.code == RULE_REVEAL_EXIT) {
+                valid = valid && op.value < DIRECTION_COUNT;
+            } else if (op.code == RULE_UNLOCK_ROOM) {
+                valid = valid && op.value < rooms;
+            }
+            if (!valid) {
+                message << "rule operation " << i << " is unknown or refers to something missing";
+            }
+        }
+        const RoomId* actorHome = reinterpret_cast<const RoomId*>(image + offset[SECTION_ACTOR_HOME]);
+        const NpcId* actorNpc = reinterpret_cast<const NpcId*>(image + offset[SECTION_ACTOR_NPC]);
+        for (uint32_t a = 0; a < header->actorCount && message.tellp() == 0; ++a) {
+            if (actorHome[a] >= rooms || actorNpc[a] >= npcs) {
+                message << "actor " << a << " lives in a missing room or is a missing NPC";
+            }
+        }
+        if (message.tellp() != 0) {
+            error = message.str();
+            return false;
         }
+        return true;
+    }
 
-        // Check for victory condition (found treasure)
-        if (player.hasTreasure) {
-            std::cout << "\n" << GameColors::bold << GameColors::green << R"(
-╔════════════════════════════════════════════════════╗
-║     🎉 Congratulations! You found the treasure! 🎉  ║
-║        You completed the game in )" << player.moveCount << " moves!        ║\n╚════════════════════════════════════════════════════╝" << GameColors::reset << std::endl;
-            break;
+    // Checks that an image is complete, matches this build and is not corrupted:
+    // every section offset is checked against the image size, then every index
+    // and text reference inside the sections by validateContents(), once at load,
+    // before bind() trusts any of it.
+    static bool validate(const char* image, size_t size, std::string& error) {
+        if (size < sizeof(WorldImageHeader)) {
+            error = "file is too small to be a world image";
+            return false;
+        }
+        const WorldImageHeader* header = reinterpret_cast<const WorldImageHeader*>(image);
+        if (std::memcmp(header->magic, WORLD_IMAGE_MAGIC, sizeof(header->magic)) != 0) {
+            error = "not a compiled world image (compile world files with --compile-world)";
+            return false;
+        }
+        if (header->endianCheck != WORLD_IMAGE_ENDIAN_CHECK) {
+            error = "image was compiled on a machine with a different byte order";
+            return false;
+        }
+        if (header->version != WORLD_IMAGE_VERSION) {
+            std::ostringstream message;
+            message << "unsupported image version " << header->version << " (expected " << WORLD_IMAGE_VERSION << ")";
+            error = message.str();
+            return false;
+        }
+        if (header->imageSize != size) {
+            error = "image size does not match its header (truncated file?)";
+            return false;
         }
 
-        // Handle talk command - interact with NPCs
-        if (command == "talk") {
-            if (player.currentRoom->npc != nullptr && !player.currentRoom->npc->isDefeated) {
-                std::cout << GameColors::bold << GameColors::cyan << player.currentRoom->npc->dialogue << GameColors::reset << std::endl;
-            } else {
-                std::cout << GameColors::bold << GameColors::red << "There is no one here to talk to." << GameColors::reset << std::endl;
+        // Expected size of every section, derived from the counts in the header
+        const uint64_t rooms = header->roomCount;
+        const uint64_t edges = header->edgeCount;
+        const uint64_t npcs = header->npcCount;
+        const uint64_t expected[SECTION_COUNT] = {
+            (rooms + 1) * sizeof(uint32_t), edges * sizeof(RoomId), edges, edges,
+            rooms, (rooms + 1) * sizeof(uint32_t), header->roomItemCount * sizeof(ItemStack), rooms, rooms * sizeof(NpcId),
+            rooms * sizeof(TextRef), rooms * sizeof(TextRef), rooms * sizeof(TextRef),
+            npcs, npcs * sizeof(TextRef), header->itemCount * sizeof(ItemInfo), header->styleCount * sizeof(TextRef),
+            (rooms + 1) * sizeof(uint32_t), header->ruleCount * sizeof(Rule), header->ruleOpCount * sizeof(RuleOp),
+            header->actorCount * sizeof(RoomId), header->actorCount * sizeof(NpcId), header->textSize
+        };
+        for (int s = 0; s < SECTION_COUNT; ++s) {
+            uint64_t offset = header->sectionOffset[s];
+            if (header->sectionSize[s] != expected[s] || offset % 8 != 0 || offset < sizeof(WorldImageHeader)
+                || offset > size || header->sectionSize[s] > size - offset) {
+                std::ostringstream message;
+                message << "section " << s << " is out of bounds or has the wrong size";
+                error = message.str();
+                return false;
             }
-            continue;
         }
+        if (header->roomCount == 0 || header->startRoom >= header->roomCount) {
+            error = "image has no valid start room";
+            return false;
+        }
+        if (header->itemCount == 0) {
+            error = "image has no item registry";
+            return false;
+        }
+        if (imageChecksum(image + sizeof(WorldImageHeader), size - sizeof(WorldImageHeader)) != header->checksum) {
+            error = "checksum mismatch, the image is corrupted";
+            return false;
+        }
+        return validateContents(image, error);
+    }
 
-        // Handle fight command - battle monsters
-        if (command == "fight") {
-            if (player.currentRoom->npc != nullptr && 
-                player.currentRoom->npc->type == MONSTER && 
-                !player.currentRoom->npc->isDefeated) {
-                if (player.canFight()) {
-                    std::cout << GameColors::bold << GameColors::green << "You defeat the monster with your sword!" << GameColors::reset << std::endl;
-                    player.currentRoom->npc->isDefeated = true;
-                    player.addItem(KEY);
-                    std::cout << GameColors::bold << GameColors::yellow << "You found a key!" << GameColors::reset << std::endl;
-                } else {
-                    std::cout << GameColors::bold << GameColors::red << "You need a sword to fight the monster!" << GameColors::reset << std::endl;
-                }
-            } else {
-                std::cout << GameColors::bold << GameColors::red << "There is nothing to fight here." << GameColors::reset << std::endl;
-            }
-            continue;
+    World(const World&);             // Not copyable: the arrays point into this world's image
+    World& operator=(const World&);
+
+public:
+    const uint32_t* edgeStart;    // Offset of each room's first edge, plus one final entry
+    const RoomId* edgeTarget;     // Room each edge leads to
+    const uint8_t* edgeDirection; // Direction of each edge
+    const uint8_t* edgeFlags;     // EdgeFlags of each edge
+    const uint8_t* exitMask;      // One bit per Direction for the visible exits of each room
+
+    const uint32_t* roomItemStart; // Offset of each room's first item stack, plus one final entry
+    const ItemStack* roomItems;   // Item stacks lying in each room at the start of the game
+    const uint8_t* roomLocked;    // Whether each room is locked
+    const NpcId* roomNpc;         // NPC present in each room, or NO_NPC_ID
+    const TextRef* roomName;      // Display name of each room
+    const TextRef* roomDescription; // Short description shown on entry
+    const TextRef* roomDetail;    // Longer description shown with 'look' command
+
+    const uint8_t* npcType;       // NPCType of each NPC
+    const TextRef* npcDialogue;   // Text displayed when player talks to each NPC
+
+    const ItemInfo* items;        // Item registry, indexed by ItemId
+    std::vector<uint64_t> weaponItems; // One bit per ItemId for the items flagged ITEM_WEAPON
+
+    const TextRef* styles;        // Interned style prefixes, by style index - 1
+
+    const uint32_t* ruleStart;    // Offset of each room's first rule, plus one final entry
+    const Rule* rules;            // Rules of each room, sorted by verb
+    const RuleOp* ruleOps;        // Conditions and actions of every rule
+    const RoomId* actorHome;      // Room each wandering actor starts in
+    const NpcId* actorNpc;        // NPC record of each wandering actor
+    const char* text;             // Cold text store
+    RoomId startRoom;             // Room the player starts in
+    uint32_t roomTotal;           // Number of rooms
+    uint32_t edgeTotal;           // Number of edges
+    uint32_t npcTotal;            // Number of NPCs
+    uint32_t styleTotal;          // Number of interned styles
+    uint32_t ruleTotal;           // Number of rules
+    uint32_t actorTotal;          // Number of wandering actors
+    uint32_t itemTotal;           // Number of item kinds, the placeholder included
+    size_t imageBytes;            // Size of the image backing the world
+    uint64_t checksum;            // Checksum of the image, which identifies the world a save belongs to
+    const RoutePlanner* routes;   // Route index for go and path, or nullptr if none was built
+    const TextIndex* textIndex;   // Word index for search and hint, or nullptr if none was built
+
+    World() : mappedImage(nullptr), mappedSize(0), startRoom(NO_ROOM), roomTotal(0), edgeTotal(0), npcTotal(0), styleTotal(0), ruleTotal(0), actorTotal(0), itemTotal(0), imageBytes(0), checksum(0), routes(nullptr), textIndex(nullptr) {}
+
+    ~World() {
+        if (mappedImage != nullptr) {
+            munmap(mappedImage, mappedSize);
         }
+    }
 
-        // Handle take command - collect items
-        if (command == "take") {
-            if (player.currentRoom->item != NONE) {
-                if (player.currentRoom->item == TREASURE && !player.hasItem(KEY)) {
-                    std::cout << GameColors::bold << GameColors::red << "The chest is locked! You need a key." << GameColors::reset << std::endl;
-                } else {   
-                    ItemType item = player.currentRoom->item;
-                    player.addItem(item);
-                    player.currentRoom->item = NONE;
-                    
-                    // Display appropriate message based on item type
-                    switch(item) {
-                        case SWORD:
-                            std::cout << GameColors::bold << GameColors::green << "You take the sword. Now you can fight monsters!" << GameColors::reset << std::endl;
-                            break;
-                        case KEY:
-                            std::cout << GameColors::bold << GameColors::yellow << "You take the key." << GameColors::reset << std::endl;
-                            break;
-                        case TREASURE:
-                            std::cout << GameColors::bold << GameColors::green << "You have taken the treasure!" << GameColors::reset << std::endl;
-                            break;
-                        default:
-                            break;
-                    }
-                }
-            } else {
-                std::cout << GameColors::bold << GameColors::red << "There is nothing to take here." << GameColors::reset << std::endl;
+    // Takes ownership of an image built in memory
+    bool load(std::vector<char>& image, std::string& error) {
+        if (!validate(image.empty() ? nullptr : &image[0], image.size(), error)) {
+            return false;
+        }
+        ownedImage.swap(image);
+        bind(&ownedImage[0]);
+        return true;
+    }
+
+    // Builds the world described by a builder
+    bool load(const WorldBuilder& builder, std::string& error) {
+        std::vector<char> image;
+        builder.build(image);
+        return load(image, error);
+    }
+
+    // Points the world at tables that are already laid out, such as those of a world
+    // compiled into the program; nothing is copied and only the weapon mask is built
+    void attach(const WorldTables& tables) {
+        roomTotal = tables.roomCount;
+        edgeTotal = tables.edgeCount;
+        npcTotal = tables.npcCount;
+        startRoom = tables.startRoom;
+        edgeStart = tables.edgeStart;
+        edgeTarget = tables.edgeTarget;
+        edgeDirection = tables.edgeDirection;
+        edgeFlags = tables.edgeFlags;
+        exitMask = tables.exitMask;
+        roomItemStart = tables.roomItemStart;
+        roomItems = tables.roomItems;
+        roomLocked = tables.roomLocked;
+        roomNpc = tables.roomNpc;
+        roomName = tables.roomName;
+        roomDescription = tables.roomDescription;
+        roomDetail = tables.roomDetail;
+        npcType = tables.npcType;
+        npcDialogue = tables.npcDialogue;
+        items = tables.items;
+        itemTotal = tables.itemCount;
+        weaponItems.assign((itemTotal + 63) / 64, 0);
+        for (ItemId item = 1; item < itemTotal; ++item) {
+            if ((items[item].flags & ITEM_WEAPON) != 0) {
+                weaponItems[item / 64] |= 1ull << (item % 64);
             }
-            continue;
         }
+        styles = tables.styles;
+        styleTotal = tables.styleCount;
+        ruleStart = tables.ruleStart;
+        rules = tables.rules;
+        ruleOps = tables.ruleOps;
+        ruleTotal = tables.ruleCount;
+        actorHome = tables.actorHome;
+        actorNpc = tables.actorNpc;
+        actorTotal = tables.actorCount;
+        text = tables.text;
+        imageBytes = static_cast<size_t>(tables.bytes);
+        checksum = tables.checksum;
+    }
 
-        // Handle movement commands
-        Direction direction;
-        bool validDirection = true;
-        
-        // Parse movement command
-        if (command == "n" || command == "north") {
-            direction = NORTH;
-        } else if (command == "e" || command == "east") {
-            direction = EAST;
-        } else if (command == "s" || command == "south") {
-            direction = SOUTH;
-        } else if (command == "w" || command == "west") {
-            direction = WEST;
-        } else {
-            std::cout << GameColors::bold << GameColors::red << "Unknown command. Try 'n', 'e', 's', or 'w'." << GameColors::reset << std::endl;
-            validDirection = false;
+    // Maps a compiled world file read-only; players never modify the world itself
+    bool mapFile(const std::string& path, std::string& error) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            error = "cannot open " + path + ": " + std::strerror(errno);
+            return false;
         }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+            error = "cannot read " + path;
+            ::close(fd);
+            return false;
+        }
+        size_t size = static_cast<size_t>(info.st_size);
+        void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            error = "cannot map " + path + ": " + std::strerror(errno);
+            return false;
+        }
+        if (!validate(static_cast<const char*>(data), size, error)) {
+            munmap(data, size);
+            return false;
+        }
+        mappedImage = data;
+        mappedSize = size;
+        bind(static_cast<char*>(data));
+        return true;
+    }
 
-        // Execute movement if direction is valid
-        if (validDirection) {
-            if (player.currentRoom->canMove(direction)) {
-                std::cout << GameColors::green << "You move " << player.currentRoom->directionToString(direction) << "." << GameColors::reset << std::endl;
-                player.currentRoom = player.currentRoom->getConnections()[direction];
-                player.moveCount++;  // Increment move counter when movement is successful
-            } else {
-                std::cout << GameColors::bold << GameColors::red << "You cannot go that way. Try another direction." << GameColors::reset << std::endl;
+    // Number of rooms in the world
+    uint32_t roomCount() const { return roomTotal; }
+
+    // Returns the room reached by moving in a direction, or NO_ROOM if there is no way
+    RoomId neighbor(RoomId room, Direction dir) const {
+        uint32_t e = findEdge(room, dir);
+        return e != NO_EDGE ? edgeTarget[e] : NO_ROOM;
+    }
+
+    // The room's exit in a direction, or NO_EDGE if it has none
+    uint32_t findEdge(RoomId room, Direction dir) const {
+        for (uint32_t e = edgeStart[room]; e < edgeStart[room + 1]; ++e) {
+            if (edgeDirection[e] == dir) {
+                return e;
             }
         }
+        return NO_EDGE;
     }
 
-    return 0;
-}
\ No newline at end of file
+    // Writes a string from the text store, with its style and trailing reset
+    void writeText(std::ostream& out, TextRef ref) const {
+        uint32_t style = ref.style();
+        if (style != 0 && style <= styleTotal) {
+            out.write(text + styles[style - 1].offset, styles[style - 1].length());
+        }
+        out.write(text + ref.offset, ref.length());
+        if (ref.endsWithReset()) {
+            out << GameColors::reset;
+        }
+    }
+
+    // Copies a string out of the text store, with its style and trailing reset
+    std::string textString(TextRef ref) const {
+        std::ostringstream out;
+        writeText(out, ref);
+        return out.str();
+    }
+
+    // Number of bytes held by the world, text included
+    size_t memoryBytes() const {
+        return imageBytes;
+    }
+};
+
+// Kinds of change a player can make to the shared world
+enum ChangeKind { CHANGE_NPC_DEFEATED = 0, CHANGE_ROOM_UNLOCKED, CHANGE_EXIT_REVEALED, CHANGE_KIND_COUNT };
+
+// Hands out state versions. They are unique across the whole process, so a room's
+// version identifies what it looks like even when players share a render cache.
+uint64_t nextStateVersion() {
+    static std::atomic<uint64_t> counter(0);
+    return counter.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+// Item stacks in a room; rooms rarely hold more than a few kinds, so these stay inline
+typedef SmallVector<ItemStack, 4> ItemStacks;
+
+// A run of item stacks, either straight from the world image or from an overlay
+struct ItemSpan {
+    const ItemStack* first;
+    const ItemStack* last;
+
+    size_t size() const { return static_cast<size_t>(last - first); }
+    bool empty() const { return first == last; }
+    const ItemStack* begin() const { return first; }
+    const ItemStack* end() const { return last; }
+};
+
+// Sorted map whose copies share structure: a treap whose nodes are reference
+// counted and copied on write, so copying a map is O(1) and a change copies only
+// the O(log n) nodes on the path to its key. Node priorities are a hash of the
+// key, so equal contents always give the same shape. The counts are not atomic:
+// a map and all its copies must be used from one thread at a time.
+template <typename Key, typename Value>
+class PersistentMap {
+private:
+    struct Node {
+        Key key;
+        Value value;
+        Node* left;
+        Node* right;
+        uint32_t priority;
+        uint32_t refs;
+    };
+
+    Node* root;
+    size_t count;
+
+    static uint32_t priorityOf(const Key& key) {
+        uint64_t mixed = (static_cast<uint64_t>(key) + 0x9E3779B97F4A7C15ull) * 0xBF58476D1CE4E5B9ull;
+        return static_cast<uint32_t>(mixed >> 32);
+    }
+
+    static void retain(Node* node) {
+        if (node != nullptr) {
+            node->refs++;
+        }
+    }
+
+    static void release(Node* node) {
+        while (node != nullptr && --node->refs == 0) {
+            release(node->left);
+            Node* right = node->right;
+            delete node;
+            liveCounter().fetch_sub(1, std::memory_order_relaxed);
+            node = right;
+        }
+    }
+
+    // Makes `link` point to a node no other map shares, copying it if it is shared
+    static Node* own(Node*& link) {
+        Node* node = link;
+        if (node->refs > 1) {
+            Node* copy = new Node(*node);
+            liveCounter().fetch_add(1, std::memory_order_relaxed);
+            copy->refs = 1;
+            retain(copy->left);
+            retain(copy->right);
+            node->refs--;
+            link = copy;
+        }
+        return link;
+    }
+
+    // Finds or inserts `key` below `link`, copying the nodes on the way down
+    static Value& edit(Node*& link, const Key& key, uint32_t priority, bool& added) {
+        if (link == nullptr) {
+            Node fresh = { key, Value(), nullptr, nullptr, priority, 1 };
+            link = new Node(fresh);
+            liveCounter().fetch_add(1, std::memory_order_relaxed);
+            added = true;
+            return link->value;
+        }
+        Node* node = own(link);
+        if (key < node->key) {
+            Value& value = edit(node->left, key, priority, added);
+            if (node->left->priority > node->priority) {
+                Node* child = node->left;
+                node->left = child->right;
+                child->right = node;
+                link = child;
+            }
+            return value;
+        }
+        if (node->key < key) {
+            Value& value = edit(node->right, key, priority, added);
+            if (node->right->priority > node->priority) {
+                Node* child = node->right;
+                node->right = child->left;
+                child->left = node;
+                link = child;
+            }
+            return value;
+        }
+        return node->value;
+    }
+
+    template <typename Visit>
+    static void visit(const Node* node, Visit& f) {
+        for (; node != nullptr; node = node->right) {
+            visit(node->left, f);
+            f(node->key, node->value);
+        }
+    }
+
+    static std::atomic<size_t>& liveCounter() {
+        static std::atomic<size_t> live(0);
+        return live;
+    }
+
+public:
+    PersistentMap() : root(nullptr), count(0) {}
+    PersistentMap(const PersistentMap& other) : root(other.root), count(other.count) { retain(root); }
+    ~PersistentMap() { release(root); }
+
+    PersistentMap& operator=(const PersistentMap& other) {
+        retain(other.root);
+        release(root);
+        root = other.root;
+        count = other.count;
+        return *this;
+    }
+
+    // The value stored under `key`, or nullptr
+    const Value* find(const Key& key) const {
+        const Node* node = root;
+        while (node != nullptr) {
+            if (key < node->key) {
+                node = node->left;
+            } else if (node->key < key) {
+                node = node->right;
+            } else {
+                return &node->value;
+            }
+        }
+        return nullptr;
+    }
+
+    // The value stored under `key` for changing, inserted default-constructed if
+    // missing; `added` tells which. Copies shared nodes, so other maps never see it.
+    Value& edit(const Key& key, bool& added) {
+        added = false;
+        Value& value = edit(root, key, priorityOf(key), added);
+        count += added ? 1 : 0;
+        return value;
+    }
+
+    // Calls f(key, value) for every entry in increasing key order
+    template <typename Visit>
+    void forEach(Visit f) const { visit(root, f); }
+
+    size_t size() const { return count; }
+
+    // Whether two maps are the same version: true only if neither changed since one was copied from the other
+    bool sameAs(const PersistentMap& other) const { return root == other.root; }
+
+    // Nodes alive in every map of this type, shared ones counted once
+    static size_t liveNodes() { return liveCounter().load(std::memory_order_relaxed); }
+
+    static const size_t NODE_BYTES = sizeof(Node);
+};
+
+template <typename Key, typename Value>
+const size_t PersistentMap<Key, Value>::NODE_BYTES;
+
+// One player's changes to the shared, read-only world, keyed by (kind, id). A player
+// only ever changes a handful of rooms, so the overlay stays small however large the
+// world is. Rooms whose items the player has taken from or dropped into get a full
+// copy of their stacks. Every room the player has changed also gets a state version,
+// which moves on with each change to it, so rendered room text can be cached until
+// it does. Both maps share structure with their copies, so the turn history can
+// keep an overlay per turn for the cost of what each turn changed.
+class WorldOverlay {
+private:
+    // What the player has done to a room
+    struct RoomState {
+        uint64_t version;     // State version, moved on by every change to the room
+        bool itemsChanged;    // Whether `stacks` replaces the room's items in the world
+        ItemStacks stacks;
+    };
+
+    PersistentMap<uint64_t, bool> keys;     // (kind << 32 | id) of each change
+    PersistentMap<RoomId, RoomState> rooms;  // Every room the player has changed
+    size_t itemRoomCount;                    // Rooms with itemsChanged set
+
+    static uint64_t makeKey(ChangeKind kind, uint32_t id) {
+        return (static_cast<uint64_t>(kind) << 32) | id;
+    }
+
+    RoomState& editRoom(RoomId room) {
+        bool added;
+        RoomState& state = rooms.edit(room, added);
+        state.version = nextStateVersion();
+        return state;
+    }
+
+public:
+    WorldOverlay() : itemRoomCount(0) {}
+
+    // Checks whether a change has been made
+    bool has(ChangeKind kind, uint32_t id) const {
+        return keys.find(makeKey(kind, id)) != nullptr;
+    }
+
+    // Records a change that alters how `room` looks; recording the same change twice has no effect
+    void set(ChangeKind kind, uint32_t id, RoomId room) {
+        bool added;
+        keys.edit(makeKey(kind, id), added) = true;
+        if (added) {
+            touch(room);
+        }
+    }
+
+    // Gives a room a new state version
+    void touch(RoomId room) {
+        if (room != NO_ROOM) {
+            editRoom(room);
+        }
+    }
+
+    // State version of a room: 0 while it is as the world describes it
+    uint64_t roomVersion(RoomId room) const {
+        const RoomState* state = rooms.find(room);
+        return state != nullptr ? state->version : 0;
+    }
+
+    // Number of changes recorded
+    size_t size() const { return keys.size(); }
+
+    // Calls f(key) for each change as a (kind << 32 | id) key, in increasing order
+    template <typename Visit>
+    void forEachChange(Visit f) const {
+        keys.forEach([&f](uint64_t key, bool) { f(key); });
+    }
+
+    // The items in a room if the player has changed them, or nullptr
+    const ItemStacks* findItems(RoomId room) const {
+        const RoomState* state = rooms.find(room);
+        return state != nullptr && state->itemsChanged ? &state->stacks : nullptr;
+    }
+
+    // The items in a room, for changing; the first change copies them from `original`
+    ItemStacks& editItems(RoomId room, ItemSpan original) {
+        RoomState& state = editRoom(room);
+        if (!state.itemsChanged) {
+            state.itemsChanged = true;
+            state.stacks.clear();
+            for (const ItemStack* stack = original.begin(); stack != original.end(); ++stack) {
+                state.stacks.push_back(*stack);
+            }
+            itemRoomCount++;
+        }
+        return state.stacks;
+    }
+
+    // Number of rooms whose items have changed
+    size_t itemRooms() const { return itemRoomCount; }
+
+    // Calls f(room, stacks) for each room whose items have changed, sorted by room
+    template <typename Visit>
+    void forEachItemRoom(Visit f) const {
+        rooms.forEach([&f](RoomId room, const RoomState& state) {
+            if (state.itemsChanged) {
+                f(room, state.stacks);
+            }
+        });
+    }
+
+    // Whether nothing has changed since one of the two overlays was copied from the other
+    bool sameAs(const WorldOverlay& other) const {
+        return keys.sameAs(other.keys) && rooms.sameAs(other.rooms);
+    }
+
+    // Bytes held by the nodes of every overlay in the process, shared nodes counted once
+    static size_t liveNodeBytes() {
+        return PersistentMap<uint64_t, bool>::liveNodes() * PersistentMap<uint64_t, bool>::NODE_BYTES
+             + PersistentMap<RoomId, RoomState>::liveNodes() * PersistentMap<RoomId, RoomState>::NODE_BYTES;
+    }
+
+    // Bytes held by the overlay, counting nodes shared with its copies in full
+    size_t memoryBytes() const {
+        size_t bytes = keys.size() * PersistentMap<uint64_t, bool>::NODE_BYTES
+                     + rooms.size() * PersistentMap<RoomId, RoomState>::NODE_BYTES;
+        forEachItemRoom([&bytes](RoomId, const ItemStacks& stacks) {
+            bytes += stacks.onHeap() ? stacks.size() * sizeof(ItemStack) : 0;
+        });
+        return bytes;
+    }
+};
+
+// What a player carries: one bit per item kind for has() and requirement checks,
+// which test whole words at a time, plus a counted stack per kind held, sorted by
+// item. The bitset only grows as far as the highest item held.
+class Inventory {
+private:
+    std::vector<uint64_t> held;   // Bit i set while the player holds item i
+    SmallVector<ItemStack, 4> stacks;
+    uint64_t revisionCount;       // Moves on with every add() or remove() that changes anything
+
+    size_t find(ItemId item) const {
+        size_t low = 0, high = stacks.size();
+        while (low < high) {
+            size_t mid = (low + high) / 2;
+            if (stacks[mid].item < item) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        return low;
+    }
+
+public:
+    Inventory() : revisionCount(0) {}
+
+    // Whether at least one of an item is held
+    bool has(ItemId item) const {
+        size_t word = item / 64;
+        return word < held.size() && (held[word] >> (item % 64) & 1) != 0;
+    }
+
+    // How many of an item are held
+    uint32_t count(ItemId item) const {
+        if (!has(item)) {
+            return 0;
+        }
+        return stacks[find(item)].count;
+    }
+
+    // Number of different kinds of item held
+    uint32_t kinds() const { return static_cast<uint32_t>(stacks.size()); }
+
+    // Number of kinds held that have a bit set in `mask`
+    uint32_t countHeld(const std::vector<uint64_t>& mask) const {
+        size_t words = std::min(held.size(), mask.size());
+        uint32_t total = 0;
+        for (size_t i = 0; i < words; ++i) {
+            total += popcount64(held[i] & mask[i]);
+        }
+        return total;
+    }
+
+    // Whether any item with a bit set in `mask` is held; ORs whole blocks of
+    // words so the compiler can vectorize it
+    bool holdsAny(const std::vector<uint64_t>& mask) const {
+        const size_t words = std::min(held.size(), mask.size());
+        const uint64_t* a = held.data();
+        const uint64_t* b = mask.data();
+        uint64_t common = 0;
+        size_t i = 0;
+        for (; i + 8 <= words; i += 8) {
+            for (size_t j = 0; j < 8; ++j) {
+                common |= a[i + j] & b[i + j];
+            }
+        }
+        for (; i < words; ++i) {
+            common |= a[i] & b[i];
+        }
+        return common != 0;
+    }
+
+    // Adds `n` of an item
+    void add(ItemId item, uint32_t n) {
+        if (item == NO_ITEM || n == 0) {
+            return;
+        }
+        revisionCount++;
+        size_t at = find(item);
+        if (at < stacks.size() && stacks[at].item == item) {
+            stacks[at].count += n;
+            return;
+        }
+        ItemStack stack = { item, n };
+        stacks.insert(at, stack);
+        if (item / 64 >= held.size()) {
+            held.resize(item / 64 + 1, 0);
+        }
+        held[item / 64] |= 1ull << (item % 64);
+    }
+
+    // Removes up to `n` of an item and returns how many were removed
+    uint32_t remove(ItemId item, uint32_t n) {
+        if (!has(item)) {
+            return 0;
+        }
+        revisionCount++;
+        size_t at = find(item);
+        uint32_t removed = std::min(n, stacks[at].count);
+        stacks[at].count -= removed;
+        if (stacks[at].count == 0) {
+            stacks.erase(at);
+            held[item / 64] &= ~(1ull << (item % 64));
+        }
+        return removed;
+    }
+
+    // Every stack held, sorted by item
+    ItemSpan contents() const {
+        ItemSpan span = { stacks.begin(), stacks.end() };
+        return span;
+    }
+
+    // Number of changes made so far; a copy keeps the count, so an inventory whose
+    // revision still matches a copy's has not changed since the copy was made
+    uint64_t revision() const { return revisionCount; }
+
+    // Bytes held on the heap
+    size_t memoryBytes() const {
+        return held.capacity() * sizeof(uint64_t) + (stacks.onHeap() ? stacks.size() * sizeof(ItemStack) : 0);
+    }
+};
+
+// Player class manages the player's state and inventory
+class Player {
+public:
+    RoomId currentRoom;     // Room the player is currently in
+    bool hasTreasure;       // Flag indicating if player has taken an item that wins the game
+    int moveCount;          // Number of moves player has made
+    Inventory inventory;    // Items the player carries
+    WorldOverlay changes;   // Items moved, monsters defeated and rooms unlocked by this player
+    SaveSlot* saveSlot;     // Where each turn is journaled, or nullptr if the game is not being saved
+    ActorSimulation* actors; // Wandering NPCs this player's turns advance, or nullptr if nothing wanders
+    RenderCache* renderCache; // Where rendered room text is kept, or nullptr to render every time
+    TurnHistory* history;   // Earlier states the player can go back to, or nullptr if turns cannot be undone
+    MacroTable* macros;     // Macros the player has defined, or nullptr if macros are not available
+
+    // Constructor initializes player at starting room with empty inventory
+    Player(RoomId startingRoom) : currentRoom(startingRoom), hasTreasure(false), moveCount(0), saveSlot(nullptr), actors(nullptr), renderCache(nullptr), history(nullptr), macros(nullptr) {}
+};
+
+// The states a player can go back to: a snapshot after each turn that changed
+// something, in a ring that keeps the last `depth` turns. Snapshots share overlay
+// nodes with each other and with the player, and share an inventory copy until the
+// inventory changes, so recording a turn costs what the turn changed, and going
+// back any number of turns costs the same. Wandering NPCs are not part of it.
+class TurnHistory {
+private:
+    struct Snapshot {
+        RoomId currentRoom;
+        bool hasTreasure;
+        int moveCount;
+        WorldOverlay changes;
+        std::shared_ptr<const Inventory> inventory;
+    };
+
+    std::vector<Snapshot> ring;  // Grows up to depth + 1 snapshots, then wraps
+    size_t depth;                // Turns that can be undone
+    size_t newest;               // Slot of the snapshot of the current state
+    size_t count;                // Snapshots held, the current state's included
+
+public:
+    static const size_t DEFAULT_DEPTH = 1000;
+
+    explicit TurnHistory(size_t turns = DEFAULT_DEPTH) : depth(turns), newest(0), count(0) {}
+
+    // Forgets every earlier state and starts again from the player's current one
+    void reset(const Player& player) {
+        ring.clear();
+        newest = 0;
+        count = 0;
+        record(player);
+    }
+
+    // Snapshots the player unless nothing has changed since the last snapshot.
+    // Returns whether a snapshot was taken.
+    bool record(const Player& player) {
+        const Snapshot* last = count > 0 ? &ring[newest] : nullptr;
+        bool sameInventory = last != nullptr && last->inventory->revision() == player.inventory.revision();
+        if (sameInventory && last->currentRoom == player.currentRoom && last->hasTreasure == player.hasTreasure
+            && last->moveCount == player.moveCount && last->changes.sameAs(player.changes)) {
+            return false;
+        }
+        Snapshot snapshot = { player.currentRoom, player.hasTreasure, player.moveCount, player.changes,
+                              sameInventory ? last->inventory : std::make_shared<const Inventory>(player.inventory) };
+        size_t slot = count > 0 ? (newest + 1) % (depth + 1) : 0;
+        if (slot == ring.size()) {
+            ring.push_back(std::move(snapshot));
+        } else {
+            ring[slot] = std::move(snapshot);
+        }
+        newest = slot;
+        count = std::min(count + 1, depth + 1);
+        return true;
+    }
+
+    // Number of turns that can be undone
+    size_t available() const { return count > 0 ? count - 1 : 0; }
+
+    // Puts the player back as they were `turns` turns ago; false if the history
+    // does not go back that far. The turns undone are dropped.
+    bool rewind(Player& player, size_t turns) {
+        if (turns == 0 || turns > available()) {
+            return false;
+        }
+        newest = (newest + depth + 1 - turns) % (depth + 1);
+        count -= turns;
+        const Snapshot& snapshot = ring[newest];
+        player.currentRoom = snapshot.currentRoom;
+        player.hasTreasure = snapshot.hasTreasure;
+        player.moveCount = snapshot.moveCount;
+        player.changes = snapshot.changes;
+        player.inventory = *snapshot.inventory;
+        return true;
+    }
+
+    // Bytes held by the snapshots, each shared node and inventory counted once;
+    // nodes the player shares with them are counted too. Walks the whole ring.
+    size_t memoryBytes() const {
+        size_t bytes = ring.capacity() * sizeof(Snapshot) + WorldOverlay::liveNodeBytes();
+        const Inventory* previous = nullptr;
+        for (size_t i = 0; i < ring.size(); ++i) {
+            const Inventory* inventory = ring[i].inventory.get();
+            if (inventory != previous) {
+                bytes += sizeof(Inventory) + inventory->memoryBytes();
+                previous = inventory;
+            }
+        }
+        return bytes;
+    }
+};
+
+const size_t TurnHistory::DEFAULT_DEPTH;
+
+// Gives the player `n` of an item; taking a goal item wins the game
+void gainItem(const World& world, Player& player, ItemId item, uint32_t n = 1) {
+    if (item == NO_ITEM || item >= world.itemTotal) {
+        return;
+    }
+    player.inventory.add(item, n);
+    if ((world.items[item].flags & ITEM_GOAL) != 0) {
+        player.hasTreasure = true;
+    }
+}
+
+// Checks if player can engage in combat, i.e. holds any item flagged as a weapon
+bool canFight(const World& world, const Player& player) {
+    return player.inventory.holdsAny(world.weaponItems);
+}
+
+// Whether the player holds what an item needs before it can be taken
+bool meetsItemNeeds(const World& world, const Player& player, ItemId item) {
+    ItemId needs = world.items[item].needs;
+    return needs == NO_ITEM || player.inventory.has(needs);
+}
+
+// Items lying in a room as this player sees it
+ItemSpan itemsInRoom(const World& world, const Player& player, RoomId room) {
+    const ItemStacks* changed = player.changes.findItems(room);
+    ItemSpan span;
+    if (changed != nullptr) {
+        span.first = changed->begin();
+        span.last = changed->end();
+    } else {
+        span.first = world.roomItems + world.roomItemStart[room];
+        span.last = world.roomItems + world.roomItemStart[room + 1];
+    }
+    return span;
+}
+
+// Whether an item lies in a room as this player sees it
+bool isItemInRoom(const World& world, const Player& player, RoomId room, ItemId item) {
+    ItemSpan here = itemsInRoom(world, player, room);
+    for (const ItemStack* stack = here.begin(); stack != here.end(); ++stack) {
+        if (stack->item == item) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Whether this player has defeated an NPC
+bool isNpcDefeated(const Player& player, NpcId npc) {
+    return player.changes.has(CHANGE_NPC_DEFEATED, npc);
+}
+
+// Whether a room is locked for this player
+bool isRoomLocked(const World& world, const Player& player, RoomId room) {
+    return world.roomLocked[room] != 0 && !player.changes.has(CHANGE_ROOM_UNLOCKED, room);
+}
+
+// Whether an exit can be walked: it is not a hidden passage still to be revealed and does
+// not lead into a room still locked. Movement, routes, hints and actors all go by this.
+// Without a player only the world's own flags count, as for what every player can walk.
+bool isEdgePassable(const World& world, const Player* player, uint32_t edge) {
+    RoomId target = world.edgeTarget[edge];
+    if (player == nullptr) {
+        return (world.edgeFlags[edge] & EDGE_HIDDEN) == 0 && world.roomLocked[target] == 0;
+    }
+    if ((world.edgeFlags[edge] & EDGE_HIDDEN) != 0 && !player->changes.has(CHANGE_EXIT_REVEALED, edge)) {
+        return false;
+    }
+    return !isRoomLocked(world, *player, target);
+}
+
+// Room whose appearance a change alters, or NO_ROOM if none does. `npcRooms` maps
+// each NPC to its room; it is filled in on the first NPC change, so restoring many
+// changes scans the rooms once rather than once per change.
+RoomId roomOfChange(const World& world, ChangeKind kind, uint32_t id, std::vector<RoomId>& npcRooms) {
+    switch (kind) {
+        case CHANGE_EXIT_REVEALED:
+            if (id < world.edgeTotal) {
+                return static_cast<RoomId>(std::upper_bound(world.edgeStart, world.edgeStart + world.roomTotal + 1, id) - world.edgeStart - 1);
+            }
+            return NO_ROOM;
+        case CHANGE_ROOM_UNLOCKED:
+            return id < world.roomTotal ? id : NO_ROOM;
+        default:
+            if (npcRooms.empty()) {
+                npcRooms.assign(world.npcTotal, NO_ROOM);
+                for (RoomId room = 0; room < world.roomTotal; ++room) {
+                    if (world.roomNpc[room] != NO_NPC_ID) {
+                        npcRooms[world.roomNpc[room]] = room;
+                    }
+                }
+            }
+            return id < npcRooms.size() ? npcRooms[id] : NO_ROOM;
+    }
+}
+
+// Schedules events a whole number of turns ahead. Each event sits in one of
+// WHEEL_SLOTS buckets picked by its due turn, so scheduling is an append and a
+// turn only visits its own bucket; an event more than one lap of the wheel away
+// stays in its bucket until the wheel comes round to its turn.
+class TimingWheel {
+public:
+    static const uint32_t WHEEL_SLOTS = 256;
+
+private:
+    // An event: the turn it is due and the id it concerns
+    struct Timer {
+        uint64_t due;
+        uint32_t id;
+    };
+    std::vector<Timer> slots[WHEEL_SLOTS];
+    size_t pending;
+
+public:
+    TimingWheel() : pending(0) {}
+
+    // Schedules an event for `id` at turn `due`
+    void schedule(uint64_t due, uint32_t id) {
+        Timer timer = { due, id };
+        slots[due % WHEEL_SLOTS].push_back(timer);
+        pending++;
+    }
+
+    // Appends the ids of the events due at turn `now` to `fired` and forgets them.
+    // Must be called for every turn in order, so no bucket is skipped.
+    void expire(uint64_t now, std::vector<uint32_t>& fired) {
+        std::vector<Timer>& slot = slots[now % WHEEL_SLOTS];
+        size_t kept = 0;
+        for (size_t i = 0; i < slot.size(); ++i) {
+            if (slot[i].due <= now) {
+                fired.push_back(slot[i].id);
+            } else {
+                slot[kept++] = slot[i];
+            }
+        }
+        pending -= slot.size() - kept;
+        slot.resize(kept);
+    }
+
+    // Number of events waiting
+    size_t size() const { return pending; }
+};
+
+// NPCs that act on their own ("actors"). The world lists where each actor starts
+// and which NPC record it uses; the simulation keeps what changes in parallel
+// arrays, one set for the villagers and one for the monsters, each indexed by the
+// actor's place among those of its kind. Every turn one branch-free pass counts all
+// actors down, which the compiler vectorizes, and only the actors whose countdown
+// runs out do any work: villagers travel to a random neighbouring room, monsters
+// patrol out of their lair one room and back. A defeated monster leaves the map and
+// a timing wheel brings it back to its lair RESPAWN_TURNS turns later.
+//
+// A monster never leaves its beat, the lair and the rooms its exits lead to. Each
+// monster keeps a copy of its beat, so patrolling touches nothing but the monsters'
+// own arrays, and is listed once and for all under every room of the beat. A
+// villager can go anywhere, so it is listed under the room it is in and moved to
+// another list whenever it travels. Both kinds of list are kept per bucket of rooms,
+// with about twice as many buckets as actors, which keeps them small enough to stay
+// cached; asking who is in a room costs the few actors in its buckets rather than a
+// pass over every actor.
+//
+// In a large world nearly every villager move misses the cache twice, once for the
+// room's edge range and once for the edge it takes. Villagers therefore move in
+// batches: one pass picks an exit for every villager due this turn and the next
+// follows them, each prefetching a few villagers ahead so the misses overlap instead
+// of queueing.
+//
+// One simulation is shared by every player in the world; it is not part of saves.
+class ActorSimulation {
+private:
+    static const size_t PREFETCH_DISTANCE = 32;
+    static const size_t WAIT_BLOCK = 16;   // Actors handled together by the loops meant to vectorize
+
+    // The actors of one kind, each indexed by its place among them
+    struct Group {
+        std::vector<uint32_t> actor;  // Actor id of each
+        std::vector<RoomId> room;     // Room each is in, or NO_ROOM while it waits to respawn
+        std::vector<uint8_t> wait;    // Turns until each acts again, padded to whole blocks of WAIT_BLOCK
+        std::vector<uint32_t> due;    // Those acting this turn, in the first dueCount entries
+        size_t dueCount;
+
+        Group() : dueCount(0) {}
+
+        // Adds an actor standing in `room`
+        void add(uint32_t id, RoomId at) {
+            actor.push_back(id);
+            room.push_back(at);
+        }
+
+        // Sizes the countdowns and the due list once every actor has been added
+        void finish() {
+            wait.assign((actor.size() + WAIT_BLOCK - 1) / WAIT_BLOCK * WAIT_BLOCK, 1);
+            due.resize(actor.size());
+        }
+
+        // Counts every actor down, then lists those whose countdown reached zero
+        // without branching on each one: every index is written and the end of the
+        // list only advances past the due ones. Actors waiting to respawn never get
+        // there, as defeat() restarts their countdown from further away than RESPAWN_TURNS.
+        void countDown() {
+            const size_t count = actor.size();
+            uint8_t* countdown = count != 0 ? &wait[0] : nullptr;
+            const size_t padded = wait.size();
+            for (size_t block = 0; block < padded; block += WAIT_BLOCK) {
+                uint8_t* w = countdown + block;
+                for (size_t a = 0; a < WAIT_BLOCK; ++a) {
+                    w[a] = static_cast<uint8_t>(w[a] - 1);
+                }
+            }
+            uint32_t* list = count != 0 ? &due[0] : nullptr;
+            dueCount = 0;
+            for (size_t a = 0; a < count; ++a) {
+                list[dueCount] = static_cast<uint32_t>(a);
+                dueCount += countdown[a] == 0;
+            }
+        }
+
+        size_t memoryBytes() const {
+            return (actor.capacity() + room.capacity() + due.capacity()) * sizeof(uint32_t) + wait.capacity();
+        }
+    };
+
+    const World& world;
+    std::vector<uint8_t> actorKind;  // NPCType of each actor
+    std::vector<uint32_t> actorSlot; // Place of each actor in its group
+    Group villagers;                 // Every actor that is not a monster
+    Group monsters;
+    std::vector<uint32_t> villagerFirst;  // First villager in each bucket of rooms, or NO_ACTOR
+    std::vector<uint32_t> villagerNext;   // Next villager in the same bucket, or NO_ACTOR
+    uint32_t villagerMask;           // Room bits that pick a villager bucket: one less than the bucket count
+    std::vector<uint32_t> exits;     // Edge each due villager takes, then the room it ends up in
+    std::vector<uint32_t> beatStart; // Where each monster's beat starts in beatRoom, plus one past the last
+    std::vector<RoomId> beatRoom;    // The lair, then where each of its exits leads (the lair if hidden or locked)
+    std::vector<uint32_t> watchStart;  // Where each bucket of rooms starts in `watchers`, plus one past the last
+    std::vector<uint32_t> watchers;  // Monsters with a room of the bucket on their beat
+    uint32_t watchMask;              // Room bits that pick a monster bucket: one less than the bucket count
+    std::vector<uint64_t> walkable;  // One bit per edge: not hidden and not leading into a locked room
+    TimingWheel respawns;            // Defeated actors, due on the turn they return
+    std::vector<uint32_t> fired;     // Respawns due this turn (reused every turn)
+    uint32_t rng;                    // xorshift state behind every random choice
+
+    uint32_t random() {
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        return rng;
+    }
+
+    // Turns until an actor acts again: villagers every 2-5 turns, monsters every 3-6.
+    // Uses the low bits of `r`, so the same random number can also pick an exit.
+    static uint8_t pace(uint8_t kind, uint32_t r) {
+        return static_cast<uint8_t>((kind == MONSTER ? 3 : 2) + (r & 3));
+    }
+
+    // Scales the high bits of `r` into [0, count) with a multiply instead of a division
+    static uint32_t scale(uint32_t r, uint32_t count) {
+        return static_cast<uint32_t>((static_cast<uint64_t>(r) * count) >> 32);
+    }
+
+    // Bucket count for lists of `actors` actors: a power of two, at least twice as many
+    static uint32_t bucketsFor(size_t actors) {
+        uint32_t buckets = 1;
+        while (buckets < 2 * actors) {
+            buckets *= 2;
+        }
+        return buckets;
+    }
+
+    static void prefetch(const void* address) {
+#ifdef __GNUC__
+        __builtin_prefetch(address);
+#else
+        (void)address;
+#endif
+    }
+
+    // Adds a villager to the front of its room's bucket
+    void link(uint32_t villager, RoomId room) {
+        uint32_t& first = villagerFirst[room & villagerMask];
+        villagerNext[villager] = first;
+        first = villager;
+    }
+
+    // Takes a villager out of the bucket of the room it is in. Buckets are singly
+    // linked: with twice as many buckets as villagers, it is nearly always the first.
+    void unlink(uint32_t villager) {
+        uint32_t* link = &villagerFirst[villagers.room[villager] & villagerMask];
+        while (*link != villager) {
+            link = &villagerNext[*link];
+        }
+        *link = villagerNext[villager];
+    }
+
+    // Picks an exit of its room for every due villager, keeping those with somewhere
+    // to go at the front of the due list
+    void chooseExits() {
+        const uint32_t* due = villagers.dueCount != 0 ? &villagers.due[0] : nullptr;
+        size_t kept = 0;
+        for (size_t i = 0; i < villagers.dueCount; ++i) {
+            if (i + PREFETCH_DISTANCE < villagers.dueCount) {
+                prefetch(&world.edgeStart[villagers.room[due[i + PREFETCH_DISTANCE]]]);
+            }
+            uint32_t villager = due[i];
+            RoomId at = villagers.room[villager];
+            uint32_t r = random();
+            villagers.wait[villager] = pace(VILLAGER, r);
+            uint32_t first = world.edgeStart[at];
+            uint32_t count = world.edgeStart[at + 1] - first;
+            villagers.due[kept] = villager;
+            exits[kept] = first + scale(r, count);
+            kept += count != 0;
+        }
+        villagers.dueCount = kept;
+    }
+
+    // Moves the kept villagers along the exits chosen for them, unless the exit is
+    // hidden or locked. The first pass looks up where each one ends up; only then are
+    // the villagers moved between buckets.
+    void followExits() {
+        const size_t count = villagers.dueCount;
+        for (size_t i = 0; i < count; ++i) {
+            if (i + PREFETCH_DISTANCE < count) {
+                prefetch(&world.edgeTarget[exits[i + PREFETCH_DISTANCE]]);
+            }
+            uint32_t e = exits[i];
+            exits[i] = (walkable[e >> 6] >> (e & 63)) & 1 ? world.edgeTarget[e] : villagers.room[villagers.due[i]];
+        }
+        for (size_t i = 0; i < count; ++i) {
+            if (i + PREFETCH_DISTANCE < count) {
+                uint32_t ahead = villagers.due[i + PREFETCH_DISTANCE];
+                prefetch(&villagerFirst[villagers.room[ahead] & villagerMask]);
+                prefetch(&villagerFirst[exits[i + PREFETCH_DISTANCE] & villagerMask]);
+            }
+            uint32_t villager = villagers.due[i];
+            RoomId next = exits[i];
+            if (next != villagers.room[villager]) {
+                unlink(villager);
+                link(villager, next);
+                villagers.room[villager] = next;
+                moves++;
+            }
+        }
+    }
+
+    // Moves every due monster along its beat: one away from the lair goes straight
+    // back, one at home takes a random exit of the lair. The loop avoids branching on
+    // where the monster is, which is random.
+    void patrol() {
+        for (size_t i = 0; i < monsters.dueCount; ++i) {
+            uint32_t monster = monsters.due[i];
+            RoomId at = monsters.room[monster];
+            uint32_t first = beatStart[monster];
+            uint32_t count = beatStart[monster + 1] - first - 1;
+            RoomId lair = beatRoom[first];
+            uint32_t r = random();
+            monsters.wait[monster] = pace(MONSTER, r);
+            RoomId out = count != 0 ? beatRoom[first + 1 + scale(r, count)] : lair;
+            RoomId next = at != lair ? lair : out;
+            moves += next != at;
+            monsters.room[monster] = next;
+        }
+    }
+
+    // Lists every monster under the buckets of the rooms on its beat, each bucket once
+    void buildWatchers() {
+        const uint32_t monsterCount = static_cast<uint32_t>(monsters.actor.size());
+        watchMask = bucketsFor(monsterCount) - 1;
+        watchStart.assign(watchMask + 2, 0);
+        std::vector<uint32_t> buckets;
+        for (int fill = 0; fill < 2; ++fill) {
+            for (uint32_t m = 0; m < monsterCount; ++m) {
+                buckets.clear();
+                for (uint32_t b = beatStart[m]; b < beatStart[m + 1]; ++b) {
+                    buckets.push_back(beatRoom[b] & watchMask);
+                }
+                std::sort(buckets.begin(), buckets.end());
+                buckets.erase(std::unique(buckets.begin(), buckets.end()), buckets.end());
+                for (size_t k = 0; k < buckets.size(); ++k) {
+                    if (fill == 0) {
+                        watchStart[buckets[k] + 1]++;
+                    } else {
+                        watchers[watchStart[buckets[k]]++] = m;
+                    }
+                }
+            }
+            if (fill == 0) {
+                for (size_t b = 1; b < watchStart.size(); ++b) {
+                    watchStart[b] += watchStart[b - 1];
+                }
+                watchers.resize(watchStart.back());
+            }
+        }
+        // Filling advanced each start to where the next bucket starts
+        for (size_t b = watchStart.size() - 1; b > 0; --b) {
+            watchStart[b] = watchStart[b - 1];
+        }
+        watchStart[0] = 0;
+    }
+
+public:
+    static const uint32_t NO_ACTOR = 0xFFFFFFFFu;
+    static const uint32_t RESPAWN_TURNS = 30;
+    static_assert(RESPAWN_TURNS < 0xFF, "a defeated actor's countdown must not run out before it respawns");
+
+    uint64_t turn;    // Turns simulated so far
+    uint64_t moves;   // Times an actor changed rooms
+
+    ActorSimulation(const World& w, unsigned seed)
+        : world(w), actorKind(w.actorTotal), actorSlot(w.actorTotal), villagerMask(0), watchMask(0),
+          rng(seed != 0 ? seed : 1), turn(0), moves(0) {
+        for (uint32_t a = 0; a < w.actorTotal; ++a) {
+            actorKind[a] = world.npcType[world.actorNpc[a]];
+            Group& group = actorKind[a] == MONSTER ? monsters : villagers;
+            actorSlot[a] = static_cast<uint32_t>(group.actor.size());
+            group.add(a, w.actorHome[a]);
+        }
+        villagers.finish();
+        monsters.finish();
+        for (uint32_t a = 0; a < w.actorTotal; ++a) {
+            (actorKind[a] == MONSTER ? monsters : villagers).wait[actorSlot[a]] = pace(actorKind[a], random());
+        }
+        if (w.actorTotal == 0) {
+            return;
+        }
+        walkable.assign((w.edgeTotal + 63) / 64, 0);
+        for (uint32_t e = 0; e < w.edgeTotal; ++e) {
+            if (isEdgePassable(w, nullptr, e)) {
+                walkable[e >> 6] |= 1ull << (e & 63);
+            }
+        }
+
+        // Linking from the last villager keeps each bucket in actor order
+        villagerMask = bucketsFor(villagers.actor.size()) - 1;
+        villagerFirst.assign(villagerMask + 1, NO_ACTOR);
+        villagerNext.resize(villagers.actor.size());
+        exits.resize(villagers.actor.size());
+        for (uint32_t v = static_cast<uint32_t>(villagers.actor.size()); v-- > 0; ) {
+            link(v, villagers.room[v]);
+        }
+
+        beatStart.push_back(0);
+        for (uint32_t m = 0; m < monsters.actor.size(); ++m) {
+            RoomId lair = monsters.room[m];
+            beatRoom.push_back(lair);
+            for (uint32_t e = w.edgeStart[lair]; e < w.edgeStart[lair + 1]; ++e) {
+                beatRoom.push_back((walkable[e >> 6] >> (e & 63)) & 1 ? w.edgeTarget[e] : lair);
+            }
+            beatStart.push_back(static_cast<uint32_t>(beatRoom.size()));
+        }
+        buildWatchers();
+    }
+
+    // Number of actors, including those waiting to respawn
+    uint32_t actorCount() const { return static_cast<uint32_t>(actorKind.size()); }
+
+    // Advances every actor by one turn
+    void tick() {
+        turn++;
+        villagers.countDown();
+        monsters.countDown();
+        chooseExits();
+        followExits();
+        patrol();
+
+        fired.clear();
+        respawns.expire(turn, fired);
+        for (size_t i = 0; i < fired.size(); ++i) {
+            uint32_t actor = fired[i];
+            uint32_t slot = actorSlot[actor];
+            uint8_t kind = actorKind[actor];
+            Group& group = kind == MONSTER ? monsters : villagers;
+            group.room[slot] = world.actorHome[actor];
+            group.wait[slot] = pace(kind, random());
+            if (kind != MONSTER) {
+                link(slot, group.room[slot]);
+            }
+        }
+    }
+
+    // Counts the villagers and monsters in a room
+    void countIn(RoomId room, uint32_t& villagerCount, uint32_t& monsterCount) const {
+        villagerCount = 0;
+        monsterCount = 0;
+        if (!villagerFirst.empty()) {
+            for (uint32_t v = villagerFirst[room & villagerMask]; v != NO_ACTOR; v = villagerNext[v]) {
+                villagerCount += villagers.room[v] == room;
+            }
+        }
+        if (!watchers.empty()) {
+            uint32_t bucket = room & watchMask;
+            for (uint32_t k = watchStart[bucket]; k < watchStart[bucket + 1]; ++k) {
+                monsterCount += monsters.room[watchers[k]] == room;
+            }
+        }
+    }
+
+    // An actor in a room, of the given type unless `kind` is NO_NPC, in which case
+    // villagers come first; NO_ACTOR if there is none
+    uint32_t findIn(RoomId room, NPCType kind) const {
+        if (kind != MONSTER && !villagerFirst.empty()) {
+            for (uint32_t v = villagerFirst[room & villagerMask]; v != NO_ACTOR; v = villagerNext[v]) {
+                if (villagers.room[v] == room && (kind == NO_NPC || actorKind[villagers.actor[v]] == kind)) {
+                    return villagers.actor[v];
+                }
+            }
+        }
+        if (kind != VILLAGER && !watchers.empty()) {
+            uint32_t bucket = room & watchMask;
+            for (uint32_t k = watchStart[bucket]; k < watchStart[bucket + 1]; ++k) {
+                if (monsters.room[watchers[k]] == room) {
+                    return monsters.actor[watchers[k]];
+                }
+            }
+        }
+        return NO_ACTOR;
+    }
+
+    // Takes an actor off the map until it respawns in its home room
+    void defeat(uint32_t actor) {
+        uint32_t slot = actorSlot[actor];
+        bool monster = actorKind[actor] == MONSTER;
+        Group& group = monster ? monsters : villagers;
+        if (group.room[slot] != NO_ROOM) {
+            if (!monster) {
+                unlink(slot);
+            }
+            group.room[slot] = NO_ROOM;
+            group.wait[slot] = 0xFF;  // Counts down past RESPAWN_TURNS without reaching zero
+            respawns.schedule(turn + RESPAWN_TURNS, actor);
+        }
+    }
+
+    // Number of defeated actors waiting to respawn
+    size_t respawnsPending() const { return respawns.size(); }
+
+    // Bytes of per-actor state
+    size_t memoryBytes() const {
+        return actorKind.capacity() + actorSlot.capacity() * sizeof(uint32_t) + villagers.memoryBytes() + monsters.memoryBytes()
+            + (villagerFirst.capacity() + villagerNext.capacity() + exits.capacity()) * sizeof(uint32_t)
+            + (beatStart.capacity() + beatRoom.capacity() + watchStart.capacity() + watchers.capacity()) * sizeof(uint32_t)
+            + walkable.capacity() * sizeof(uint64_t);
+    }
+};
+
+const size_t ActorSimulation::PREFETCH_DISTANCE;
+const size_t ActorSimulation::WAIT_BLOCK;
+const uint32_t ActorSimulation::NO_ACTOR;
+const uint32_t ActorSimulation::RESPAWN_TURNS;
+
+// Rules of a room that a verb triggers, as a range of indexes into World::rules
+void findRules(const World& world, RoomId room, unsigned verb, uint32_t& first, uint32_t& last) {
+    first = world.ruleStart[room];
+    last = world.ruleStart[room + 1];
+    while (first < last && world.rules[first].verb < verb) {
+        ++first;
+    }
+    uint32_t end = first;
+    while (end < last && world.rules[end].verb == verb) {
+        ++end;
+    }
+    last = end;
+}
+
+// Checks the conditions of a rule against the player's state in `room`
+bool ruleConditionsHold(const World& world, const Player& player, RoomId room, const Rule& rule) {
+    for (uint32_t i = 0; i < rule.opCount; ++i) {
+        const RuleOp& op = world.ruleOps[rule.firstOp + i];
+        NpcId npc = world.roomNpc[room];
+        switch (op.code) {
+            case RULE_HAS_ITEM:
+                if (!player.inventory.has(op.value)) return false;
+                break;
+            case RULE_LACKS_ITEM:
+                if (player.inventory.has(op.value)) return false;
+                break;
+            case RULE_ITEM_HERE:
+                if (!isItemInRoom(world, player, room, op.value)) return false;
+                break;
+            case RULE_MONSTER_HERE:
+                if (npc == NO_NPC_ID || world.npcType[npc] != MONSTER || isNpcDefeated(player, npc)) return false;
+                break;
+            default:
+                return true;  // Conditions end where the actions begin
+        }
+    }
+    return true;
+}
+
+// Carries out the actions of a rule that fired in `room`
+void applyRuleActions(const World& world, Player& player, RoomId room, const Rule& rule, std::ostream& out) {
+    for (uint32_t i = 0; i < rule.opCount; ++i) {
+        const RuleOp& op = world.ruleOps[rule.firstOp + i];
+        switch (op.code) {
+            case RULE_PRINT:
+                world.writeText(out, op.text);
+                out << "\n";
+                break;
+            case RULE_GIVE_ITEM:
+                gainItem(world, player, op.value);
+                break;
+            case RULE_REVEAL_EXIT:
+                for (uint32_t e = world.edgeStart[room]; e < world.edgeStart[room + 1]; ++e) {
+                    if (world.edgeDirection[e] == op.value) {
+                        player.changes.set(CHANGE_EXIT_REVEALED, e, room);
+                    }
+                }
+                break;
+            case RULE_UNLOCK_ROOM:
+                player.changes.set(CHANGE_ROOM_UNLOCKED, op.value, op.value);
+                break;
+            case RULE_DEFEAT_NPC:
+                if (world.roomNpc[room] != NO_NPC_ID) {
+                    player.changes.set(CHANGE_NPC_DEFEATED, world.roomNpc[room], room);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// Exits of a room the player can see: the visible ones, plus hidden ones a rule has revealed
+unsigned visibleExits(const World& world, const Player& player, RoomId room) {
+    unsigned mask = world.exitMask[room];
+    for (uint32_t e = world.edgeStart[room]; e < world.edgeStart[room + 1]; ++e) {
+        if ((world.edgeFlags[e] & EDGE_HIDDEN) != 0 && player.changes.has(CHANGE_EXIT_REVEALED, e)) {
+            mask |= 1u << world.edgeDirection[e];
+        }
+    }
+    return mask;
+}
+
+// Displays the exits and the room's own NPC
+void showPathsAndNpc(const World& world, const Player& player, RoomId room, std::ostream& out) {
+    // Show available exits, derived from the room's exit mask
+    unsigned mask = visibleExits(world, player, room);
+    if (mask != 0) {
+        out << GameColors::cyan << "Available paths lead: ";
+        for (int dir = 0; dir < DIRECTION_COUNT; ++dir) {
+            if (mask & (1u << dir)) {
+                mask &= ~(1u << dir);
+                out << GameColors::yellow << directionToString(static_cast<Direction>(dir)) << GameColors::cyan;
+                if (mask != 0) {
+                    out << ", ";
+                }
+            }
+        }
+        out << "." << GameColors::reset << "\n";
+    }
+
+    // Show NPCs if present
+    NpcId npc = world.roomNpc[room];
+    if (npc != NO_NPC_ID && !isNpcDefeated(player, npc)) {
+        if (world.npcType[npc] == VILLAGER) {
+            out << GameColors::bold << GameColors::cyan << "There is a villager here you can talk to." << GameColors::reset << "\n";
+        } else if (world.npcType[npc] == MONSTER) {
+            out << GameColors::bold << GameColors::red << "A fearsome monster blocks your path!" << GameColors::reset << "\n";
+        }
+    }
+}
+
+// Displays the wandering NPCs passing through
+void showActors(const Player& player, RoomId room, std::ostream& out) {
+    if (player.actors != nullptr) {
+        uint32_t villagers, monsters;
+        player.actors->countIn(room, villagers, monsters);
+        if (villagers == 1) {
+            out << GameColors::cyan << "A traveller is passing through." << GameColors::reset << "\n";
+        } else if (villagers > 1) {
+            out << GameColors::cyan << villagers << " travellers are passing through." << GameColors::reset << "\n";
+        }
+        if (monsters == 1) {
+            out << GameColors::bold << GameColors::red << "A monster prowls here!" << GameColors::reset << "\n";
+        } else if (monsters > 1) {
+            out << GameColors::bold << GameColors::red << monsters << " monsters prowl here!" << GameColors::reset << "\n";
+        }
+    }
+}
+
+// Displays the items lying in the room
+void showItems(const World& world, const Player& player, RoomId room, std::ostream& out) {
+    ItemSpan here = itemsInRoom(world, player, room);
+    for (const ItemStack* stack = here.begin(); stack != here.end(); ++stack) {
+        world.writeText(out, world.items[stack->item].seen);
+        if (stack->count > 1) {
+            out << GameColors::cyan << " (" << stack->count << " of them)" << GameColors::reset;
+        }
+        out << "\n";
+    }
+}
+
+// Displays the part of a room's entry text (or its look text) that comes before
+// the wandering NPCs: its description, exits and NPC
+void showRoomHead(const World& world, const Player& player, RoomId room, bool look, std::ostream& out) {
+    if (look) {
+        out << "\nYou carefully examine ";
+        world.writeText(out, world.roomName[room]);
+        out << ".\n";
+        world.writeText(out, world.roomDetail[room]);
+    } else {
+        out << "\nYou are in ";
+        world.writeText(out, world.roomName[room]);
+        out << ". ";
+        world.writeText(out, world.roomDescription[room]);
+    }
+    out << "\n";
+    showPathsAndNpc(world, player, room, out);
+}
+
+// Rendered room text, kept as finished bytes so describing a room nobody has
+// changed is a buffer copy. Entries are keyed by room, entry or look text, and the
+// room's state version in the player's overlay. Untouched rooms have version 0 and
+// share one entry between every player; a change gives the room a version no other
+// state has, so a stale entry is never used and simply ages out. The table is direct
+// mapped with two slots per room, enough for every entry and look text of a small
+// world, up to SLOT_LIMIT, which bounds its memory in worlds of any size.
+//
+// A cache is not thread safe; each thread that renders needs its own.
+class RenderCache {
+public:
+    static const size_t SLOT_LIMIT = 4096;
+
+private:
+    struct Entry {
+        uint64_t key;       // (room << 1 | look) + 1, or 0 for an empty slot
+        uint64_t version;   // Room state version the text was rendered at
+        std::string text;   // Rendered text
+        size_t split;       // Where the wandering NPCs go in `text`
+    };
+    std::vector<Entry> slots;
+    std::ostringstream scratch;  // Reused to render misses
+
+public:
+    uint64_t hits;
+    uint64_t misses;
+
+    explicit RenderCache(uint32_t roomCount, size_t limit = SLOT_LIMIT) : hits(0), misses(0) {
+        size_t slotCount = std::min(static_cast<size_t>(roomCount) * 2, limit);
+        size_t size = 1;
+        while (size < slotCount) {
+            size <<= 1;
+        }
+        Entry empty = { 0, 0, std::string(), 0 };
+        slots.assign(size, empty);
+    }
+
+    // Writes a room's entry text, or its look text, as the player sees it
+    void describe(const World& world, const Player& player, RoomId room, bool look, std::ostream& out) {
+        uint64_t key = ((static_cast<uint64_t>(room) << 1) | (look ? 1u : 0u)) + 1;
+        uint64_t version = player.changes.roomVersion(room);
+        uint64_t mixed = (key ^ (version * 0x9E3779B97F4A7C15ull)) * 0xBF58476D1CE4E5B9ull;
+        Entry& entry = slots[(mixed >> 32) & (slots.size() - 1)];
+        if (entry.key != key || entry.version != version) {
+            misses++;
+            scratch.str(std::string());
+            showRoomHead(world, player, room, look, scratch);
+            entry.split = static_cast<size_t>(scratch.tellp());
+            showItems(world, player, room, scratch);
+            entry.key = key;
+            entry.version = version;
+            entry.text = scratch.str();
+        } else {
+            hits++;
+        }
+        if (player.actors == nullptr) {
+            out.write(entry.text.data(), static_cast<std::streamsize>(entry.text.size()));
+            return;
+        }
+        out.write(entry.text.data(), static_cast<std::streamsize>(entry.split));
+        showActors(player, room, out);
+        out.write(entry.text.data() + entry.split, static_cast<std::streamsize>(entry.text.size() - entry.split));
+    }
+
+    // Bytes held by the cache
+    size_t memoryBytes() const {
+        size_t bytes = slots.capacity() * sizeof(Entry);
+        for (size_t i = 0; i < slots.size(); ++i) {
+            bytes += slots[i].text.capacity();
+        }
+        return bytes;
+    }
+};
+
+const size_t RenderCache::SLOT_LIMIT;
+
+// Writes a room's text through the player's render cache, or renders it directly without one
+void writeRoom(const World& world, const Player& player, RoomId room, bool look, std::ostream& out) {
+    if (player.renderCache != nullptr) {
+        player.renderCache->describe(world, player, room, look, out);
+        return;
+    }
+    showRoomHead(world, player, room, look, out);
+    showActors(player, room, out);
+    showItems(world, player, room, out);
+}
+
+// Displays basic room information on entry
+void describeRoom(const World& world, const Player& player, RoomId room, std::ostream& out) {
+    writeRoom(world, player, room, false, out);
+}
+
+// Displays detailed room information when looking
+void describeRoomLook(const World& world, const Player& player, RoomId room, std::ostream& out) {
+    writeRoom(world, player, room, true, out);
+}
+
+// Outcome of processing a single command
+enum TurnResult { TURN_CONTINUE, TURN_QUIT, TURN_WON, TURN_END_OF_INPUT };
+
+
+// Returns the display name of an item
+std::string itemName(const World& world, ItemId item) {
+    return world.textString(world.items[item].name);
+}
+
+// Copies `text` into `plain` without its ANSI escape sequences, reusing the capacity of `plain`
+void stripAnsiInto(const std::string& text, std::string& plain) {
+    plain.clear();
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (text[i] == '\033' && i + 1 < text.size() && text[i + 1] == '[') {
+            // Skip parameters up to and including the final byte of the sequence
+            i += 2;
+            while (i < text.size() && !(text[i] >= '@' && text[i] <= '~')) {
+                ++i;
+            }
+            continue;
+        }
+        plain += text[i];
+    }
+}
+
+// Removes ANSI escape sequences from a string, leaving only the visible text
+std::string stripAnsi(const std::string& text) {
+    std::string plain;
+    plain.reserve(text.size());
+    stripAnsiInto(text, plain);
+    return plain;
+}
+
+// Hashes a room name for lookups, ignoring case and ANSI color codes
+uint64_t hashRoomName(const char* data, size_t size) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; ++i) {
+        if (data[i] == '\033' && i + 1 < size && data[i + 1] == '[') {
+            i += 2;
+            while (i < size && !(data[i] >= '@' && data[i] <= '~')) {
+                ++i;
+            }
+            continue;
+        }
+        hash = (hash ^ static_cast<unsigned char>(std::tolower(static_cast<unsigned char>(data[i])))) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// Answers "how do I get from room A to room B" for the go and path commands.
+// Routes only use exits the player can see and never enter a locked room, so
+// the hidden passage east of the mountain stays a secret until a rule reveals it.
+//
+// The index is built once per world. Small worlds get an all-pairs next-hop
+// table (one byte per pair), so a route is read off one step at a time. Larger
+// worlds are split into clusters of rooms joined by loops. The passages left over
+// (bridges) join the clusters into a tree, as generated maps are trees with a
+// few loops, and every route crosses exactly the bridges on the tree path between
+// its ends. Only the clusters along that path are searched.
+class RoutePlanner {
+private:
+    static const uint32_t TABLE_ROOM_LIMIT = 2048;  // Largest world given a next-hop table
+    static const uint32_t NO_CLUSTER = 0xFFFFFFFFu;
+    static const uint32_t UNREACHABLE = 0xFFFFFFFFu;
+    static const uint8_t NO_HOP = 0xFF;
+
+    const World& world;
+    std::vector<uint32_t> edgeIds;         // Usable edges, grouped by source room
+    std::vector<uint32_t> usableStart;     // Offset of each room's first usable edge
+    std::vector<uint32_t> reverseStart;    // Usable edges grouped by target room
+    std::vector<RoomId> reverseSource;     // Source room of each reversed edge
+    std::vector<uint32_t> reverseEdge;     // World edge id of each reversed edge
+    std::vector<uint8_t> nextHop;          // Small worlds: first exit to take, counted from the room's first edge, [from * rooms + to]
+    std::vector<uint32_t> cluster;         // Large worlds: the cluster of each room
+    std::vector<uint32_t> clusterParent;   // Large worlds: the cluster across each cluster's bridge towards the root, or NO_CLUSTER
+    std::vector<uint32_t> clusterDepth;    // Large worlds: bridges between each cluster and the root
+    std::vector<RoomId> clusterExit;       // Large worlds: the room of each cluster at that bridge
+    std::vector<RoomId> clusterEntry;      // Large worlds: the room at the other end of it, in the parent
+    std::vector<std::pair<uint64_t, RoomId> > names;  // Room name hashes, sorted
+
+    // A route may take an edge every player can walk from the start, and that moving in
+    // its direction actually takes
+    bool usable(RoomId room, uint32_t edge) const {
+        return isEdgePassable(world, nullptr, edge)
+            && world.findEdge(room, static_cast<Direction>(world.edgeDirection[edge])) == edge;
+    }
+
+    // Fills the next-hop table with one backward search per destination
+    void buildNextHopTable() {
+        uint32_t rooms = world.roomCount();
+        nextHop.assign(static_cast<size_t>(rooms) * rooms, NO_HOP);
+        std::vector<RoomId> queue;
+        std::vector<uint8_t> seen(rooms);
+        for (RoomId to = 0; to < rooms; ++to) {
+            std::fill(seen.begin(), seen.end(), 0);
+            queue.assign(1, to);
+            seen[to] = 1;
+            for (size_t head = 0; head < queue.size(); ++head) {
+                RoomId room = queue[head];
+                for (uint32_t e = reverseStart[room]; e < reverseStart[room + 1]; ++e) {
+                    RoomId from = reverseSource[e];
+                    if (!seen[from]) {
+                        seen[from] = 1;
+                        nextHop[static_cast<size_t>(from) * rooms + to] = static_cast<uint8_t>(reverseEdge[e] - world.edgeStart[from]);
+                        queue.push_back(from);
+                    }
+                }
+            }
+        }
+    }
+
+    // Splits the map into clusters: rooms joined by loops, so that no single passage
+    // separates any two of them. A cluster is found with one depth-first search over the
+    // passages taken either way, as the rooms below a room that no passage leads back above.
+    void buildClusters() {
+        uint32_t rooms = world.roomCount();
+
+        // Neighbours along usable edges in either direction, each listed once
+        std::vector<uint32_t> start(rooms + 1, 0);
+        std::vector<RoomId> neighbour;
+        neighbour.reserve(edgeIds.size() * 2);
+        for (RoomId r = 0; r < rooms; ++r) {
+            size_t first = neighbour.size();
+            for (uint32_t e = usableStart[r]; e < usableStart[r + 1]; ++e) {
+                neighbour.push_back(world.edgeTarget[edgeIds[e]]);
+            }
+            for (uint32_t e = reverseStart[r]; e < reverseStart[r + 1]; ++e) {
+                neighbour.push_back(reverseSource[e]);
+            }
+            std::sort(neighbour.begin() + first, neighbour.end());
+            neighbour.erase(std::unique(neighbour.begin() + first, neighbour.end()), neighbour.end());
+            neighbour.erase(std::remove(neighbour.begin() + first, neighbour.end(), r), neighbour.end());
+            start[r + 1] = static_cast<uint32_t>(neighbour.size());
+        }
+
+        // Tarjan's bridge search, with an explicit stack: `low` is the earliest room in
+        // search order reachable from below a room by at most one passage back up
+        std::vector<uint32_t> order(rooms, UNREACHABLE), low(rooms), cursor(start.begin(), start.end() - 1);
+        std::vector<RoomId> parent(rooms, NO_ROOM);
+        std::vector<RoomId> path, pending;  // The search's current path, and rooms not yet in a cluster
+        cluster.assign(rooms, NO_CLUSTER);
+        uint32_t time = 0;
+        for (RoomId root = 0; root < rooms; ++root) {
+            if (order[root] != UNREACHABLE) {
+                continue;
+            }
+            order[root] = low[root] = time++;
+            path.push_back(root);
+            pending.push_back(root);
+            while (!path.empty()) {
+                RoomId room = path.back();
+                if (cursor[room] < start[room + 1]) {
+                    RoomId other = neighbour[cursor[room]++];
+                    if (order[other] == UNREACHABLE) {
+                        order[other] = low[other] = time++;
+                        parent[other] = room;
+                        path.push_back(other);
+                        pending.push_back(other);
+                    } else if (other != parent[room]) {
+                        low[room] = std::min(low[room], order[other]);
+                    }
+                    continue;
+                }
+                path.pop_back();
+                if (parent[room] != NO_ROOM) {
+                    low[parent[room]] = std::min(low[parent[room]], low[room]);
+                }
+                if (low[room] == order[room]) {
+                    // Nothing below this room leads back above it: it heads a cluster, and
+                    // the passage to its parent (if any) is a bridge
+                    uint32_t id = static_cast<uint32_t>(clusterExit.size());
+                    RoomId member;
+                    do {
+                        member = pending.back();
+                        pending.pop_back();
+                        cluster[member] = id;
+                    } while (member != room);
+                    clusterExit.push_back(room);
+                    clusterEntry.push_back(parent[room]);
+                }
+            }
+        }
+
+        // A cluster is numbered after every cluster below it, so going down from the last
+        // sets each parent's depth before its children's
+        uint32_t clusters = static_cast<uint32_t>(clusterExit.size());
+        clusterParent.resize(clusters);
+        clusterDepth.resize(clusters);
+        for (uint32_t c = clusters; c-- > 0; ) {
+            bool root = clusterEntry[c] == NO_ROOM;
+            clusterParent[c] = root ? NO_CLUSTER : cluster[clusterEntry[c]];
+            clusterDepth[c] = root ? 0 : clusterDepth[clusterParent[c]] + 1;
+        }
+    }
+
+    // Appends the move along a usable edge from one room to a neighbouring one; false
+    // if the only passages between them lead the other way
+    bool appendCrossing(RoomId from, RoomId to, std::vector<uint8_t>& route) const {
+        for (uint32_t e = usableStart[from]; e < usableStart[from + 1]; ++e) {
+            if (world.edgeTarget[edgeIds[e]] == to) {
+                route.push_back(world.edgeDirection[edgeIds[e]]);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Appends a fewest-moves route between two rooms of the same cluster, found by
+    // breadth-first searches from both ends that never leave the cluster. Each round
+    // grows the smaller frontier by one move; the first round in which they touch holds
+    // the shortest route.
+    bool appendClusterRoute(RoomId from, RoomId to, std::vector<uint8_t>& route) const {
+        if (from == to) {
+            return true;
+        }
+        // Per-thread scratch for both directions, reset in O(1) by bumping the generation
+        static thread_local std::vector<uint32_t> generation[2], dist[2], via[2];
+        static thread_local std::vector<RoomId> parent[2], frontier[2], grown;
+        static thread_local uint32_t currentGeneration = 0;
+        uint32_t rooms = world.roomCount();
+        if (generation[0].size() < rooms || ++currentGeneration == 0) {
+            for (int side = 0; side < 2; ++side) {
+                generation[side].assign(rooms, 0);
+                dist[side].resize(rooms);
+                via[side].resize(rooms);
+                parent[side].resize(rooms);
+            }
+            currentGeneration = 1;
+        }
+
+        const uint32_t home = cluster[from];
+        const RoomId ends[2] = { from, to };
+        for (int side = 0; side < 2; ++side) {
+            generation[side][ends[side]] = currentGeneration;
+            dist[side][ends[side]] = 0;
+            frontier[side].assign(1, ends[side]);
+        }
+        uint32_t best = UNREACHABLE;
+        RoomId meet = NO_ROOM;
+        while (meet == NO_ROOM && !frontier[0].empty() && !frontier[1].empty()) {
+            // Forwards along usable edges from `from`, backwards against them from `to`
+            int side = frontier[0].size() <= frontier[1].size() ? 0 : 1;
+            grown.clear();
+            for (size_t i = 0; i < frontier[side].size(); ++i) {
+                RoomId room = frontier[side][i];
+                uint32_t first = side == 0 ? usableStart[room] : reverseStart[room];
+                uint32_t last = side == 0 ? usableStart[room + 1] : reverseStart[room + 1];
+                for (uint32_t e = first; e < last; ++e) {
+                    uint32_t edge = side == 0 ? edgeIds[e] : reverseEdge[e];
+                    RoomId next = side == 0 ? world.edgeTarget[edge] : reverseSource[e];
+                    if (cluster[next] != home || generation[side][next] == currentGeneration) {
+                        continue;
+                    }
+                    generation[side][next] = currentGeneration;
+                    dist[side][next] = dist[side][room] + 1;
+                    parent[side][next] = room;
+                    via[side][next] = edge;
+                    grown.push_back(next);
+                    if (generation[1 - side][next] == currentGeneration && dist[side][next] + dist[1 - side][next] < best) {
+                        best = dist[side][next] + dist[1 - side][next];
+                        meet = next;
+                    }
+                }
+            }
+            frontier[side].swap(grown);
+        }
+        if (meet == NO_ROOM) {
+            return false;
+        }
+        size_t mark = route.size();
+        for (RoomId room = meet; room != from; room = parent[0][room]) {
+            route.push_back(world.edgeDirection[via[0][room]]);
+        }
+        std::reverse(route.begin() + mark, route.end());
+        for (RoomId room = meet; room != to; room = parent[1][room]) {
+            route.push_back(world.edgeDirection[via[1][room]]);
+        }
+        return true;
+    }
+
+    // The bridges a route crosses are those on the path between the two clusters in
+    // the tree the bridges form, so a route climbs from `from` to the cluster where the
+    // two ends' paths to the root meet, then comes down to `to`. Inside each cluster on
+    // the way it takes a shortest route between where it enters and where it leaves.
+    bool clusterRoute(RoomId from, RoomId to, std::vector<uint8_t>& route) const {
+        static thread_local std::vector<uint32_t> climb, descent;
+        climb.clear();
+        descent.clear();
+        uint32_t up = cluster[from];
+        uint32_t down = cluster[to];
+        while (up != down) {
+            if (clusterDepth[up] >= clusterDepth[down]) {
+                if (clusterParent[up] == NO_CLUSTER) {
+                    return false;  // The two rooms are not joined at all
+                }
+                climb.push_back(up);
+                up = clusterParent[up];
+            } else {
+                descent.push_back(down);
+                down = clusterParent[down];
+            }
+        }
+        RoomId room = from;
+        for (size_t i = 0; i < climb.size(); ++i) {
+            uint32_t c = climb[i];
+            if (!appendClusterRoute(room, clusterExit[c], route) || !appendCrossing(clusterExit[c], clusterEntry[c], route)) {
+                return false;
+            }
+            room = clusterEntry[c];
+        }
+        for (size_t i = descent.size(); i-- > 0; ) {
+            uint32_t c = descent[i];
+            if (!appendClusterRoute(room, clusterEntry[c], route) || !appendCrossing(clusterEntry[c], clusterExit[c], route)) {
+                return false;
+            }
+            room = clusterExit[c];
+        }
+        return appendClusterRoute(room, to, route);
+    }
+
+public:
+    // Builds the routing index for a world
+    explicit RoutePlanner(const World& w) : world(w) {
+        uint32_t rooms = world.roomCount();
+
+        // Keep only the edges a route may use, forwards and reversed
+        usableStart.assign(rooms + 1, 0);
+        reverseStart.assign(rooms + 1, 0);
+        for (RoomId r = 0; r < rooms; ++r) {
+            for (uint32_t e = world.edgeStart[r]; e < world.edgeStart[r + 1]; ++e) {
+                if (usable(r, e)) {
+                    edgeIds.push_back(e);
+                    reverseStart[world.edgeTarget[e] + 1]++;
+                }
+            }
+            usableStart[r + 1] = static_cast<uint32_t>(edgeIds.size());
+        }
+        for (RoomId r = 0; r < rooms; ++r) {
+            reverseStart[r + 1] += reverseStart[r];
+        }
+        std::vector<uint32_t> cursor(reverseStart.begin(), reverseStart.end() - 1);
+        reverseSource.resize(edgeIds.size());
+        reverseEdge.resize(edgeIds.size());
+        for (RoomId r = 0; r < rooms; ++r) {
+            for (uint32_t e = usableStart[r]; e < usableStart[r + 1]; ++e) {
+                uint32_t slot = cursor[world.edgeTarget[edgeIds[e]]]++;
+                reverseSource[slot] = r;
+                reverseEdge[slot] = edgeIds[e];
+            }
+        }
+
+        if (rooms <= TABLE_ROOM_LIMIT) {
+            buildNextHopTable();
+        } else {
+            buildClusters();
+        }
+
+        names.reserve(rooms);
+        for (RoomId r = 0; r < rooms; ++r) {
+            names.push_back(std::make_pair(hashRoomName(world.text + world.roomName[r].offset, world.roomName[r].length()), r));
+        }
+        std::sort(names.begin(), names.end());
+    }
+
+    // Finds a room by its name, ignoring case and color; returns NO_ROOM if there is none
+    RoomId findRoom(const char* name, size_t size) const {
+        std::pair<uint64_t, RoomId> key(hashRoomName(name, size), 0);
+        std::string plain;
+        for (std::vector<std::pair<uint64_t, RoomId> >::const_iterator it = std::lower_bound(names.begin(), names.end(), key);
+             it != names.end() && it->first == key.first; ++it) {
+            // Rule out hash collisions by comparing the names themselves
+            stripAnsiInto(world.textString(world.roomName[it->second]), plain);
+            if (plain.size() == size) {
+                size_t i = 0;
+                while (i < size && std::tolower(static_cast<unsigned char>(plain[i])) == std::tolower(static_cast<unsigned char>(name[i]))) {
+                    ++i;
+                }
+                if (i == size) {
+                    return it->second;
+                }
+            }
+        }
+        return NO_ROOM;
+    }
+
+    // Fills `route` with the directions of a fewest-moves route; false if there is none
+    bool findRoute(RoomId from, RoomId to, std::vector<uint8_t>& route) const {
+        route.clear();
+        if (from == to) {
+            return true;
+        }
+        if (world.roomLocked[to] != 0) {
+            return false;
+        }
+        if (nextHop.empty()) {
+            return clusterRoute(from, to, route);
+        }
+        uint32_t rooms = world.roomCount();
+        for (RoomId room = from; room != to; ) {
+            uint8_t hop = nextHop[static_cast<size_t>(room) * rooms + to];
+            if (hop == NO_HOP || route.size() >= rooms) {
+                return false;  // No route, or a table that does not lead to the room
+            }
+            uint32_t edge = world.edgeStart[room] + hop;
+            route.push_back(world.edgeDirection[edge]);
+            room = world.edgeTarget[edge];
+        }
+        return true;
+    }
+
+    // Whether the index is a next-hop table (rather than clusters)
+    bool usesTable() const { return !nextHop.empty(); }
+
+    // Bytes held by the index
+    size_t memoryBytes() const {
+        size_t bytes = nextHop.capacity();
+        bytes += (edgeIds.capacity() + reverseEdge.capacity() + usableStart.capacity() + reverseStart.capacity()
+                  + cluster.capacity() + clusterParent.capacity() + clusterDepth.capacity()) * sizeof(uint32_t);
+        bytes += (clusterExit.capacity() + clusterEntry.capacity()) * sizeof(RoomId);
+        bytes += reverseSource.capacity() * sizeof(RoomId) + names.capacity() * sizeof(names[0]);
+        return bytes;
+    }
+};
+
+const uint32_t RoutePlanner::TABLE_ROOM_LIMIT;
+const uint32_t RoutePlanner::NO_CLUSTER;
+const uint32_t RoutePlanner::UNREACHABLE;
+const uint8_t RoutePlanner::NO_HOP;
+
+// Runs work(0) .. work(workers - 1), each on a thread of its own when there is more than one
+template <typename Work>
+void runOnWorkers(unsigned workers, Work work) {
+    if (workers <= 1) {
+        work(0u);
+        return;
+    }
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < workers; ++t) {
+        threads.push_back(std::thread(work, t));
+    }
+    for (size_t t = 0; t < threads.size(); ++t) {
+        threads[t].join();
+    }
+}
+
+const size_t SEARCH_WORD_LIMIT = 24;  // Longer words are indexed by their first 24 characters
+
+// Words too common to be worth indexing
+bool isSearchStopWord(const char* word, size_t length) {
+    static const char* const stopWords[] = {
+        "an", "and", "are", "as", "at", "be", "but", "by", "for", "from", "in", "into", "is", "it",
+        "its", "of", "on", "or", "that", "the", "this", "to", "with", "you", "your"
+    };
+    for (size_t i = 0; i < sizeof(stopWords) / sizeof(stopWords[0]); ++i) {
+        if (std::strlen(stopWords[i]) == length && std::memcmp(stopWords[i], word, length) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Calls emit(word, length) for each word of a text as the search index sees it: ANSI
+// escape sequences are skipped, letters and digits are lowercased and everything else
+// separates words. A plural "s" is dropped, so "footprint" finds "footprints", and
+// single letters and stop words are left out (single digits are kept for room numbers).
+template <typename Emit>
+void scanSearchWords(const char* text, size_t size, Emit emit) {
+    char word[SEARCH_WORD_LIMIT];
+    size_t i = 0;
+    while (i < size) {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        if (c == '\033' && i + 1 < size && text[i + 1] == '[') {
+            i += 2;
+            while (i < size && !(text[i] >= '@' && text[i] <= '~')) {
+                ++i;
+            }
+            ++i;
+            continue;
+        }
+        if (c >= 0x80 || !std::isalnum(c)) {
+            ++i;
+            continue;
+        }
+        size_t length = 0, full = 0;
+        while (i < size && static_cast<unsigned char>(text[i]) < 0x80 && std::isalnum(static_cast<unsigned char>(text[i]))) {
+            if (length < SEARCH_WORD_LIMIT) {
+                word[length++] = static_cast<char>(std::tolower(static_cast<unsigned char>(text[i])));
+            }
+            ++full;
+            ++i;
+        }
+        if (full == length && length >= 4 && word[length - 1] == 's' && std::strchr("isu", word[length - 2]) == nullptr) {
+            --length;
+        }
+        if ((length >= 2 || std::isdigit(static_cast<unsigned char>(word[0]))) && !isSearchStopWord(word, length)) {
+            emit(word, length);
+        }
+    }
+}
+
+// Full-text index over what the world says, for the search and hint commands.
+// Documents are rooms (name and descriptions) followed by NPCs (what they say):
+// document `room` is a room and document roomCount + npc is an NPC.
+//
+// Terms are kept sorted in one string and found by binary search. A term's
+// postings (document, count) are delta-encoded as variable-length integers in
+// blocks of 64; a skip entry per block records its last document and what bounds
+// the score of a posting in it, so a query jumps over blocks that cannot hold a
+// match or cannot beat the results it already has (block-max pruning). Terms in
+// at least one document in 16 also get a bitset of their documents: a query made
+// of such words intersects the bitsets a word at a time instead of walking postings.
+//
+// The build splits the documents across threads. Generated worlds repeat a few
+// descriptions across many rooms, so each thread tokenizes a shared text once.
+// The threads' vocabularies are merged in order, then terms are encoded in parallel.
+class TextIndex {
+public:
+    // A document that matched a query, and its BM25 score
+    struct Hit {
+        uint32_t document;
+        float score;
+    };
+
+private:
+    static const uint32_t BLOCK_POSTINGS = 64;   // Postings per skip block
+    static const uint32_t NAME_WEIGHT = 3;       // A word of a room's name counts this many times
+    static const uint32_t SHARD_DOCUMENTS = 4096; // Fewest documents worth a build thread
+    static const uint32_t DENSE_FRACTION = 16;   // Terms in this share of documents or more get a bitset
+    static const uint32_t DENSE_MINIMUM = 1024;  // ... if they are in at least this many
+    static const uint32_t NO_TERM = 0xFFFFFFFFu;
+
+    // One block of a term's postings
+    struct PostingBlock {
+        uint32_t lastDocument;  // Document of the block's last posting
+        uint32_t offset;        // Offset of the block's first posting from the term's first
+        float maxWeight;        // Highest term weight (before idf) of a posting in the block
+        float minNorm;          // Lowest length normalisation of a document in the block
+    };
+
+    // Occurrences of a term in a document while building
+    struct TermCount {
+        uint32_t term;
+        uint32_t count;
+        bool operator<(const TermCount& other) const { return term < other.term; }
+    };
+
+    // What one build thread gathers from its range of documents
+    struct BuildShard {
+        uint32_t first, last;                   // Documents [first, last)
+        std::vector<std::string> terms;         // Local vocabulary, by local term id
+        std::vector<uint32_t> termStart;        // Offset of each local term's first posting
+        std::vector<uint32_t> documents;        // Postings grouped by local term, documents ascending
+        std::vector<uint8_t> counts;            // Occurrences for each posting, at most 255
+        std::vector<uint32_t> lengths;          // Words in each document
+        std::vector<uint32_t> order;            // Local term ids sorted by spelling
+        std::vector<uint32_t> localOf;          // Local id of each global term, or NO_TERM
+    };
+
+    const World& world;
+    std::string termText;                 // Every term, in sorted order
+    std::vector<uint32_t> termStart;      // Offset of each term in termText, plus one final entry
+    std::vector<uint32_t> frequency;      // Documents containing each term
+    std::vector<float> termMaxWeight;     // Highest weight of each term in any document
+    std::vector<uint8_t> termMaxCount;    // Most occurrences of each term in one document
+    std::vector<uint32_t> denseStart;     // First word of each term's document bitset, or NO_TERM
+    std::vector<uint64_t> denseBits;
+    std::vector<uint64_t> postingStart;   // Offset of each term's postings, plus one final entry
+    std::vector<uint32_t> blockStart;     // Index of each term's first block, plus one final entry
+    std::vector<PostingBlock> blocks;
+    std::vector<uint8_t> postings;
+    std::vector<float> lengthNorm;        // BM25 length normalisation of each document
+    std::vector<RoomId> npcRoom;          // Room each NPC stands in, or NO_ROOM for wandering actors
+    uint64_t wordTotal;
+
+    // Where a query is in one term's postings
+    struct Cursor {
+        uint32_t term;
+        const uint8_t* data;            // The term's first posting
+        const uint8_t* next;            // Next posting to decode
+        const PostingBlock* firstBlock;
+        const PostingBlock* block;      // Block holding the current posting
+        const PostingBlock* blockEnd;
+        const PostingBlock* loaded;     // Block `next` points into, or nullptr before the first
+        const uint64_t* bits;           // Bitset of the term's documents, or nullptr
+        uint32_t document;              // Current posting
+        uint32_t count;
+        float idf;
+    };
+
+    static float bm25(uint32_t count, float norm) {
+        return count * 2.2f / (count + norm);  // k1 = 1.2, with b = 0.75 folded into norm
+    }
+
+    // Reads a variable-length integer
+    static uint32_t readVarint(const uint8_t*& p) {
+        uint32_t value = *p & 0x7F;
+        for (unsigned shift = 7; *p++ & 0x80; shift += 7) {
+            value |= static_cast<uint32_t>(*p & 0x7F) << shift;
+        }
+        return value;
+    }
+
+    static void writeVarint(std::vector<uint8_t>& out, uint32_t value) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(value));
+    }
+
+    // Text of a document: a room's name, then its detail and any description the
+    // detail does not already contain; an NPC's dialogue
+    void documentTexts(uint32_t document, TextRef& name, TextRef& body, TextRef& extra) const {
+        TextRef none = { 0, 0 };
+        name = body = extra = none;
+        if (document >= world.roomTotal) {
+            body = world.npcDialogue[document - world.roomTotal];
+            return;
+        }
+        name = world.roomName[document];
+        body = world.roomDetail[document];
+        TextRef description = world.roomDescription[document];
+        if (description.offset < body.offset || description.offset + description.length() > body.offset + body.length()) {
+            extra = description;
+        }
+    }
+
+    // Local term id of a word, added to the shard's vocabulary if new
+    static uint32_t localTerm(BuildShard& shard, std::map<std::string, uint32_t>& ids, std::string& word) {
+        std::map<std::string, uint32_t>::iterator it = ids.lower_bound(word);
+        if (it != ids.end() && it->first == word) {
+            return it->second;
+        }
+        uint32_t id = static_cast<uint32_t>(shard.terms.size());
+        ids.insert(it, std::make_pair(word, id));
+        shard.terms.push_back(word);
+        return id;
+    }
+
+    // Tokenizes a shard's documents and groups its postings by local term
+    void scanShard(BuildShard& shard) const {
+        std::map<std::string, uint32_t> ids;
+        std::map<std::pair<uint64_t, uint64_t>, uint32_t> cached;  // (body, extra) -> index into bodies
+        std::vector<std::vector<TermCount> > bodies;                // Term counts of each distinct body
+        std::vector<TermCount> found, doc;
+        std::vector<uint32_t> docStart(1, 0);                       // Offset of each document's term counts
+        std::vector<TermCount> all;
+        std::string word;
+
+        for (uint32_t d = shard.first; d < shard.last; ++d) {
+            TextRef name, body, extra;
+            documentTexts(d, name, body, extra);
+            std::pair<uint64_t, uint64_t> key(static_cast<uint64_t>(body.offset) << 32 | body.length(),
+                                              static_cast<uint64_t>(extra.offset) << 32 | extra.length());
+            std::map<std::pair<uint64_t, uint64_t>, uint32_t>::iterator hit = cached.lower_bound(key);
+            if (hit == cached.end() || hit->first != key) {
+                found.clear();
+                TextRef parts[2] = { body, extra };
+                for (int p = 0; p < 2; ++p) {
+                    scanSearchWords(world.text + parts[p].offset, parts[p].length(), [&](const char* w, size_t n) {
+                        word.assign(w, n);
+                        TermCount entry = { localTerm(shard, ids, word), 1 };
+                        found.push_back(entry);
+                    });
+                }
+                std::sort(found.begin(), found.end());
+                std::vector<TermCount> counts;
+                for (size_t i = 0; i < found.size(); ++i) {
+                    if (!counts.empty() && counts.back().term == found[i].term) {
+                        counts.back().count++;
+                    } else {
+                        counts.push_back(found[i]);
+                    }
+                }
+                hit = cached.insert(hit, std::make_pair(key, static_cast<uint32_t>(bodies.size())));
+                bodies.push_back(counts);
+            }
+
+            // Words of the name count extra, so a room is the best match for its own name
+            doc = bodies[hit->second];
+            scanSearchWords(world.text + name.offset, name.length(), [&](const char* w, size_t n) {
+                word.assign(w, n);
+                TermCount entry = { localTerm(shard, ids, word), NAME_WEIGHT };
+                std::vector<TermCount>::iterator at = std::lower_bound(doc.begin(), doc.end(), entry);
+                if (at != doc.end() && at->term == entry.term) {
+                    at->count += NAME_WEIGHT;
+                } else {
+                    doc.insert(at, entry);
+                }
+            });
+            uint32_t length = 0;
+            for (size_t i = 0; i < doc.size(); ++i) {
+                length += doc[i].count;
+            }
+            shard.lengths.push_back(length);
+            all.insert(all.end(), doc.begin(), doc.end());
+            docStart.push_back(static_cast<uint32_t>(all.size()));
+        }
+
+        // Counting sort by term; documents stay in ascending order within each term
+        uint32_t terms = static_cast<uint32_t>(shard.terms.size());
+        shard.termStart.assign(terms + 1, 0);
+        for (size_t i = 0; i < all.size(); ++i) {
+            shard.termStart[all[i].term + 1]++;
+        }
+        for (uint32_t t = 0; t < terms; ++t) {
+            shard.termStart[t + 1] += shard.termStart[t];
+        }
+        std::vector<uint32_t> fill(shard.termStart.begin(), shard.termStart.end() - 1);
+        shard.documents.resize(all.size());
+        shard.counts.resize(all.size());
+        for (uint32_t d = shard.first; d < shard.last; ++d) {
+            uint32_t local = d - shard.first;
+            for (uint32_t i = docStart[local]; i < docStart[local + 1]; ++i) {
+                uint32_t at = fill[all[i].term]++;
+                shard.documents[at] = d;
+                shard.counts[at] = static_cast<uint8_t>(std::min<uint32_t>(all[i].count, 255));
+            }
+        }
+
+        // The vocabulary map already holds the terms in order
+        shard.order.reserve(terms);
+        for (std::map<std::string, uint32_t>::const_iterator it = ids.begin(); it != ids.end(); ++it) {
+            shard.order.push_back(it->second);
+        }
+    }
+
+    // Encodes the postings of global terms [first, last) into `bytes` and `out`, with offsets relative to their start
+    void encodeTerms(const std::vector<BuildShard>& shards, uint32_t first, uint32_t last,
+                     std::vector<uint8_t>& bytes, std::vector<PostingBlock>& out) {
+        for (uint32_t t = first; t < last; ++t) {
+            postingStart[t] = bytes.size();
+            blockStart[t] = static_cast<uint32_t>(out.size());
+            uint64_t termBegin = bytes.size();
+            uint32_t previous = 0, inBlock = 0, mostCount = 0;
+            float best = 0;
+            PostingBlock block = { 0, 0, 0, 0 };
+            uint64_t* bits = denseStart[t] != NO_TERM ? &denseBits[denseStart[t]] : nullptr;
+            for (size_t s = 0; s < shards.size(); ++s) {
+                const BuildShard& shard = shards[s];
+                uint32_t local = shard.localOf[t];
+                if (local == NO_TERM) {
+                    continue;
+                }
+                for (uint32_t i = shard.termStart[local]; i < shard.termStart[local + 1]; ++i) {
+                    uint32_t doc = shard.documents[i];
+                    if (inBlock == 0) {
+                        block.offset = static_cast<uint32_t>(bytes.size() - termBegin);
+                        block.maxWeight = 0;
+                        block.minNorm = lengthNorm[doc];
+                    }
+                    writeVarint(bytes, doc - previous);
+                    bytes.push_back(shard.counts[i]);
+                    previous = doc;
+                    block.maxWeight = std::max(block.maxWeight, bm25(shard.counts[i], lengthNorm[doc]));
+                    block.minNorm = std::min(block.minNorm, lengthNorm[doc]);
+                    mostCount = std::max<uint32_t>(mostCount, shard.counts[i]);
+                    if (bits != nullptr) {
+                        bits[doc >> 6] |= 1ull << (doc & 63);
+                    }
+                    if (++inBlock == BLOCK_POSTINGS) {
+                        block.lastDocument = doc;
+                        out.push_back(block);
+                        best = std::max(best, block.maxWeight);
+                        inBlock = 0;
+                    }
+                }
+            }
+            if (inBlock > 0) {
+                block.lastDocument = previous;
+                out.push_back(block);
+                best = std::max(best, block.maxWeight);
+            }
+            termMaxWeight[t] = best;
+            termMaxCount[t] = static_cast<uint8_t>(mostCount);
+        }
+    }
+
+    // Finds a term, or returns NO_TERM
+    uint32_t findTerm(const char* word, size_t length) const {
+        uint32_t low = 0, high = static_cast<uint32_t>(frequency.size());
+        while (low < high) {
+            uint32_t mid = low + (high - low) / 2;
+            size_t size = termStart[mid + 1] - termStart[mid];
+            int order = std::memcmp(&termText[termStart[mid]], word, std::min(size, length));
+            if (order < 0 || (order == 0 && size < length)) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        if (low < frequency.size() && termStart[low + 1] - termStart[low] == length
+            && std::memcmp(&termText[termStart[low]], word, length) == 0) {
+            return low;
+        }
+        return NO_TERM;
+    }
+
+    void openCursor(uint32_t term, Cursor& cursor) const {
+        cursor.term = term;
+        cursor.data = &postings[0] + postingStart[term];
+        cursor.firstBlock = cursor.block = &blocks[0] + blockStart[term];
+        cursor.blockEnd = &blocks[0] + blockStart[term + 1];
+        cursor.loaded = nullptr;
+        cursor.bits = denseStart[term] != NO_TERM ? &denseBits[denseStart[term]] : nullptr;
+        cursor.document = 0;
+        cursor.count = 0;
+        double documents = static_cast<double>(lengthNorm.size());
+        cursor.idf = static_cast<float>(std::log(1.0 + (documents - frequency[term] + 0.5) / (frequency[term] + 0.5)));
+    }
+
+    // Moves a cursor to the block that would hold `target` without decoding anything.
+    // Returns false if every posting is before `target`.
+    static bool seekBlock(Cursor& cursor, uint32_t target) {
+        while (cursor.block != cursor.blockEnd && cursor.block->lastDocument < target) {
+            ++cursor.block;
+        }
+        return cursor.block != cursor.blockEnd;
+    }
+
+    // Moves a cursor to its first posting for a document at or after `target`.
+    // Whole blocks that end before `target` are skipped without being decoded.
+    static bool advance(Cursor& cursor, uint32_t target) {
+        if (cursor.loaded != nullptr && cursor.document >= target) {
+            return true;
+        }
+        if (!seekBlock(cursor, target)) {
+            return false;
+        }
+        if (cursor.loaded != cursor.block) {
+            cursor.loaded = cursor.block;
+            cursor.next = cursor.data + cursor.block->offset;
+            cursor.document = cursor.block == cursor.firstBlock ? 0 : (cursor.block - 1)->lastDocument;
+        }
+        // The block's last document is at or after `target`, so this stops inside the block
+        do {
+            cursor.document += readVarint(cursor.next);
+            cursor.count = *cursor.next++;
+        } while (cursor.document < target);
+        return true;
+    }
+
+public:
+    TextIndex(const World& world, unsigned threads) : world(world), wordTotal(0) {
+        uint32_t documents = world.roomTotal + world.npcTotal;
+        unsigned workers = std::max(1u, std::min<unsigned>(threads, documents / SHARD_DOCUMENTS));
+
+        // Each worker tokenizes a contiguous range of documents
+        std::vector<BuildShard> shards(workers);
+        runOnWorkers(workers, [this, &shards, documents, workers](unsigned t) {
+            shards[t].first = static_cast<uint32_t>(static_cast<uint64_t>(documents) * t / workers);
+            shards[t].last = static_cast<uint32_t>(static_cast<uint64_t>(documents) * (t + 1) / workers);
+            scanShard(shards[t]);
+        });
+
+        lengthNorm.resize(documents);
+        for (size_t s = 0; s < shards.size(); ++s) {
+            for (size_t i = 0; i < shards[s].lengths.size(); ++i) {
+                wordTotal += shards[s].lengths[i];
+            }
+        }
+        double averageLength = documents > 0 ? std::max(1.0, static_cast<double>(wordTotal) / documents) : 1.0;
+        for (size_t s = 0; s < shards.size(); ++s) {
+            for (size_t i = 0; i < shards[s].lengths.size(); ++i) {
+                lengthNorm[shards[s].first + i] = static_cast<float>(1.2 * (0.25 + 0.75 * shards[s].lengths[i] / averageLength));
+            }
+        }
+
+        // Merge the sorted vocabularies into the global term list
+        std::vector<size_t> head(workers, 0);
+        for (size_t s = 0; s < shards.size(); ++s) {
+            shards[s].localOf.reserve(shards[s].terms.size());
+        }
+        termStart.push_back(0);
+        while (true) {
+            const std::string* smallest = nullptr;
+            for (size_t s = 0; s < shards.size(); ++s) {
+                if (head[s] < shards[s].order.size()) {
+                    const std::string& term = shards[s].terms[shards[s].order[head[s]]];
+                    if (smallest == nullptr || term < *smallest) {
+                        smallest = &term;
+                    }
+                }
+            }
+            if (smallest == nullptr) {
+                break;
+            }
+            uint32_t df = 0;
+            std::string term = *smallest;
+            termText += term;
+            termStart.push_back(static_cast<uint32_t>(termText.size()));
+            for (size_t s = 0; s < shards.size(); ++s) {
+                BuildShard& shard = shards[s];
+                uint32_t local = head[s] < shard.order.size() ? shard.order[head[s]] : NO_TERM;
+                if (local != NO_TERM && shard.terms[local] == term) {
+                    shard.localOf.push_back(local);
+                    df += shard.termStart[local + 1] - shard.termStart[local];
+                    ++head[s];
+                } else {
+                    shard.localOf.push_back(NO_TERM);
+                }
+            }
+            frequency.push_back(df);
+        }
+        for (size_t s = 0; s < shards.size(); ++s) {
+            std::vector<std::string>().swap(shards[s].terms);
+        }
+
+        // Encode terms in parallel, each worker taking a run of terms with about the same number of postings
+        uint32_t terms = static_cast<uint32_t>(frequency.size());
+        postingStart.resize(terms + 1);
+        blockStart.resize(terms + 1);
+        termMaxWeight.resize(terms);
+        termMaxCount.resize(terms);
+        denseStart.assign(terms, NO_TERM);
+        uint64_t totalPostings = 0, denseWords = 0;
+        for (uint32_t t = 0; t < terms; ++t) {
+            totalPostings += frequency[t];
+            if (frequency[t] >= DENSE_MINIMUM && frequency[t] >= documents / DENSE_FRACTION) {
+                denseStart[t] = static_cast<uint32_t>(denseWords);
+                denseWords += (documents + 63) / 64;
+            }
+        }
+        denseBits.assign(denseWords, 0);
+        std::vector<uint32_t> split(workers + 1, terms);
+        split[0] = 0;
+        uint64_t seen = 0;
+        for (uint32_t t = 0, w = 1; t < terms && w < workers; ++t) {
+            seen += frequency[t];
+            while (w < workers && seen >= totalPostings * w / workers) {
+                split[w++] = t + 1;
+            }
+        }
+        std::vector<std::vector<uint8_t> > bytes(workers);
+        std::vector<std::vector<PostingBlock> > encoded(workers);
+        runOnWorkers(workers, [this, &shards, &split, &bytes, &encoded](unsigned w) {
+            encodeTerms(shards, split[w], split[w + 1], bytes[w], encoded[w]);
+        });
+        shards.clear();
+
+        // Join the workers' output, moving their offsets to where it lands
+        uint64_t byteBase = 0;
+        uint32_t blockBase = 0;
+        for (unsigned w = 0; w < workers; ++w) {
+            for (uint32_t t = split[w]; t < split[w + 1]; ++t) {
+                postingStart[t] += byteBase;
+                blockStart[t] += blockBase;
+            }
+            byteBase += bytes[w].size();
+            blockBase += static_cast<uint32_t>(encoded[w].size());
+        }
+        postingStart[terms] = byteBase;
+        blockStart[terms] = blockBase;
+        postings.reserve(byteBase + 1);
+        blocks.reserve(blockBase);
+        for (unsigned w = 0; w < workers; ++w) {
+            postings.insert(postings.end(), bytes[w].begin(), bytes[w].end());
+            blocks.insert(blocks.end(), encoded[w].begin(), encoded[w].end());
+            std::vector<uint8_t>().swap(bytes[w]);
+        }
+        postings.push_back(0);  // Keeps &postings[0] valid in an empty index
+
+        npcRoom.assign(world.npcTotal, NO_ROOM);
+        for (RoomId room = 0; room < world.roomTotal; ++room) {
+            if (world.roomNpc[room] != NO_NPC_ID) {
+                npcRoom[world.roomNpc[room]] = room;
+            }
+        }
+    }
+
+    // Best score a document in a block of the lead cursor could reach: the block's best
+    // weight for the lead term, and the other terms at their most frequent in the block's shortest document
+    float blockBound(const Cursor* cursors, size_t terms, const PostingBlock& block) const {
+        float bound = cursors[0].idf * block.maxWeight;
+        for (size_t i = 1; i < terms; ++i) {
+            bound += cursors[i].idf * bm25(termMaxCount[cursors[i].term], block.minNorm);
+        }
+        return bound;
+    }
+
+    // Finds the documents containing every word of a query and writes the best `limit`
+    // of them that `accept(document)` allows to `hits`, best first. Returns how many were
+    // found. Words the index does not know are added to `missing`; then nothing matches.
+    template <typename Accept>
+    size_t search(const char* query, size_t size, size_t limit, Accept accept, Hit* hits, std::vector<std::string>* missing) const {
+        Cursor cursors[8];
+        size_t terms = 0;
+        bool unknown = false;
+        scanSearchWords(query, size, [&](const char* word, size_t length) {
+            uint32_t term = findTerm(word, length);
+            if (term == NO_TERM) {
+                unknown = true;
+                if (missing != nullptr) {
+                    missing->push_back(std::string(word, length));
+                }
+                return;
+            }
+            for (size_t i = 0; i < terms; ++i) {
+                if (cursors[i].term == term) {
+                    return;  // Repeated word
+                }
+            }
+            if (terms < sizeof(cursors) / sizeof(cursors[0])) {
+                openCursor(term, cursors[terms++]);
+            }
+        });
+        if (unknown || terms == 0 || limit == 0) {
+            return 0;
+        }
+
+        // The rarest term leads; the others are probed at its documents
+        for (size_t i = 1; i < terms; ++i) {
+            for (size_t j = i; j > 0 && frequency[cursors[j].term] < frequency[cursors[j - 1].term]; --j) {
+                std::swap(cursors[j], cursors[j - 1]);
+            }
+        }
+        // No document scores more than every term at its best
+        float bound = 0;
+        for (size_t i = 0; i < terms; ++i) {
+            bound += cursors[i].idf * termMaxWeight[cursors[i].term];
+        }
+
+        // hits[0, found) is a heap with the weakest hit on top once it is full
+        struct Weaker {
+            bool operator()(const Hit& a, const Hit& b) const {
+                return a.score > b.score || (a.score == b.score && a.document < b.document);
+            }
+        };
+        size_t found = 0;
+        Cursor& lead = cursors[0];
+        uint32_t documents = documentCount();
+        uint32_t target = 0;
+        while (target < documents) {
+            bool full = found == limit;
+            float threshold = full ? hits[0].score : 0;
+            if (full && bound <= threshold) {
+                break;  // Nothing left can beat the hits so far
+            }
+            if (lead.bits != nullptr) {
+                // Every term has a bitset (the lead is the rarest): find the next document in all of them
+                size_t word = target >> 6;
+                uint64_t both = ~0ull << (target & 63);
+                for (size_t i = 0; i < terms; ++i) {
+                    both &= cursors[i].bits[word];
+                }
+                while (both == 0 && ++word < (documents + 63) / 64) {
+                    both = ~0ull;
+                    for (size_t i = 0; i < terms && both != 0; ++i) {
+                        both &= cursors[i].bits[word];
+                    }
+                }
+                if (both == 0) {
+                    break;
+                }
+                target = static_cast<uint32_t>(word * 64 + __builtin_ctzll(both));
+            }
+            if (!seekBlock(lead, target)) {
+                break;
+            }
+            if (full && blockBound(cursors, terms, *lead.block) <= threshold) {
+                target = lead.block->lastDocument + 1;  // Nothing in this block can beat the hits so far
+                continue;
+            }
+            advance(lead, target);
+            uint32_t document = lead.document;
+            target = document + 1;
+            float norm = lengthNorm[document];
+            float score = lead.idf * bm25(lead.count, norm);
+            float best = score;
+            bool all = true;
+            for (size_t i = 1; i < terms && all; ++i) {
+                all = cursors[i].bits == nullptr || (cursors[i].bits[document >> 6] >> (document & 63) & 1) != 0;
+                best += cursors[i].idf * bm25(termMaxCount[cursors[i].term], norm);
+            }
+            if (!all || (full && best <= threshold)) {
+                continue;
+            }
+            for (size_t i = 1; i < terms && all; ++i) {
+                if (!advance(cursors[i], document)) {
+                    target = documents;
+                    all = false;
+                } else if (cursors[i].document != document) {
+                    target = cursors[i].document;  // Leapfrog to where the next match could be
+                    all = false;
+                } else {
+                    score += cursors[i].idf * bm25(cursors[i].count, norm);
+                }
+            }
+            if (!all || (full && score <= threshold) || !accept(document)) {
+                continue;
+            }
+            Hit hit = { document, score };
+            if (full) {
+                std::pop_heap(hits, hits + found, Weaker());
+                hits[found - 1] = hit;
+            } else {
+                hits[found++] = hit;
+            }
+            std::push_heap(hits, hits + found, Weaker());
+        }
+        std::sort_heap(hits, hits + found, Weaker());
+        return found;
+    }
+
+    // Number of documents: every room, then every NPC
+    uint32_t documentCount() const { return static_cast<uint32_t>(lengthNorm.size()); }
+
+    // Whether a document is what an NPC says rather than a room
+    bool isDialogue(uint32_t document) const { return document >= world.roomTotal; }
+
+    // NPC of a dialogue document
+    NpcId documentNpc(uint32_t document) const { return document - world.roomTotal; }
+
+    // Room a document belongs to: the room itself, or where the NPC stands (NO_ROOM for wandering actors)
+    RoomId documentRoom(uint32_t document) const {
+        return isDialogue(document) ? npcRoom[documentNpc(document)] : document;
+    }
+
+    // Visible text of a document, without color codes
+    std::string documentText(uint32_t document) const {
+        TextRef name, body, extra;
+        documentTexts(document, name, body, extra);
+        std::string text = stripAnsi(world.textString(body));
+        if (extra.length() > 0) {
+            text += "\n" + stripAnsi(world.textString(extra));
+        }
+        return text;
+    }
+
+    uint32_t termCount() const { return static_cast<uint32_t>(frequency.size()); }
+    uint64_t wordCount() const { return wordTotal; }
+    size_t postingBytes() const { return postings.size(); }
+
+    // Bytes held by the index
+    size_t memoryBytes() const {
+        return termText.capacity() + postings.capacity() + blocks.capacity() * sizeof(PostingBlock)
+               + (termStart.capacity() + frequency.capacity() + blockStart.capacity() + npcRoom.capacity() + denseStart.capacity()) * sizeof(uint32_t)
+               + (termMaxWeight.capacity() + lengthNorm.capacity()) * sizeof(float) + termMaxCount.capacity()
+               + (postingStart.capacity() + denseBits.capacity()) * sizeof(uint64_t);
+    }
+};
+
+const uint32_t TextIndex::BLOCK_POSTINGS;
+const uint32_t TextIndex::NAME_WEIGHT;
+const uint32_t TextIndex::SHARD_DOCUMENTS;
+const uint32_t TextIndex::DENSE_FRACTION;
+const uint32_t TextIndex::DENSE_MINIMUM;
+const uint32_t TextIndex::NO_TERM;
+
+// Stream buffer that collects everything written to it in a reusable string
+class FrameBuffer : public std::streambuf {
+private:
+    std::string frame;  // Output of the current turn; keeps its capacity between turns
+
+protected:
+    int overflow(int c) override {
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            frame += traits_type::to_char_type(c);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+        frame.append(s, static_cast<size_t>(n));
+        return n;
+    }
+
+public:
+    const std::string& contents() const { return frame; }
+    void clear() { frame.clear(); }
+};
+
+// Collects one turn of game output and emits it with a single write() call.
+// In plain-text mode (NO_COLOR or --plain) the GameColors escape codes are stripped first.
+// A negative file descriptor renders frames without writing them anywhere (headless runs).
+class Renderer {
+private:
+    FrameBuffer buffer;      // Output collected for the current frame
+    std::ostream stream;     // Stream the game writes into
+    std::string plainFrame;  // Reusable scratch buffer for plain-text frames
+    int fd;                  // Destination file descriptor, or -1 to discard output
+    bool plainText;          // Whether to strip ANSI escape codes
+
+public:
+    uint64_t frames;         // Number of non-empty frames emitted
+    uint64_t bytes;          // Total bytes emitted
+    uint64_t syscalls;       // Total write() calls made
+
+    Renderer(int outputFd, bool plain)
+        : stream(&buffer), fd(outputFd), plainText(plain), frames(0), bytes(0), syscalls(0) {}
+
+    // Stream that the current frame is written into
+    std::ostream& out() { return stream; }
+
+    // Completes the current frame and returns the bytes to emit (color stripped in
+    // plain-text mode). The frame stays valid until discardFrame() is called.
+    const std::string& finishFrame() {
+        const std::string* frame = &buffer.contents();
+        if (plainText) {
+            stripAnsiInto(*frame, plainFrame);
+            frame = &plainFrame;
+        }
+        if (!frame->empty()) {
+            frames++;
+            bytes += frame->size();
+        }
+        return *frame;
+    }
+
+    // Starts a new, empty frame
+    void discardFrame() {
+        buffer.clear();
+    }
+
+    // Emits the collected frame and starts a new one
+    void flush() {
+        const std::string& frame = finishFrame();
+        if (fd >= 0) {
+            // write() may accept only part of the frame, so keep going until it is all out
+            const char* data = frame.data();
+            size_t remaining = frame.size();
+            while (remaining > 0) {
+                ssize_t written = ::write(fd, data, remaining);
+                syscalls++;
+                if (written < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    break;
+                }
+                data += written;
+                remaining -= static_cast<size_t>(written);
+            }
+        }
+        discardFrame();
+    }
+};
+
+// Input stream buffer that reads a file descriptor ahead on a background thread, so
+// the game never waits on a read() for input that has already arrived, and a piped
+// session keeps the pipe drained while turns are being played. Reading stops once
+// READ_AHEAD_LIMIT bytes are queued and resumes as the game catches up. If the pipe
+// that stops the thread cannot be created, there is no thread and reads go straight
+// to the descriptor instead.
+class ReadAheadBuffer : public std::streambuf {
+private:
+    static const size_t CHUNK_SIZE = 65536;
+    static const size_t READ_AHEAD_LIMIT = 4 << 20;
+
+    int fd;
+    int wake[2];                    // Pipe that tells the reader thread to stop
+    std::mutex lock;
+    std::condition_variable changed;
+    std::deque<std::string> chunks; // Data read but not yet handed to the game
+    size_t queuedBytes;
+    bool finished;                  // The reader hit end of input or an error
+    bool stopping;                  // The buffer is being destroyed
+    std::string current;            // Chunk the game is reading from
+    std::thread reader;
+
+    void readLoop() {
+        std::vector<char> chunk(CHUNK_SIZE);
+        while (true) {
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                changed.wait(guard, [this] { return stopping || queuedBytes < READ_AHEAD_LIMIT; });
+                if (stopping) {
+                    return;
+                }
+            }
+            struct pollfd fds[2] = { { fd, POLLIN, 0 }, { wake[0], POLLIN, 0 } };
+            if (::poll(fds, 2, -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+            if (fds[1].revents != 0) {
+                return;
+            }
+            ssize_t received = ::read(fd, &chunk[0], chunk.size());
+            if (received < 0 && (errno == EINTR || errno == EAGAIN)) {
+                continue;
+            }
+            if (received <= 0) {
+                break;
+            }
+            std::lock_guard<std::mutex> guard(lock);
+            chunks.push_back(std::string(&chunk[0], static_cast<size_t>(received)));
+            queuedBytes += static_cast<size_t>(received);
+            changed.notify_all();
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        finished = true;
+        changed.notify_all();
+    }
+
+protected:
+    int underflow() override {
+        if (gptr() < egptr()) {
+            return traits_type::to_int_type(*gptr());
+        }
+        if (!reader.joinable()) {
+            current.resize(CHUNK_SIZE);
+            ssize_t received;
+            do {
+                received = ::read(fd, &current[0], current.size());
+            } while (received < 0 && errno == EINTR);
+            if (received <= 0) {
+                return traits_type::eof();
+            }
+            setg(&current[0], &current[0], &current[0] + received);
+            return traits_type::to_int_type(*gptr());
+        }
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait(guard, [this] { return finished || !chunks.empty(); });
+        if (chunks.empty()) {
+            return traits_type::eof();
+        }
+        current.swap(chunks.front());
+        chunks.pop_front();
+        queuedBytes -= current.size();
+        changed.notify_all();
+        setg(&current[0], &current[0], &current[0] + current.size());
+        return traits_type::to_int_type(*gptr());
+    }
+
+public:
+    explicit ReadAheadBuffer(int input) : fd(input), queuedBytes(0), finished(false), stopping(false) {
+        if (::pipe(wake) == 0) {
+            reader = std::thread(&ReadAheadBuffer::readLoop, this);
+        }
+    }
+
+    ~ReadAheadBuffer() {
+        if (!reader.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+            changed.notify_all();
+        }
+        char byte = 0;
+        ssize_t ignored = ::write(wake[1], &byte, 1);
+        (void)ignored;
+        reader.join();
+        ::close(wake[0]);
+        ::close(wake[1]);
+    }
+};
+
+const size_t ReadAheadBuffer::CHUNK_SIZE;
+const size_t ReadAheadBuffer::READ_AHEAD_LIMIT;
+
+// Worlds defined at compile time. A world written as constexpr tables of the
+// descriptors below is turned by CompiledWorld into the arrays a World reads, so the
+// program starts with the world already laid out in read-only data. Broken links and
+// unreachable rooms are reported by static_assert while the program is compiled.
+
+const uint32_t NO_WORLD_TEXT = 0xFFFFFFFFu;  // A rule operation that prints nothing
+
+// One string: its body, its style (1-based index into the world's styles, 0 = none)
+// and whether GameColors::reset follows it
+struct TextDescriptor {
+    const char* body;
+    uint32_t length;
+    uint32_t style;
+    bool reset;
+};
+
+// Describes an unstyled string; the length is taken from the array, not counted
+template <size_t N>
+constexpr TextDescriptor worldText(const char (&body)[N]) {
+    return TextDescriptor{ body, static_cast<uint32_t>(N - 1), 0, false };
+}
+
+// Describes a string printed in a style and followed by a reset
+template <size_t N>
+constexpr TextDescriptor styledText(uint32_t style, const char (&body)[N]) {
+    return TextDescriptor{ body, static_cast<uint32_t>(N - 1), style, true };
+}
+
+struct RoomDescriptor {
+    uint32_t name;          // Texts, by index into the world's texts
+    uint32_t description;
+    uint32_t detail;
+    bool locked;
+};
+
+// One exit. Every exit must be listed together with the one leading back, and a
+// world's exits must be sorted by the room they leave from.
+struct ExitDescriptor {
+    RoomId from;
+    Direction direction;
+    RoomId to;
+    uint8_t flags;          // EdgeFlags
+};
+
+struct NpcDescriptor {
+    NPCType type;
+    uint32_t dialogue;
+    RoomId room;            // Room the NPC stays in, or NO_ROOM for an NPC that only wanders
+};
+
+// An item kind; the first descriptor is item 1
+struct ItemDescriptor {
+    uint32_t name;
+    uint32_t seen;
+    uint32_t taken;
+    uint32_t refused;
+    ItemId needs;
+    uint32_t flags;         // ItemFlags
+};
+
+// Items lying in a room at the start, sorted by room with each kind listed once per room
+struct PlacementDescriptor {
+    RoomId room;
+    ItemId item;
+    uint32_t count;
+};
+
+// A rule, sorted by room and then verb. Its operations are the next `opCount`
+// entries of the world's operation table.
+struct RuleDescriptor {
+    RoomId room;
+    RuleVerb verb;
+    uint8_t flags;          // RuleFlags
+    uint16_t opCount;
+};
+
+struct RuleOpDescriptor {
+    RuleOpCode code;
+    uint32_t value;
+    uint32_t text;          // Text printed by RULE_PRINT, otherwise NO_WORLD_TEXT
+};
+
+struct ActorDescriptor {
+    RoomId home;
+    NpcId npc;
+};
+
+// The actors of a compile-time world. C++ has no empty arrays, so a world without
+// wandering NPCs leaves out its actors array instead.
+template <typename T> struct VoidType { typedef void type; };
+template <typename W, typename = void>
+struct ActorsOf {
+    static constexpr uint32_t COUNT = 0;
+    static constexpr ActorDescriptor at(uint32_t) { return ActorDescriptor{ NO_ROOM, NO_NPC_ID }; }
+};
+template <typename W>
+struct ActorsOf<W, typename VoidType<decltype(W::actors)>::type> {
+    static constexpr uint32_t COUNT = sizeof(W::actors) / sizeof(W::actors[0]);
+    static constexpr ActorDescriptor at(uint32_t a) { return W::actors[a]; }
+};
+
+constexpr RuleOpDescriptor ruleOp(RuleOpCode code, uint32_t value = 0) {
+    return RuleOpDescriptor{ code, value, NO_WORLD_TEXT };
+}
+
+constexpr RuleOpDescriptor rulePrint(uint32_t text) {
+    return RuleOpDescriptor{ RULE_PRINT, 0, text };
+}
+
+// The indexes 0 to N - 1 as a parameter pack. MakeIndexes halves N at each step, so
+// a table of thousands of entries stays far below the template depth limit.
+template <unsigned... I> struct IndexList { typedef IndexList type; };
+template <typename A, typename B> struct JoinIndexes;
+template <unsigned... A, unsigned... B>
+struct JoinIndexes<IndexList<A...>, IndexList<B...> > : IndexList<A..., (sizeof...(A) + B)...> {};
+template <unsigned N>
+struct MakeIndexes : JoinIndexes<typename MakeIndexes<N / 2>::type, typename MakeIndexes<N - N / 2>::type> {};
+template <> struct MakeIndexes<0> : IndexList<> {};
+template <> struct MakeIndexes<1> : IndexList<0> {};
+
+// A read-only array whose entry i is Entry::at(i), filled in by the compiler
+template <typename T, typename Entry, typename Indexes> struct ConstTable;
+template <typename T, typename Entry, unsigned... I>
+struct ConstTable<T, Entry, IndexList<I...> > {
+    static constexpr T values[sizeof...(I) > 0 ? sizeof...(I) : 1] = { Entry::at(I)... };
+};
+template <typename T, typename Entry, unsigned... I>
+constexpr T ConstTable<T, Entry, IndexList<I...> >::values[sizeof...(I) > 0 ? sizeof...(I) : 1];
+
+// Counts and lookups over a world's descriptors, and the checks run on them. `W`
+// holds the descriptors as static constexpr arrays (see Eldara); every array needs
+// at least one entry. The checks recurse once per entry, so compile-time worlds
+// are kept small: at most 64 rooms.
+template <typename W>
+struct WorldDescriptor {
+    static constexpr uint32_t TEXTS = sizeof(W::texts) / sizeof(W::texts[0]);
+    static constexpr uint32_t STYLES = sizeof(W::styles) / sizeof(W::styles[0]);
+    static constexpr uint32_t ROOMS = sizeof(W::rooms) / sizeof(W::rooms[0]);
+    static constexpr uint32_t EXITS = sizeof(W::exits) / sizeof(W::exits[0]);
+    static constexpr uint32_t NPCS = sizeof(W::npcs) / sizeof(W::npcs[0]);
+    static constexpr uint32_t ITEMS = sizeof(W::items) / sizeof(W::items[0]);
+    static constexpr uint32_t PLACEMENTS = sizeof(W::placements) / sizeof(W::placements[0]);
+    static constexpr uint32_t RULES = sizeof(W::rules) / sizeof(W::rules[0]);
+    static constexpr uint32_t OPS = sizeof(W::ops) / sizeof(W::ops[0]);
+    static constexpr uint32_t ACTORS = ActorsOf<W>::COUNT;
+
+    // The text store is every text body in order
+    static constexpr uint32_t textOffset(uint32_t t) {
+        return t == 0 ? 0 : textOffset(t - 1) + W::texts[t - 1].length;
+    }
+
+    // Character i of the text store, found starting from text t
+    static constexpr char textChar(uint32_t t, uint32_t i) {
+        return i < W::texts[t].length ? W::texts[t].body[i] : textChar(t + 1, i - W::texts[t].length);
+    }
+
+    static constexpr TextRef textRef(uint32_t t) {
+        return t == NO_WORLD_TEXT ? TextRef{ 0, 0 }
+            : TextRef{ textOffset(t), W::texts[t].length | W::texts[t].style << TEXT_STYLE_SHIFT | (W::texts[t].reset ? TEXT_RESET : 0) };
+    }
+
+    // Number of exits, item placements and rules belonging to rooms before `room`
+    static constexpr uint32_t exitsBefore(RoomId room, uint32_t e = 0) {
+        return e == EXITS ? 0 : (W::exits[e].from < room ? 1 : 0) + exitsBefore(room, e + 1);
+    }
+    static constexpr uint32_t placementsBefore(RoomId room, uint32_t p = 0) {
+        return p == PLACEMENTS ? 0 : (W::placements[p].room < room ? 1 : 0) + placementsBefore(room, p + 1);
+    }
+    static constexpr uint32_t rulesBefore(RoomId room, uint32_t r = 0) {
+        return r == RULES ? 0 : (W::rules[r].room < room ? 1 : 0) + rulesBefore(room, r + 1);
+    }
+
+    // Index of the first operation of rule r
+    static constexpr uint32_t firstOp(uint32_t r) {
+        return r == 0 ? 0 : firstOp(r - 1) + W::rules[r - 1].opCount;
+    }
+
+    // One bit per direction with a visible exit from a room
+    static constexpr uint8_t exitMask(RoomId room, uint32_t e = 0) {
+        return e == EXITS ? 0 : static_cast<uint8_t>(
+            (W::exits[e].from == room && (W::exits[e].flags & EDGE_HIDDEN) == 0 ? 1u << W::exits[e].direction : 0u) | exitMask(room, e + 1));
+    }
+
+    // The NPC that stays in a room, or NO_NPC_ID
+    static constexpr NpcId npcIn(RoomId room, uint32_t n = 0) {
+        return n == NPCS ? NO_NPC_ID : W::npcs[n].room == room ? n : npcIn(room, n + 1);
+    }
+
+    static constexpr uint32_t npcsIn(RoomId room, uint32_t n = 0) {
+        return n == NPCS ? 0 : (W::npcs[n].room == room ? 1 : 0) + npcsIn(room, n + 1);
+    }
+
+    // Number of exits leaving `from` in a direction, and whether one leads to `to`
+    static constexpr uint32_t exitsFrom(RoomId from, Direction direction, uint32_t e = 0) {
+        return e == EXITS ? 0 : (W::exits[e].from == from && W::exits[e].direction == direction ? 1 : 0) + exitsFrom(from, direction, e + 1);
+    }
+    static constexpr bool hasExit(RoomId from, Direction direction, RoomId to, uint32_t e = 0) {
+        return e < EXITS && ((W::exits[e].from == from && W::exits[e].direction == direction && W::exits[e].to == to)
+                             || hasExit(from, direction, to, e + 1));
+    }
+
+    // Checks. Each holds for entries i onwards.
+    static constexpr bool textsValid(uint32_t t = 0) {
+        return t == TEXTS || (W::texts[t].style <= STYLES && W::texts[t].length <= TEXT_LENGTH_MASK && textsValid(t + 1));
+    }
+    static constexpr bool stylesValid(uint32_t s = 0) {
+        return s == STYLES || (W::styles[s] < TEXTS && W::texts[W::styles[s]].style == 0 && stylesValid(s + 1));
+    }
+    static constexpr bool roomsValid(uint32_t r = 0) {
+        return r == ROOMS || (W::rooms[r].name < TEXTS && W::rooms[r].description < TEXTS && W::rooms[r].detail < TEXTS
+                              && npcsIn(r) <= 1 && roomsValid(r + 1));
+    }
+    static constexpr bool exitsValid(uint32_t e = 0) {
+        return e == EXITS || (W::exits[e].from < ROOMS && W::exits[e].to < ROOMS && W::exits[e].direction < DIRECTION_COUNT
+                              && (e == 0 || W::exits[e - 1].from <= W::exits[e].from)
+                              && exitsFrom(W::exits[e].from, W::exits[e].direction) == 1 && exitsValid(e + 1));
+    }
+    static constexpr bool exitsPaired(uint32_t e = 0) {
+        return e == EXITS || (hasExit(W::exits[e].to, oppositeDirection(W::exits[e].direction), W::exits[e].from) && exitsPaired(e + 1));
+    }
+    static constexpr bool npcsValid(uint32_t n = 0) {
+        return n == NPCS || (W::npcs[n].dialogue < TEXTS && (W::npcs[n].room < ROOMS || W::npcs[n].room == NO_ROOM)
+                             && (n == 0 || W::npcs[n - 1].room <= W::npcs[n].room) && npcsValid(n + 1));
+    }
+    static constexpr bool itemsValid(uint32_t i = 0) {
+        return i == ITEMS || (W::items[i].name < TEXTS && W::items[i].seen < TEXTS && W::items[i].taken < TEXTS
+                              && W::items[i].refused < TEXTS && W::items[i].needs <= ITEMS && itemsValid(i + 1));
+    }
+    static constexpr bool placementsValid(uint32_t p = 0) {
+        return p == PLACEMENTS || (W::placements[p].room < ROOMS && W::placements[p].item >= 1 && W::placements[p].item <= ITEMS
+                                   && W::placements[p].count > 0
+                                   && (p == 0 || W::placements[p - 1].room < W::placements[p].room
+                                       || (W::placements[p - 1].room == W::placements[p].room && W::placements[p - 1].item != W::placements[p].item))
+                                   && placementsValid(p + 1));
+    }
+    static constexpr bool rulesValid(uint32_t r = 0) {
+        return r == RULES ? firstOp(RULES) == OPS
+            : W::rules[r].room < ROOMS && W::rules[r].verb < VERB_COUNT
+              && (r == 0 || W::rules[r - 1].room < W::rules[r].room
+                  || (W::rules[r - 1].room == W::rules[r].room && W::rules[r - 1].verb <= W::rules[r].verb))
+              && rulesValid(r + 1);
+    }
+    static constexpr bool opsValid(uint32_t o = 0) {
+        return o == OPS || (W::ops[o].code < RULE_OP_COUNT && (W::ops[o].code != RULE_PRINT || W::ops[o].text < TEXTS) && opsValid(o + 1));
+    }
+    static constexpr bool actorsValid(uint32_t a = 0) {
+        return a == ACTORS || (ActorsOf<W>::at(a).home < ROOMS && ActorsOf<W>::at(a).npc < NPCS && actorsValid(a + 1));
+    }
+
+    // Rooms reachable from those in `mask`: each pass follows every exit once, and
+    // as many passes as there are rooms reach every room that can be reached at all
+    static constexpr uint64_t followExits(uint64_t mask, uint32_t e = 0) {
+        return e == EXITS ? mask
+            : followExits((mask >> W::exits[e].from & 1) != 0 ? mask | 1ull << W::exits[e].to : mask, e + 1);
+    }
+    static constexpr uint64_t reachable(uint64_t mask, uint32_t passes) {
+        return passes == 0 ? mask : reachable(followExits(mask), passes - 1);
+    }
+    static constexpr bool everyRoomReachable() {
+        return reachable(1ull << W::start, ROOMS) == (ROOMS == 64 ? ~0ull : (1ull << ROOMS) - 1);
+    }
+
+    // Checksum identifying the world in saves: the text store, split in halves so the
+    // recursion stays shallow, then the exits, items placed and rule operations
+    static constexpr uint64_t mix(uint64_t h, uint64_t value) {
+        return ((h ^ value) * 0x100000001B3ull) ^ (((h ^ value) * 0x100000001B3ull) >> 29);
+    }
+    static constexpr uint64_t hashText(uint32_t first, uint32_t count) {
+        return count == 1 ? static_cast<unsigned char>(textChar(0, first))
+            : mix(hashText(first, count / 2), hashText(first + count / 2, count - count / 2));
+    }
+    static constexpr uint64_t hashExits(uint64_t h, uint32_t e = 0) {
+        return e == EXITS ? h : hashExits(mix(h, W::exits[e].from | static_cast<uint64_t>(W::exits[e].to) << 32
+                                                  | static_cast<uint64_t>(W::exits[e].direction) << 24 | static_cast<uint64_t>(W::exits[e].flags) << 16), e + 1);
+    }
+    static constexpr uint64_t hashRooms(uint64_t h, uint32_t r = 0) {
+        return r == ROOMS ? h : hashRooms(mix(h, W::rooms[r].locked ? 1 : 0), r + 1);
+    }
+    static constexpr uint64_t hashPlacements(uint64_t h, uint32_t p = 0) {
+        return p == PLACEMENTS ? h : hashPlacements(mix(h, W::placements[p].room | static_cast<uint64_t>(W::placements[p].item) << 32), p + 1);
+    }
+    static constexpr uint64_t hashOps(uint64_t h, uint32_t o = 0) {
+        return o == OPS ? h : hashOps(mix(h, W::ops[o].code | static_cast<uint64_t>(W::ops[o].value) << 32), o + 1);
+    }
+    static constexpr uint64_t checksum() {
+        return hashOps(hashPlacements(hashRooms(hashExits(mix(hashText(0, textOffset(TEXTS)), W::start)))));
+    }
+};
+
+// The tables of a compile-time world. Every array is a ConstTable, so the compiler
+// lays it out in read-only data and tables() only collects their addresses.
+template <typename W>
+class CompiledWorld : private WorldDescriptor<W> {
+private:
+    typedef WorldDescriptor<W> D;
+
+    static_assert(D::ROOMS >= 1 && D::ROOMS <= 64, "a compile-time world has 1 to 64 rooms");
+    static_assert(W::start < D::ROOMS, "the start room does not exist");
+    static_assert(D::STYLES <= TEXT_STYLE_LIMIT, "too many styles");
+    static_assert(D::textsValid(), "a text has a style that does not exist or is too long");
+    static_assert(D::stylesValid(), "a style refers to a missing or styled text");
+    static_assert(D::roomsValid(), "a room refers to a missing text or holds more than one NPC");
+    static_assert(D::exitsValid(), "an exit leads to a missing room, exits are not sorted by room, or a room has two exits one way");
+    static_assert(D::exitsPaired(), "an exit has no exit leading back");
+    static_assert(D::everyRoomReachable(), "some room cannot be reached from the start room");
+    static_assert(D::npcsValid(), "an NPC refers to a missing text or room, or NPCs are not sorted by room");
+    static_assert(D::itemsValid(), "an item refers to a missing text or item");
+    static_assert(D::placementsValid(), "an item placement is invalid, repeated, or not sorted by room");
+    static_assert(D::rulesValid(), "a rule is invalid, rules are not sorted by room and verb, or operations are missing");
+    static_assert(D::opsValid(), "a rule operation is invalid or prints a missing text");
+    static_assert(D::actorsValid(), "an actor refers to a missing room or NPC");
+
+    // Entries of each table
+    struct TextChar { static constexpr char at(unsigned i) { return D::textChar(0, i); } };
+    struct Style { static constexpr TextRef at(unsigned s) { return D::textRef(W::styles[s]); } };
+    struct EdgeStart { static constexpr uint32_t at(unsigned r) { return D::exitsBefore(r); } };
+    struct EdgeTarget { static constexpr RoomId at(unsigned e) { return W::exits[e].to; } };
+    struct EdgeDirection { static constexpr uint8_t at(unsigned e) { return static_cast<uint8_t>(W::exits[e].direction); } };
+    struct EdgeFlags { static constexpr uint8_t at(unsigned e) { return W::exits[e].flags; } };
+    struct ExitMask { static constexpr uint8_t at(unsigned r) { return D::exitMask(r); } };
+    struct RoomItemStart { static constexpr uint32_t at(unsigned r) { return D::placementsBefore(r); } };
+    struct RoomItem { static constexpr ItemStack at(unsigned p) { return ItemStack{ W::placements[p].item, W::placements[p].count }; } };
+    struct RoomLocked { static constexpr uint8_t at(unsigned r) { return W::rooms[r].locked ? 1 : 0; } };
+    struct RoomNpc { static constexpr NpcId at(unsigned r) { return D::npcIn(r); } };
+    struct RoomName { static constexpr TextRef at(unsigned r) { return D::textRef(W::rooms[r].name); } };
+    struct RoomDescription { static constexpr TextRef at(unsigned r) { return D::textRef(W::rooms[r].description); } };
+    struct RoomDetail { static constexpr TextRef at(unsigned r) { return D::textRef(W::rooms[r].detail); } };
+    struct NpcType { static constexpr uint8_t at(unsigned n) { return static_cast<uint8_t>(W::npcs[n].type); } };
+    struct NpcDialogue { static constexpr TextRef at(unsigned n) { return D::textRef(W::npcs[n].dialogue); } };
+    struct Item {
+        static constexpr ItemInfo at(unsigned i) {
+            return i == 0 ? ItemInfo{ { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, NO_ITEM, 0 }
+                : ItemInfo{ D::textRef(W::items[i - 1].name), D::textRef(W::items[i - 1].seen), D::textRef(W::items[i - 1].taken),
+                            D::textRef(W::items[i - 1].refused), W::items[i - 1].needs, W::items[i - 1].flags };
+        }
+    };
+    struct RuleStart { static constexpr uint32_t at(unsigned r) { return D::rulesBefore(r); } };
+    struct RuleEntry {
+        static constexpr Rule at(unsigned r) {
+            return Rule{ static_cast<uint8_t>(W::rules[r].verb), W::rules[r].flags, W::rules[r].opCount, D::firstOp(r) };
+        }
+    };
+    struct RuleOpEntry {
+        static constexpr RuleOp at(unsigned o) { return RuleOp{ static_cast<uint32_t>(W::ops[o].code), W::ops[o].value, D::textRef(W::ops[o].text) }; }
+    };
+    struct ActorHome { static constexpr RoomId at(unsigned a) { return ActorsOf<W>::at(a).home; } };
+    struct ActorNpc { static constexpr NpcId at(unsigned a) { return ActorsOf<W>::at(a).npc; } };
+
+    typedef typename MakeIndexes<D::ROOMS>::type Rooms;
+    typedef typename MakeIndexes<D::ROOMS + 1>::type RoomBounds;  // One entry per room plus a final one
+    typedef typename MakeIndexes<D::EXITS>::type Exits;
+    typedef typename MakeIndexes<D::NPCS>::type Npcs;
+    typedef typename MakeIndexes<D::ACTORS>::type Actors;
+
+    typedef ConstTable<char, TextChar, typename MakeIndexes<D::textOffset(D::TEXTS)>::type> Text;
+    typedef ConstTable<TextRef, Style, typename MakeIndexes<D::STYLES>::type> Styles;
+    typedef ConstTable<uint32_t, EdgeStart, RoomBounds> EdgeStarts;
+    typedef ConstTable<RoomId, EdgeTarget, Exits> EdgeTargets;
+    typedef ConstTable<uint8_t, EdgeDirection, Exits> EdgeDirections;
+    typedef ConstTable<uint8_t, EdgeFlags, Exits> EdgeFlagTable;
+    typedef ConstTable<uint8_t, ExitMask, Rooms> ExitMasks;
+    typedef ConstTable<uint32_t, RoomItemStart, RoomBounds> RoomItemStarts;
+    typedef ConstTable<ItemStack, RoomItem, typename MakeIndexes<D::PLACEMENTS>::type> RoomItems;
+    typedef ConstTable<uint8_t, RoomLocked, Rooms> RoomLocks;
+    typedef ConstTable<NpcId, RoomNpc, Rooms> RoomNpcs;
+    typedef ConstTable<TextRef, RoomName, Rooms> RoomNames;
+    typedef ConstTable<TextRef, RoomDescription, Rooms> RoomDescriptions;
+    typedef ConstTable<TextRef, RoomDetail, Rooms> RoomDetails;
+    typedef ConstTable<uint8_t, NpcType, Npcs> NpcTypes;
+    typedef ConstTable<TextRef, NpcDialogue, Npcs> NpcDialogues;
+    typedef ConstTable<ItemInfo, Item, typename MakeIndexes<D::ITEMS + 1>::type> Items;
+    typedef ConstTable<uint32_t, RuleStart, RoomBounds> RuleStarts;
+    typedef ConstTable<Rule, RuleEntry, typename MakeIndexes<D::RULES>::type> Rules;
+    typedef ConstTable<RuleOp, RuleOpEntry, typename MakeIndexes<D::OPS>::type> RuleOps;
+    typedef ConstTable<RoomId, ActorHome, Actors> ActorHomes;
+    typedef ConstTable<NpcId, ActorNpc, Actors> ActorNpcs;
+
+public:
+    // The world's tables, ready for World::attach()
+    static WorldTables tables() {
+        WorldTables t = {
+            EdgeStarts::values, EdgeTargets::values, EdgeDirections::values, EdgeFlagTable::values, ExitMasks::values,
+            RoomItemStarts::values, RoomItems::values, RoomLocks::values, RoomNpcs::values,
+            RoomNames::values, RoomDescriptions::values, RoomDetails::values, NpcTypes::values, NpcDialogues::values,
+            Items::values, Styles::values, RuleStarts::values, Rules::values, RuleOps::values,
+            ActorHomes::values, ActorNpcs::values, Text::values,
+            W::start, D::ROOMS, D::EXITS, D::NPCS, D::STYLES, D::RULES, D::ACTORS, D::ITEMS + 1,
+            sizeof(EdgeStarts::values) + sizeof(EdgeTargets::values) + sizeof(EdgeDirections::values) + sizeof(EdgeFlagTable::values)
+                + sizeof(ExitMasks::values) + sizeof(RoomItemStarts::values) + sizeof(RoomItems::values) + sizeof(RoomLocks::values)
+                + sizeof(RoomNpcs::values) + sizeof(RoomNames::values) + sizeof(RoomDescriptions::values) + sizeof(RoomDetails::values)
+                + sizeof(NpcTypes::values) + sizeof(NpcDialogues::values) + sizeof(Items::values) + sizeof(Styles::values)
+                + sizeof(RuleStarts::values) + sizeof(Rules::values) + sizeof(RuleOps::values) + sizeof(ActorHomes::values)
+                + sizeof(ActorNpcs::values) + sizeof(Text::values),
+            D::checksum()
+        };
+        return t;
+    }
+};
+
+// Feeds a compile-time world through a WorldBuilder instead, building the same world
+// at run time (used to compare the two)
+template <typename W>
+void buildCompiledWorld(WorldBuilder& builder) {
+    typedef WorldDescriptor<W> D;
+    std::vector<TextRef> texts;
+    std::vector<std::string> strings(D::TEXTS);
+    for (uint32_t t = 0; t < D::TEXTS; ++t) {
+        const TextDescriptor& text = W::texts[t];
+        if (text.style != 0) {
+            const TextDescriptor& style = W::texts[W::styles[text.style - 1]];
+            strings[t].assign(style.body, style.length);
+        }
+        strings[t].append(text.body, text.length);
+        if (text.reset) {
+            strings[t] += GameColors::reset;
+        }
+    }
+    // Everything is added in the order parseWorldDefinition() adds it: items, then each
+    // room with what lies and stands in it, so a world file written in the same order
+    // builds the same image (see checkBuiltinWorld)
+    for (uint32_t i = 0; i < D::ITEMS; ++i) {
+        const ItemDescriptor& item = W::items[i];
+        builder.addItem(strings[item.name], strings[item.seen], strings[item.taken], strings[item.refused], item.flags, item.needs);
+    }
+    for (uint32_t r = 0, p = 0; r < D::ROOMS; ++r) {
+        const RoomDescriptor& room = W::rooms[r];
+        builder.addRoom(strings[room.name], strings[room.description], strings[room.detail]);
+        builder.roomLocked[r] = room.locked ? 1 : 0;
+        for (; p < D::PLACEMENTS && W::placements[p].room == r; ++p) {
+            builder.placeItem(W::placements[p].room, W::placements[p].item, W::placements[p].count);
+        }
+        for (uint32_t n = 0; n < D::NPCS; ++n) {
+            if (W::npcs[n].room == r) {
+                builder.addNPC(r, W::npcs[n].type, strings[W::npcs[n].dialogue]);
+            }
+        }
+    }
+    for (uint32_t n = 0; n < D::NPCS; ++n) {
+        if (W::npcs[n].room == NO_ROOM) {
+            builder.defineNPC(W::npcs[n].type, strings[W::npcs[n].dialogue]);
+        }
+    }
+    for (uint32_t e = 0; e < D::EXITS; ++e) {
+        builder.connectOneWay(W::exits[e].from, W::exits[e].direction, W::exits[e].to, W::exits[e].flags);
+    }
+    uint32_t op = 0;
+    for (uint32_t r = 0; r < D::RULES; ++r) {
+        builder.addRule(W::rules[r].room, W::rules[r].verb, W::rules[r].flags);
+        for (uint32_t last = op + W::rules[r].opCount; op < last; ++op) {
+            if (W::ops[op].code == RULE_PRINT) {
+                builder.addRulePrint(strings[W::ops[op].text]);
+            } else {
+                builder.addRuleOp(W::ops[op].code, W::ops[op].value);
+            }
+        }
+    }
+    for (uint32_t a = 0; a < D::ACTORS; ++a) {
+        builder.addActor(ActorsOf<W>::at(a).home, ActorsOf<W>::at(a).npc);
+    }
+    builder.startRoom = W::start;
+}
+
+// The world of Eldara: rooms, NPCs, items and the connections between them
+struct Eldara {
+    enum Room { FOREST, RUINS, CAVE, MOUNTAIN, VALLEY, LAKE, VILLAGE, HIDDEN_ROOM };
+    enum Item { SWORD = 1, KEY, TREASURE };
+    enum Npc { CAVE_MONSTER, ELDER };  // In the order worlds/eldara.world meets them
+
+    // Styles are escape sequences printed before a text, by 1-based index
+    enum Style {
+        FOREST_TITLE = 1, RUINS_TITLE, CAVE_TITLE, MOUNTAIN_TITLE, VALLEY_TITLE, LAKE_TITLE, VILLAGE_TITLE, HIDDEN_TITLE,
+        FOREST_TEXT, RUINS_TEXT, CAVE_TEXT, MOUNTAIN_TEXT, VALLEY_TEXT, LAKE_TEXT, VILLAGE_TEXT, HIDDEN_TEXT,
+        BOLD_GREEN, BOLD_YELLOW, BOLD_RED, BOLD_CYAN
+    };
+
+    enum Text {
+        // The escape sequences of each style, in Style order
+        FOREST_TITLE_CODES, RUINS_TITLE_CODES, CAVE_TITLE_CODES, MOUNTAIN_TITLE_CODES, VALLEY_TITLE_CODES,
+        LAKE_TITLE_CODES, VILLAGE_TITLE_CODES, HIDDEN_TITLE_CODES,
+        FOREST_CODES, RUINS_CODES, CAVE_CODES, MOUNTAIN_CODES, VALLEY_CODES, LAKE_CODES, VILLAGE_CODES, HIDDEN_CODES,
+        BOLD_GREEN_CODES, BOLD_YELLOW_CODES, BOLD_RED_CODES, BOLD_CYAN_CODES,
+        // Rooms
+        FOREST_NAME, FOREST_DESCRIPTION, FOREST_DETAIL,
+        RUINS_NAME, RUINS_DESCRIPTION, RUINS_DETAIL,
+        CAVE_NAME, CAVE_DESCRIPTION, CAVE_DETAIL,
+        MOUNTAIN_NAME, MOUNTAIN_DESCRIPTION, MOUNTAIN_DETAIL,
+        VALLEY_NAME, VALLEY_DESCRIPTION, VALLEY_DETAIL,
+        LAKE_NAME, LAKE_DESCRIPTION, LAKE_DETAIL,
+        VILLAGE_NAME, VILLAGE_DESCRIPTION, VILLAGE_DETAIL,
+        HIDDEN_NAME, HIDDEN_DESCRIPTION, HIDDEN_DETAIL,
+        // NPCs
+        ELDER_DIALOGUE, MONSTER_DIALOGUE,
+        // Items
+        SWORD_NAME, SWORD_SEEN, SWORD_TAKEN, SWORD_REFUSED,
+        KEY_NAME, KEY_SEEN, KEY_TAKEN, KEY_REFUSED,
+        TREASURE_NAME, TREASURE_SEEN, TREASURE_TAKEN, TREASURE_REFUSED,
+        // Rules
+        DOORWAY_FOUND, KEY_FOUND
+    };
+
+    static constexpr RoomId start = FOREST;  // The player begins the adventure in the forest
+
+    static constexpr TextDescriptor texts[] = {
+        // Room names: the room's color, bold, and italics for the mountain and the lake
+        worldText("\033[38;5;28m\033[1m"), worldText("\033[38;5;137m\033[1m"), worldText("\033[38;5;240m\033[1m"),
+        worldText("\033[38;5;248m\033[1m\033[3m"), worldText("\033[38;5;106m\033[1m"), worldText("\033[38;5;39m\033[1m\033[3m"),
+        worldText("\033[38;5;180m\033[1m"), worldText("\033[38;5;141m\033[1m"),
+        // Room descriptions, in the GameColors room colors (the valley is a light green)
+        worldText("\033[38;5;28m"), worldText("\033[38;5;137m"), worldText("\033[38;5;240m"), worldText("\033[38;5;248m"),
+        worldText("\033[38;5;106m"), worldText("\033[38;5;39m"), worldText("\033[38;5;180m"), worldText("\033[38;5;141m"),
+        worldText("\033[1m\033[32m"), worldText("\033[1m\033[33m"), worldText("\033[1m\033[31m"), worldText("\033[1m\033[36m"),
+
+        // Forest - Starting Room
+        styledText(FOREST_TITLE, "Forest"),
+        styledText(FOREST_TEXT, "A dark forest surrounds you. Ancient trees tower overhead, and the air is thick with the scent of pine."),
+        styledText(FOREST_TEXT, "Ancient trees tower overhead, their branches swaying in the breeze. The air is thick with the scent of pine and wild mushrooms. Fallen leaves crunch beneath your feet, and somewhere in the distance, an owl hoots softly. The dense canopy above allows only occasional shafts of light to penetrate to the forest floor. You notice some old footprints leading east."),
+        // Ruins - Ancient civilization remains
+        styledText(RUINS_TITLE, "Ruins"),
+        styledText(RUINS_TEXT, "Crumbling stone walls and weathered pillars tell tales of an ancient civilization."),
+        styledText(RUINS_TEXT, "Crumbling stone walls and weathered pillars tell tales of an ancient civilization. Intricate carvings, though worn by time, still adorn the weathered stones. Vines and moss have claimed much of the architecture. Among the broken pottery shards, you spot what appears to be a map fragment showing a path leading south."),
+        // Cave - Dark and mysterious location
+        styledText(CAVE_TITLE, "Cave"),
+        styledText(CAVE_TEXT, "The damp cave walls glisten with moisture. Strange echoes bounce off the rocky surfaces."),
+        styledText(CAVE_TEXT, "The damp cave walls glisten with moisture. Strange echoes bounce off the rocky surfaces, making it impossible to tell their source. Mineral formations catch what little light there is, creating an otherworldly atmosphere. The monster's presence makes it difficult to explore further, but you sense something valuable might be hidden here."),
+        // Mountain - Elevated vantage point
+        styledText(MOUNTAIN_TITLE, "Mountain"),
+        styledText(MOUNTAIN_TEXT, "The majestic mountain peak pierces the clouds above. The air is thin but crisp."),
+        styledText(MOUNTAIN_TEXT, "The air is thin but crisp, and the view from here is breathtaking. Snow-capped peaks stretch into the distance, and the wind whistles through the rocky crags. Ancient runes are carved into some of the larger boulders. The eastern rock face seems unusually smooth compared to the rest."),
+        // Valley - Peaceful transition area
+        styledText(VALLEY_TITLE, "Valley"),
+        styledText(VALLEY_TEXT, "A serene valley stretches between the mountains."),
+        styledText(VALLEY_TEXT, "Wildflowers dot the gentle slopes, creating a carpet of vibrant colors. A gentle breeze carries the sweet scent of mountain blooms, and butterflies dance among the flowers. Small streams trickle down from the heights, creating a peaceful melody. The path continues east towards what appears to be a large body of water."),
+        // Lake - Reflective water body
+        styledText(LAKE_TITLE, "Lake"),
+        styledText(LAKE_TEXT, "Crystal clear waters stretch before you, reflecting the sky like a mirror."),
+        styledText(LAKE_TEXT, "Crystal clear waters stretch before you, reflecting the sky like a mirror. The surface occasionally ripples as fish jump, creating expanding circles that distort the perfect reflection. The shoreline is dotted with smooth pebbles and tall reeds. Through the clear water, you can make out what looks like an old path leading south."),
+        // Village - Inhabited settlement
+        styledText(VILLAGE_TITLE, "Village"),
+        styledText(VILLAGE_TEXT, "A peaceful village with thatched-roof houses and cobblestone streets."),
+        styledText(VILLAGE_TEXT, "Thatched-roof houses line the cobblestone streets, smoke rising from their chimneys. The scent of hearth fires and cooking meals fills the air. Children play between the buildings while adults go about their daily tasks. You overhear villagers discussing local legends about hidden treasures and secret passages in the mountains."),
+        // Hidden Room - Secret treasure location
+        styledText(HIDDEN_TITLE, "Hidden Room"),
+        styledText(HIDDEN_TEXT, "This dusty chamber seems untouched for centuries. An ornate chest catches your eye."),
+        styledText(HIDDEN_TEXT, "This dusty chamber seems untouched for centuries. An ornate chest catches your eye, its metalwork still gleaming despite its age. The walls are covered in elaborate tapestries depicting ancient battles and mystical creatures. Precious gems and metals are worked into the very structure of the room, creating a subtle sparkle in the dim light."),
+
+        // The village elder shows a map of the area
+        styledText(0, "Greetings traveler! Let me show you a map of the area:\n\n" "\033[1m\033[34m" R"(
+    Village ─── Valley ─── Lake
+        │                    │
+        │                    │
+    Forest ─── Ruins         │
+                  │          │
+                  │          │
+                Cave         │
+                             │
+                         Mountain
+)" "\033[0m\n\033[36m" "There are many interesting places to explore. I've heard whispers of ancient treasures hidden somewhere in these lands, but their location remains a mystery..."),
+        worldText("A fearsome monster guards a mysterious key!"),
+
+        // The sword is a weapon, and the chest can only be taken with the key
+        worldText("sword"),
+        styledText(BOLD_GREEN, "There is a sword here that you can take."),
+        styledText(BOLD_GREEN, "You take the sword. Now you can fight monsters!"),
+        worldText("You cannot take the sword yet."),
+        worldText("key"),
+        styledText(BOLD_YELLOW, "There is a key here that you can take."),
+        styledText(BOLD_YELLOW, "You take the key."),
+        worldText("You cannot take the key yet."),
+        worldText("treasure"),
+        styledText(BOLD_YELLOW, "There is a treasure chest here!"),
+        styledText(BOLD_GREEN, "You have taken the treasure!"),
+        styledText(BOLD_RED, "The chest is locked! You need a key."),
+
+        styledText(BOLD_CYAN, "\nAs you examine the area more carefully with your key in hand, you notice that some of the runes on the eastern rock face seem to form the outline of a doorway. Perhaps there's more here than meets the eye..."),
+        styledText(BOLD_YELLOW, "You found a key!")
+    };
+
+    static constexpr uint32_t styles[] = {
+        FOREST_TITLE_CODES, RUINS_TITLE_CODES, CAVE_TITLE_CODES, MOUNTAIN_TITLE_CODES, VALLEY_TITLE_CODES,
+        LAKE_TITLE_CODES, VILLAGE_TITLE_CODES, HIDDEN_TITLE_CODES,
+        FOREST_CODES, RUINS_CODES, CAVE_CODES, MOUNTAIN_CODES, VALLEY_CODES, LAKE_CODES, VILLAGE_CODES, HIDDEN_CODES,
+        BOLD_GREEN_CODES, BOLD_YELLOW_CODES, BOLD_RED_CODES, BOLD_CYAN_CODES
+    };
+
+    static constexpr RoomDescriptor rooms[] = {
+        { FOREST_NAME, FOREST_DESCRIPTION, FOREST_DETAIL, false },
+        { RUINS_NAME, RUINS_DESCRIPTION, RUINS_DETAIL, false },
+        { CAVE_NAME, CAVE_DESCRIPTION, CAVE_DETAIL, false },
+        { MOUNTAIN_NAME, MOUNTAIN_DESCRIPTION, MOUNTAIN_DETAIL, false },
+        { VALLEY_NAME, VALLEY_DESCRIPTION, VALLEY_DETAIL, false },
+        { LAKE_NAME, LAKE_DESCRIPTION, LAKE_DETAIL, false },
+        { VILLAGE_NAME, VILLAGE_DESCRIPTION, VILLAGE_DETAIL, false },
+        { HIDDEN_NAME, HIDDEN_DESCRIPTION, HIDDEN_DETAIL, true }
+    };
+
+    // The hidden path east from the mountain is not listed among the mountain's exits
+    static constexpr ExitDescriptor exits[] = {
+        { FOREST, NORTH, VILLAGE, 0 }, { FOREST, EAST, RUINS, 0 },
+        { RUINS, WEST, FOREST, 0 }, { RUINS, SOUTH, CAVE, 0 },
+        { CAVE, NORTH, RUINS, 0 },
+        { MOUNTAIN, NORTH, LAKE, 0 }, { MOUNTAIN, EAST, HIDDEN_ROOM, EDGE_HIDDEN },
+        { VALLEY, WEST, VILLAGE, 0 }, { VALLEY, EAST, LAKE, 0 },
+        { LAKE, WEST, VALLEY, 0 }, { LAKE, SOUTH, MOUNTAIN, 0 },
+        { VILLAGE, EAST, VALLEY, 0 }, { VILLAGE, SOUTH, FOREST, 0 },
+        { HIDDEN_ROOM, WEST, MOUNTAIN, 0 }
+    };
+
+    static constexpr NpcDescriptor npcs[] = {
+        { MONSTER, MONSTER_DIALOGUE, CAVE },
+        { VILLAGER, ELDER_DIALOGUE, VILLAGE }
+    };
+
+    static constexpr ItemDescriptor items[] = {
+        { SWORD_NAME, SWORD_SEEN, SWORD_TAKEN, SWORD_REFUSED, NO_ITEM, ITEM_WEAPON },
+        { KEY_NAME, KEY_SEEN, KEY_TAKEN, KEY_REFUSED, NO_ITEM, 0 },
+        { TREASURE_NAME, TREASURE_SEEN, TREASURE_TAKEN, TREASURE_REFUSED, KEY, ITEM_GOAL }
+    };
+
+    static constexpr PlacementDescriptor placements[] = {
+        { MOUNTAIN, SWORD, 1 },
+        { HIDDEN_ROOM, TREASURE, 1 }
+    };
+
+    // Defeating the cave monster yields the key, and looking around the mountain
+    // with the key reveals the hidden passage
+    static constexpr RuleDescriptor rules[] = {
+        { CAVE, VERB_FIGHT, 0, 4 },
+        { MOUNTAIN, VERB_LOOK, RULE_INSTEAD, 4 }
+    };
+
+    static constexpr RuleOpDescriptor ops[] = {
+        ruleOp(RULE_MONSTER_HERE), ruleOp(RULE_HAS_ITEM, SWORD), ruleOp(RULE_GIVE_ITEM, KEY), rulePrint(KEY_FOUND),
+        ruleOp(RULE_HAS_ITEM, KEY), rulePrint(DOORWAY_FOUND), ruleOp(RULE_REVEAL_EXIT, EAST), ruleOp(RULE_UNLOCK_ROOM, HIDDEN_ROOM)
+    };
+};
+
+constexpr RoomId Eldara::start;
+constexpr TextDescriptor Eldara::texts[];
+constexpr uint32_t Eldara::styles[];
+constexpr RoomDescriptor Eldara::rooms[];
+constexpr ExitDescriptor Eldara::exits[];
+constexpr NpcDescriptor Eldara::npcs[];
+constexpr ItemDescriptor Eldara::items[];
+constexpr PlacementDescriptor Eldara::placements[];
+constexpr RuleDescriptor Eldara::rules[];
+constexpr RuleOpDescriptor Eldara::ops[];
+
+static_assert(sizeof(Eldara::texts) / sizeof(Eldara::texts[0]) == Eldara::KEY_FOUND + 1, "Eldara's texts do not match its Text enum");
+static_assert(sizeof(Eldara::styles) / sizeof(Eldara::styles[0]) == Eldara::BOLD_CYAN, "Eldara's styles do not match its Style enum");
+
+// Looks up the escape sequence for a {style} reference in world definition text
+bool lookupStyle(const std::map<std::string, std::string>& styles, const std::string& name, std::string& code) {
+    std::map<std::string, std::string>::const_iterator it = styles.find(name);
+    if (it == styles.end()) {
+        return false;
+    }
+    code = it->second;
+    return true;
+}
+
+// Expands the markup used in world definition text: {style} references become
+// escape sequences, \n becomes a newline and {{ or }} are literal braces
+bool expandWorldText(const std::string& raw, const std::map<std::string, std::string>& styles, std::string& expanded, std::string& error) {
+    expanded.clear();
+    for (size_t i = 0; i < raw.size(); ++i) {
+        char c = raw[i];
+        if (c == '\\' && i + 1 < raw.size() && raw[i + 1] == 'n') {
+            expanded += '\n';
+            ++i;
+        } else if ((c == '{' || c == '}') && i + 1 < raw.size() && raw[i + 1] == c) {
+            expanded += c;
+            ++i;
+        } else if (c == '{') {
+            size_t close = raw.find('}', i);
+            std::string code;
+            if (close == std::string::npos || !lookupStyle(styles, raw.substr(i + 1, close - i - 1), code)) {
+                error = "unknown style in \"" + raw.substr(i, close == std::string::npos ? std::string::npos : close - i + 1) + "\"";
+                return false;
+            }
+            expanded += code;
+            i = close;
+        } else {
+            expanded += c;
+        }
+    }
+    return true;
+}
+
+// Parses a direction name as used in world definition files
+bool parseDirection(const std::string& word, Direction& dir) {
+    for (int d = 0; d < DIRECTION_COUNT; ++d) {
+        if (word == directionToString(static_cast<Direction>(d))) {
+            dir = static_cast<Direction>(d);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Parses the verb a rule is triggered by
+bool parseRuleVerb(const std::string& word, RuleVerb& verb) {
+    static const char* const names[] = { "look", "talk", "fight", "take" };
+    for (int v = VERB_LOOK; v < VERB_COUNT; ++v) {
+        if (word == names[v - VERB_LOOK]) {
+            verb = static_cast<RuleVerb>(v);
+            return true;
+        }
+    }
+    Direction dir;
+    if (parseDirection(word, dir)) {
+        verb = static_cast<RuleVerb>(dir);
+        return true;
+    }
+    return false;
+}
+
+// Reads a world definition file into a builder. The format is line based:
+//
+//   # comment
+//   style <name> <SGR parameters>        defines {name}, e.g. "style forest 38;5;28"
+//   object <id> [weapon] [goal] [needs <id>]
+//                                        an item kind, named by its id; a weapon lets the player
+//                                        fight, taking a goal wins, and "needs" gates taking it
+//     seen <text>                        shown when it lies in the player's room
+//     taken <text>                       shown when the player takes it
+//     refused <text>                     shown when the player lacks what it needs
+//   room <id>                            starts a room; the lines below describe it
+//     name <text>                        display name
+//     desc <text>                        short description shown on entry
+//     look <text>                        longer description shown with 'look'
+//     item <object> [count]              items lying in the room; repeat for more kinds
+//     npc <villager|monster> <text>      NPC and what it says
+//     locked                             the room starts locked
+//   | <text>                             continues the previous text on a new line
+//   exit <room> <direction> <room> [hidden] [oneway]
+//   start <room>
+//   rule <room> <verb> [instead]         a rule for look, talk, fight, take or a direction in a room;
+//                                        "instead" rules replace the verb's usual handling
+//     if has|lacks|here <item>           condition: the player holds / lacks the item, or it lies here
+//     if monster                         condition: an undefeated monster is here
+//     then print <text>                  action: print a line of text
+//     then give <item>                   action: give the player an item
+//     then reveal <direction>            action: list a hidden exit of the room
+//     then unlock <room>                 action: unlock a room
+//     then defeat                        action: defeat the room's NPC
+//   actor <room> <villager|monster> <count> <text>
+//                                        NPCs that wander from the room (a monster's lair) and what they say
+//
+// Text may use {style} references, the built-in styles {reset} {bold} {italic}
+// {red} {green} {yellow} {blue} {magenta} {cyan}, and \n for a line break.
+bool parseWorldDefinition(std::istream& in, WorldBuilder& builder, std::string& error) {
+    std::map<std::string, std::string> styles;
+    styles["reset"] = GameColors::reset;
+    styles["bold"] = GameColors::bold;
+    styles["italic"] = "\033[3m";
+    styles["red"] = GameColors::red;
+    styles["green"] = GameColors::green;
+    styles["yellow"] = GameColors::yellow;
+    styles["blue"] = GameColors::blue;
+    styles["magenta"] = GameColors::magenta;
+    styles["cyan"] = GameColors::cyan;
+
+    // A room is collected completely before it is added, since its texts may span several lines
+    struct PendingRoom {
+        std::string id, name, description, detail, dialogue;
+        std::vector<std::pair<std::string, uint32_t> > items;  // Object id and count
+        NPCType npc;
+        bool locked;
+        int line;
+    };
+    struct PendingExit {
+        std::string from, to;
+        Direction dir;
+        uint8_t flags;
+        bool oneWay;
+        int line;
+    };
+    struct PendingObject {
+        std::string id, needs, seen, taken, refused;
+        uint32_t flags;
+        int line;
+    };
+    struct PendingRuleOp {
+        RuleOpCode code;
+        uint32_t value;
+        std::string text;   // Text to print, the room to unlock or the object a condition or gift names
+    };
+    struct PendingRule {
+        std::string room;
+        RuleVerb verb;
+        uint8_t flags;
+        std::vector<PendingRuleOp> ops;
+        bool hasActions;
+        int line;
+    };
+    std::vector<PendingObject> objects;
+    std::vector<PendingRoom> rooms;
+    std::vector<PendingExit> exits;
+    struct PendingActor {
+        std::string room, dialogue;
+        NPCType type;
+        uint32_t count;
+        int line;
+    };
+    std::vector<PendingRule> rules;
+    std::vector<PendingActor> actors;
+    std::string startId;
+    std::string* lastText = nullptr;  // Text that a "|" line continues
+
+    std::string line;
+    int lineNumber = 0;
+    std::ostringstream where;
+    while (std::getline(in, line)) {
+        ++lineNumber;
+        where.str("");
+        where << "line " << lineNumber << ": ";
+        if (!line.empty() && line[line.size() - 1] == '\r') {
+            line.erase(line.size() - 1);
+        }
+
+        size_t start = line.find_first_not_of(" \t");
+        if (start == std::string::npos || line[start] == '#') {
+            continue;
+        }
+        if (line[start] == '|') {
+            if (lastText == nullptr) {
+                error = where.str() + "continuation line without text to continue";
+                return false;
+            }
+            size_t textStart = start + 1;
+            if (textStart < line.size() && line[textStart] == ' ') {
+                ++textStart;
+            }
+            std::string expanded;
+            if (!expandWorldText(line.substr(textStart), styles, expanded, error)) {
+                error = where.str() + error;
+                return false;
+            }
+            *lastText += "\n" + expanded;
+            continue;
+        }
+
+        // Split into keyword and the rest of the line
+        size_t keywordEnd = line.find_first_of(" \t", start);
+        std::string keyword = line.substr(start, keywordEnd == std::string::npos ? std::string::npos : keywordEnd - start);
+        std::string rest;
+        if (keywordEnd != std::string::npos) {
+            size_t restStart = line.find_first_not_of(" \t", keywordEnd);
+            if (restStart != std::string::npos) {
+                rest = line.substr(restStart);
+            }
+        }
+        std::istringstream words(rest);
+        lastText = nullptr;
+
+        if (keyword == "style") {
+            std::string name, parameters;
+            words >> name >> parameters;
+            if (name.empty() || parameters.empty()) {
+                error = where.str() + "expected: style <name> <SGR parameters>";
+                return false;
+            }
+            styles[name] = "\033[" + parameters + "m";
+        } else if (keyword == "room") {
+            PendingRoom room;
+            words >> room.id;
+            if (room.id.empty()) {
+                error = where.str() + "expected: room <id>";
+                return false;
+            }
+            room.npc = NO_NPC;
+            room.locked = false;
+            room.line = lineNumber;
+            rooms.push_back(room);
+        } else if (keyword == "name" || keyword == "desc" || keyword == "look" || keyword == "npc") {
+            if (rooms.empty()) {
+                error = where.str() + "'" + keyword + "' must follow a room";
+                return false;
+            }
+            PendingRoom& room = rooms.back();
+            std::string raw = rest;
+            if (keyword == "npc") {
+                std::string type;
+                words >> type;
+                if (type == "villager") {
+                    room.npc = VILLAGER;
+                } else if (type == "monster") {
+                    room.npc = MONSTER;
+                } else {
+                    error = where.str() + "unknown NPC type '" + type + "'";
+                    return false;
+                }
+                size_t textStart = rest.find_first_not_of(" \t", type.size());
+                raw = textStart == std::string::npos ? std::string() : rest.substr(textStart);
+            }
+            std::string* field = keyword == "name" ? &room.name
+                : keyword == "desc" ? &room.description
+                : keyword == "look" ? &room.detail : &room.dialogue;
+            if (!expandWorldText(raw, styles, *field, error)) {
+                error = where.str() + error;
+                return false;
+            }
+            lastText = field;
+        } else if (keyword == "object") {
+            PendingObject object;
+            std::string option;
+            words >> object.id;
+            object.flags = 0;
+            object.line = lineNumber;
+            bool valid = !object.id.empty();
+            while (valid && words >> option) {
+                if (option == "weapon") {
+                    object.flags |= ITEM_WEAPON;
+                } else if (option == "goal") {
+                    object.flags |= ITEM_GOAL;
+                } else if (option == "needs") {
+                    valid = static_cast<bool>(words >> object.needs);
+                } else {
+                    valid = false;
+                }
+            }
+            if (!valid) {
+                error = where.str() + "expected: object <id> [weapon] [goal] [needs <object>]";
+                return false;
+            }
+            objects.push_back(object);
+        } else if (keyword == "seen" || keyword == "taken" || keyword == "refused") {
+            if (objects.empty()) {
+                error = where.str() + "'" + keyword + "' must follow an object";
+                return false;
+            }
+            PendingObject& object = objects.back();
+            std::string* field = keyword == "seen" ? &object.seen : keyword == "taken" ? &object.taken : &object.refused;
+            if (!expandWorldText(rest, styles, *field, error)) {
+                error = where.str() + error;
+                return false;
+            }
+            lastText = field;
+        } else if (keyword == "item") {
+            std::string name, countWord;
+            words >> name >> countWord;
+            if (rooms.empty()) {
+                error = where.str() + "'item' must follow a room";
+                return false;
+            }
+            char* countEnd = nullptr;
+            long count = countWord.empty() ? 1 : std::strtol(countWord.c_str(), &countEnd, 10);
+            if (name.empty() || (countEnd != nullptr && *countEnd != '\0') || count < 1 || count > 1000000000) {
+                error = where.str() + "expected: item <object> [count]";
+                return false;
+            }
+            rooms.back().items.push_back(std::make_pair(name, static_cast<uint32_t>(count)));
+        } else if (keyword == "locked") {
+            if (rooms.empty()) {
+                error = where.str() + "'locked' must follow a room";
+                return false;
+            }
+            rooms.back().locked = true;
+        } else if (keyword == "exit") {
+            PendingExit exit;
+            std::string dirName, option;
+            words >> exit.from >> dirName >> exit.to;
+            if (exit.to.empty() || !parseDirection(dirName, exit.dir)) {
+                error = where.str() + "expected: exit <room> <direction> <room> [hidden] [oneway]";
+                return false;
+            }
+            exit.flags = 0;
+            exit.oneWay = false;
+            exit.line = lineNumber;
+            while (words >> option) {
+                if (option == "hidden") {
+                    exit.flags |= EDGE_HIDDEN;
+                } else if (option == "oneway") {
+                    exit.oneWay = true;
+                } else {
+                    error = where.str() + "unknown exit option '" + option + "'";
+                    return false;
+                }
+            }
+            exits.push_back(exit);
+        } else if (keyword == "start") {
+            words >> startId;
+        } else if (keyword == "actor") {
+            PendingActor actor;
+            std::string type;
+            long count = 0;
+            words >> actor.room >> type >> count;
+            if (actor.room.empty() || (type != "villager" && type != "monster") || count < 1 || count > 100000000) {
+                error = where.str() + "expected: actor <room> <villager|monster> <count> <text>";
+                return false;
+            }
+            actor.type = type == "villager" ? VILLAGER : MONSTER;
+            actor.count = static_cast<uint32_t>(count);
+            actor.line = lineNumber;
+            std::string raw;
+            std::getline(words >> std::ws, raw);
+            if (!expandWorldText(raw, styles, actor.dialogue, error)) {
+                error = where.str() + error;
+                return false;
+            }
+            actors.push_back(actor);
+            lastText = &actors.back().dialogue;
+        } else if (keyword == "rule") {
+            PendingRule rule;
+            std::string verbName, option;
+            words >> rule.room >> verbName >> option;
+            if (rule.room.empty() || !parseRuleVerb(verbName, rule.verb) || (!option.empty() && option != "instead")) {
+                error = where.str() + "expected: rule <room> <look|talk|fight|take|direction> [instead]";
+                return false;
+            }
+            rule.flags = option == "instead" ? RULE_INSTEAD : 0;
+            rule.hasActions = false;
+            rule.line = lineNumber;
+            rules.push_back(rule);
+        } else if (keyword == "if" || keyword == "then") {
+            if (rules.empty()) {
+                error = where.str() + "'" + keyword + "' must follow a rule";
+                return false;
+            }
+            PendingRule& rule = rules.back();
+            PendingRuleOp op;
+            op.value = 0;
+            std::string name, argument;
+            words >> name >> argument;
+            Direction dir;
+            if (keyword == "if") {
+                if (rule.hasActions) {
+                    error = where.str() + "conditions must come before the rule's actions";
+                    return false;
+                }
+                if ((name == "has" || name == "lacks" || name == "here") && !argument.empty()) {
+                    op.code = name == "has" ? RULE_HAS_ITEM : name == "lacks" ? RULE_LACKS_ITEM : RULE_ITEM_HERE;
+                    op.text = argument;
+                } else if (name == "monster") {
+                    op.code = RULE_MONSTER_HERE;
+                } else {
+                    error = where.str() + "expected: if has|lacks|here <object>, or if monster";
+                    return false;
+                }
+            } else {
+                rule.hasActions = true;
+                if (name == "print") {
+                    op.code = RULE_PRINT;
+                    size_t textStart = rest.find_first_not_of(" \t", name.size());
+                    if (!expandWorldText(textStart == std::string::npos ? std::string() : rest.substr(textStart), styles, op.text, error)) {
+                        error = where.str() + error;
+                        return false;
+                    }
+                } else if (name == "give" && !argument.empty()) {
+                    op.code = RULE_GIVE_ITEM;
+                    op.text = argument;
+                } else if (name == "reveal" && parseDirection(argument, dir)) {
+                    op.code = RULE_REVEAL_EXIT;
+                    op.value = dir;
+                } else if (name == "unlock" && !argument.empty()) {
+                    op.code = RULE_UNLOCK_ROOM;
+                    op.text = argument;
+                } else if (name == "defeat") {
+                    op.code = RULE_DEFEAT_NPC;
+                } else {
+                    error = where.str() + "expected: then print <text>, give <object>, reveal <direction>, unlock <room> or defeat";
+                    return false;
+                }
+            }
+            rule.ops.push_back(op);
+            if (op.code == RULE_PRINT) {
+                lastText = &rule.ops.back().text;
+            }
+        } else {
+            error = where.str() + "unknown keyword '" + keyword + "'";
+            return false;
+        }
+    }
+
+    if (rooms.empty()) {
+        error = "the world has no rooms";
+        return false;
+    }
+
+    // Register objects in file order, then resolve what each needs
+    std::map<std::string, ItemId> itemIds;
+    for (size_t i = 0; i < objects.size(); ++i) {
+        const PendingObject& object = objects[i];
+        if (itemIds.count(object.id) != 0) {
+            where.str("");
+            where << "line " << object.line << ": object '" << object.id << "' is defined twice";
+            error = where.str();
+            return false;
+        }
+        itemIds[object.id] = builder.addItem(object.id, object.seen, object.taken, object.refused, object.flags);
+    }
+    for (size_t i = 0; i < objects.size(); ++i) {
+        const PendingObject& object = objects[i];
+        if (!object.needs.empty()) {
+            if (itemIds.count(object.needs) == 0) {
+                where.str("");
+                where << "line " << object.line << ": object needs unknown object '" << object.needs << "'";
+                error = where.str();
+                return false;
+            }
+            builder.items[itemIds[object.id]].needs = itemIds[object.needs];
+        }
+    }
+
+    // Add rooms in file order, so room ids follow the order of the definition
+    std::map<std::string, RoomId> ids;
+    for (size_t i = 0; i < rooms.size(); ++i) {
+        const PendingRoom& room = rooms[i];
+        if (ids.count(room.id) != 0) {
+            where.str("");
+            where << "line " << room.line << ": room '" << room.id << "' is defined twice";
+            error = where.str();
+            return false;
+        }
+        RoomId id = builder.addRoom(room.name, room.description, room.detail);
+        ids[room.id] = id;
+        builder.roomLocked[id] = room.locked ? 1 : 0;
+        for (size_t j = 0; j < room.items.size(); ++j) {
+            if (itemIds.count(room.items[j].first) == 0) {
+                where.str("");
+                where << "line " << room.line << ": room '" << room.id << "' holds unknown object '" << room.items[j].first << "'";
+                error = where.str();
+                return false;
+            }
+            builder.placeItem(id, itemIds[room.items[j].first], room.items[j].second);
+        }
+        if (room.npc != NO_NPC) {
+            builder.addNPC(id, room.npc, room.dialogue);
+        }
+    }
+
+    // Each room has at most one exit per direction, counting the way back of two-way exits
+    std::map<std::pair<RoomId, int>, int> exitLines;
+    for (size_t i = 0; i < exits.size(); ++i) {
+        const PendingExit& exit = exits[i];
+        if (ids.count(exit.from) == 0 || ids.count(exit.to) == 0) {
+            where.str("");
+            where << "line " << exit.line << ": exit refers to unknown room '" << (ids.count(exit.from) == 0 ? exit.from : exit.to) << "'";
+            error = where.str();
+            return false;
+        }
+        for (int side = 0; side < (exit.oneWay ? 1 : 2); ++side) {
+            const std::string& room = side == 0 ? exit.from : exit.to;
+            Direction dir = side == 0 ? exit.dir : oppositeDirection(exit.dir);
+            int& line = exitLines[std::make_pair(ids[room], static_cast<int>(dir))];
+            if (line != 0) {
+                where.str("");
+                where << "line " << exit.line << ": room '" << room << "' already has an exit " << directionToString(dir)
+                      << " (line " << line << ")";
+                error = where.str();
+                return false;
+            }
+            line = exit.line;
+        }
+        if (exit.oneWay) {
+            builder.connectOneWay(ids[exit.from], exit.dir, ids[exit.to], exit.flags);
+        } else {
+            builder.connect(ids[exit.from], exit.dir, ids[exit.to], exit.flags);
+        }
+    }
+
+    // Rules; the engine looks at no more than 64 rules for one room and verb
+    std::map<std::pair<RoomId, int>, int> rulesPerVerb;
+    for (size_t i = 0; i < rules.size(); ++i) {
+        const PendingRule& rule = rules[i];
+        where.str("");
+        where << "line " << rule.line << ": ";
+        if (ids.count(rule.room) == 0) {
+            error = where.str() + "rule refers to unknown room '" + rule.room + "'";
+            return false;
+        }
+        RoomId room = ids[rule.room];
+        if (++rulesPerVerb[std::make_pair(room, static_cast<int>(rule.verb))] > 64) {
+            error = where.str() + "more than 64 rules for the same room and verb";
+            return false;
+        }
+        builder.addRule(room, rule.verb, rule.flags);
+        for (size_t j = 0; j < rule.ops.size(); ++j) {
+            const PendingRuleOp& op = rule.ops[j];
+            if (op.code == RULE_PRINT) {
+                builder.addRulePrint(op.text);
+            } else if (op.code == RULE_UNLOCK_ROOM) {
+                if (ids.count(op.text) == 0) {
+                    error = where.str() + "rule unlocks unknown room '" + op.text + "'";
+                    return false;
+                }
+                builder.addRuleOp(op.code, ids[op.text]);
+            } else if (op.code == RULE_HAS_ITEM || op.code == RULE_LACKS_ITEM || op.code == RULE_ITEM_HERE || op.code == RULE_GIVE_ITEM) {
+                if (itemIds.count(op.text) == 0) {
+                    error = where.str() + "rule refers to unknown object '" + op.text + "'";
+                    return false;
+                }
+                builder.addRuleOp(op.code, itemIds[op.text]);
+            } else {
+                builder.addRuleOp(op.code, op.value);
+            }
+        }
+    }
+
+    // Actors of one line share an NPC record
+    for (size_t i = 0; i < actors.size(); ++i) {
+        const PendingActor& actor = actors[i];
+        if (ids.count(actor.room) == 0) {
+            where.str("");
+            where << "line " << actor.line << ": actor refers to unknown room '" << actor.room << "'";
+            error = where.str();
+            return false;
+        }
+        NpcId npc = builder.defineNPC(actor.type, actor.dialogue);
+        for (uint32_t n = 0; n < actor.count; ++n) {
+            builder.addActor(ids[actor.room], npc);
+        }
+    }
+
+    if (!startId.empty()) {
+        if (ids.count(startId) == 0) {
+            error = "start refers to unknown room '" + startId + "'";
+            return false;
+        }
+        builder.startRoom = ids[startId];
+    }
+    return true;
+}
+
+// Compiles a world definition file into a binary world image
+bool compileWorldFile(const std::string& sourcePath, const std::string& imagePath, std::string& error) {
+    std::ifstream source(sourcePath.c_str());
+    if (!source) {
+        error = "cannot open " + sourcePath;
+        return false;
+    }
+    WorldBuilder builder;
+    if (!parseWorldDefinition(source, builder, error)) {
+        error = sourcePath + ": " + error;
+        return false;
+    }
+    std::vector<char> image;
+    builder.build(image);
+
+    std::ofstream output(imagePath.c_str(), std::ios::binary | std::ios::trunc);
+    output.write(&image[0], static_cast<std::streamsize>(image.size()));
+    if (!output) {
+        error = "cannot write " + imagePath;
+        return false;
+    }
+    return true;
+}
+
+// Checks that a world definition file describes the built-in world. Eldara is written
+// twice, as the tables in struct Eldara and as worlds/eldara.world, and both have to
+// build into the same image. Writes where they first differ to `error`.
+bool checkBuiltinWorld(const std::string& sourcePath, std::string& error) {
+    std::ifstream source(sourcePath.c_str());
+    if (!source) {
+        error = "cannot open " + sourcePath;
+        return false;
+    }
+    WorldBuilder fromFile;
+    if (!parseWorldDefinition(source, fromFile, error)) {
+        error = sourcePath + ": " + error;
+        return false;
+    }
+    WorldBuilder fromTables;
+    buildCompiledWorld<Eldara>(fromTables);
+    std::vector<char> fileImage, builtinImage;
+    fromFile.build(fileImage);
+    fromTables.build(builtinImage);
+
+    const WorldImageHeader* file = reinterpret_cast<const WorldImageHeader*>(&fileImage[0]);
+    const WorldImageHeader* builtin = reinterpret_cast<const WorldImageHeader*>(&builtinImage[0]);
+    if (file->checksum == builtin->checksum && fileImage == builtinImage) {
+        return true;
+    }
+    std::ostringstream message;
+    message << sourcePath << " and the built-in world differ";
+    for (int s = 0; s < SECTION_COUNT; ++s) {
+        if (file->sectionSize[s] != builtin->sectionSize[s]
+            || std::memcmp(&fileImage[file->sectionOffset[s]], &builtinImage[builtin->sectionOffset[s]], file->sectionSize[s]) != 0) {
+            message << ", first in image section " << s;
+            break;
+        }
+    }
+    error = message.str();
+    return false;
+}
+
+// Settings for the procedural world generator
+struct GeneratorOptions {
+    uint32_t rooms;       // Rooms to generate
+    unsigned seed;        // The same seed and settings always give the same world
+    double branching;     // Chance that a room opens off a random earlier room rather than the one before it
+    double loops;         // Chance that a room gets an extra passage to a nearby room
+    uint32_t locks;       // Locked regions, each opened with a key that lies outside it
+    double monsters;      // Share of rooms guarded by a monster
+    double villagers;     // Share of rooms with a villager to talk to
+    bool quest;           // Place the sword, the keys and a treasure to win
+    unsigned threads;     // Worker threads for planning; the world does not depend on it
+
+    GeneratorOptions()
+        : rooms(1000), seed(1), branching(0.3), loops(0.05), locks(3), monsters(0.02), villagers(0.02), quest(true), threads(1) {}
+};
+
+// Most locked regions a generated world can have: the solver tracks at most 32 items,
+// and every key counts along with the sword and the treasure
+const uint32_t GENERATOR_LOCK_LIMIT = 30;
+
+// Rooms planned by one task. Each chunk has its own random stream, so a world comes
+// out the same whichever thread plans which chunk.
+const uint32_t GENERATOR_CHUNK = 65536;
+
+// Random numbers for the generator: xorshift64*, seeded per chunk through splitmix64
+struct WorldRandom {
+    uint64_t state;
+
+    WorldRandom(uint64_t seed, uint64_t stream) {
+        uint64_t z = seed * 0x9E3779B97F4A7C15ull + stream * 0xD1B54A32D192ED03ull + 0x9E3779B97F4A7C15ull;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        state = (z ^ (z >> 31)) | 1;
+    }
+
+    uint32_t next() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return static_cast<uint32_t>((state * 2685821657736338717ull) >> 32);
+    }
+
+    // Uniform in [0, n)
+    uint32_t below(uint32_t n) { return static_cast<uint32_t>((static_cast<uint64_t>(next()) * n) >> 32); }
+
+    // Uniform in [0, 1)
+    double unit() { return next() / 4294967296.0; }
+};
+
+// Look of one kind of generated room. Texts use the world definition markup.
+struct GeneratorBiome {
+    const char* style;       // Style name, defined in generated world files
+    const char* parameters;  // Its SGR parameters
+    const char* name;        // Room names are this plus the room number
+    const char* description; // Shown on entry; the start of the detail, so the two share storage
+    const char* detail;      // Shown with 'look'
+};
+
+const GeneratorBiome GENERATOR_BIOMES[] = {
+    { "forest", "38;5;28", "Forest", "Tall pines crowd close around a narrow trail.",
+      "Tall pines crowd close around a narrow trail. Needles muffle your steps, and a woodpecker knocks somewhere out of sight." },
+    { "ruins", "38;5;137", "Ruins", "Broken columns lean over a courtyard of cracked flagstones.",
+      "Broken columns lean over a courtyard of cracked flagstones. Faded carvings of kings and serpents cover what is left of the walls." },
+    { "cave", "38;5;240", "Cave", "Water drips from the ceiling of a low, cold cave.",
+      "Water drips from the ceiling of a low, cold cave. Pale fungus glows faintly along the cracks in the rock." },
+    { "mountain", "38;5;248", "Pass", "A windswept pass winds between bare grey peaks.",
+      "A windswept pass winds between bare grey peaks. Cairns of stacked stones mark the way for travellers." },
+    { "valley", "38;5;106", "Meadow", "Long grass ripples across an open meadow.",
+      "Long grass ripples across an open meadow. Bees drift between clumps of clover, and a stream murmurs nearby." },
+    { "lake", "38;5;39", "Shore", "Still water laps at a pebbled shore.",
+      "Still water laps at a pebbled shore. Reeds sway in the shallows, and mist hangs low over the far bank." },
+    { "village", "38;5;180", "Hamlet", "A handful of cottages cluster around a well.",
+      "A handful of cottages cluster around a well. Washing flaps on a line, and a dog watches you from a doorway." },
+    { "marsh", "38;5;64", "Marsh", "Boardwalks cross a marsh of black pools and sedge.",
+      "Boardwalks cross a marsh of black pools and sedge. Frogs fall silent as you pass, then start up again behind you." }
+};
+const uint32_t GENERATOR_BIOME_COUNT = sizeof(GENERATOR_BIOMES) / sizeof(GENERATOR_BIOMES[0]);
+
+// What generated NPCs say; a room's NPC uses one line of its type
+const char* const GENERATOR_MONSTER_LINES[] = {
+    "{red}A snarling beast blocks the way!{reset}",
+    "{red}Something huge stirs in the shadows and growls.{reset}",
+    "{red}A troll plants its club in the ground and grins at you.{reset}"
+};
+const char* const GENERATOR_VILLAGER_LINES[] = {
+    "{cyan}\"Keys turn up in the oddest places. Look around carefully once you have one.\"{reset}",
+    "{cyan}\"The beasts hereabouts hoard whatever they find. Bring a blade.\"{reset}",
+    "{cyan}\"They say a treasure lies beyond the deepest of the locked doors.\"{reset}"
+};
+const uint32_t GENERATOR_LINE_COUNT = 3;
+
+// A generated world before it is built or written out. Rooms form a tree rooted
+// at room 0, in which every room's parent has a smaller id, plus a few extra passages.
+struct WorldPlan {
+    struct Passage {
+        RoomId from;
+        RoomId to;
+        uint8_t direction;   // Direction from `from` to `to`
+    };
+    std::vector<RoomId> parent;             // Room each room is entered from, NO_ROOM for room 0
+    std::vector<uint8_t> parentDirection;   // Direction from the parent into the room
+    std::vector<uint8_t> biome;             // Index into GENERATOR_BIOMES
+    std::vector<uint8_t> npc;               // NPCType of the room's NPC
+    std::vector<uint8_t> npcLine;           // Which line of its type the NPC says
+    std::vector<Passage> loops;             // Extra two-way passages
+    std::vector<RoomId> gates;              // Locked rooms in increasing order; gate i opens with key i + 1
+    std::vector<RoomId> keyRooms;           // Where each key lies, or the monster holding it waits
+    std::vector<uint8_t> keyHeld;           // Whether each key is dropped by the monster in its room
+    RoomId swordRoom;                       // NO_ROOM if the world has no quest
+    RoomId treasureRoom;
+    double planSeconds;
+
+    WorldPlan() : swordRoom(NO_ROOM), treasureRoom(NO_ROOM), planSeconds(0) {}
+
+    uint32_t roomCount() const { return static_cast<uint32_t>(parent.size()); }
+    bool isGate(RoomId room) const { return std::binary_search(gates.begin(), gates.end(), room); }
+};
+
+// Picks a direction that is free in a room (`fromUsed`) and whose opposite is free in
+// another (`toUsed`): the compass points first, from a random one, then up and down.
+// Returns DIRECTION_COUNT if there is none.
+unsigned freeDirection(uint8_t fromUsed, uint8_t toUsed, WorldRandom& rng) {
+    unsigned first = rng.below(4);
+    for (unsigned i = 0; i < DIRECTION_COUNT; ++i) {
+        unsigned dir = i < 4 ? (first + i) % 4 : i;
+        if ((fromUsed & (1u << dir)) == 0 && (toUsed & (1u << oppositeDirection(static_cast<Direction>(dir)))) == 0) {
+            return dir;
+        }
+    }
+    return DIRECTION_COUNT;
+}
+
+// Joins `room` to `parent` in the plan and marks the directions used
+void attachRoom(WorldPlan& plan, std::vector<uint8_t>& used, RoomId room, RoomId parent, unsigned dir) {
+    plan.parent[room] = parent;
+    plan.parentDirection[room] = static_cast<uint8_t>(dir);
+    used[parent] |= static_cast<uint8_t>(1u << dir);
+    used[room] |= static_cast<uint8_t>(1u << oppositeDirection(static_cast<Direction>(dir)));
+}
+
+// Plans the rooms of one chunk: a tree hanging from the chunk's first room, the
+// extra passages inside the chunk, and the rooms' looks and NPCs
+void planChunk(const GeneratorOptions& options, uint32_t chunk, WorldPlan& plan, std::vector<uint8_t>& used,
+               std::vector<WorldPlan::Passage>& loops) {
+    RoomId begin = chunk * GENERATOR_CHUNK;
+    RoomId end = static_cast<RoomId>(std::min<uint64_t>(options.rooms, static_cast<uint64_t>(begin) + GENERATOR_CHUNK));
+    WorldRandom rng(options.seed, chunk + 1);
+    if (chunk > 0) {
+        used[begin] = 1u << UP;  // Kept free for the passage from an earlier chunk
+    }
+    for (RoomId r = begin; r < end; ++r) {
+        if (r == begin) {
+            plan.biome[r] = static_cast<uint8_t>(rng.below(GENERATOR_BIOME_COUNT));
+        } else {
+            // Corridors grow from the previous room; branches open off any earlier room
+            RoomId candidate = rng.unit() < options.branching ? begin + rng.below(r - begin) : r - 1;
+            unsigned dir = freeDirection(used[candidate], used[r], rng);
+            while (dir == DIRECTION_COUNT) {
+                candidate = candidate > begin ? candidate - 1 : r - 1;
+                dir = freeDirection(used[candidate], used[r], rng);
+            }
+            attachRoom(plan, used, r, candidate, dir);
+            // Neighbouring rooms mostly share a look, so regions read as forests, caves and so on
+            plan.biome[r] = rng.unit() < 0.1 ? static_cast<uint8_t>(rng.below(GENERATOR_BIOME_COUNT)) : plan.biome[candidate];
+        }
+        double roll = rng.unit();
+        plan.npc[r] = r == 0 ? NO_NPC : roll < options.monsters ? MONSTER : roll < options.monsters + options.villagers ? VILLAGER : NO_NPC;
+        plan.npcLine[r] = static_cast<uint8_t>(rng.below(GENERATOR_LINE_COUNT));
+    }
+    for (RoomId r = begin + 2; r < end; ++r) {
+        if (rng.unit() < options.loops) {
+            RoomId other = r - 2 - rng.below(std::min<uint32_t>(r - begin - 1, 64));
+            unsigned dir = freeDirection(used[r], used[other], rng);
+            if (dir != DIRECTION_COUNT) {
+                WorldPlan::Passage loop = { r, other, static_cast<uint8_t>(dir) };
+                loops.push_back(loop);
+                used[r] |= static_cast<uint8_t>(1u << dir);
+                used[other] |= static_cast<uint8_t>(1u << oppositeDirection(static_cast<Direction>(dir)));
+            }
+        }
+    }
+}
+
+// Plans a world from the options. Chunks of rooms are planned in parallel and then
+// joined into one tree; locks, keys and the treasure are placed afterwards so that
+// the world can always be won: the key to a locked room always lies in a room with a
+// smaller id, which is never behind that lock or any lock opened later.
+bool planWorld(const GeneratorOptions& options, WorldPlan& plan, std::string& error) {
+    if (options.rooms == 0 || options.rooms > 0x7FFFFFFFu) {
+        error = "a generated world needs between 1 and 2147483647 rooms";
+        return false;
+    }
+    if (options.locks > GENERATOR_LOCK_LIMIT) {
+        std::ostringstream message;
+        message << "a generated world can have at most " << GENERATOR_LOCK_LIMIT << " locked regions";
+        error = message.str();
+        return false;
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    const uint32_t n = options.rooms;
+    plan = WorldPlan();
+    plan.parent.assign(n, NO_ROOM);
+    plan.parentDirection.assign(n, 0);
+    plan.biome.assign(n, 0);
+    plan.npc.assign(n, NO_NPC);
+    plan.npcLine.assign(n, 0);
+    std::vector<uint8_t> used(n, 0);  // Directions already taken in each room
+
+    const uint32_t chunks = (n + GENERATOR_CHUNK - 1) / GENERATOR_CHUNK;
+    std::vector<std::vector<WorldPlan::Passage> > chunkLoops(chunks);
+    unsigned workers = std::max(1u, std::min<unsigned>(options.threads, chunks));
+    if (workers == 1) {
+        for (uint32_t c = 0; c < chunks; ++c) {
+            planChunk(options, c, plan, used, chunkLoops[c]);
+        }
+    } else {
+        std::vector<std::thread> threads;
+        for (unsigned t = 0; t < workers; ++t) {
+            threads.push_back(std::thread([&options, &plan, &used, &chunkLoops, chunks, workers, t]() {
+                for (uint32_t c = t; c < chunks; c += workers) {
+                    planChunk(options, c, plan, used, chunkLoops[c]);
+                }
+            }));
+        }
+        for (size_t t = 0; t < threads.size(); ++t) {
+            threads[t].join();
+        }
+    }
+
+    // Hang each chunk's first room off a room of an earlier chunk
+    WorldRandom rng(options.seed, 0);
+    for (uint32_t c = 1; c < chunks; ++c) {
+        RoomId root = c * GENERATOR_CHUNK;
+        used[root] &= static_cast<uint8_t>(~(1u << UP));
+        RoomId candidate = rng.below(root);
+        unsigned dir = freeDirection(used[candidate], used[root], rng);
+        while (dir == DIRECTION_COUNT) {
+            candidate = candidate > 0 ? candidate - 1 : root - 1;
+            dir = freeDirection(used[candidate], used[root], rng);
+        }
+        attachRoom(plan, used, root, candidate, dir);
+    }
+
+    // Lock the rooms at the top of a few large subtrees. Parents have smaller ids than
+    // their children, so one backward pass sums the subtree sizes.
+    std::vector<uint32_t> subtree(n, 1);
+    for (RoomId r = n - 1; r > 0; --r) {
+        subtree[plan.parent[r]] += subtree[r];
+    }
+    if (options.quest && options.locks > 0) {
+        uint32_t threshold = std::max<uint32_t>(2, n / (options.locks * 4));
+        std::vector<RoomId> candidates;
+        for (RoomId r = 1; r < n; ++r) {
+            if (subtree[r] >= threshold) {
+                candidates.push_back(r);
+            }
+        }
+        for (uint32_t i = 0; i < options.locks && i < candidates.size(); ++i) {
+            std::swap(candidates[i], candidates[i + rng.below(static_cast<uint32_t>(candidates.size() - i))]);
+            plan.gates.push_back(candidates[i]);
+        }
+        std::sort(plan.gates.begin(), plan.gates.end());
+    }
+    std::vector<uint32_t>().swap(subtree);
+
+    // Which locked region each room is in (0 for none, else the gate's index + 1),
+    // how many locks lie on the way to it, and how far it is from the start
+    std::vector<uint8_t> region(n, 0);
+    std::vector<uint8_t> locksAbove(n, 0);
+    std::vector<uint32_t> depth(n, 0);
+    for (RoomId r = 1, g = 0; r < n; ++r) {
+        RoomId p = plan.parent[r];
+        bool gate = g < plan.gates.size() && plan.gates[g] == r;
+        region[r] = gate ? static_cast<uint8_t>(++g) : region[p];
+        locksAbove[r] = static_cast<uint8_t>(locksAbove[p] + (gate ? 1 : 0));
+        depth[r] = depth[p] + 1;
+    }
+
+    // Extra passages stay inside one region, so none of them gets around a lock
+    for (uint32_t c = 0; c < chunks; ++c) {
+        for (size_t i = 0; i < chunkLoops[c].size(); ++i) {
+            const WorldPlan::Passage& loop = chunkLoops[c][i];
+            if (region[loop.from] == region[loop.to]) {
+                plan.loops.push_back(loop);
+            }
+        }
+    }
+
+    if (options.quest) {
+        // The sword lies outside every locked region, so the monsters holding keys can be beaten
+        plan.swordRoom = 0;
+        for (int tries = 0; tries < 64 && n > 1; ++tries) {
+            RoomId r = 1 + rng.below(n - 1);
+            if (region[r] == 0) {
+                plan.swordRoom = r;
+                break;
+            }
+        }
+        // Each key lies in a room before its gate, held by a monster when one of the candidates has one
+        for (size_t k = 0; k < plan.gates.size(); ++k) {
+            RoomId gate = plan.gates[k];
+            RoomId room = rng.below(gate);
+            for (int tries = 0; tries < 8 && plan.npc[room] != MONSTER; ++tries) {
+                RoomId other = rng.below(gate);
+                if (plan.npc[other] == MONSTER) {
+                    room = other;
+                }
+            }
+            plan.keyRooms.push_back(room);
+            plan.keyHeld.push_back(plan.npc[room] == MONSTER ? 1 : 0);
+        }
+        // The treasure lies behind as many locks as possible, and as far from the start as possible
+        plan.treasureRoom = 0;
+        for (RoomId r = 1; r < n; ++r) {
+            RoomId best = plan.treasureRoom;
+            if (locksAbove[r] > locksAbove[best] || (locksAbove[r] == locksAbove[best] && depth[r] > depth[best])) {
+                plan.treasureRoom = r;
+            }
+        }
+    }
+    plan.planSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return true;
+}
+
+// Name of the room a plan gives `room`, e.g. "Forest 12"
+std::string generatedRoomName(const WorldPlan& plan, RoomId room) {
+    return std::string(GENERATOR_BIOMES[plan.biome[room]].name) + " " + std::to_string(room);
+}
+
+// Texts of the generated items and rules, in world definition markup
+std::string generatedKeySeen(const WorldPlan& plan, size_t key) {
+    return "{bold}{yellow}A small iron key marked " + std::to_string(key + 1) + " lies here. It opens a hidden door in "
+         + generatedRoomName(plan, plan.parent[plan.gates[key]]) + ".{reset}";
+}
+std::string generatedKeyTaken(size_t key) {
+    return "{bold}{yellow}You take key " + std::to_string(key + 1) + ".{reset}";
+}
+std::string generatedKeyDropped(const WorldPlan& plan, size_t key) {
+    return "{bold}{yellow}The monster drops key " + std::to_string(key + 1) + ". It opens a hidden door in "
+         + generatedRoomName(plan, plan.parent[plan.gates[key]]) + ".{reset}";
+}
+std::string generatedDoorOpens(const WorldPlan& plan, size_t key) {
+    return std::string("{bold}{cyan}Key ") + std::to_string(key + 1) + " fits a lock hidden in the "
+         + directionToString(static_cast<Direction>(plan.parentDirection[plan.gates[key]])) + " wall. A door swings open.{reset}";
+}
+const char* const GENERATED_SWORD_SEEN = "{bold}{green}There is a sword here that you can take.{reset}";
+const char* const GENERATED_SWORD_TAKEN = "{bold}{green}You take the sword. Now you can fight monsters!{reset}";
+const char* const GENERATED_TREASURE_SEEN = "{bold}{yellow}There is a treasure chest here!{reset}";
+const char* const GENERATED_TREASURE_TAKEN = "{bold}{green}You have taken the treasure!{reset}";
+
+// Styles known to generated worlds: the built-in ones and one per biome
+std::map<std::string, std::string> generatorStyles() {
+    std::map<std::string, std::string> styles;
+    styles["reset"] = GameColors::reset;
+    styles["bold"] = GameColors::bold;
+    styles["red"] = GameColors::red;
+    styles["green"] = GameColors::green;
+    styles["yellow"] = GameColors::yellow;
+    styles["cyan"] = GameColors::cyan;
+    for (uint32_t b = 0; b < GENERATOR_BIOME_COUNT; ++b) {
+        styles[GENERATOR_BIOMES[b].style] = std::string("\033[") + GENERATOR_BIOMES[b].parameters + "m";
+    }
+    return styles;
+}
+
+// Adds a planned world to a builder. Shared texts are expanded and stored once; only
+// the room names are built per room, and they are stored without interning since
+// every one is different.
+void buildGeneratedWorld(const WorldPlan& plan, WorldBuilder& builder) {
+    std::map<std::string, std::string> styles = generatorStyles();
+    std::string error;
+    struct Look {
+        std::string prefix;
+        TextRef description, detail;
+    };
+    std::vector<Look> looks(GENERATOR_BIOME_COUNT);
+    for (uint32_t b = 0; b < GENERATOR_BIOME_COUNT; ++b) {
+        const GeneratorBiome& biome = GENERATOR_BIOMES[b];
+        std::string description, detail;
+        looks[b].prefix = styles[biome.style] + GameColors::bold + biome.name + " ";
+        expandWorldText(std::string("{") + biome.style + "}" + biome.description + "{reset}", styles, description, error);
+        expandWorldText(std::string("{") + biome.style + "}" + biome.detail + "{reset}", styles, detail, error);
+        looks[b].detail = builder.addText(detail);
+        looks[b].description = builder.addText(description, &looks[b].detail);
+    }
+    std::string lines[2][GENERATOR_LINE_COUNT];
+    for (uint32_t i = 0; i < GENERATOR_LINE_COUNT; ++i) {
+        expandWorldText(GENERATOR_MONSTER_LINES[i], styles, lines[0][i], error);
+        expandWorldText(GENERATOR_VILLAGER_LINES[i], styles, lines[1][i], error);
+    }
+
+    const uint32_t n = plan.roomCount();
+    builder.roomLocked.reserve(builder.roomCount() + n);
+    builder.roomNpc.reserve(builder.roomCount() + n);
+    builder.roomName.reserve(builder.roomCount() + n);
+    builder.roomDescription.reserve(builder.roomCount() + n);
+    builder.roomDetail.reserve(builder.roomCount() + n);
+    const RoomId first = builder.roomCount();
+    std::string name;
+    for (RoomId r = 0; r < n; ++r) {
+        const Look& look = looks[plan.biome[r]];
+        name.assign(look.prefix);
+        name += std::to_string(r);
+        name += GameColors::reset;
+        builder.addRoom(builder.addText(name, nullptr, false), look.description, look.detail);
+        if (plan.npc[r] != NO_NPC) {
+            builder.addNPC(first + r, static_cast<NPCType>(plan.npc[r]), lines[plan.npc[r] == MONSTER ? 0 : 1][plan.npcLine[r]]);
+        }
+    }
+    for (RoomId r = 1; r < n; ++r) {
+        builder.connect(first + plan.parent[r], static_cast<Direction>(plan.parentDirection[r]), first + r, plan.isGate(r) ? EDGE_HIDDEN : 0);
+    }
+    for (size_t i = 0; i < plan.loops.size(); ++i) {
+        builder.connect(first + plan.loops[i].from, static_cast<Direction>(plan.loops[i].direction), first + plan.loops[i].to);
+    }
+    builder.startRoom = first;
+
+    if (plan.treasureRoom == NO_ROOM) {
+        return;
+    }
+    std::string seen, taken;
+    expandWorldText(GENERATED_SWORD_SEEN, styles, seen, error);
+    expandWorldText(GENERATED_SWORD_TAKEN, styles, taken, error);
+    ItemId sword = builder.addItem("sword", seen, taken, std::string(), ITEM_WEAPON);
+    builder.placeItem(first + plan.swordRoom, sword);
+    for (size_t k = 0; k < plan.gates.size(); ++k) {
+        expandWorldText(generatedKeySeen(plan, k), styles, seen, error);
+        expandWorldText(generatedKeyTaken(k), styles, taken, error);
+        ItemId key = builder.addItem("key" + std::to_string(k + 1), seen, taken);
+        RoomId gate = first + plan.gates[k];
+        RoomId door = first + plan.parent[plan.gates[k]];
+        builder.roomLocked[gate] = 1;
+        std::string message;
+        if (plan.keyHeld[k]) {
+            builder.addRule(first + plan.keyRooms[k], VERB_FIGHT);
+            builder.addRuleOp(RULE_MONSTER_HERE);
+            builder.addRuleOp(RULE_HAS_ITEM, sword);
+            builder.addRuleOp(RULE_GIVE_ITEM, key);
+            expandWorldText(generatedKeyDropped(plan, k), styles, message, error);
+            builder.addRulePrint(message);
+        } else {
+            builder.placeItem(first + plan.keyRooms[k], key);
+        }
+        builder.addRule(door, VERB_LOOK);
+        builder.addRuleOp(RULE_HAS_ITEM, key);
+        expandWorldText(generatedDoorOpens(plan, k), styles, message, error);
+        builder.addRulePrint(message);
+        builder.addRuleOp(RULE_REVEAL_EXIT, plan.parentDirection[plan.gates[k]]);
+        builder.addRuleOp(RULE_UNLOCK_ROOM, gate);
+    }
+    expandWorldText(GENERATED_TREASURE_SEEN, styles, seen, error);
+    expandWorldText(GENERATED_TREASURE_TAKEN, styles, taken, error);
+    builder.placeItem(first + plan.treasureRoom, builder.addItem("treasure", seen, taken, std::string(), ITEM_GOAL));
+}
+
+// Writes a planned world as a world definition file, which --compile-world turns
+// into the same world buildGeneratedWorld() builds
+void writeGeneratedWorld(const WorldPlan& plan, const GeneratorOptions& options, std::ostream& out) {
+    const char* const npcTypes[] = { "", "villager", "monster" };
+    out << "# Generated world: " << plan.roomCount() << " rooms, seed " << options.seed << ", branching " << options.branching
+        << ", loops " << options.loops << ", " << plan.gates.size() << " locked regions, monsters " << options.monsters
+        << ", villagers " << options.villagers << "\n\n";
+    for (uint32_t b = 0; b < GENERATOR_BIOME_COUNT; ++b) {
+        out << "style " << GENERATOR_BIOMES[b].style << " " << GENERATOR_BIOMES[b].parameters << "\n";
+    }
+    if (plan.treasureRoom != NO_ROOM) {
+        out << "\nobject sword weapon\n  seen " << GENERATED_SWORD_SEEN << "\n  taken " << GENERATED_SWORD_TAKEN << "\n";
+        for (size_t k = 0; k < plan.gates.size(); ++k) {
+            out << "object key" << k + 1 << "\n  seen " << generatedKeySeen(plan, k) << "\n  taken " << generatedKeyTaken(k) << "\n";
+        }
+        out << "object treasure goal\n  seen " << GENERATED_TREASURE_SEEN << "\n  taken " << GENERATED_TREASURE_TAKEN << "\n";
+    }
+
+    for (RoomId r = 0; r < plan.roomCount(); ++r) {
+        const GeneratorBiome& biome = GENERATOR_BIOMES[plan.biome[r]];
+        out << "\nroom r" << r << "\n"
+            << "  name {" << biome.style << "}{bold}" << biome.name << " " << r << "{reset}\n"
+            << "  desc {" << biome.style << "}" << biome.description << "{reset}\n"
+            << "  look {" << biome.style << "}" << biome.detail << "{reset}\n";
+        if (plan.npc[r] != NO_NPC) {
+            out << "  npc " << npcTypes[plan.npc[r]] << " "
+                << (plan.npc[r] == MONSTER ? GENERATOR_MONSTER_LINES : GENERATOR_VILLAGER_LINES)[plan.npcLine[r]] << "\n";
+        }
+        if (r == plan.swordRoom) {
+            out << "  item sword\n";
+        }
+        for (size_t k = 0; k < plan.keyRooms.size(); ++k) {
+            if (plan.keyRooms[k] == r && !plan.keyHeld[k]) {
+                out << "  item key" << k + 1 << "\n";
+            }
+        }
+        if (r == plan.treasureRoom) {
+            out << "  item treasure\n";
+        }
+        if (plan.isGate(r)) {
+            out << "  locked\n";
+        }
+    }
+
+    out << "\n";
+    for (RoomId r = 1; r < plan.roomCount(); ++r) {
+        out << "exit r" << plan.parent[r] << " " << directionToString(static_cast<Direction>(plan.parentDirection[r])) << " r" << r
+            << (plan.isGate(r) ? " hidden\n" : "\n");
+    }
+    for (size_t i = 0; i < plan.loops.size(); ++i) {
+        out << "exit r" << plan.loops[i].from << " " << directionToString(static_cast<Direction>(plan.loops[i].direction))
+            << " r" << plan.loops[i].to << "\n";
+    }
+
+    for (size_t k = 0; k < plan.gates.size(); ++k) {
+        if (plan.keyHeld[k]) {
+            out << "\nrule r" << plan.keyRooms[k] << " fight\n  if monster\n  if has sword\n  then give key" << k + 1
+                << "\n  then print " << generatedKeyDropped(plan, k) << "\n";
+        }
+        out << "\nrule r" << plan.parent[plan.gates[k]] << " look\n  if has key" << k + 1 << "\n  then print " << generatedDoorOpens(plan, k)
+            << "\n  then reveal " << directionToString(static_cast<Direction>(plan.parentDirection[plan.gates[k]]))
+            << "\n  then unlock r" << plan.gates[k] << "\n";
+    }
+    out << "\nstart r0\n";
+}
+
+// Plain generated world for benchmarks that add their own content: no NPCs, locks or items
+void buildBenchmarkWorld(WorldBuilder& builder, uint32_t rooms, unsigned seed) {
+    GeneratorOptions options;
+    options.rooms = rooms;
+    options.seed = seed;
+    options.monsters = 0;
+    options.villagers = 0;
+    options.locks = 0;
+    options.quest = false;
+    options.threads = std::max(1u, std::thread::hardware_concurrency());
+    WorldPlan plan;
+    std::string error;
+    planWorld(options, plan, error);
+    buildGeneratedWorld(plan, builder);
+}
+
+// Generates a world and writes it to `path`: a world definition file if the name ends
+// in ".world", otherwise a compiled world image. Prints what was generated.
+int runGenerator(std::ostream& out, const GeneratorOptions& options, const std::string& path) {
+    typedef std::chrono::steady_clock Clock;
+    WorldPlan plan;
+    std::string error;
+    if (!planWorld(options, plan, error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    Clock::time_point start = Clock::now();
+    bool source = path.size() >= 6 && path.compare(path.size() - 6, 6, ".world") == 0;
+    std::ofstream output(path.c_str(), std::ios::binary | std::ios::trunc);
+    if (source) {
+        writeGeneratedWorld(plan, options, output);
+    } else {
+        std::vector<char> image;
+        {
+            WorldBuilder builder;
+            buildGeneratedWorld(plan, builder);
+            builder.build(image);
+        }
+        output.write(&image[0], static_cast<std::streamsize>(image.size()));
+    }
+    output.close();
+    if (!output) {
+        std::cerr << "cannot write " << path << std::endl;
+        return 1;
+    }
+    double writeSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    uint32_t monsters = 0, villagers = 0;
+    for (RoomId r = 0; r < plan.roomCount(); ++r) {
+        monsters += plan.npc[r] == MONSTER ? 1 : 0;
+        villagers += plan.npc[r] == VILLAGER ? 1 : 0;
+    }
+    uint32_t held = 0;
+    for (size_t k = 0; k < plan.keyHeld.size(); ++k) {
+        held += plan.keyHeld[k];
+    }
+    out << "Generated " << path << " (seed " << options.seed << ")\n"
+        << "  rooms:        " << plan.roomCount() << ", " << plan.roomCount() - 1 + plan.loops.size() << " passages ("
+        << plan.loops.size() << " closing loops)\n"
+        << "  locks:        " << plan.gates.size() << " locked regions, " << held << " keys held by monsters\n"
+        << "  npcs:         " << monsters << " monsters, " << villagers << " villagers\n"
+        << "  plan:         " << plan.planSeconds * 1000.0 << " ms on " << std::max(1u, options.threads) << " threads\n"
+        << "  " << (source ? "write:" : "build:") << "        " << writeSeconds * 1000.0 << " ms" << std::endl;
+    return 0;
+}
+
+// Displays the command menu, shown on the title screen and by the help command
+void showCommandMenu(std::ostream& out) {
+    out << GameColors::bold
+        << "┌─────────────── "
+        << GameColors::yellow << "Commands"
+        << GameColors::cyan << " ───────────────┐\n"
+        << "│ " << GameColors::green << "▶ n, s, e, w"
+        << GameColors::cyan << ": Movement                │\n"
+        << "│ " << GameColors::green << "▶ go <room>"
+        << GameColors::cyan << ": Walk to a room           │\n"
+        << "│ " << GameColors::blue << "▶ path <room>"
+        << GameColors::cyan << ": Show the way to a room │\n"
+        << "│ " << GameColors::yellow << "▶ take [item]"
+        << GameColors::cyan << ": Pick up items          │\n"
+        << "│ " << GameColors::yellow << "▶ drop <item>"
+        << GameColors::cyan << ": Put an item down       │\n"
+        << "│ " << GameColors::green << "▶ i, inventory"
+        << GameColors::cyan << ": List what you carry   │\n"
+        << "│ " << GameColors::blue << "▶ look"
+        << GameColors::cyan << ": Look around the room          │\n"
+        << "│ " << GameColors::blue << "▶ search <words>"
+        << GameColors::cyan << ": Find mentions       │\n"
+        << "│ " << GameColors::magenta << "▶ hint"
+        << GameColors::cyan << ": Suggest what to do next       │\n"
+        << "│ " << GameColors::blue << "▶ talk"
+        << GameColors::cyan << ": Speak with characters         │\n"
+        << "│ " << GameColors::red << "▶ fight"
+        << GameColors::cyan << ": Battle monsters              │\n"
+        << "│ " << GameColors::green << "▶ n; e; 3s"
+        << GameColors::cyan << ": Run several commands      │\n"
+        << "│ " << GameColors::yellow << "▶ define <name> <cmds>"
+        << GameColors::cyan << ": Macros        │\n"
+        << "│ " << GameColors::magenta << "▶ help"
+        << GameColors::cyan << ": Show commands                 │\n"
+        << "│ " << GameColors::green << "▶ save, load"
+        << GameColors::cyan << ": Keep your progress      │\n"
+        << "│ " << GameColors::magenta << "▶ undo, rewind <n>"
+        << GameColors::cyan << ": Go back turns     │\n"
+        << "│ " << GameColors::yellow << "▶ quit"
+        << GameColors::cyan << ": Exit game                     │\n"
+        << "└────────────────────────────────────────┘"
+        << GameColors::reset << "\n";
+}
+
+// Displays the title banner, story introduction and command menu
+void showTitleScreen(std::ostream& out) {
+    // Display welcome banner using Unicode block characters
+    out << GameColors::bold << GameColors::cyan;
+    out << R"(
+█████╗    ██████╗  ██╗   ██╗ ███████╗ ███╗   ██╗ ████████╗ ██╗   ██╗ ██████╗  ███████╗
+██╔══██╗  ██╔══██╗ ██║   ██║ ██╔════╝ ████╗  ██║ ╚══██╔══╝ ██║   ██║ ██╔══██╗ ██╔════╝
+███████║  ██║  ██║ ██║   ██║ █████╗   ██╔██╗ ██║    ██║    ██║   ██║ ██████╔╝ █████╗  
+██╔══██║  ██║  ██║ ╚██╗ ██╔╝ ██╔══╝   ██║╚██╗██║    ██║    ██║   ██║ ██╔══██╗ ██╔══╝  
+██║  ██║  ██████╔╝  ╚████╔╝  ███████╗ ██║ ╚████║    ██║    ╚██████╔╝ ██║  ██║ ███████╗
+╚═╝  ╚═╝  ╚═════╝    ╚═══╝   ╚══════╝ ╚═╝  ╚═══╝    ╚═╝     ╚═════╝  ╚═╝  ╚═╝ ╚══════╝
+)" << GameColors::reset << "\n";
+
+    // Display welcome message and game introduction
+    out << GameColors::bold << GameColors::magenta << R"(
+╔═══════════════════════════════════════════╗
+║           Welcome to the Adventure!       ║
+╚═══════════════════════════════════════════╝
+)" << GameColors::reset << "\n";
+
+    // Display story introduction with colored text
+    out << GameColors::bold << GameColors::forestColor 
+         << "Welcome to the mystical realm of " << GameColors::cyan << "Eldara" << GameColors::forestColor 
+         << ", where ancient magic flows through emerald forests" << "\n"
+         << "and " << GameColors::lakeColor << "crystalline lakes shimmer with otherworldly light" << GameColors::forestColor << ". Hidden within this enchanted land lies a" << "\n"
+         << GameColors::yellow << "legendary treasure" << GameColors::forestColor << ", sought after by brave adventurers for centuries." << "\n\n"
+         << "As you journey through the " << GameColors::forestColor << "whispering woods" << " and " << GameColors::ruinsColor << "crumbling ruins" << GameColors::forestColor << ", you'll encounter " << GameColors::villageColor << "friendly villagers" << "\n" 
+         << GameColors::forestColor << "who hold age-old secrets, and " << GameColors::red << "fearsome creatures" << GameColors::forestColor << " who guard sacred places. The very air tingles with" << "\n"
+         << GameColors::magenta << "arcane energy" << GameColors::forestColor << ", while " << GameColors::caveColor << "mysterious caves" << GameColors::forestColor << " and " << GameColors::mountainColor << "towering mountains" << GameColors::forestColor << " beckon you to explore their depths." << "\n\n"
+         << "Your quest will test both your " << GameColors::red << "courage" << GameColors::forestColor << " and " << GameColors::blue << "wisdom" << GameColors::forestColor << " as you unravel the mysteries of this magical realm." << "\n"
+         << "The " << GameColors::yellow << "treasure" << GameColors::forestColor << " awaits those pure of heart and sharp of mind - will you be the one to discover its" << "\n"
+         << "resting place?" << GameColors::reset << "\n";
+    
+    showCommandMenu(out);
+}
+
+// Displays the command prompt box
+void showPrompt(std::ostream& out) {
+    out << "\n" << GameColors::bold << GameColors::blue << "┌─────────────────────┐" << "\n"
+        << "│  Enter a command:   │" << "\n"
+        << "└─────────────────────┘" << GameColors::reset << "\n";
+}
+
+// Phases of a turn measured by the engine instrumentation
+enum StatPhase {
+    PHASE_READ = 0,   // Waiting for and reading the command line
+    PHASE_MATCH,      // Splitting the line and looking the verb up
+    PHASE_HANDLE,     // Rules, the handler, wandering NPCs and the save journal
+    PHASE_RENDER,     // Describing the room and the prompt
+    PHASE_FLUSH,      // Writing the frame out
+    PHASE_TURN,       // Everything from matching the command to the end of the flush
+    PHASE_COUNT
+};
+
+const char* const STAT_PHASE_NAMES[PHASE_COUNT] = { "read", "match", "handle", "render", "flush", "turn" };
+
+// Clock for the probes: the time-stamp counter where there is one, since it costs a
+// few nanoseconds to read; steady_clock nanoseconds elsewhere; nothing when compiled out
+#if ENGINE_STATS && (defined(__x86_64__) || defined(__i386__))
+inline uint64_t statTicks() { return __rdtsc(); }
+#elif ENGINE_STATS
+inline uint64_t statTicks() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+#else
+inline uint64_t statTicks() { return 0; }
+#endif
+
+// Adds to a counter that only its own thread writes; other threads may read it at any time
+inline void bumpCounter(std::atomic<uint64_t>& counter, uint64_t amount) {
+    counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+// Latency histogram with HDR-style log-linear buckets: values below 32 have a bucket
+// each, and every power of two above that is split into 16 buckets, so a value is
+// never more than 1/16 above the floor of its bucket. Recording is a bit scan and
+// two stores, with no allocation and no lock.
+class LatencyHistogram {
+public:
+    static const unsigned BUCKETS = 976;    // Enough for any 64-bit value
+    std::atomic<uint64_t> counts[BUCKETS];
+    std::atomic<uint64_t> total;            // Sum of every recorded value
+    std::atomic<uint64_t> largest;
+
+    LatencyHistogram() {
+        for (unsigned b = 0; b < BUCKETS; ++b) {
+            counts[b].store(0, std::memory_order_relaxed);
+        }
+        total.store(0, std::memory_order_relaxed);
+        largest.store(0, std::memory_order_relaxed);
+    }
+
+    static unsigned bucketOf(uint64_t value) {
+        unsigned exponent = 63 - __builtin_clzll(value | 1);
+        return exponent < 4 ? static_cast<unsigned>(value) : (exponent - 3) * 16 + static_cast<unsigned>((value >> (exponent - 4)) & 15);
+    }
+
+    // Smallest value that falls in a bucket
+    static uint64_t bucketFloor(unsigned bucket) {
+        return bucket < 32 ? bucket : (16ull + bucket % 16) << (bucket / 16 - 1);
+    }
+
+    void record(uint64_t value) {
+        bumpCounter(counts[bucketOf(value)], 1);
+        bumpCounter(total, value);
+        if (value > largest.load(std::memory_order_relaxed)) {
+            largest.store(value, std::memory_order_relaxed);
+        }
+    }
+};
+
+const unsigned LatencyHistogram::BUCKETS;
+
+// One thread's instrumentation buffer. Only the owning thread writes it; the stats
+// command and the dumps read every thread's buffer while holding the registry lock.
+class EngineStats {
+public:
+    static const unsigned VERB_LIMIT = 64;   // Verbs with their own counters; verb 0 is "unknown"
+
+    LatencyHistogram phases[PHASE_COUNT];
+    std::atomic<uint64_t> verbCount[VERB_LIMIT];
+    std::atomic<uint64_t> verbTicks[VERB_LIMIT];   // Time spent handling each verb
+    std::atomic<uint64_t>* roomVisits;             // Turns ended in each room
+    uint32_t roomSlots;
+
+    EngineStats() : roomVisits(nullptr), roomSlots(0) {
+        for (unsigned v = 0; v < VERB_LIMIT; ++v) {
+            verbCount[v].store(0, std::memory_order_relaxed);
+            verbTicks[v].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    ~EngineStats() {
+        delete[] roomVisits;
+    }
+
+    // This thread's buffer, registered on first use. The registry owns the buffers and
+    // keeps them until exit, so threads that have finished, such as playtest workers,
+    // still count in a dump.
+    static EngineStats& local();
+
+    void visit(RoomId room, uint32_t rooms);
+};
+
+const unsigned EngineStats::VERB_LIMIT;
+
+// Every thread's buffer, plus what is needed to read them
+struct StatsRegistry {
+    std::mutex lock;                         // Held to register a buffer, grow room counts or read
+    std::vector<std::unique_ptr<EngineStats> > buffers;
+    std::vector<std::string> verbNames;      // Indexed by CommandEntry::statVerb
+    uint64_t startTicks;                     // statTicks() and steady_clock when the registry was
+    std::chrono::steady_clock::time_point startTime;  // created, to convert ticks to nanoseconds
+
+    StatsRegistry() : verbNames(1, "(unknown)"), startTicks(statTicks()), startTime(std::chrono::steady_clock::now()) {}
+};
+
+StatsRegistry& statsRegistry() {
+    static StatsRegistry registry;
+    return registry;
+}
+
+// Nanoseconds per statTicks() tick, from the time since the registry was created. Once
+// that is long enough to measure well the rate is cached; until then each call measures
+// the shorter span instead of waiting. Needs no lock, as the start fields never change.
+double statNanosPerTick() {
+#if ENGINE_STATS && (defined(__x86_64__) || defined(__i386__))
+    static std::atomic<double> cached(0.0);
+    double rate = cached.load(std::memory_order_relaxed);
+    if (rate == 0.0) {
+        const StatsRegistry& registry = statsRegistry();
+        double nanos = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - registry.startTime).count();
+        uint64_t ticks = statTicks() - registry.startTicks;
+        if (ticks == 0) {
+            return 1.0;
+        }
+        rate = nanos / ticks;
+        if (nanos >= 5e6) {
+            cached.store(rate, std::memory_order_relaxed);
+        }
+    }
+    return rate;
+#else
+    return 1.0;
+#endif
+}
+
+EngineStats& EngineStats::local() {
+    static thread_local EngineStats* buffer = nullptr;
+    if (buffer == nullptr) {
+        StatsRegistry& registry = statsRegistry();
+        std::unique_ptr<EngineStats> owned(new EngineStats);
+        buffer = owned.get();
+        std::lock_guard<std::mutex> guard(registry.lock);
+        registry.buffers.push_back(std::move(owned));
+    }
+    return *buffer;
+}
+
+void EngineStats::visit(RoomId room, uint32_t rooms) {
+    if (room >= roomSlots) {
+        // Rare: the first turn in a world, or a larger world than before
+        std::lock_guard<std::mutex> guard(statsRegistry().lock);
+        uint32_t slots = std::max(rooms, room + 1);
+        std::atomic<uint64_t>* grown = new std::atomic<uint64_t>[slots];
+        for (uint32_t r = 0; r < slots; ++r) {
+            grown[r].store(r < roomSlots ? roomVisits[r].load(std::memory_order_relaxed) : 0, std::memory_order_relaxed);
+        }
+        delete[] roomVisits;
+        roomVisits = grown;
+        roomSlots = slots;
+    }
+    bumpCounter(roomVisits[room], 1);
+}
+
+// Names the counters of a verb for reports
+void nameStatVerb(unsigned verb, const std::string& name) {
+    StatsRegistry& registry = statsRegistry();
+    std::lock_guard<std::mutex> guard(registry.lock);
+    if (verb >= registry.verbNames.size()) {
+        registry.verbNames.resize(verb + 1);
+    }
+    registry.verbNames[verb] = name;
+}
+
+// The probes. Built with -DENGINE_STATS=0 they are empty and, with statTicks()
+// returning 0, the compiler removes them along with the arithmetic around them.
+#if ENGINE_STATS
+inline void recordPhase(StatPhase phase, uint64_t ticks) {
+    EngineStats::local().phases[phase].record(ticks);
+}
+
+inline void recordVerb(unsigned verb, uint64_t ticks) {
+    EngineStats& stats = EngineStats::local();
+    verb = verb < EngineStats::VERB_LIMIT ? verb : 0;
+    bumpCounter(stats.verbCount[verb], 1);
+    bumpCounter(stats.verbTicks[verb], ticks);
+}
+
+inline void recordVisit(RoomId room, uint32_t rooms) {
+    EngineStats::local().visit(room, rooms);
+}
+#else
+inline void recordPhase(StatPhase, uint64_t) {}
+inline void recordVerb(unsigned, uint64_t) {}
+inline void recordVisit(RoomId, uint32_t) {}
+#endif
+
+// Every thread's buffer added together
+struct StatsTotals {
+    std::vector<uint64_t> phaseCounts[PHASE_COUNT];   // Histogram buckets
+    uint64_t phaseTotal[PHASE_COUNT];
+    uint64_t phaseLargest[PHASE_COUNT];
+    uint64_t verbCount[EngineStats::VERB_LIMIT];
+    uint64_t verbTicks[EngineStats::VERB_LIMIT];
+    std::vector<uint64_t> roomVisits;
+    std::vector<std::string> verbNames;
+    size_t threads;
+    double nanosPerTick;
+
+    // Number of values recorded for a phase
+    uint64_t count(unsigned phase) const {
+        uint64_t n = 0;
+        for (unsigned b = 0; b < LatencyHistogram::BUCKETS; ++b) {
+            n += phaseCounts[phase][b];
+        }
+        return n;
+    }
+
+    // Percentile (0-100) of a phase in nanoseconds: the floor of the bucket it falls in
+    double percentile(unsigned phase, double pct) const {
+        uint64_t n = count(phase);
+        uint64_t rank = static_cast<uint64_t>(pct / 100.0 * (n > 0 ? n - 1 : 0) + 0.5);
+        uint64_t seen = 0;
+        for (unsigned b = 0; b < LatencyHistogram::BUCKETS; ++b) {
+            seen += phaseCounts[phase][b];
+            if (seen > rank) {
+                return std::min(LatencyHistogram::bucketFloor(b), phaseLargest[phase]) * nanosPerTick;
+            }
+        }
+        return 0;
+    }
+
+    // Rooms with the most visits, busiest first
+    std::vector<RoomId> busiestRooms(size_t limit) const {
+        std::vector<RoomId> order;
+        for (RoomId r = 0; r < roomVisits.size(); ++r) {
+            if (roomVisits[r] > 0) {
+                order.push_back(r);
+            }
+        }
+        limit = std::min(limit, order.size());
+        std::partial_sort(order.begin(), order.begin() + limit, order.end(), [this](RoomId a, RoomId b) {
+            return roomVisits[a] != roomVisits[b] ? roomVisits[a] > roomVisits[b] : a < b;
+        });
+        order.resize(limit);
+        return order;
+    }
+};
+
+// Adds up every thread's buffer
+void collectEngineStats(StatsTotals& totals) {
+    totals.nanosPerTick = statNanosPerTick();
+    StatsRegistry& registry = statsRegistry();
+    std::lock_guard<std::mutex> guard(registry.lock);
+    for (unsigned p = 0; p < PHASE_COUNT; ++p) {
+        totals.phaseCounts[p].assign(LatencyHistogram::BUCKETS, 0);
+        totals.phaseTotal[p] = 0;
+        totals.phaseLargest[p] = 0;
+    }
+    for (unsigned v = 0; v < EngineStats::VERB_LIMIT; ++v) {
+        totals.verbCount[v] = 0;
+        totals.verbTicks[v] = 0;
+    }
+    totals.roomVisits.clear();
+    for (size_t i = 0; i < registry.buffers.size(); ++i) {
+        const EngineStats& stats = *registry.buffers[i];
+        for (unsigned p = 0; p < PHASE_COUNT; ++p) {
+            for (unsigned b = 0; b < LatencyHistogram::BUCKETS; ++b) {
+                totals.phaseCounts[p][b] += stats.phases[p].counts[b].load(std::memory_order_relaxed);
+            }
+            totals.phaseTotal[p] += stats.phases[p].total.load(std::memory_order_relaxed);
+            totals.phaseLargest[p] = std::max(totals.phaseLargest[p], stats.phases[p].largest.load(std::memory_order_relaxed));
+        }
+        for (unsigned v = 0; v < EngineStats::VERB_LIMIT; ++v) {
+            totals.verbCount[v] += stats.verbCount[v].load(std::memory_order_relaxed);
+            totals.verbTicks[v] += stats.verbTicks[v].load(std::memory_order_relaxed);
+        }
+        if (totals.roomVisits.size() < stats.roomSlots) {
+            totals.roomVisits.resize(stats.roomSlots, 0);
+        }
+        for (uint32_t r = 0; r < stats.roomSlots; ++r) {
+            totals.roomVisits[r] += stats.roomVisits[r].load(std::memory_order_relaxed);
+        }
+    }
+    totals.verbNames = registry.verbNames;
+    totals.threads = registry.buffers.size();
+}
+
+// Prints per-verb counters, phase latencies and the busiest rooms
+void printEngineStats(std::ostream& out, const World& world) {
+    if (!ENGINE_STATS) {
+        out << "Engine statistics are compiled out of this build (it was built with -DENGINE_STATS=0).\n";
+        return;
+    }
+    StatsTotals totals;
+    collectEngineStats(totals);
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(2)
+        << "Engine statistics (" << totals.threads << (totals.threads == 1 ? " thread" : " threads") << ")\n"
+        << "  phase (us)         count       p50       p90       p99     p99.9       max\n";
+    for (unsigned p = 0; p < PHASE_COUNT; ++p) {
+        out << "  " << std::left << std::setw(10) << STAT_PHASE_NAMES[p] << std::right << std::setw(14) << totals.count(p);
+        const double pcts[] = { 50, 90, 99, 99.9 };
+        for (size_t i = 0; i < 4; ++i) {
+            out << std::setw(10) << totals.percentile(p, pcts[i]) / 1000.0;
+        }
+        out << std::setw(10) << totals.phaseLargest[p] * totals.nanosPerTick / 1000.0 << "\n";
+    }
+    out << "  verb                count   mean handle us\n";
+    for (unsigned v = 0; v < EngineStats::VERB_LIMIT; ++v) {
+        if (totals.verbCount[v] > 0) {
+            out << "  " << std::left << std::setw(12) << (v < totals.verbNames.size() ? totals.verbNames[v] : "?") << std::right
+                << std::setw(12) << totals.verbCount[v]
+                << std::setw(17) << totals.verbTicks[v] * totals.nanosPerTick / totals.verbCount[v] / 1000.0 << "\n";
+        }
+    }
+    std::vector<RoomId> busiest = totals.busiestRooms(5);
+    out << "  busiest rooms:";
+    for (size_t i = 0; i < busiest.size(); ++i) {
+        RoomId r = busiest[i];
+        out << (i > 0 ? "," : "") << " "
+            << (r < world.roomCount() ? stripAnsi(world.textString(world.roomName[r])) : std::to_string(r))
+            << " (" << totals.roomVisits[r] << ")";
+    }
+    out << "\n";
+    out.flags(flags);
+    out.precision(precision);
+}
+
+// Writes a string as a JSON string literal
+void writeJsonString(std::ostream& out, const std::string& text) {
+    out << '"';
+    for (size_t i = 0; i < text.size(); ++i) {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        if (c == '"' || c == '\\') {
+            out << '\\' << text[i];
+        } else if (c < 0x20) {
+            out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<unsigned>(c) << std::dec << std::setfill(' ');
+        } else {
+            out << text[i];
+        }
+    }
+    out << '"';
+}
+
+// Writes the statistics as JSON for dashboards. Latencies are in nanoseconds, and each
+// phase lists its non-empty histogram buckets as [floor_ns, count] pairs.
+void writeEngineStatsJson(std::ostream& out, const World& world) {
+    if (!ENGINE_STATS) {
+        out << "{\"enabled\": false}\n";
+        return;
+    }
+    StatsTotals totals;
+    collectEngineStats(totals);
+    out << "{\n  \"enabled\": true,\n  \"threads\": " << totals.threads << ",\n  \"phases\": {";
+    for (unsigned p = 0; p < PHASE_COUNT; ++p) {
+        out << (p > 0 ? "," : "") << "\n    \"" << STAT_PHASE_NAMES[p] << "\": {\"count\": " << totals.count(p)
+            << ", \"total_ns\": " << static_cast<uint64_t>(totals.phaseTotal[p] * totals.nanosPerTick)
+            << ", \"max_ns\": " << static_cast<uint64_t>(totals.phaseLargest[p] * totals.nanosPerTick);
+        const double pcts[] = { 50, 90, 99, 99.9 };
+        const char* const names[] = { "p50_ns", "p90_ns", "p99_ns", "p999_ns" };
+        for (size_t i = 0; i < 4; ++i) {
+            out << ", \"" << names[i] << "\": " << static_cast<uint64_t>(totals.percentile(p, pcts[i]));
+        }
+        out << ", \"buckets\": [";
+        bool first = true;
+        for (unsigned b = 0; b < LatencyHistogram::BUCKETS; ++b) {
+            if (totals.phaseCounts[p][b] > 0) {
+                out << (first ? "" : ", ") << "[" << static_cast<uint64_t>(LatencyHistogram::bucketFloor(b) * totals.nanosPerTick)
+                    << ", " << totals.phaseCounts[p][b] << "]";
+                first = false;
+            }
+        }
+        out << "]}";
+    }
+    out << "\n  },\n  \"verbs\": {";
+    bool first = true;
+    for (unsigned v = 0; v < EngineStats::VERB_LIMIT; ++v) {
+        if (totals.verbCount[v] > 0) {
+            out << (first ? "" : ",") << "\n    ";
+            writeJsonString(out, v < totals.verbNames.size() ? totals.verbNames[v] : "?");
+            out << ": {\"count\": " << totals.verbCount[v] << ", \"handle_ns\": "
+                << static_cast<uint64_t>(totals.verbTicks[v] * totals.nanosPerTick) << "}";
+            first = false;
+        }
+    }
+    uint64_t visits = 0, rooms = 0;
+    for (size_t r = 0; r < totals.roomVisits.size(); ++r) {
+        visits += totals.roomVisits[r];
+        rooms += totals.roomVisits[r] > 0 ? 1 : 0;
+    }
+    out << "\n  },\n  \"rooms\": {\"visits\": " << visits << ", \"rooms_visited\": " << rooms << ", \"busiest\": [";
+    std::vector<RoomId> busiest = totals.busiestRooms(100);
+    for (size_t i = 0; i < busiest.size(); ++i) {
+        RoomId r = busiest[i];
+        out << (i > 0 ? ", " : "") << "{\"room\": " << r << ", \"name\": ";
+        writeJsonString(out, r < world.roomCount() ? stripAnsi(world.textString(world.roomName[r])) : std::string());
+        out << ", \"visits\": " << totals.roomVisits[r] << "}";
+    }
+    out << "]}\n}\n";
+}
+
+// Prints the statistics to stderr and/or writes them to a JSON file as a run ends
+int reportEngineStats(const World& world, bool print, const std::string& path, int status) {
+    if (print) {
+        printEngineStats(std::cerr, world);
+    }
+    if (!path.empty()) {
+        std::ofstream file(path.c_str(), std::ios::trunc);
+        if (file) {
+            writeEngineStatsJson(file, world);
+        }
+        if (!file) {
+            std::cerr << "Cannot write statistics file: " << path << std::endl;
+            return status == 0 ? 1 : status;
+        }
+    }
+    return status;
+}
+
+// View of a run of characters inside a command line; parsing never copies the input
+struct Token {
+    const char* data;  // First character (not null-terminated)
+    size_t size;       // Number of characters
+
+    Token() : data(""), size(0) {}
+    Token(const char* d, size_t n) : data(d), size(n) {}
+
+    bool empty() const { return size == 0; }
+    bool equals(const char* text) const { return std::strlen(text) == size && std::memcmp(data, text, size) == 0; }
+};
+
+// Signature shared by every command handler. `data` is the value the verb was
+// registered with (for example the direction of a movement verb) and `argument`
+// is everything after the verb, with surrounding whitespace removed.
+typedef TurnResult (*CommandHandler)(const World& world, Player& player, int data, const Token& argument, std::ostream& out);
+
+// Flags that control how the dispatcher treats a verb
+enum CommandFlags {
+    COMMAND_META = 1,       // Runs even after the treasure is found (look, help, quit)
+    COMMAND_NO_REDRAW = 2   // The room is not described again before the next prompt
+};
+
+// A verb registered in the command table
+struct CommandEntry {
+    std::string name;        // Interned spelling of the verb
+    CommandHandler handler;  // Function that carries the command out
+    int data;                // Value passed through to the handler
+    unsigned flags;          // Combination of CommandFlags
+    unsigned ruleVerb;       // RuleVerb whose rules the verb triggers, or NO_RULE_VERB
+    unsigned statVerb;       // Verb counters it is recorded under (aliases share them)
+};
+
+// Splits a command line into a verb and an argument without allocating
+void parseCommand(const std::string& line, Token& verb, Token& argument) {
+    const char* p = line.data();
+    const char* end = p + line.size();
+    while (p < end && std::isspace(static_cast<unsigned char>(*p))) {
+        ++p;
+    }
+    const char* verbStart = p;
+    while (p < end && !std::isspace(static_cast<unsigned char>(*p))) {
+        ++p;
+    }
+    verb = Token(verbStart, p - verbStart);
+    while (p < end && std::isspace(static_cast<unsigned char>(*p))) {
+        ++p;
+    }
+    while (end > p && std::isspace(static_cast<unsigned char>(end[-1]))) {
+        --end;
+    }
+    argument = Token(p, end - p);
+}
+
+// Maps verbs and their aliases to handlers. Once every verb is registered, build()
+// picks a table size and hash seed under which no two spellings collide, so a lookup
+// is one hash, one slot read and one comparison no matter how many verbs exist.
+class CommandTable {
+private:
+    std::vector<CommandEntry> entries;  // Every registered spelling, aliases included
+    std::vector<int16_t> slots;         // Perfect hash table of indexes into entries (-1 = empty)
+    uint32_t seed;                      // Hash seed chosen by build()
+    uint32_t mask;                      // Table size minus one
+    unsigned verbs;                     // Verbs added so far, aliases not included
+
+    // FNV-1a, with the seed folded into the offset basis
+    static uint32_t hash(uint32_t seed, const char* data, size_t size) {
+        uint32_t h = 2166136261u ^ seed;
+        for (size_t i = 0; i < size; ++i) {
+            h ^= static_cast<unsigned char>(data[i]);
+            h *= 16777619u;
+        }
+        return h ^ (h >> 15);
+    }
+
+public:
+    CommandTable() : seed(0), mask(0), verbs(0) {}
+
+    // Registers a verb with its handler
+    void add(const std::string& name, CommandHandler handler, int data = 0, unsigned flags = 0, unsigned ruleVerb = NO_RULE_VERB) {
+        CommandEntry entry = { name, handler, data, flags, ruleVerb, ++verbs };
+        entries.push_back(entry);
+        nameStatVerb(entry.statVerb, name);
+    }
+
+    // Registers another spelling for an existing verb
+    void addAlias(const std::string& alias, const std::string& name) {
+        for (size_t i = 0; i < entries.size(); ++i) {
+            if (entries[i].name == name) {
+                CommandEntry entry = entries[i];
+                entry.name = alias;
+                entries.push_back(entry);
+                return;
+            }
+        }
+    }
+
+    // Builds the perfect hash table; must be called after the last add()
+    void build() {
+        size_t size = 1;
+        while (size < entries.size() * 2) {
+            size <<= 1;
+        }
+        // Try seeds until every spelling lands in its own slot, growing the table if needed
+        while (true) {
+            for (uint32_t candidate = 1; candidate <= 1000; ++candidate) {
+                slots.assign(size, -1);
+                bool collision = false;
+                for (size_t i = 0; i < entries.size() && !collision; ++i) {
+                    uint32_t slot = hash(candidate, entries[i].name.data(), entries[i].name.size()) & (size - 1);
+                    if (slots[slot] >= 0) {
+                        collision = true;
+                    } else {
+                        slots[slot] = static_cast<int16_t>(i);
+                    }
+                }
+                if (!collision) {
+                    seed = candidate;
+                    mask = static_cast<uint32_t>(size - 1);
+                    return;
+                }
+            }
+            size <<= 1;
+        }
+    }
+
+    // Finds the entry for a verb, or nullptr if the verb is unknown
+    const CommandEntry* find(const Token& verb) const {
+        if (slots.empty()) {
+            return nullptr;
+        }
+        int16_t index = slots[hash(seed, verb.data, verb.size) & mask];
+        if (index < 0) {
+            return nullptr;
+        }
+        const CommandEntry& entry = entries[index];
+        if (entry.name.size() != verb.size || std::memcmp(entry.name.data(), verb.data, verb.size) != 0) {
+            return nullptr;
+        }
+        return &entry;
+    }
+
+    size_t size() const { return entries.size(); }
+};
+
+TurnResult processCommand(const CommandTable& commands, const World& world, Player& player, const std::string& line, std::ostream& out, bool& redraw);
+
+// Save file format version; files written by other versions are refused
+const uint8_t SAVE_VERSION = 2;
+const char SAVE_MAGIC[4] = { 'E', 'S', 'A', 'V' };
+const char JOURNAL_MAGIC[4] = { 'E', 'J', 'N', 'L' };
+
+// Appends an unsigned LEB128 varint
+void putVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out += static_cast<char>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+// Reads a varint at `pos`, advancing it; false if the data ends first
+bool getVarint(const std::string& in, size_t& pos, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && pos < in.size(); shift += 7) {
+        unsigned char byte = static_cast<unsigned char>(in[pos++]);
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Appends a list of item stacks: the number of stacks, then each item and count
+void putStacks(std::string& out, ItemSpan stacks) {
+    putVarint(out, stacks.size());
+    for (const ItemStack* stack = stacks.begin(); stack != stacks.end(); ++stack) {
+        putVarint(out, stack->item);
+        putVarint(out, stack->count);
+    }
+}
+
+// Reads a list written by putStacks(); false if it is cut short or names an item the world lacks
+bool getStacks(const World& world, const std::string& in, size_t& pos, ItemStacks& stacks) {
+    uint64_t size, item, count;
+    stacks.clear();
+    if (!getVarint(in, pos, size) || size > in.size() - pos) {
+        return false;
+    }
+    for (uint64_t i = 0; i < size; ++i) {
+        if (!getVarint(in, pos, item) || !getVarint(in, pos, count) || item == NO_ITEM || item >= world.itemTotal
+            || count == 0 || count > 0xFFFFFFFFu) {
+            return false;
+        }
+        ItemStack stack = { static_cast<ItemId>(item), static_cast<uint32_t>(count) };
+        stacks.push_back(stack);
+    }
+    return true;
+}
+
+// Reads a whole file; false if it does not exist or cannot be read
+bool readFile(const std::string& path, std::string& contents) {
+    std::ifstream file(path.c_str(), std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    std::ostringstream buffer;
+    buffer << file.rdbuf();
+    contents = buffer.str();
+    return true;
+}
+
+// A saved game: a snapshot of everything the player has changed, plus an append-only
+// journal of the commands played since. Each turn costs one small write() to the
+// journal; every JOURNAL_LIMIT turns the journal is folded into a fresh snapshot.
+// Recovery loads the snapshot and replays the journal, so a crashed or disconnected
+// session loses at most the command that was being typed.
+//
+// Snapshot: "ESAV", version, world checksum (8 bytes), then varints for the generation,
+// room, move count, inventory bits and changes (delta-encoded), then a 4-byte checksum.
+// Journal: "EJNL", version, the generation of the snapshot it extends (8 bytes), then
+// one record per command: varint length, the command, one check byte.
+class SaveSlot {
+private:
+    static const uint32_t JOURNAL_LIMIT = 1024;  // Journal records kept before compacting
+
+    const CommandTable& commands;
+    std::string path;          // Snapshot path; the journal is path + ".journal"
+    int journalFd;             // Open journal, or -1
+    uint64_t generation;       // Bumped on every snapshot so a stale journal is never replayed
+    uint32_t journalRecords;   // Records in the journal since the last snapshot
+    std::string record;        // Reusable buffer for one journal record
+
+    static uint8_t checkByte(const char* data, size_t size) {
+        return static_cast<uint8_t>(imageChecksum(data, size));
+    }
+
+    void closeJournal() {
+        if (journalFd >= 0) {
+            ::close(journalFd);
+            journalFd = -1;
+        }
+    }
+
+    // Starts an empty journal for the current generation
+    bool resetJournal(std::string& error) {
+        closeJournal();
+        std::string journalPath = path + ".journal";
+        journalFd = ::open(journalPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+        if (journalFd < 0) {
+            error = "cannot write " + journalPath + ": " + std::strerror(errno);
+            return false;
+        }
+        std::string header(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+        header += static_cast<char>(SAVE_VERSION);
+        header.append(reinterpret_cast<const char*>(&generation), sizeof(generation));
+        journalRecords = 0;
+        if (::write(journalFd, header.data(), header.size()) != static_cast<ssize_t>(header.size())) {
+            error = "cannot write " + journalPath + ": " + std::strerror(errno);
+            closeJournal();
+            return false;
+        }
+        return true;
+    }
+
+    SaveSlot(const SaveSlot&);
+    SaveSlot& operator=(const SaveSlot&);
+
+public:
+    uint64_t snapshotBytes;    // Size of the last snapshot written or read
+    uint64_t journalBytes;     // Bytes appended to journals by this slot
+    uint64_t journaledTurns;   // Turns journaled by this slot
+
+    SaveSlot(const CommandTable& table, const std::string& file)
+        : commands(table), path(file), journalFd(-1), generation(0), journalRecords(0),
+          snapshotBytes(0), journalBytes(0), journaledTurns(0) {}
+
+    ~SaveSlot() { closeJournal(); }
+
+    const std::string& file() const { return path; }
+
+    // Whether turns are being journaled, i.e. the game has been saved or loaded
+    bool journaling() const { return journalFd >= 0; }
+
+    // Points the slot at another file; the next save starts it afresh
+    void setFile(const std::string& file) {
+        closeJournal();
+        path = file;
+        generation = 0;
+    }
+
+    // Writes a snapshot of the player and starts a new, empty journal.
+    // The snapshot replaces the old one atomically, so a crash never leaves a torn save.
+    bool save(const World& world, const Player& player, std::string& error) {
+        std::string data(SAVE_MAGIC, sizeof(SAVE_MAGIC));
+        data += static_cast<char>(SAVE_VERSION);
+        data.append(reinterpret_cast<const char*>(&world.checksum), sizeof(world.checksum));
+        putVarint(data, generation + 1);
+        putVarint(data, player.currentRoom);
+        putVarint(data, static_cast<uint64_t>(player.moveCount));
+        putStacks(data, player.inventory.contents());
+        putVarint(data, player.changes.size());
+        uint64_t previous = 0;
+        player.changes.forEachChange([&data, &previous](uint64_t key) {
+            putVarint(data, key - previous);
+            previous = key;
+        });
+        putVarint(data, player.changes.itemRooms());
+        previous = 0;
+        player.changes.forEachItemRoom([&data, &previous](RoomId room, const ItemStacks& stacks) {
+            putVarint(data, room - previous);
+            previous = room;
+            ItemSpan span = { stacks.begin(), stacks.end() };
+            putStacks(data, span);
+        });
+        uint32_t check = static_cast<uint32_t>(imageChecksum(data.data(), data.size()));
+        data.append(reinterpret_cast<const char*>(&check), sizeof(check));
+
+        std::string temporary = path + ".tmp";
+        int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            error = "cannot write " + temporary + ": " + std::strerror(errno);
+            return false;
+        }
+        bool written = ::write(fd, data.data(), data.size()) == static_cast<ssize_t>(data.size());
+        ::close(fd);
+        if (!written || std::rename(temporary.c_str(), path.c_str()) != 0) {
+            error = "cannot write " + path + ": " + std::strerror(errno);
+            ::unlink(temporary.c_str());
+            return false;
+        }
+        generation++;
+        snapshotBytes = data.size();
+        return resetJournal(error);
+    }
+
+    // Appends one command to the journal, compacting it into a snapshot when it grows long
+    void recordTurn(const std::string& line, const World& world, const Player& player) {
+        if (journalFd < 0) {
+            return;
+        }
+        record.clear();
+        putVarint(record, line.size());
+        record += line;
+        record += static_cast<char>(checkByte(line.data(), line.size()));
+        if (::write(journalFd, record.data(), record.size()) == static_cast<ssize_t>(record.size())) {
+            journalBytes += record.size();
+            journaledTurns++;
+        }
+        if (++journalRecords >= JOURNAL_LIMIT) {
+            std::string error;
+            save(world, player, error);
+        }
+    }
+
+    // Restores the player from the snapshot, then replays the journal on top of it.
+    // A journal cut short by a crash is replayed up to its last complete record.
+    bool load(const World& world, Player& player, uint32_t& replayed, std::string& error) {
+        replayed = 0;
+        std::string data;
+        if (!readFile(path, data)) {
+            error = "no saved game at " + path;
+            return false;
+        }
+        const size_t headerSize = sizeof(SAVE_MAGIC) + 1 + sizeof(uint64_t);
+        uint32_t check = 0;
+        if (data.size() >= headerSize + sizeof(check)) {
+            std::memcpy(&check, data.data() + data.size() - sizeof(check), sizeof(check));
+        }
+        if (data.size() < headerSize + sizeof(check) || std::memcmp(data.data(), SAVE_MAGIC, sizeof(SAVE_MAGIC)) != 0
+            || check != static_cast<uint32_t>(imageChecksum(data.data(), data.size() - sizeof(check)))) {
+            error = path + " is not a saved game or is corrupted";
+            return false;
+        }
+        if (static_cast<uint8_t>(data[sizeof(SAVE_MAGIC)]) != SAVE_VERSION) {
+            error = path + " was saved by an incompatible version of the game";
+            return false;
+        }
+        uint64_t worldChecksum;
+        std::memcpy(&worldChecksum, data.data() + sizeof(SAVE_MAGIC) + 1, sizeof(worldChecksum));
+        if (worldChecksum != world.checksum) {
+            error = path + " belongs to a different world";
+            return false;
+        }
+
+        data.resize(data.size() - sizeof(check));
+        size_t pos = headerSize;
+        uint64_t savedGeneration, room, moves, changeCount, itemRoomCount;
+        if (!getVarint(data, pos, savedGeneration) || !getVarint(data, pos, room) || !getVarint(data, pos, moves)
+            || room >= world.roomCount()) {
+            error = path + " is corrupted";
+            return false;
+        }
+        Player restored(static_cast<RoomId>(room));
+        restored.moveCount = static_cast<int>(moves);
+        ItemStacks stacks;
+        if (!getStacks(world, data, pos, stacks) || !getVarint(data, pos, changeCount)) {
+            error = path + " is corrupted";
+            return false;
+        }
+        for (size_t i = 0; i < stacks.size(); ++i) {
+            gainItem(world, restored, stacks[i].item, stacks[i].count);
+        }
+        uint64_t key = 0;
+        std::vector<RoomId> npcRooms;
+        // Each change names an NPC, room or exit of this world
+        const uint32_t changeBounds[CHANGE_KIND_COUNT] = { world.npcTotal, world.roomTotal, world.edgeTotal };
+        for (uint64_t i = 0; i < changeCount; ++i) {
+            uint64_t delta;
+            if (!getVarint(data, pos, delta) || (key += delta) >> 32 >= CHANGE_KIND_COUNT
+                || static_cast<uint32_t>(key) >= changeBounds[key >> 32]) {
+                error = path + " is corrupted";
+                return false;
+            }
+            ChangeKind kind = static_cast<ChangeKind>(key >> 32);
+            restored.changes.set(kind, static_cast<uint32_t>(key), roomOfChange(world, kind, static_cast<uint32_t>(key), npcRooms));
+        }
+        if (!getVarint(data, pos, itemRoomCount)) {
+            error = path + " is corrupted";
+            return false;
+        }
+        uint64_t itemRoom = 0;
+        for (uint64_t i = 0; i < itemRoomCount; ++i) {
+            uint64_t delta;
+            if (!getVarint(data, pos, delta) || (itemRoom += delta) >= world.roomCount() || !getStacks(world, data, pos, stacks)) {
+                error = path + " is corrupted";
+                return false;
+            }
+            ItemSpan none = { nullptr, nullptr };
+            restored.changes.editItems(static_cast<RoomId>(itemRoom), none) = stacks;
+        }
+        restored.saveSlot = player.saveSlot;
+        restored.actors = player.actors;
+        restored.renderCache = player.renderCache;
+        restored.history = player.history;
+        restored.macros = player.macros;
+        player = restored;
+        if (player.history != nullptr) {
+            player.history->reset(player);
+        }
+        generation = savedGeneration;
+        snapshotBytes = data.size() + sizeof(check);
+
+        // Replay the journal if it continues this snapshot
+        std::string journal;
+        size_t valid = sizeof(JOURNAL_MAGIC) + 1 + sizeof(uint64_t);
+        uint64_t journalGeneration = 0;
+        if (readFile(path + ".journal", journal) && journal.size() >= valid
+            && std::memcmp(journal.data(), JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) == 0
+            && static_cast<uint8_t>(journal[sizeof(JOURNAL_MAGIC)]) == SAVE_VERSION) {
+            std::memcpy(&journalGeneration, journal.data() + sizeof(JOURNAL_MAGIC) + 1, sizeof(journalGeneration));
+        }
+        std::vector<std::string> lines;
+        if (journalGeneration == generation) {
+            pos = valid;
+            uint64_t length;
+            while (getVarint(journal, pos, length) && length < journal.size() && pos + length < journal.size()
+                   && static_cast<uint8_t>(journal[pos + length]) == checkByte(journal.data() + pos, length)) {
+                lines.push_back(journal.substr(pos, length));
+                pos += length + 1;
+                valid = pos;
+            }
+        }
+
+        // Start a fresh journal; replaying the intact records journals them again,
+        // which drops a torn record left by a crash
+        if (!resetJournal(error)) {
+            return false;
+        }
+        // Wandering NPCs are not saved, so replayed turns must not move them on
+        FrameBuffer discarded;
+        std::ostream out(&discarded);
+        ActorSimulation* actors = player.actors;
+        player.actors = nullptr;
+        for (size_t i = 0; i < lines.size(); ++i) {
+            bool redraw;
+            processCommand(commands, world, player, lines[i], out, redraw);
+            discarded.clear();
+            replayed++;
+        }
+        player.actors = actors;
+        return true;
+    }
+};
+
+// Handles the save command - snapshots the game, optionally to a new file
+TurnResult handleSave(const World& world, Player& player, int, const Token& argument, std::ostream& out) {
+    if (player.saveSlot == nullptr) {
+        out << GameColors::bold << GameColors::red << "Saving is not available in this game." << GameColors::reset << "\n";
+        return TURN_CONTINUE;
+    }
+    if (!argument.empty()) {
+        player.saveSlot->setFile(std::string(argument.data, argument.size));
+    }
+    std::string error;
+    if (player.saveSlot->save(world, player, error)) {
+        out << GameColors::bold << GameColors::green << "Game saved to " << player.saveSlot->file() << "." << GameColors::reset << "\n";
+    } else {
+        out << GameColors::bold << GameColors::red << "Could not save: " << error << GameColors::reset << "\n";
+    }
+    return TURN_CONTINUE;
+}
+
+// Handles the load command - restores a saved game, optionally from another file
+TurnResult handleLoad(const World& world, Player& player, int, const Token& argument, std::ostream& out) {
+    if (player.saveSlot == nullptr) {
+        out << GameColors::bold << GameColors::red << "Loading is not available in this game." << GameColors::reset << "\n";
+        return TURN_CONTINUE;
+    }
+    if (!argument.empty()) {
+        player.saveSlot->setFile(std::string(argument.data, argument.size));
+    }
+    std::string error;
+    uint32_t replayed;
+    if (player.saveSlot->load(world, player, replayed, error)) {
+        out << GameColors::bold << GameColors::green << "Game loaded from " << player.saveSlot->file() << "." << GameColors::reset << "\n";
+    } else {
+        out << GameColors::bold << GameColors::red << "Could not load: " << error << GameColors::reset << "\n";
+    }
+    return TURN_CONTINUE;
+}
+
+// Handles the undo and rewind commands - goes back one turn, or as many as asked
+TurnResult handleRewind(const World& world, Player& player, int turns, const Token& argument, std::ostream& out) {
+    if (player.history == nullptr) {
+        out << GameColors::bold << GameColors::red << "Undo is not available in this game." << GameColors::reset << "\n";
+        return TURN_CONTINUE;
+    }
+    size_t wanted = static_cast<size_t>(turns);
+    if (wanted == 0) {
+        for (size_t i = 0; i < argument.size; ++i) {
+            if (!std::isdigit(static_cast<unsigned char>(argument.data[i])) || wanted > 100000000) {
+                wanted = 0;
+                break;
+            }
+            wanted = wanted * 10 + static_cast<size_t>(argument.data[i] - '0');
+        }
+        if (wanted == 0) {
+            out << GameColors::bold << GameColors::red << "Rewind how many turns? Try 'rewind 3'." << GameColors::reset << "\n";
+            return TURN_CONTINUE;
+        }
+    }
+    size_t available = player.history->available();
+    if (!player.history->rewind(player, wanted)) {
+        out << GameColors::bold << GameColors::red;
+        if (available == 0) {
+            out << "There is nothing to undo.";
+        } else {
+            out << "You can only go back " << available << (available == 1 ? " turn." : " turns.");
+        }
+        out << GameColors::reset << "\n";
+        return TURN_CONTINUE;
+    }
+    out << GameColors::magenta << "Time folds back " << wanted << (wanted == 1 ? " turn." : " turns.") << GameColors::reset << "\n";
+
+    // The journal holds the turns just undone, so a saved game starts again from here
+    if (player.saveSlot != nullptr && player.saveSlot->journaling()) {
+        std::string error;
+        if (!player.saveSlot->save(world, player, error)) {
+            out << GameColors::bold << GameColors::red << "Could not save: " << error << GameColors::reset << "\n";
+        }
+    }
+    return TURN_CONTINUE;
+}
+
+// Named command sequences a player defines with `define <name> <commands>`. A macro
+// runs wherever its name is used as a command, repeat counts included, and may use
+// other macros. Verbs the game already knows cannot be redefined.
+class MacroTable {
+private:
+    const CommandTable& commands;
+    std::map<std::string, std::string> bodies;
+
+public:
+    static const size_t MAX_MACROS = 100;
+    static const size_t MAX_BODY = 1000;
+
+    explicit MacroTable(const CommandTable& table) : commands(table) {}
+
+    // Defines a macro, or removes it if `body` is empty; false with `error` set if
+    // the name is taken or malformed, or the body or table would grow too large
+    bool define(const std::string& name, const std::string& body, std::string& error) {
+        bool valid = !name.empty() && name.size() <= 32 && std::islower(static_cast<unsigned char>(name[0]));
+        for (size_t i = 0; valid && i < name.size(); ++i) {
+            unsigned char c = static_cast<unsigned char>(name[i]);
+            valid = std::islower(c) || std::isdigit(c) || c == '_' || c == '-';
+        }
+        if (!valid) {
+            error = "Macro names start with a lowercase letter and use only letters, digits, '_' and '-'.";
+            return false;
+        }
+        if (commands.find(Token(name.data(), name.size())) != nullptr) {
+            error = "'" + name + "' is already a command.";
+            return false;
+        }
+        if (body.empty()) {
+            if (bodies.erase(name) == 0) {
+                error = "There is no macro called '" + name + "'.";
+                return false;
+            }
+            return true;
+        }
+        if (body.size() > MAX_BODY) {
+            error = "A macro can hold at most " + std::to_string(MAX_BODY) + " characters.";
+            return false;
+        }
+        if (bodies.size() >= MAX_MACROS && bodies.find(name) == bodies.end()) {
+            error = "You can keep at most " + std::to_string(MAX_MACROS) + " macros.";
+            return false;
+        }
+        bodies[name] = body;
+        return true;
+    }
+
+    // Reads definitions from a file, one `<name> <commands>` per line; blank lines
+    // and lines starting with '#' are skipped
+    bool load(const std::string& path, std::string& error) {
+        std::ifstream file(path.c_str());
+        if (!file) {
+            error = "cannot open " + path;
+            return false;
+        }
+        size_t number = 0;
+        for (std::string line; std::getline(file, line); ) {
+            number++;
+            Token name, body;
+            parseCommand(line, name, body);
+            if (name.empty() || name.data[0] == '#') {
+                continue;
+            }
+            if (body.empty()) {
+                error = path + ":" + std::to_string(number) + ": macro '" + std::string(name.data, name.size) + "' has no commands";
+                return false;
+            }
+            if (!define(std::string(name.data, name.size), std::string(body.data, body.size), error)) {
+                error = path + ":" + std::to_string(number) + ": " + error;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // The commands a macro stands for, or nullptr if there is no such macro
+    const std::string* find(const Token& name) const {
+        if (bodies.empty()) {
+            return nullptr;
+        }
+        std::map<std::string, std::string>::const_iterator it = bodies.find(std::string(name.data, name.size));
+        return it != bodies.end() ? &it->second : nullptr;
+    }
+
+    // Every macro, sorted by name
+    const std::map<std::string, std::string>& all() const { return bodies; }
+};
+
+const size_t MacroTable::MAX_MACROS;
+const size_t MacroTable::MAX_BODY;
+
+// Handles the define command - lists macros, defines one, or removes one when no commands are given
+TurnResult handleDefine(const World&, Player& player, int, const Token& argument, std::ostream& out) {
+    if (player.macros == nullptr) {
+        out << GameColors::bold << GameColors::red << "Macros are not available in this game." << GameColors::reset << "\n";
+        return TURN_CONTINUE;
+    }
+    if (argument.empty()) {
+        if (player.macros->all().empty()) {
+            out << GameColors::cyan << "You have no macros. Try 'define loop n; e; s; w'." << GameColors::reset << "\n";
+            return TURN_CONTINUE;
+        }
+        out << GameColors::bold << GameColors::yellow << "Your macros:" << GameColors::reset << "\n";
+        const std::map<std::string, std::string>& macros = player.macros->all();
+        for (std::map<std::string, std::string>::const_iterator it = macros.begin(); it != macros.end(); ++it) {
+            out << "  " << GameColors::green << it->first << GameColors::reset << ": " << it->second << "\n";
+        }
+        return TURN_CONTINUE;
+    }
+    std::string line(argument.data, argument.size);
+    Token name, body;
+    parseCommand(line, name, body);
+    std::string macro(name.data, name.size);
+    std::string error;
+    if (!player.macros->define(macro, std::string(body.data, body.size), error)) {
+        out << GameColors::bold << GameColors::red << error << GameColors::reset << "\n";
+    } else if (body.empty()) {
+        out << GameColors::green << "Macro '" << macro << "' removed." << GameColors::reset << "\n";
+    } else {
+        out << GameColors::green << "Macro '" << macro << "' defined. Type '" << macro << "' to run it." << GameColors::reset << "\n";
+    }
+    return TURN_CONTINUE;
+}
+
+// Handles the look command - shows detailed room description
+TurnResult handleLook(const World& world, Player& player, int, const Token&, std::ostream& out) {
+    describeRoomLook(world, player, player.currentRoom, out);
+    return TURN_CONTINUE;
+}
+
+// Handles the help command - displays available commands
+TurnResult handleHelp(const World&, Player&, int, const Token&, std::ostream& out) {
+    showCommandMenu(out);
+    return TURN_CONTINUE;
+}
+
+// Handles the stats command - prints the engine's counters and latencies so far
+TurnResult handleStats(const World& world, Player&, int, const Token&, std::ostream& out) {
+    printEngineStats(out, world);
+    return TURN_CONTINUE;
+}
+
+// Handles the quit command - exits the game
+TurnResult handleQuit(const World&, Player&, int, const Token&, std::ostream& out) {
+    out << GameColors::bold << GameColors::blue << R"(
+╔═══════════════════════════════════════════╗
+║          Thanks for playing!              ║
+╚═══════════════════════════════════════════╝
+)" << GameColors::reset << "\n";
+    return TURN_QUIT;
+}
+
+// Handles the talk command - interact with NPCs
+TurnResult handleTalk(const World& world, Player& player, int, const Token&, std::ostream& out) {
+    NpcId npc = world.roomNpc[player.currentRoom];
+    uint32_t actor;
+    if (npc != NO_NPC_ID && !isNpcDefeated(player, npc)) {
+        out << GameColors::bold << GameColors::cyan;
+        world.writeText(out, world.npcDialogue[npc]);
+        out << GameColors::reset << "\n";
+    } else if (player.actors != nullptr && (actor = player.actors->findIn(player.currentRoom, NO_NPC)) != ActorSimulation::NO_ACTOR) {
+        out << GameColors::bold << GameColors::cyan;
+        world.writeText(out, world.npcDialogue[world.actorNpc[actor]]);
+        out << GameColors::reset << "\n";
+    } else {
+        out << GameColors::bold << GameColors::red << "There is no one here to talk to." << GameColors::reset << "\n";
+    }
+    return TURN_CONTINUE;
+}
+
+// Handles the fight command - battle monsters
+TurnResult handleFight(const World& world, Player& player, int, const Token&, std::ostream& out) {
+    NpcId npc = world.roomNpc[player.currentRoom];
+    uint32_t actor;
+    if (npc != NO_NPC_ID && 
+        world.npcType[npc] == MONSTER && 
+        !isNpcDefeated(player, npc)) {
+        if (canFight(world, player)) {
+            out << GameColors::bold << GameColors::green << "You defeat the monster with your sword!" << GameColors::reset << "\n";
+            player.changes.set(CHANGE_NPC_DEFEATED, npc, player.currentRoom);
+        } else {
+            out << GameColors::bold << GameColors::red << "You need a sword to fight the monster!" << GameColors::reset << "\n";
+        }
+    } else if (player.actors != nullptr && (actor = player.actors->findIn(player.currentRoom, MONSTER)) != ActorSimulation::NO_ACTOR) {
+        if (canFight(world, player)) {
+            out << GameColors::bold << GameColors::green << "You drive off the prowling monster with your sword! It slinks away, but it will be back." << GameColors::reset << "\n";
+            player.actors->defeat(actor);
+        } else {
+            out << GameColors::bold << GameColors::red << "You need a sword to fight the monster!" << GameColors::reset << "\n";
+        }
+    } else {
+        out << GameColors::bold << GameColors::red << "There is nothing to fight here." << GameColors::reset << "\n";
+    }
+    return TURN_CONTINUE;
+}
+
+// Finds the stack of the item a take or drop argument names, matching names without regard to case
+const ItemStack* findNamedItem(const World& world, ItemSpan stacks, const Token& name) {
+    for (const ItemStack* stack = stacks.begin(); stack != stacks.end(); ++stack) {
+        TextRef ref = world.items[stack->item].name;
+        if (ref.length() != name.size) {
+            continue;
+        }
+        size_t i = 0;
+        while (i < name.size && std::tolower(static_cast<unsigned char>(world.text[ref.offset + i]))
+                                    == std::tolower(static_cast<unsigned char>(name.data[i]))) {
+            ++i;
+        }
+        if (i == name.size) {
+            return stack;
+        }
+    }
+    return nullptr;
+}
+
+// Moves a whole stack from the room into the inventory, unless the player lacks what the item needs
+void takeStack(const World& world, Player& player, ItemStack stack, std::ostream& out) {
+    const ItemInfo& info = world.items[stack.item];
+    if (!meetsItemNeeds(world, player, stack.item)) {
+        world.writeText(out, info.refused);
+        out << "\n";
+        return;
+    }
+    ItemStacks& here = player.changes.editItems(player.currentRoom, itemsInRoom(world, player, player.currentRoom));
+    for (size_t i = 0; i < here.size(); ++i) {
+        if (here[i].item == stack.item) {
+            here.erase(i);
+            break;
+        }
+    }
+    gainItem(world, player, stack.item, stack.count);
+    world.writeText(out, info.taken);
+    if (stack.count > 1) {
+        out << GameColors::cyan << " (" << stack.count << " of them)" << GameColors::reset;
+    }
+    out << "\n";
+}
+
+// Handles the take command - collect the named item, or everything in the room
+TurnResult handleTake(const World& world, Player& player, int, const Token& argument, std::ostream& out) {
+    ItemSpan here = itemsInRoom(world, player, player.currentRoom);
+    if (here.empty()) {
+        out << GameColors::bold << GameColors::red << "There is nothing to take here." << GameColors::reset << "\n";
+    } else if (argument.empty()) {
+        // Copied first, since taking changes the room's list
+        ItemStacks all;
+        for (const ItemStack* stack = here.begin(); stack != here.end(); ++stack) {
+            all.push_back(*stack);
+        }
+        for (size_t i = 0; i < all.size(); ++i) {
+            takeStack(world, player, all[i], out);
+        }
+    } else if (const ItemStack* stack = findNamedItem(world, here, argument)) {
+        takeStack(world, player, *stack, out);
+    } else {
+        out << GameColors::bold << GameColors::red << "There is no ";
+        out.write(argument.data, argument.size);
+        out << " here." << GameColors::reset << "\n";
+    }
+    return TURN_CONTINUE;
+}
+
+// Handles the drop command - puts a whole stack the player carries down in the room
+TurnResult handleDrop(const World& world, Player& player, int, const Token& argument, std::ostream& out) {
+    if (argument.empty()) {
+        out << GameColors::bold << GameColors::red << "Drop what? Name an item, for example 'drop sword'." << GameColors::reset << "\n";
+        return TURN_CONTINUE;
+    }
+    const ItemStack* held = findNamedItem(world, player.inventory.contents(), argument);
+    if (held == nullptr) {
+        out << GameColors::bold << GameColors::red << "You are not carrying any ";
+        out.write(argument.data, argument.size);
+        out << "." << GameColors::reset << "\n";
+        return TURN_CONTINUE;
+    }
+    ItemStack stack = *held;
+    player.inventory.remove(stack.item, stack.count);
+    ItemStacks& here = player.changes.editItems(player.currentRoom, itemsInRoom(world, player, player.currentRoom));
+    size_t i = 0;
+    while (i < here.size() && here[i].item != stack.item) {
+        ++i;
+    }
+    if (i < here.size()) {
+        here[i].count += stack.count;
+    } else {
+        here.push_back(stack);
+    }
+    out << GameColors::green << "You drop the " << itemName(world, stack.item);
+    if (stack.count > 1) {
+        out << " (" << stack.count << " of them)";
+    }
+    out << "." << GameColors::reset << "\n";
+    return TURN_CONTINUE;
+}
+
+// Handles the inventory command - lists what the player carries
+TurnResult handleInventory(const World& world, Player& player, int, const Token&, std::ostream& out) {
+    ItemSpan held = player.inventory.contents();
+    if (held.empty()) {
+        out << GameColors::cyan << "You are not carrying anything." << GameColors::reset << "\n";
+        return TURN_CONTINUE;
+    }
+    out << GameColors::cyan << "You are carrying: ";
+    for (const ItemStack* stack = held.begin(); stack != held.end(); ++stack) {
+        out << (stack != held.begin() ? ", " : "") << GameColors::yellow << itemName(world, stack->item) << GameColors::cyan;
+        if (stack->count > 1) {
+            out << " (" << stack->count << ")";
+        }
+    }
+    out << "." << GameColors::reset << "\n";
+    return TURN_CONTINUE;
+}
+
+// Handles the movement commands; `data` holds the Direction to move in
+TurnResult handleMove(const World& world, Player& player, int data, const Token&, std::ostream& out) {
+    Direction direction = static_cast<Direction>(data);
+    uint32_t edge = world.findEdge(player.currentRoom, direction);
+    if (edge != NO_EDGE && isEdgePassable(world, &player, edge)) {
+        out << GameColors::green << "You move " << directionToString(direction) << "." << GameColors::reset << "\n";
+        player.currentRoom = world.edgeTarget[edge];
+        player.moveCount++;  // Increment move counter when movement is successful
+    } else if (edge != NO_EDGE && (visibleExits(world, player, player.currentRoom) & (1u << direction)) != 0) {
+        out << GameColors::bold << GameColors::red << "The way " << directionToString(direction) << " is locked." << GameColors::reset << "\n";
+    } else {
+        out << GameColors::bold << GameColors::red << "You cannot go that way. Try another direction." << GameColors::reset << "\n";
+    }
+    return TURN_CONTINUE;
+}
+
+bool findHintPath(const World& world, const Player& player, RoomId target, bool open, std::vector<uint32_t>& path);
+
+// Looks up the room named by a go or path argument and the route to it. The route index
+// only knows what every player can walk; if it has no route, a search over what this
+// player has revealed and unlocked may still find one. Writes the reason and returns
+// false when there is no route to follow.
+bool planRoute(const World& world, const Player& player, const Token& argument, std::vector<uint8_t>& route, std::ostream& out) {
+    if (argument.empty()) {
+        out << GameColors::bold << GameColors::red << "Where to? Name a room, for example 'go village'." << GameColors::reset << "\n";
+        return false;
+    }
+    RoomId target = world.routes != nullptr ? world.routes->findRoom(argument.data, argument.size) : NO_ROOM;
+    if (target == NO_ROOM) {
+        out << GameColors::bold << GameColors::red << "You don't know of any place called '";
+        out.write(argument.data, argument.size);
+        out << "'." << GameColors::reset << "\n";
+        return false;
+    }
+    if (target == player.currentRoom) {
+        out << GameColors::bold << GameColors::yellow << "You are already there." << GameColors::reset << "\n";
+        return false;
+    }
+    std::vector<uint32_t> path;
+    bool found = world.routes->findRoute(player.currentRoom, target, route);
+    if (!found && findHintPath(world, player, target, false, path)) {
+        // Keep the path only if moving in each direction takes the edge it found
+        route.clear();
+        found = true;
+        RoomId room = player.currentRoom;
+        for (size_t i = 0; found && i < path.size(); ++i) {
+            Direction dir = static_cast<Direction>(world.edgeDirection[path[i]]);
+            found = world.findEdge(room, dir) == path[i];
+            route.push_back(dir);
+            room = world.edgeTarget[path[i]];
+        }
+    }
+    if (!found) {
+        out << GameColors::bold << GameColors::red << "You know of no way to reach ";
+        world.writeText(out, world.roomName[target]);
+        out << GameColors::bold << GameColors::red << " from here." << GameColors::reset << "\n";
+        return false;
+    }
+    return true;
+}
+
+// Handles the path command - shows the route to a room without walking it
+TurnResult handlePath(const World& world, Player& player, int, const Token& argument, std::ostream& out) {
+    std::vector<uint8_t> route;
+    if (planRoute(world, player, argument, route, out)) {
+        out << GameColors::cyan << "Route (" << route.size() << (route.size() == 1 ? " move" : " moves") << "): ";
+        for (size_t i = 0; i < route.size(); ++i) {
+            out << GameColors::yellow << directionToString(static_cast<Direction>(route[i])) << GameColors::cyan
+                << (i + 1 < route.size() ? ", " : ".");
+        }
+        out << GameColors::reset << "\n";
+    }
+    return TURN_CONTINUE;
+}
+
+// Handles the go command - walks the route to a room, one move per step
+TurnResult handleGo(const World& world, Player& player, int, const Token& argument, std::ostream& out) {
+    std::vector<uint8_t> route;
+    if (planRoute(world, player, argument, route, out)) {
+        for (size_t i = 0; i < route.size(); ++i) {
+            handleMove(world, player, route[i], argument, out);
+        }
+    }
+    return TURN_CONTINUE;
+}
+
+const size_t SEARCH_RESULTS = 5;     // Hits listed by the search command
+const size_t SNIPPET_LIMIT = 160;    // Longest sentence quoted from a search hit, in bytes
+const int HINT_DEPTH = 16;           // Deepest chain of prerequisites the hint command follows
+
+// Words of a query as the search index sees them
+std::vector<std::string> searchWords(const char* text, size_t size) {
+    std::vector<std::string> words;
+    scanSearchWords(text, size, [&words](const char* word, size_t length) {
+        words.push_back(std::string(word, length));
+    });
+    return words;
+}
+
+// Writes the sentence of a text that mentions the most of `words` (the first sentence
+// if none does), shortened at a word boundary if it is too long for one line
+void writeSnippet(const std::string& text, const std::vector<std::string>& words, std::ostream& out) {
+    size_t bestBegin = 0, bestEnd = 0, bestMatches = 0;
+    bool any = false;
+    std::vector<uint8_t> seen(words.size());
+    size_t begin = 0;
+    while (begin < text.size()) {
+        while (begin < text.size() && std::isspace(static_cast<unsigned char>(text[begin]))) {
+            ++begin;
+        }
+        if (begin == text.size()) {
+            break;
+        }
+        // A sentence ends at a line break, or at . ! or ? before a space
+        size_t end = begin;
+        while (end < text.size() && text[end] != '\n'
+               && !(std::strchr(".!?", text[end]) != nullptr && (end + 1 == text.size() || text[end + 1] == ' ' || text[end + 1] == '\n'))) {
+            ++end;
+        }
+        if (end < text.size() && text[end] != '\n') {
+            ++end;
+        }
+        std::fill(seen.begin(), seen.end(), 0);
+        size_t matches = 0;
+        scanSearchWords(&text[begin], end - begin, [&](const char* word, size_t length) {
+            for (size_t i = 0; i < words.size(); ++i) {
+                if (!seen[i] && words[i].size() == length && std::memcmp(words[i].data(), word, length) == 0) {
+                    seen[i] = 1;
+                    ++matches;
+                }
+            }
+        });
+        if (!any || matches > bestMatches) {
+            bestBegin = begin;
+            bestEnd = end;
+            bestMatches = matches;
+            any = true;
+        }
+        begin = end;
+    }
+
+    std::string sentence = text.substr(bestBegin, bestEnd - bestBegin);
+    if (sentence.size() > SNIPPET_LIMIT) {
+        size_t cut = sentence.rfind(' ', SNIPPET_LIMIT);
+        sentence.resize(cut != std::string::npos ? cut : SNIPPET_LIMIT);
+        while (!sentence.empty() && (static_cast<unsigned char>(sentence[sentence.size() - 1]) & 0xC0) == 0x80) {
+            sentence.resize(sentence.size() - 1);  // Never end inside a UTF-8 sequence
+        }
+        sentence += "...";
+    }
+    out << sentence;
+}
+
+// Whether search results may show a document: rooms the player cannot enter yet,
+// and the NPCs in them, stay out of sight
+bool isDocumentVisible(const World& world, const Player& player, uint32_t document) {
+    RoomId room = world.textIndex->documentRoom(document);
+    return room == NO_ROOM || !isRoomLocked(world, player, room);
+}
+
+// Writes one search hit: the room, who is speaking if it is dialogue, and the best sentence
+void writeSearchHit(const World& world, uint32_t document, const std::vector<std::string>& words, std::ostream& out) {
+    const TextIndex& index = *world.textIndex;
+    RoomId room = index.documentRoom(document);
+    out << "  ";
+    if (index.isDialogue(document)) {
+        const char* who = world.npcType[index.documentNpc(document)] == MONSTER ? "monster" : "villager";
+        if (room != NO_ROOM) {
+            world.writeText(out, world.roomName[room]);
+            out << GameColors::cyan << " (" << who << ")";
+        } else {
+            out << GameColors::cyan << "A wandering " << who;
+        }
+    } else {
+        world.writeText(out, world.roomName[room]);
+    }
+    out << GameColors::cyan << ": ";
+    writeSnippet(index.documentText(document), words, out);
+    out << GameColors::reset << "\n";
+}
+
+// Handles the search command - lists the rooms and dialogue that mention every word given
+TurnResult handleSearch(const World& world, Player& player, int, const Token& argument, std::ostream& out) {
+    if (argument.empty()) {
+        out << GameColors::bold << GameColors::red << "Search for what? For example 'search footprints'." << GameColors::reset << "\n";
+        return TURN_CONTINUE;
+    }
+    if (world.textIndex == nullptr) {
+        out << GameColors::bold << GameColors::red << "There is nothing to search." << GameColors::reset << "\n";
+        return TURN_CONTINUE;
+    }
+    std::vector<std::string> missing;
+    TextIndex::Hit hits[SEARCH_RESULTS];
+    size_t found = world.textIndex->search(argument.data, argument.size, SEARCH_RESULTS, [&world, &player](uint32_t document) {
+        return isDocumentVisible(world, player, document);
+    }, hits, &missing);
+    if (found == 0 && missing.empty() && searchWords(argument.data, argument.size).empty()) {
+        out << GameColors::bold << GameColors::red << "Those words are too common to search for." << GameColors::reset << "\n";
+        return TURN_CONTINUE;
+    }
+    if (found == 0) {
+        out << GameColors::bold << GameColors::red << "Nothing you have come across mentions '";
+        if (missing.empty()) {
+            out.write(argument.data, argument.size);
+        } else {
+            for (size_t i = 0; i < missing.size(); ++i) {
+                out << (i > 0 ? "', '" : "") << missing[i];
+            }
+        }
+        out << "'." << GameColors::reset << "\n";
+        return TURN_CONTINUE;
+    }
+    out << GameColors::cyan << "Mentions of '";
+    out.write(argument.data, argument.size);
+    out << "':" << GameColors::reset << "\n";
+    std::vector<std::string> words = searchWords(argument.data, argument.size);
+    for (size_t i = 0; i < found; ++i) {
+        writeSearchHit(world, hits[i].document, words, out);
+    }
+    return TURN_CONTINUE;
+}
+
+// A step toward the goal, worked out for the hint command
+struct Objective {
+    RoomId room;    // Where to act
+    uint8_t verb;   // RuleVerb to use there
+    ItemId item;    // Item the step leads to
+};
+
+// Room whose rules include the rule at index `rule`
+RoomId ruleRoom(const World& world, uint32_t rule) {
+    return static_cast<RoomId>(std::upper_bound(world.ruleStart, world.ruleStart + world.roomTotal + 1, rule) - world.ruleStart - 1);
+}
+
+bool planObjective(const World& world, const Player& player, ItemId item, Objective& objective, int depth);
+bool planUnlock(const World& world, const Player& player, RoomId room, ItemId item, Objective& objective, int depth);
+
+// Works out the first step toward using a rule: an item it needs comes first,
+// then a weapon if it needs a monster present, then the way into its room
+bool planRule(const World& world, const Player& player, uint32_t rule, ItemId item, Objective& objective, int depth) {
+    const Rule& r = world.rules[rule];
+    for (uint32_t i = 0; i < r.opCount; ++i) {
+        const RuleOp& op = world.ruleOps[r.firstOp + i];
+        if (op.code == RULE_HAS_ITEM && !player.inventory.has(op.value)) {
+            return planObjective(world, player, op.value, objective, depth + 1);
+        }
+        if (op.code == RULE_MONSTER_HERE && !canFight(world, player)) {
+            for (ItemId weapon = 1; weapon < world.itemTotal; ++weapon) {
+                if ((world.items[weapon].flags & ITEM_WEAPON) != 0 && planObjective(world, player, weapon, objective, depth + 1)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+    }
+    RoomId room = ruleRoom(world, rule);
+    if (isRoomLocked(world, player, room)) {
+        return planUnlock(world, player, room, item, objective, depth + 1);
+    }
+    objective.room = room;
+    objective.verb = r.verb;
+    objective.item = item;
+    return true;
+}
+
+// Works out the first step toward getting into a locked room, through the rule that unlocks it
+bool planUnlock(const World& world, const Player& player, RoomId room, ItemId item, Objective& objective, int depth) {
+    for (uint32_t rule = 0; rule < world.ruleTotal; ++rule) {
+        const Rule& r = world.rules[rule];
+        for (uint32_t i = 0; i < r.opCount; ++i) {
+            const RuleOp& op = world.ruleOps[r.firstOp + i];
+            if (op.code == RULE_UNLOCK_ROOM && op.value == room) {
+                return planRule(world, player, rule, item, objective, depth);
+            }
+        }
+    }
+    return false;
+}
+
+// Works back from an item the player lacks to the first step toward it: the item it
+// needs, the way into the locked room it lies in, or the rule that hands it out
+bool planObjective(const World& world, const Player& player, ItemId item, Objective& objective, int depth) {
+    if (depth > HINT_DEPTH) {
+        return false;
+    }
+    ItemId needs = world.items[item].needs;
+    if (needs != NO_ITEM && !player.inventory.has(needs) && planObjective(world, player, needs, objective, depth + 1)) {
+        return true;
+    }
+    for (RoomId room = 0; room < world.roomTotal; ++room) {
+        if (isItemInRoom(world, player, room, item)) {
+            if (isRoomLocked(world, player, room)) {
+                return planUnlock(world, player, room, item, objective, depth + 1);
+            }
+            objective.room = room;
+            objective.verb = VERB_TAKE;
+            objective.item = item;
+            return true;
+        }
+    }
+    for (uint32_t rule = 0; rule < world.ruleTotal; ++rule) {
+        const Rule& r = world.rules[rule];
+        for (uint32_t i = 0; i < r.opCount; ++i) {
+            const RuleOp& op = world.ruleOps[r.firstOp + i];
+            if (op.code == RULE_GIVE_ITEM && op.value == item) {
+                return planRule(world, player, rule, item, objective, depth);
+            }
+        }
+    }
+    return false;
+}
+
+// Finds the shortest way from the player's room to `target` as a list of edges. With
+// `open` set, locked rooms and hidden passages count as passable; otherwise only what
+// the player can use now does. Returns false if there is no way.
+bool findHintPath(const World& world, const Player& player, RoomId target, bool open, std::vector<uint32_t>& path) {
+    std::vector<uint32_t> entry(world.roomTotal, NO_ROOM);  // Edge each room was reached by
+    std::vector<RoomId> queue(1, player.currentRoom);
+    path.clear();
+    for (size_t head = 0; head < queue.size(); ++head) {
+        RoomId room = queue[head];
+        if (room == target) {
+            while (room != player.currentRoom) {
+                path.push_back(entry[room]);
+                room = static_cast<RoomId>(std::upper_bound(world.edgeStart, world.edgeStart + world.roomTotal + 1, entry[room]) - world.edgeStart - 1);
+            }
+            std::reverse(path.begin(), path.end());
+            return true;
+        }
+        for (uint32_t e = world.edgeStart[room]; e < world.edgeStart[room + 1]; ++e) {
+            RoomId next = world.edgeTarget[e];
+            if (next == player.currentRoom || entry[next] != NO_ROOM) {
+                continue;
+            }
+            if (!open && !isEdgePassable(world, &player, e)) {
+                continue;
+            }
+            entry[next] = e;
+            queue.push_back(next);
+        }
+    }
+    return false;
+}
+
+// Replaces an objective with the first step toward clearing what blocks the way to it:
+// the first locked room or unrevealed passage along `path`. Returns false if nothing can.
+bool planBlocker(const World& world, const Player& player, const std::vector<uint32_t>& path, Objective& objective) {
+    RoomId room = player.currentRoom;
+    for (size_t i = 0; i < path.size(); ++i) {
+        uint32_t e = path[i];
+        if ((world.edgeFlags[e] & EDGE_HIDDEN) != 0 && !player.changes.has(CHANGE_EXIT_REVEALED, e)) {
+            // Look for the rule in this room that reveals the passage
+            for (uint32_t rule = world.ruleStart[room]; rule < world.ruleStart[room + 1]; ++rule) {
+                const Rule& r = world.rules[rule];
+                for (uint32_t op = 0; op < r.opCount; ++op) {
+                    if (world.ruleOps[r.firstOp + op].code == RULE_REVEAL_EXIT && world.ruleOps[r.firstOp + op].value == world.edgeDirection[e]) {
+                        return planRule(world, player, rule, objective.item, objective, 0);
+                    }
+                }
+            }
+        }
+        room = world.edgeTarget[e];
+        if (isRoomLocked(world, player, room)) {
+            return planUnlock(world, player, room, objective.item, objective, 0);
+        }
+    }
+    return false;
+}
+
+// Handles the hint command - works out the next step toward the goal from what the
+// player has done so far, says which way to head, and quotes the text that best hints at it
+TurnResult handleHint(const World& world, Player& player, int, const Token&, std::ostream& out) {
+    if (player.hasTreasure) {
+        out << GameColors::bold << GameColors::green << "You have already found what you came for." << GameColors::reset << "\n";
+        return TURN_CONTINUE;
+    }
+    ItemId goal = NO_ITEM;
+    for (ItemId item = 1; item < world.itemTotal && goal == NO_ITEM; ++item) {
+        goal = (world.items[item].flags & ITEM_GOAL) != 0 ? item : NO_ITEM;
+    }
+    Objective objective;
+    if (goal == NO_ITEM || !planObjective(world, player, goal, objective, 0)) {
+        out << GameColors::bold << GameColors::yellow << "You will have to find your own way from here." << GameColors::reset << "\n";
+        return TURN_CONTINUE;
+    }
+    // A locked room or a passage not yet found may stand in the way; if so, dealing with it comes first
+    std::vector<uint32_t> path;
+    for (int depth = 0; depth < HINT_DEPTH && !findHintPath(world, player, objective.room, false, path); ++depth) {
+        if (!findHintPath(world, player, objective.room, true, path) || !planBlocker(world, player, path, objective)) {
+            path.clear();
+            break;
+        }
+    }
+
+    out << GameColors::cyan << "Hint: ";
+    switch (objective.verb) {
+        case VERB_TAKE: out << "take the " << GameColors::yellow << itemName(world, objective.item) << GameColors::cyan << " in "; break;
+        case VERB_FIGHT: out << "fight the monster in "; break;
+        case VERB_TALK: out << "talk to whoever is in "; break;
+        case VERB_LOOK: out << "look around "; break;
+        default: out << "try going " << directionToString(static_cast<Direction>(objective.verb)) << " from "; break;
+    }
+    world.writeText(out, world.roomName[objective.room]);
+    out << GameColors::cyan << (objective.verb == VERB_LOOK ? " carefully." : ".") << "\n";
+
+    // Which way to go: the first move of the shortest way there
+    if (objective.room == player.currentRoom) {
+        out << "You are there now.";
+    } else if (path.empty()) {
+        out << "You know of no way there yet.";
+    } else {
+        out << "Head " << directionToString(static_cast<Direction>(world.edgeDirection[path[0]])) << " from here ("
+            << path.size() << (path.size() == 1 ? " move" : " moves") << " away).";
+    }
+    out << GameColors::reset << "\n";
+
+    // A clue from the world's text: what mentions the item, or else the room, outside the room itself
+    if (world.textIndex != nullptr) {
+        std::string queries[2] = { itemName(world, objective.item), stripAnsi(world.textString(world.roomName[objective.room])) };
+        RoomId skip = objective.room;
+        for (int q = 0; q < 2; ++q) {
+            TextIndex::Hit hit;
+            if (world.textIndex->search(queries[q].data(), queries[q].size(), 1, [&world, &player, skip](uint32_t document) {
+                    return document != skip && isDocumentVisible(world, player, document);
+                }, &hit, nullptr) == 1) {
+                out << GameColors::cyan << "Something you may have noticed:" << GameColors::reset << "\n";
+                writeSearchHit(world, hit.document, searchWords(queries[q].data(), queries[q].size()), out);
+                break;
+            }
+        }
+    }
+    return TURN_CONTINUE;
+}
+
+// Registers every verb the game understands
+void registerGameCommands(CommandTable& commands) {
+    commands.add("look", handleLook, 0, COMMAND_META | COMMAND_NO_REDRAW, VERB_LOOK);
+    commands.add("help", handleHelp, 0, COMMAND_META);
+    commands.add("quit", handleQuit, 0, COMMAND_META);
+    commands.add("save", handleSave, 0, COMMAND_META | COMMAND_NO_REDRAW);
+    commands.add("load", handleLoad, 0, COMMAND_META);
+    commands.add("undo", handleRewind, 1, COMMAND_META);
+    commands.add("rewind", handleRewind, 0, COMMAND_META);
+    commands.add("define", handleDefine, 0, COMMAND_META | COMMAND_NO_REDRAW);
+    commands.add("talk", handleTalk, 0, 0, VERB_TALK);
+    commands.add("fight", handleFight, 0, 0, VERB_FIGHT);
+    commands.add("take", handleTake, 0, 0, VERB_TAKE);
+    commands.add("drop", handleDrop);
+    commands.add("inventory", handleInventory, 0, COMMAND_META | COMMAND_NO_REDRAW);
+    commands.add("north", handleMove, NORTH, 0, NORTH);
+    commands.add("east", handleMove, EAST, 0, EAST);
+    commands.add("south", handleMove, SOUTH, 0, SOUTH);
+    commands.add("west", handleMove, WEST, 0, WEST);
+    commands.add("up", handleMove, UP, 0, UP);
+    commands.add("down", handleMove, DOWN, 0, DOWN);
+    commands.add("go", handleGo);
+    commands.add("path", handlePath, 0, COMMAND_META | COMMAND_NO_REDRAW);
+    commands.add("search", handleSearch, 0, COMMAND_META | COMMAND_NO_REDRAW);
+    commands.add("hint", handleHint, 0, COMMAND_META | COMMAND_NO_REDRAW);
+    commands.add("stats", handleStats, 0, COMMAND_META | COMMAND_NO_REDRAW);
+    commands.addAlias("n", "north");
+    commands.addAlias("e", "east");
+    commands.addAlias("s", "south");
+    commands.addAlias("w", "west");
+    commands.addAlias("u", "up");
+    commands.addAlias("d", "down");
+    commands.addAlias("i", "inventory");
+    commands.addAlias("inv", "inventory");
+    commands.build();
+}
+
+// Processes a single command line, updating the player and world and writing the response to `out`.
+// `redraw` is set to whether the room should be described again before the next prompt.
+TurnResult processCommand(const CommandTable& commands, const World& world, Player& player, const std::string& line, std::ostream& out, bool& redraw) {
+    uint64_t matchStart = statTicks();
+    Token verb, argument;
+    parseCommand(line, verb, argument);
+    const CommandEntry* entry = commands.find(verb);
+    redraw = entry == nullptr || (entry->flags & COMMAND_NO_REDRAW) == 0;
+    uint64_t handleStart = statTicks();
+    recordPhase(PHASE_MATCH, handleStart - matchStart);
+
+    // Check for victory condition (found treasure)
+    if (player.hasTreasure && (entry == nullptr || (entry->flags & COMMAND_META) == 0)) {
+        out << "\n" << GameColors::bold << GameColors::green << R"(
+╔════════════════════════════════════════════════════╗
+║     🎉 Congratulations! You found the treasure! 🎉  ║
+║        You completed the game in )" << player.moveCount << " moves!        ║\n╚════════════════════════════════════════════════════╝" << GameColors::reset << "\n";
+        uint64_t handled = statTicks() - handleStart;
+        recordPhase(PHASE_HANDLE, handled);
+        recordVerb(entry != nullptr ? entry->statVerb : 0, handled);
+        return TURN_WON;
+    }
+
+    if (entry == nullptr) {
+        out << GameColors::bold << GameColors::red << "Unknown command. Try 'n', 'e', 's', or 'w'." << GameColors::reset << "\n";
+        uint64_t handled = statTicks() - handleStart;
+        recordPhase(PHASE_HANDLE, handled);
+        recordVerb(0, handled);
+        return TURN_CONTINUE;
+    }
+    // The rules for this room and verb are checked against the state before the command.
+    // Rules marked instead replace the verb's usual handling; the others run after it.
+    // Rules are indexed by room and verb, so a turn only looks at the few that can apply.
+    RoomId room = player.currentRoom;
+    uint32_t firstRule = 0, lastRule = 0;
+    uint64_t fired = 0;  // Bit i set if rule firstRule + i fired (at most 64 rules per room and verb)
+    bool replaced = false;
+    if (entry->ruleVerb != NO_RULE_VERB) {
+        findRules(world, room, entry->ruleVerb, firstRule, lastRule);
+        lastRule = std::min(lastRule, firstRule + 64);
+        for (uint32_t r = firstRule; r < lastRule; ++r) {
+            if (ruleConditionsHold(world, player, room, world.rules[r])) {
+                fired |= 1ull << (r - firstRule);
+                replaced = replaced || (world.rules[r].flags & RULE_INSTEAD) != 0;
+            }
+        }
+    }
+    TurnResult result = replaced ? TURN_CONTINUE : entry->handler(world, player, entry->data, argument, out);
+    for (uint32_t r = firstRule; r < lastRule; ++r) {
+        if (fired & (1ull << (r - firstRule))) {
+            applyRuleActions(world, player, room, world.rules[r], out);
+        }
+    }
+
+    // Wandering NPCs act once for every turn that passes game time
+    if (player.actors != nullptr && (entry->flags & COMMAND_META) == 0) {
+        player.actors->tick();
+    }
+
+    // Journal every turn that can change the game so the session can be recovered
+    if (player.saveSlot != nullptr && result == TURN_CONTINUE && (entry->flags & COMMAND_META) == 0) {
+        player.saveSlot->recordTurn(line, world, player);
+    }
+
+    // Snapshot every turn that changed something so it can be undone; rules can
+    // fire on meta verbs too, and a turn that changed nothing costs a comparison
+    if (player.history != nullptr && result == TURN_CONTINUE) {
+        player.history->record(player);
+    }
+    uint64_t handled = statTicks() - handleStart;
+    recordPhase(PHASE_HANDLE, handled);
+    recordVerb(entry->statVerb, handled);
+    recordVisit(player.currentRoom, world.roomCount());
+    return result;
+}
+
+// Runs a line of input that may hold several commands: commands separated by ';',
+// each optionally preceded by a repeat count ("3n"), with macros expanded in place.
+// The commands run back to back as one turn of output: each writes into a scratch
+// buffer that reaches the frame condensed, with a message repeated by consecutive
+// commands printed once with its count, and no room is described until the batch
+// ends. A line holding a single plain command runs as it is.
+class CommandBatch {
+public:
+    static const size_t LIMIT = 1000;  // Commands one line may run, and macro expansions it may make
+    static const int MACRO_DEPTH = 8;  // Macros that may be nested inside one another
+
+private:
+    struct Step {
+        std::string text;
+        uint32_t times;
+    };
+
+    std::vector<Step> steps;  // Keeps its strings' capacity between lines
+    size_t used;              // Steps of the current line
+    size_t total;             // Commands the current line runs
+    size_t expansions;        // Macros expanded for the current line
+    FrameBuffer scratch;      // Output of the command just run inside the batch
+    std::ostream scratchOut;
+    std::string previous;     // Output of the last command, not yet written
+    uint32_t repeats;         // Consecutive commands that wrote `previous`
+
+    // Appends the commands in [p, end) to the steps; false with `error` set if the line is not allowed
+    bool expand(const CommandTable& commands, const MacroTable* macros, const char* p, const char* end, int depth, std::string& error) {
+        while (p < end) {
+            const char* stop = std::find(p, end, ';');
+            while (p < stop && std::isspace(static_cast<unsigned char>(*p))) {
+                ++p;
+            }
+            const char* last = stop;
+            while (last > p && std::isspace(static_cast<unsigned char>(last[-1]))) {
+                --last;
+            }
+            const char* command = p;
+            size_t count = 0;
+            while (command < last && std::isdigit(static_cast<unsigned char>(*command)) && count <= LIMIT) {
+                count = count * 10 + static_cast<size_t>(*command++ - '0');
+            }
+            if (command == p || command == last) {
+                count = 1;
+                command = p;
+            } else if (count == 0 || count > LIMIT) {
+                error = "Repeat counts run from 1 to " + std::to_string(LIMIT) + ".";
+                return false;
+            }
+            while (command < last && std::isspace(static_cast<unsigned char>(*command))) {
+                ++command;
+            }
+            p = stop + 1;
+            if (command == last) {
+                continue;
+            }
+
+            const char* verbEnd = command;
+            while (verbEnd < last && !std::isspace(static_cast<unsigned char>(*verbEnd))) {
+                ++verbEnd;
+            }
+            Token verb(command, static_cast<size_t>(verbEnd - command));
+            const std::string* body = macros != nullptr && commands.find(verb) == nullptr ? macros->find(verb) : nullptr;
+            if (body != nullptr) {
+                if (depth >= MACRO_DEPTH) {
+                    error = "Macros are nested more than " + std::to_string(MACRO_DEPTH) + " deep.";
+                    return false;
+                }
+                for (size_t i = 0; i < count; ++i) {
+                    if (++expansions > LIMIT) {
+                        error = "That line expands more than " + std::to_string(LIMIT) + " macros.";
+                        return false;
+                    }
+                    if (!expand(commands, macros, body->data(), body->data() + body->size(), depth + 1, error)) {
+                        return false;
+                    }
+                }
+                continue;
+            }
+            total += count;
+            if (total > LIMIT) {
+                error = "That line runs more than " + std::to_string(LIMIT) + " commands.";
+                return false;
+            }
+            if (used == steps.size()) {
+                steps.push_back(Step());
+            }
+            steps[used].text.assign(command, last);
+            steps[used].times = static_cast<uint32_t>(count);
+            used++;
+        }
+        return true;
+    }
+
+    // Writes the pending output, marked with how many commands wrote it
+    void writePrevious(std::ostream& out) {
+        if (repeats == 0) {
+            return;
+        }
+        if (repeats > 1 && !previous.empty() && previous[previous.size() - 1] == '\n') {
+            out.write(previous.data(), static_cast<std::streamsize>(previous.size() - 1));
+            out << " (×" << repeats << ")\n";
+        } else {
+            out << previous;
+        }
+        repeats = 0;
+    }
+
+    // Merges the output of the command just run into the pending output
+    void condense(std::ostream& out) {
+        const std::string& message = scratch.contents();
+        if (repeats > 0 && message == previous) {
+            repeats++;
+        } else {
+            writePrevious(out);
+            previous = message;
+            repeats = 1;
+        }
+        scratch.clear();
+    }
+
+public:
+    uint64_t commandsRun;  // Commands run by every line so far
+
+    CommandBatch() : used(0), total(0), expansions(0), scratchOut(&scratch), repeats(0), commandsRun(0) {}
+
+    // Runs every command on `line`, writing their output to `out`; `redraw` is set if
+    // any of them asked for the room to be described again
+    TurnResult run(const CommandTable& commands, const World& world, Player& player, const std::string& line, std::ostream& out, bool& redraw) {
+        used = 0;
+        total = 0;
+        expansions = 0;
+        std::string error;
+        Token verb, argument;
+        parseCommand(line, verb, argument);
+        bool single = line.find(';') == std::string::npos && (verb.empty() || !std::isdigit(static_cast<unsigned char>(verb.data[0])))
+                   && (player.macros == nullptr || player.macros->find(verb) == nullptr);
+        if (single || verb.equals("define")) {
+            commandsRun++;
+            return processCommand(commands, world, player, line, out, redraw);
+        }
+        if (!expand(commands, player.macros, line.data(), line.data() + line.size(), 0, error)) {
+            out << GameColors::bold << GameColors::red << error << GameColors::reset << "\n";
+            redraw = false;
+            return TURN_CONTINUE;
+        }
+        if (total == 0) {
+            commandsRun++;
+            return processCommand(commands, world, player, line, out, redraw);
+        }
+
+        redraw = false;
+        TurnResult result = TURN_CONTINUE;
+        for (size_t s = 0; s < used && result == TURN_CONTINUE; ++s) {
+            for (uint32_t t = 0; t < steps[s].times && result == TURN_CONTINUE; ++t) {
+                bool stepRedraw;
+                result = processCommand(commands, world, player, steps[s].text, scratchOut, stepRedraw);
+                condense(out);
+                redraw = redraw || stepRedraw;
+                commandsRun++;
+            }
+        }
+        writePrevious(out);
+        return result;
+    }
+};
+
+const size_t CommandBatch::LIMIT;
+const int CommandBatch::MACRO_DEPTH;
+
+// Timing data collected while running the game loop headless
+struct ReplayStats {
+    std::vector<uint64_t> turnNanos;  // Latency of each line of input, including the redraw that follows it
+    double totalSeconds;              // Wall-clock time spent in the game loop
+    uint64_t commands;                // Commands run; more than the lines when lines hold several
+
+    ReplayStats() : totalSeconds(0.0), commands(0) {}
+};
+
+// Runs the main game loop, reading commands from `in` and rendering all output through
+// `renderer`, which emits each turn as a single frame just before the next command is read.
+// When `stats` is provided, every command is timed from the moment it is read until the
+// frame that answers it has been emitted.
+TurnResult runGameLoop(const CommandTable& commands, const World& world, Player& player, std::istream& in, Renderer& renderer, ReplayStats* stats) {
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point loopStart = Clock::now();
+    Clock::time_point turnStart;
+    bool timing = false;
+    TurnResult result = TURN_CONTINUE;
+    std::ostream& out = renderer.out();
+
+    std::string command;
+    CommandBatch batch;
+    bool redraw = true;
+    bool turned = false;       // A command has been processed, so the next flush ends a turn
+    uint64_t turnTicks = 0;    // statTicks() when the current command was read
+    while (true) {
+        // Display current room description unless using look command
+        uint64_t renderStart = statTicks();
+        if (redraw) {
+            describeRoom(world, player, player.currentRoom, out);
+        }
+
+        // Display command prompt and emit the whole turn at once
+        showPrompt(out);
+        uint64_t flushStart = statTicks();
+        recordPhase(PHASE_RENDER, flushStart - renderStart);
+        renderer.flush();
+        uint64_t readStart = statTicks();
+        recordPhase(PHASE_FLUSH, readStart - flushStart);
+        if (turned) {
+            recordPhase(PHASE_TURN, readStart - turnTicks);
+        }
+        if (timing) {
+            stats->turnNanos.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - turnStart).count());
+        }
+
+        // Stop when the input runs out instead of spinning on an empty command
+        if (!std::getline(in, command)) {
+            result = TURN_END_OF_INPUT;
+            break;
+        }
+        turnTicks = statTicks();
+        recordPhase(PHASE_READ, turnTicks - readStart);
+        turned = true;
+
+        if (stats != nullptr) {
+            turnStart = Clock::now();
+            timing = true;
+        }
+        result = batch.run(commands, world, player, command, out, redraw);
+        if (result != TURN_CONTINUE) {
+            uint64_t finalFlush = statTicks();
+            renderer.flush();
+            uint64_t flushed = statTicks();
+            recordPhase(PHASE_FLUSH, flushed - finalFlush);
+            recordPhase(PHASE_TURN, flushed - turnTicks);
+            if (timing) {
+                stats->turnNanos.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - turnStart).count());
+            }
+            break;
+        }
+    }
+
+    if (stats != nullptr) {
+        stats->totalSeconds = std::chrono::duration<double>(Clock::now() - loopStart).count();
+        stats->commands = batch.commandsRun;
+    }
+    return result;
+}
+
+// Generates a deterministic transcript of `count` commands for benchmarking.
+// The transcript mixes movement (valid and blocked), look, talk, fight, help and
+// unknown commands. It never contains "take" or "quit", so the game runs to the
+// end of the transcript instead of finishing early.
+std::string generateTranscript(size_t count, unsigned seed) {
+    static const char* const vocabulary[] = {
+        "n", "e", "s", "w", "north", "east", "south", "west",
+        "n", "e", "s", "w", "look", "talk", "fight", "help", "dance"
+    };
+    const size_t vocabularySize = sizeof(vocabulary) / sizeof(vocabulary[0]);
+
+    std::string transcript;
+    transcript.reserve(count * 5);
+    uint32_t state = seed != 0 ? seed : 1;
+    for (size_t i = 0; i < count; ++i) {
+        // xorshift32 keeps the transcript identical across platforms and standard libraries
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        transcript += vocabulary[state % vocabularySize];
+        transcript += '\n';
+    }
+    return transcript;
+}
+
+// Returns the given percentile (0-100) of a sorted list of latencies
+uint64_t percentile(const std::vector<uint64_t>& sorted, double pct) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t index = static_cast<size_t>(pct / 100.0 * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+// Prints bytes and write() calls per emitted frame
+void printRenderStats(std::ostream& out, const Renderer& renderer) {
+    double frames = renderer.frames > 0 ? static_cast<double>(renderer.frames) : 1.0;
+    out << renderer.frames << " frames, " << renderer.bytes / frames << " bytes/frame, "
+        << renderer.syscalls / frames << " writes/frame";
+}
+
+// Prints throughput, latency percentiles and the final game state after a headless run
+void printReplayReport(std::ostream& out, const ReplayStats& stats, const Renderer& renderer, const World& world, const Player& player, TurnResult result) {
+    std::vector<uint64_t> sorted(stats.turnNanos);
+    std::sort(sorted.begin(), sorted.end());
+
+    double throughput = stats.totalSeconds > 0.0 ? stats.commands / stats.totalSeconds : 0.0;
+
+    std::string inventory;
+    ItemSpan held = player.inventory.contents();
+    for (const ItemStack* stack = held.begin(); stack != held.end(); ++stack) {
+        inventory += (inventory.empty() ? "" : ", ") + itemName(world, stack->item);
+    }
+
+    // Taking the treasure wins; the game only announces it on the next command
+    const char* outcome = "transcript ended";
+    if (result == TURN_WON || (result == TURN_END_OF_INPUT && player.hasTreasure)) {
+        outcome = "won";
+    } else if (result == TURN_QUIT) {
+        outcome = "quit";
+    }
+
+    out << "Replay summary\n"
+        << "  commands:     " << stats.commands;
+    if (stats.commands != sorted.size()) {
+        out << " in " << sorted.size() << " lines";
+    }
+    out << "\n"
+        << "  elapsed:      " << stats.totalSeconds << " s\n"
+        << "  throughput:   " << static_cast<uint64_t>(throughput) << " commands/s\n"
+        << "  latency (us): p50 " << percentile(sorted, 50) / 1000.0
+        << "  p90 " << percentile(sorted, 90) / 1000.0
+        << "  p99 " << percentile(sorted, 99) / 1000.0
+        << "  max " << (sorted.empty() ? 0 : sorted.back()) / 1000.0 << "\n"
+        << "  output:       ";
+    printRenderStats(out, renderer);
+    out << "\n"
+        << "  outcome:      " << outcome << "\n"
+        << "  final room:   " << stripAnsi(world.textString(world.roomName[player.currentRoom])) << "\n"
+        << "  inventory:    " << (inventory.empty() ? "empty" : inventory) << "\n"
+        << "  moves:        " << player.moveCount << "\n";
+    if (player.renderCache != nullptr) {
+        out << "  room cache:   " << player.renderCache->hits << " hits, " << player.renderCache->misses << " misses, "
+            << player.renderCache->memoryBytes() / 1024 << " KiB\n";
+    }
+    out << std::flush;
+}
+
+// One readiness notification from the event loop
+struct ReadyEvent {
+    int fd;          // Socket that is ready
+    bool readable;   // Data (or a new connection) is waiting
+    bool writable;   // The socket can accept more output
+    bool hangup;     // The peer closed the connection or an error occurred
+};
+
+// Waits for many sockets at once: epoll on Linux, poll() on other systems
+class EventLoop {
+private:
+#ifdef __linux__
+    int epollFd;
+    std::vector<epoll_event> events;
+#else
+    std::vector<pollfd> fds;
+    std::vector<int> position;  // Index into fds for each descriptor, or -1
+#endif
+
+    EventLoop(const EventLoop&);
+    EventLoop& operator=(const EventLoop&);
+
+public:
+#ifdef __linux__
+    EventLoop() : epollFd(epoll_create1(0)), events(1024) {}
+    ~EventLoop() { ::close(epollFd); }
+
+    // Starts watching a socket for input, and for output space when `wantWrite` is set
+    void add(int fd, bool wantWrite) {
+        epoll_event event;
+        event.events = EPOLLIN | (wantWrite ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+        event.data.fd = fd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+    }
+
+    // Changes whether a socket is watched for output space
+    void modify(int fd, bool wantWrite) {
+        epoll_event event;
+        event.events = EPOLLIN | (wantWrite ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+        event.data.fd = fd;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event);
+    }
+
+    // Stops watching a socket (call before closing it)
+    void remove(int fd) {
+        epoll_event event;
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, &event);
+    }
+
+    // Waits up to `timeoutMs` and fills `ready`; returns -1 if interrupted by a signal
+    int wait(std::vector<ReadyEvent>& ready, int timeoutMs) {
+        ready.clear();
+        int count = epoll_wait(epollFd, &events[0], static_cast<int>(events.size()), timeoutMs);
+        for (int i = 0; i < count; ++i) {
+            ReadyEvent event = { events[i].data.fd, (events[i].events & EPOLLIN) != 0,
+                                 (events[i].events & EPOLLOUT) != 0, (events[i].events & (EPOLLHUP | EPOLLERR)) != 0 };
+            ready.push_back(event);
+        }
+        return count;
+    }
+#else
+    EventLoop() {}
+
+    // Starts watching a socket for input, and for output space when `wantWrite` is set
+    void add(int fd, bool wantWrite) {
+        if (static_cast<size_t>(fd) >= position.size()) {
+            position.resize(fd + 1, -1);
+        }
+        pollfd entry = { fd, static_cast<short>(POLLIN | (wantWrite ? POLLOUT : 0)), 0 };
+        position[fd] = static_cast<int>(fds.size());
+        fds.push_back(entry);
+    }
+
+    // Changes whether a socket is watched for output space
+    void modify(int fd, bool wantWrite) {
+        fds[position[fd]].events = static_cast<short>(POLLIN | (wantWrite ? POLLOUT : 0));
+    }
+
+    // Stops watching a socket (call before closing it)
+    void remove(int fd) {
+        int index = position[fd];
+        fds[index] = fds.back();
+        position[fds[index].fd] = index;
+        fds.pop_back();
+        position[fd] = -1;
+    }
+
+    // Waits up to `timeoutMs` and fills `ready`; returns -1 if interrupted by a signal
+    int wait(std::vector<ReadyEvent>& ready, int timeoutMs) {
+        ready.clear();
+        int count = ::poll(fds.empty() ? nullptr : &fds[0], fds.size(), timeoutMs);
+        for (size_t i = 0; count > 0 && i < fds.size(); ++i) {
+            if (fds[i].revents != 0) {
+                ReadyEvent event = { fds[i].fd, (fds[i].revents & POLLIN) != 0,
+                                     (fds[i].revents & POLLOUT) != 0, (fds[i].revents & (POLLHUP | POLLERR)) != 0 };
+                ready.push_back(event);
+            }
+        }
+        return count < 0 ? -1 : static_cast<int>(ready.size());
+    }
+#endif
+};
+
+// Puts a socket into non-blocking mode
+void setNonBlocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+// Raises the open-file limit as far as allowed, since every session is a socket
+void raiseFileLimit() {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+// Fills in a socket address from "<port>", "<host>:<port>" or a Unix socket path (anything with a '/')
+bool resolveAddress(const std::string& address, sockaddr_storage& storage, socklen_t& length, std::string& error) {
+    std::memset(&storage, 0, sizeof(storage));
+    if (address.find('/') != std::string::npos) {
+        sockaddr_un* unixAddress = reinterpret_cast<sockaddr_un*>(&storage);
+        if (address.size() >= sizeof(unixAddress->sun_path)) {
+            error = "socket path is too long";
+            return false;
+        }
+        unixAddress->sun_family = AF_UNIX;
+        std::strcpy(unixAddress->sun_path, address.c_str());
+        length = sizeof(sockaddr_un);
+        return true;
+    }
+
+    std::string host = "127.0.0.1";
+    std::string port = address;
+    size_t colon = address.rfind(':');
+    if (colon != std::string::npos) {
+        host = address.substr(0, colon);
+        port = address.substr(colon + 1);
+    }
+    sockaddr_in* inetAddress = reinterpret_cast<sockaddr_in*>(&storage);
+    inetAddress->sin_family = AF_INET;
+    inetAddress->sin_port = htons(static_cast<uint16_t>(std::atoi(port.c_str())));
+    if (inet_pton(AF_INET, host.c_str(), &inetAddress->sin_addr) != 1 || inetAddress->sin_port == 0) {
+        error = "invalid address '" + address + "' (expected <port>, <host>:<port> or a socket path)";
+        return false;
+    }
+    length = sizeof(sockaddr_in);
+    return true;
+}
+
+// Opens a non-blocking listening socket
+int openListener(const std::string& address, std::string& error) {
+    sockaddr_storage storage;
+    socklen_t length;
+    if (!resolveAddress(address, storage, length, error)) {
+        return -1;
+    }
+    int fd = socket(storage.ss_family, SOCK_STREAM, 0);
+    int enable = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    if (storage.ss_family == AF_UNIX) {
+        unlink(address.c_str());
+    }
+    if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&storage), length) != 0 || listen(fd, 4096) != 0) {
+        error = "cannot listen on " + address + ": " + std::strerror(errno);
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        return -1;
+    }
+    setNonBlocking(fd);
+    return fd;
+}
+
+// Connects to a server, returning a non-blocking socket
+int connectTo(const std::string& address, std::string& error) {
+    sockaddr_storage storage;
+    socklen_t length;
+    if (!resolveAddress(address, storage, length, error)) {
+        return -1;
+    }
+    int fd = socket(storage.ss_family, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&storage), length) != 0) {
+        error = "cannot connect to " + address + ": " + std::strerror(errno);
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        return -1;
+    }
+    setNonBlocking(fd);
+    return fd;
+}
+
+// Set by SIGINT/SIGTERM to stop the server loop
+volatile sig_atomic_t stopRequested = 0;
+
+void requestStop(int) {
+    stopRequested = 1;
+}
+
+// A player connected to the server. All sessions share the read-only world; a
+// session only holds the player (with its overlay) and any unsent bytes.
+struct ClientSession {
+    Player player;        // This player's position, inventory and changes to the world
+    std::string input;    // Received bytes that do not yet form a complete line
+    std::string pending;  // Output the socket has not accepted yet
+    bool redraw;          // Whether to describe the room before the next prompt
+    bool closing;         // Close the connection once pending output is sent
+
+    TurnHistory history;  // Earlier states the player can go back to
+    MacroTable macros;    // Macros this player has defined
+
+    ClientSession(RoomId start, size_t historyDepth, const CommandTable& commands)
+        : player(start), redraw(true), closing(false), history(historyDepth), macros(commands) {
+        player.macros = &macros;
+        if (historyDepth > 0) {
+            player.history = &history;
+            history.reset(player);
+        }
+    }
+};
+
+// Serves any number of players from one thread. Every turn is rendered into one
+// shared frame and written with a single non-blocking write; whatever the socket
+// does not accept is queued on the session until it becomes writable.
+class GameServer {
+private:
+    const World& world;
+    const CommandTable& commands;
+    ActorSimulation* actors;                // Wandering NPCs shared by every session, or nullptr
+    size_t historyDepth;                    // Turns each session can undo
+    Renderer renderer;                      // Shared frame for rendering turns
+    CommandBatch batch;                     // Runs each line's commands; shared, as lines are played one at a time
+    EventLoop loop;
+    std::vector<ClientSession*> sessions;   // Session for each descriptor, or nullptr
+    int listener;
+
+public:
+    uint64_t sessionsServed;                // Connections accepted
+    size_t activeSessions;                  // Connections currently open
+    size_t peakSessions;                    // Most connections open at once
+    uint64_t turns;                         // Commands processed, counting each command of a batch
+    std::vector<uint32_t> turnNanos;        // Time spent processing each command
+    RenderCache rooms;                      // Room text shared by every session
+
+    GameServer(const World& w, const CommandTable& c, ActorSimulation* a, size_t depth, bool plain)
+        : world(w), commands(c), actors(a), historyDepth(depth), renderer(-1, plain), listener(-1),
+          sessionsServed(0), activeSessions(0), peakSessions(0), turns(0), rooms(w.roomCount()) {}
+
+    // Listens on `address` and serves players until SIGINT or SIGTERM
+    bool run(const std::string& address, std::string& error) {
+        listener = openListener(address, error);
+        if (listener < 0) {
+            return false;
+        }
+        loop.add(listener, false);
+
+        std::vector<ReadyEvent> ready;
+        while (!stopRequested) {
+            loop.wait(ready, 1000);
+            for (size_t i = 0; i < ready.size(); ++i) {
+                const ReadyEvent& event = ready[i];
+                if (event.fd == listener) {
+                    acceptClients();
+                    continue;
+                }
+                if (event.readable || event.hangup) {
+                    receive(event.fd);
+                }
+                if (event.writable && static_cast<size_t>(event.fd) < sessions.size() && sessions[event.fd] != nullptr) {
+                    send(event.fd);
+                }
+            }
+        }
+
+        // Close every remaining session
+        for (size_t fd = 0; fd < sessions.size(); ++fd) {
+            if (sessions[fd] != nullptr) {
+                closeSession(static_cast<int>(fd));
+            }
+        }
+        loop.remove(listener);
+        ::close(listener);
+        if (address.find('/') != std::string::npos) {
+            unlink(address.c_str());
+        }
+        return true;
+    }
+
+private:
+    // Accepts every waiting connection and greets each new player
+    void acceptClients() {
+        while (true) {
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd < 0) {
+                return;
+            }
+            setNonBlocking(fd);
+            if (static_cast<size_t>(fd) >= sessions.size()) {
+                sessions.resize(fd + 1, nullptr);
+            }
+            ClientSession* session = new ClientSession(world.startRoom, historyDepth, commands);
+            session->player.actors = actors;
+            session->player.renderCache = &rooms;
+            sessions[fd] = session;
+            loop.add(fd, false);
+            sessionsServed++;
+            activeSessions++;
+            peakSessions = std::max(peakSessions, activeSessions);
+
+            std::ostream& out = renderer.out();
+            showTitleScreen(out);
+            describeRoom(world, session->player, session->player.currentRoom, out);
+            showPrompt(out);
+            emit(fd, *session);
+        }
+    }
+
+    // Reads from a session and plays every complete line it has sent
+    void receive(int fd) {
+        ClientSession* session = sessions[fd];
+        char chunk[4096];
+        uint64_t readStart = statTicks();
+        while (true) {
+            ssize_t received = ::read(fd, chunk, sizeof(chunk));
+            if (received > 0) {
+                session->input.append(chunk, static_cast<size_t>(received));
+                continue;
+            }
+            if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                closeSession(fd);
+                return;
+            }
+            if (errno != EINTR) {
+                break;
+            }
+        }
+        recordPhase(PHASE_READ, statTicks() - readStart);
+
+        // Play each complete command; all of their output goes out in one frame
+        std::ostream& out = renderer.out();
+        size_t lineStart = 0;
+        size_t newline;
+        std::string command;
+        while (!session->closing && (newline = session->input.find('\n', lineStart)) != std::string::npos) {
+            command.assign(session->input, lineStart, newline - lineStart);
+            if (!command.empty() && command[command.size() - 1] == '\r') {
+                command.erase(command.size() - 1);
+            }
+            lineStart = newline + 1;
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            uint64_t turnTicks = statTicks();
+            uint64_t commandsBefore = batch.commandsRun;
+            TurnResult result = batch.run(commands, world, session->player, command, out, session->redraw);
+            uint64_t renderStart = statTicks();
+            if (result == TURN_CONTINUE) {
+                if (session->redraw) {
+                    describeRoom(world, session->player, session->player.currentRoom, out);
+                }
+                showPrompt(out);
+            } else {
+                session->closing = true;
+            }
+            // A turn ends once its frame is rendered; the session's turns share one write
+            uint64_t rendered = statTicks();
+            recordPhase(PHASE_RENDER, rendered - renderStart);
+            recordPhase(PHASE_TURN, rendered - turnTicks);
+            turns += batch.commandsRun - commandsBefore;
+            turnNanos.push_back(static_cast<uint32_t>(std::min<int64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count(), 0xFFFFFFFF)));
+        }
+        session->input.erase(0, lineStart);
+        emit(fd, *session);
+    }
+
+    // Sends the rendered frame, queueing whatever the socket does not take
+    void emit(int fd, ClientSession& session) {
+        uint64_t flushStart = statTicks();
+        const std::string& frame = renderer.finishFrame();
+        if (session.pending.empty() && !frame.empty()) {
+            ssize_t written = ::write(fd, frame.data(), frame.size());
+            renderer.syscalls++;
+            size_t sent = written > 0 ? static_cast<size_t>(written) : 0;
+            if (sent < frame.size()) {
+                session.pending.assign(frame, sent, std::string::npos);
+                loop.modify(fd, true);
+            }
+        } else {
+            session.pending += frame;
+        }
+        renderer.discardFrame();
+        recordPhase(PHASE_FLUSH, statTicks() - flushStart);
+        if (session.closing && session.pending.empty()) {
+            closeSession(fd);
+        }
+    }
+
+    // Writes queued output once the socket has room for it
+    void send(int fd) {
+        ClientSession* session = sessions[fd];
+        ssize_t written = ::write(fd, session->pending.data(), session->pending.size());
+        renderer.syscalls++;
+        if (written > 0) {
+            session->pending.erase(0, static_cast<size_t>(written));
+        }
+        if (session->pending.empty()) {
+            if (session->closing) {
+                closeSession(fd);
+            } else {
+                loop.modify(fd, false);
+            }
+        }
+    }
+
+    void closeSession(int fd) {
+        loop.remove(fd);
+        ::close(fd);
+        delete sessions[fd];
+        sessions[fd] = nullptr;
+        activeSessions--;
+    }
+};
+
+// Runs the game server and prints how it performed when it is stopped
+int runServer(const World& world, const CommandTable& commands, ActorSimulation* actors, size_t historyDepth, const std::string& address, bool plain) {
+    signal(SIGPIPE, SIG_IGN);
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = requestStop;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    raiseFileLimit();
+
+    GameServer server(world, commands, actors, historyDepth, plain);
+    std::cerr << "Serving on " << address << " (Ctrl-C to stop)" << std::endl;
+    std::string error;
+    if (!server.run(address, error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double cpuSeconds = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+        + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+    std::vector<uint64_t> sorted(server.turnNanos.begin(), server.turnNanos.end());
+    std::sort(sorted.begin(), sorted.end());
+    std::cerr << "Server summary (one thread)\n"
+              << "  sessions:     " << server.sessionsServed << " served, " << server.peakSessions << " at once\n"
+              << "  turns:        " << server.turns << "\n"
+              << "  cpu time:     " << cpuSeconds << " s ("
+              << static_cast<uint64_t>(cpuSeconds > 0 ? server.turns / cpuSeconds : 0) << " turns per core-second)\n"
+              << "  turn (us):    p50 " << percentile(sorted, 50) / 1000.0 << "  p99 " << percentile(sorted, 99) / 1000.0 << "\n"
+              << "  room cache:   " << server.rooms.hits << " hits, " << server.rooms.misses << " misses, "
+              << server.rooms.memoryBytes() / 1024 << " KiB" << std::endl;
+    return 0;
+}
+
+// One simulated player in the load generator
+struct LoadClient {
+    int fd;
+    std::vector<std::string> commands;  // Commands still to send, in order
+    size_t next;                        // Index of the next command to send
+    std::string tail;                   // End of the last data received, for finding the prompt
+    std::chrono::steady_clock::time_point sentAt;
+};
+
+// Opens `sessions` concurrent connections to a running server, plays `turns` generated
+// commands on each (sending the next one as soon as the prompt comes back) and reports
+// throughput and turn latency as seen by the clients
+int runLoadGenerator(const std::string& address, size_t sessionCount, size_t turns, unsigned seed) {
+    typedef std::chrono::steady_clock Clock;
+    signal(SIGPIPE, SIG_IGN);
+    raiseFileLimit();
+
+    // The bottom edge of the prompt box marks the end of each answer
+    const std::string promptEnd = "└─────────────────────┘";
+
+    EventLoop loop;
+    std::vector<LoadClient> clients(sessionCount);
+    std::vector<int> clientOf;  // Client index for each descriptor
+    for (size_t i = 0; i < sessionCount; ++i) {
+        std::string error;
+        LoadClient& client = clients[i];
+        client.fd = connectTo(address, error);
+        if (client.fd < 0) {
+            std::cerr << error << " (after " << i << " sessions)" << std::endl;
+            return 1;
+        }
+        std::istringstream transcript(generateTranscript(turns, seed + static_cast<unsigned>(i)));
+        std::string line;
+        while (std::getline(transcript, line)) {
+            client.commands.push_back(line);
+        }
+        client.next = 0;
+        if (static_cast<size_t>(client.fd) >= clientOf.size()) {
+            clientOf.resize(client.fd + 1, -1);
+        }
+        clientOf[client.fd] = static_cast<int>(i);
+        loop.add(client.fd, false);
+    }
+
+    std::vector<uint64_t> latencies;
+    latencies.reserve(sessionCount * turns);
+    size_t open = sessionCount;
+    bool failed = false;
+    Clock::time_point start = Clock::now();
+    std::vector<ReadyEvent> ready;
+    char chunk[16384];
+    while (open > 0 && !failed) {
+        if (loop.wait(ready, 10000) == 0) {
+            std::cerr << "Timed out waiting for the server" << std::endl;
+            failed = true;
+            break;
+        }
+        for (size_t r = 0; r < ready.size(); ++r) {
+            LoadClient& client = clients[clientOf[ready[r].fd]];
+            bool sawPrompt = false;
+            ssize_t received;
+            while ((received = ::read(client.fd, chunk, sizeof(chunk))) > 0) {
+                client.tail.append(chunk, static_cast<size_t>(received));
+                if (client.tail.find(promptEnd) != std::string::npos) {
+                    sawPrompt = true;
+                    client.tail.clear();
+                } else if (client.tail.size() > promptEnd.size()) {
+                    client.tail.erase(0, client.tail.size() - promptEnd.size());
+                }
+            }
+            if (received == 0) {
+                std::cerr << "Server closed a session early" << std::endl;
+                failed = true;
+                break;
+            }
+            if (!sawPrompt) {
+                continue;
+            }
+
+            // The answer to the previous command (or the greeting) is complete
+            Clock::time_point now = Clock::now();
+            if (client.next > 0) {
+                latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(now - client.sentAt).count());
+            }
+            if (client.next == client.commands.size()) {
+                loop.remove(client.fd);
+                ::close(client.fd);
+                open--;
+                continue;
+            }
+            std::string line = client.commands[client.next++] + "\n";
+            client.sentAt = now;
+            if (::write(client.fd, line.data(), line.size()) != static_cast<ssize_t>(line.size())) {
+                std::cerr << "Could not send a command" << std::endl;
+                failed = true;
+                break;
+            }
+        }
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << "Load generator summary\n"
+              << "  sessions:     " << sessionCount << " concurrent, " << turns << " commands each\n"
+              << "  turns:        " << latencies.size() << " in " << seconds << " s ("
+              << static_cast<uint64_t>(seconds > 0 ? latencies.size() / seconds : 0) << " turns/s)\n"
+              << "  latency (us): p50 " << percentile(latencies, 50) / 1000.0
+              << "  p90 " << percentile(latencies, 90) / 1000.0
+              << "  p99 " << percentile(latencies, 99) / 1000.0
+              << "  max " << (latencies.empty() ? 0 : latencies.back()) / 1000.0 << std::endl;
+    return failed ? 1 : 0;
+}
+
+// A solver state packed into 64 bits: the room in the high half and the player's
+// inventory in the low half, one bit for each item that matters to winning (goals,
+// what items need and what rules test or give) and for each locked room a rule
+// elsewhere unlocks. Each solver step is a RuleVerb, or a move through a hidden
+// exit or into a locked room right after the verb whose rule opens the way.
+// Items are only ever gained, so the solver treats an item as lying in its room
+// until the player holds it and a monster as undefeated; fighting one again can
+// only hand out items the player already has.
+inline uint64_t packState(RoomId room, uint32_t inventory) {
+    return (static_cast<uint64_t>(room) << 32) | inventory;
+}
+inline RoomId stateRoom(uint64_t state) { return static_cast<RoomId>(state >> 32); }
+inline uint32_t stateInventory(uint64_t state) { return static_cast<uint32_t>(state); }
+
+// Lock-free hash set of visited solver states. Each state is claimed with a single
+// compare-and-swap; the thread that claims it records the state and move it came from.
+class StateTable {
+private:
+    static const uint64_t EMPTY = ~0ull;          // No valid state has every bit set
+    std::unique_ptr<std::atomic<uint64_t>[]> keys;
+    std::unique_ptr<uint64_t[]> parents;          // State each entry was first reached from
+    std::unique_ptr<uint8_t[]> actions;           // Action that reached each entry
+    uint64_t mask;
+
+    static uint64_t hash(uint64_t key) {
+        key = (key ^ (key >> 30)) * 0xBF58476D1CE4E5B9ull;
+        key = (key ^ (key >> 27)) * 0x94D049BB133111EBull;
+        return key ^ (key >> 31);
+    }
+
+public:
+    enum InsertResult { INSERTED, PRESENT, FULL };
+
+    explicit StateTable(uint64_t capacity) {
+        uint64_t size = 1024;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        keys.reset(new std::atomic<uint64_t>[size]);
+        parents.reset(new uint64_t[size]);
+        actions.reset(new uint8_t[size]);
+        for (uint64_t i = 0; i < size; ++i) {
+            keys[i].store(EMPTY, std::memory_order_relaxed);
+        }
+        mask = size - 1;
+    }
+
+    // Adds a state unless another thread got there first
+    InsertResult insert(uint64_t key, uint64_t parent, uint8_t action) {
+        uint64_t slot = hash(key) & mask;
+        for (uint64_t probe = 0; probe <= mask; ++probe, slot = (slot + 1) & mask) {
+            uint64_t current = keys[slot].load(std::memory_order_relaxed);
+            if (current == key) {
+                return PRESENT;
+            }
+            if (current == EMPTY) {
+                uint64_t expected = EMPTY;
+                if (keys[slot].compare_exchange_strong(expected, key, std::memory_order_relaxed)) {
+                    parents[slot] = parent;
+                    actions[slot] = action;
+                    return INSERTED;
+                }
+                if (expected == key) {
+                    return PRESENT;
+                }
+            }
+        }
+        return FULL;
+    }
+
+    // Looks up how a state was reached; only valid once no thread is inserting
+    bool find(uint64_t key, uint64_t& parent, uint8_t& action) const {
+        uint64_t slot = hash(key) & mask;
+        for (uint64_t probe = 0; probe <= mask; ++probe, slot = (slot + 1) & mask) {
+            uint64_t current = keys[slot].load(std::memory_order_relaxed);
+            if (current == key) {
+                parent = parents[slot];
+                action = actions[slot];
+                return true;
+            }
+            if (current == EMPTY) {
+                return false;
+            }
+        }
+        return false;
+    }
+
+    uint64_t capacity() const { return mask + 1; }
+};
+
+// Result of solving a world
+struct SolverResult {
+    bool solved;                        // A winning sequence exists
+    int moves;                          // Fewest moves needed to win
+    std::vector<std::string> commands;  // Commands that win in that many moves
+    uint64_t states;                    // States explored
+    double seconds;                     // Time taken
+    size_t keys;                        // Items that rules revealing exits or unlocking rooms test for
+    bool exhaustive;                    // Whether not finding a win proves there is none
+};
+
+// Finds the fewest-moves way to take the treasure with a level-synchronous BFS.
+// Only movement counts as a move, so each level is first closed under the other
+// verbs and only then expanded by movement. Every round splits the frontier
+// into one shard per thread; new states are claimed in the shared StateTable and
+// collected per thread, so threads never wait on each other inside a round.
+class WorldSolver {
+private:
+    const World& world;
+    unsigned threadCount;
+    StateTable visited;
+    std::atomic<uint64_t> goal;          // First winning state found, or ~0
+    std::atomic<uint64_t> explored;
+    std::atomic<bool> overflow;
+    std::vector<uint32_t> itemBits;      // Inventory bit of each item, or 0 for items that do not matter
+    ItemId bitItems[32];                 // Item of each inventory bit, or NO_ITEM for rooms
+    std::vector<uint32_t> roomBits;      // Bit of each locked room that has to be remembered as open, or 0
+    std::vector<uint64_t> entersBehind;  // One bit per edge: leads into a locked room from rooms only reachable through it
+    uint32_t goalBits;                   // Bits of the goal items
+    uint32_t keyBits;                    // Bits of the items that open the way
+    uint32_t withheld;                   // Bits the player is never allowed to gain
+    uint32_t droppable;                  // Bits of the items worth dropping
+    size_t trackedBits;                  // Items and rooms that matter, which may be more than there are bits
+
+    static const uint8_t AFTER_VERB = 0x80;  // Action flag: the move follows verb (action >> 3) & 15
+    static const uint8_t DROP = 0x40;        // Action flag: drops the item of bit action & 31
+    static const uint8_t NO_ACTION = 0xFF;
+
+    // Gives an item an inventory bit unless it has one
+    void track(ItemId item) {
+        if (item != NO_ITEM && item < itemBits.size() && itemBits[item] == 0) {
+            itemBits[item] = trackedBits < 32 ? 1u << trackedBits : 0;
+            if (trackedBits < 32) {
+                bitItems[trackedBits] = item;
+            }
+            trackedBits++;
+        }
+    }
+
+    // Gives a locked room a bit unless it has one
+    void trackRoom(RoomId room) {
+        if (roomBits[room] == 0) {
+            roomBits[room] = trackedBits < 32 ? 1u << trackedBits : 0;
+            trackedBits++;
+        }
+    }
+
+    // Marks the exits into a locked room from rooms the player can only reach through it.
+    // Returns whether there is another way in that no rule beside it unlocks.
+    bool markBehind(RoomId locked, std::vector<uint8_t>& reached) {
+        reached.assign(world.roomTotal, 0);
+        std::vector<RoomId> queue;
+        if (world.startRoom != locked) {
+            reached[world.startRoom] = 1;
+            queue.push_back(world.startRoom);
+        }
+        for (size_t head = 0; head < queue.size(); ++head) {
+            RoomId room = queue[head];
+            for (uint32_t e = world.edgeStart[room]; e < world.edgeStart[room + 1]; ++e) {
+                RoomId next = world.edgeTarget[e];
+                if (next != locked && !reached[next]) {
+                    reached[next] = 1;
+                    queue.push_back(next);
+                }
+            }
+        }
+        bool remember = false;
+        for (RoomId room = 0; room < world.roomTotal; ++room) {
+            for (uint32_t e = world.edgeStart[room]; e < world.edgeStart[room + 1]; ++e) {
+                if (world.edgeTarget[e] != locked) {
+                    continue;
+                }
+                if (!reached[room]) {
+                    entersBehind[e >> 6] |= 1ull << (e & 63);
+                } else {
+                    remember = remember || !unlocksHere(room, locked);
+                }
+            }
+        }
+        return remember;
+    }
+
+    // Whether a rule in `room` unlocks `locked` through a verb the solver uses
+    bool unlocksHere(RoomId room, RoomId locked) const {
+        for (uint32_t r = world.ruleStart[room]; r < world.ruleStart[room + 1]; ++r) {
+            const Rule& rule = world.rules[r];
+            for (uint32_t i = 0; i < rule.opCount && rule.verb >= VERB_LOOK; ++i) {
+                const RuleOp& op = world.ruleOps[rule.firstOp + i];
+                if (op.code == RULE_UNLOCK_ROOM && op.value == locked) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // Whether a rule's conditions hold in `room` for a player holding `inventory`
+    bool holds(RoomId room, uint32_t inventory, const Rule& rule) const {
+        NpcId npc = world.roomNpc[room];
+        for (uint32_t i = 0; i < rule.opCount && world.ruleOps[rule.firstOp + i].code < RULE_PRINT; ++i) {
+            const RuleOp& op = world.ruleOps[rule.firstOp + i];
+            uint32_t bit = op.value < itemBits.size() ? itemBits[op.value] : 0;
+            bool met = op.code == RULE_HAS_ITEM ? (inventory & bit) != 0
+                     : op.code == RULE_LACKS_ITEM ? (inventory & bit) == 0
+                     : op.code == RULE_ITEM_HERE ? liesIn(room, op.value) && (inventory & bit) == 0
+                     : npc != NO_NPC_ID && world.npcType[npc] == MONSTER;
+            if (!met) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // The action that takes exit `edge` out of `room`: its direction if it is open, the
+    // direction after the verb of a rule here that reveals or unlocks the way, or NO_ACTION
+    uint8_t crossing(RoomId room, uint32_t inventory, uint32_t edge) const {
+        uint8_t direction = world.edgeDirection[edge];
+        RoomId target = world.edgeTarget[edge];
+        bool hidden = (world.edgeFlags[edge] & EDGE_HIDDEN) != 0;
+        bool locked = world.roomLocked[target] != 0 && (inventory & roomBits[target]) == 0
+                   && ((entersBehind[edge >> 6] >> (edge & 63)) & 1) == 0;
+        if (!hidden && !locked) {
+            return direction;
+        }
+        for (uint32_t r = world.ruleStart[room]; r < world.ruleStart[room + 1]; ++r) {
+            const Rule& rule = world.rules[r];
+            if (rule.verb < VERB_LOOK || rule.verb >= VERB_COUNT || !holds(room, inventory, rule)) {
+                continue;
+            }
+            bool revealed = !hidden, unlocked = !locked;
+            for (uint32_t i = 0; i < rule.opCount; ++i) {
+                const RuleOp& op = world.ruleOps[rule.firstOp + i];
+                revealed = revealed || (op.code == RULE_REVEAL_EXIT && op.value == direction);
+                unlocked = unlocked || (op.code == RULE_UNLOCK_ROOM && op.value == target);
+            }
+            if (revealed && unlocked) {
+                return static_cast<uint8_t>(AFTER_VERB | (rule.verb - VERB_LOOK) << 3 | direction);
+            }
+        }
+        return NO_ACTION;
+    }
+
+    // Inventory after using `verb` in `room`: the verb's usual effect, unless an
+    // instead rule replaces it, plus the items given by every rule that fires
+    uint32_t applyVerb(RoomId room, uint32_t inventory, unsigned verb) const {
+        uint32_t first, last;
+        findRules(world, room, verb, first, last);
+        uint32_t gained = 0;
+        bool replaced = false;
+        for (uint32_t r = first; r < last && r < first + 64; ++r) {
+            const Rule& rule = world.rules[r];
+            if (!holds(room, inventory, rule)) {
+                continue;
+            }
+            replaced = replaced || (rule.flags & RULE_INSTEAD) != 0;
+            for (uint32_t i = 0; i < rule.opCount; ++i) {
+                const RuleOp& op = world.ruleOps[rule.firstOp + i];
+                if (op.code == RULE_GIVE_ITEM && op.value < itemBits.size()) {
+                    gained |= itemBits[op.value];
+                } else if (op.code == RULE_UNLOCK_ROOM && op.value < roomBits.size()) {
+                    gained |= roomBits[op.value];
+                }
+            }
+        }
+        if (verb == VERB_TAKE && !replaced) {
+            // take with no argument takes every stack whose needs are met
+            for (uint32_t i = world.roomItemStart[room]; i < world.roomItemStart[room + 1]; ++i) {
+                ItemId item = world.roomItems[i].item;
+                ItemId needs = world.items[item].needs;
+                if (needs == NO_ITEM || (inventory & itemBits[needs]) != 0) {
+                    gained |= itemBits[item];
+                }
+            }
+        }
+        return inventory | (gained & ~withheld);
+    }
+
+    // Whether an item lies in a room at the start of the game
+    bool liesIn(RoomId room, ItemId item) const {
+        for (uint32_t i = world.roomItemStart[room]; i < world.roomItemStart[room + 1]; ++i) {
+            if (world.roomItems[i].item == item) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Adds the successors of `state` to `out`: by movement, or by the verbs that can change the inventory
+    void expand(uint64_t state, bool movement, std::vector<uint64_t>& out) {
+        RoomId room = stateRoom(state);
+        uint32_t inventory = stateInventory(state);
+        if (movement) {
+            for (uint32_t e = world.edgeStart[room]; e < world.edgeStart[room + 1]; ++e) {
+                uint8_t action = crossing(room, inventory, e);
+                if (action != NO_ACTION) {
+                    visit(packState(world.edgeTarget[e], inventory), state, action, out);
+                }
+            }
+            return;
+        }
+        for (unsigned verb = VERB_LOOK; verb < VERB_COUNT; ++verb) {
+            uint32_t next = applyVerb(room, inventory, verb);
+            if (next != inventory) {
+                visit(packState(room, next), state, static_cast<uint8_t>(verb), out);
+            }
+        }
+        // Dropping costs no move either. The dropped item is left behind for good.
+        for (uint32_t bits = inventory & droppable; bits != 0; bits &= bits - 1) {
+            unsigned bit = __builtin_ctz(bits);
+            visit(packState(room, inventory & ~(1u << bit)), state, static_cast<uint8_t>(DROP | bit), out);
+        }
+    }
+
+    void visit(uint64_t next, uint64_t parent, uint8_t action, std::vector<uint64_t>& out) {
+        StateTable::InsertResult result = visited.insert(next, parent, action);
+        if (result == StateTable::INSERTED) {
+            out.push_back(next);
+            // Linear probing slows down sharply in a nearly full table, so three quarters counts as full
+            if (explored.fetch_add(1, std::memory_order_relaxed) + 1 > visited.capacity() / 4 * 3) {
+                overflow.store(true);
+            }
+            if (stateInventory(next) & goalBits) {
+                uint64_t none = ~0ull;
+                goal.compare_exchange_strong(none, next);
+            }
+        } else if (result == StateTable::FULL) {
+            overflow.store(true);
+        }
+    }
+
+    // Expands every state in `frontier` and returns the newly discovered states
+    std::vector<uint64_t> expandAll(const std::vector<uint64_t>& frontier, bool movement) {
+        // Small frontiers are not worth the cost of starting threads
+        unsigned shards = frontier.size() < 4096 ? 1 : threadCount;
+        std::vector<std::vector<uint64_t> > found(shards);
+        if (shards == 1) {
+            for (size_t i = 0; i < frontier.size(); ++i) {
+                expand(frontier[i], movement, found[0]);
+            }
+        } else {
+            std::vector<std::thread> workers;
+            for (unsigned t = 0; t < shards; ++t) {
+                workers.push_back(std::thread([this, &frontier, &found, movement, shards, t]() {
+                    size_t begin = frontier.size() * t / shards;
+                    size_t end = frontier.size() * (t + 1) / shards;
+                    for (size_t i = begin; i < end; ++i) {
+                        expand(frontier[i], movement, found[t]);
+                    }
+                }));
+            }
+            for (size_t t = 0; t < workers.size(); ++t) {
+                workers[t].join();
+            }
+        }
+
+        std::vector<uint64_t> merged;
+        merged.swap(found[0]);
+        for (unsigned t = 1; t < shards; ++t) {
+            merged.insert(merged.end(), found[t].begin(), found[t].end());
+        }
+        return merged;
+    }
+
+public:
+    // A state is a room plus the items held, and items are usually gained in one order
+    // (sword, key, treasure), so few rooms are reached with more than four inventories;
+    // `statesPerRoom` sizes the visited set for worlds where that is not enough.
+    // With `withoutKeys` set the player never gets the items that open the way.
+    WorldSolver(const World& w, unsigned threads, uint64_t statesPerRoom = 8, bool withoutKeys = false)
+        : world(w), threadCount(threads == 0 ? 1 : threads),
+          visited(static_cast<uint64_t>(w.roomCount()) * statesPerRoom), goal(~0ull), explored(0), overflow(false),
+          itemBits(w.itemTotal, 0), roomBits(w.roomTotal, 0), goalBits(0), keyBits(0), withheld(0), droppable(0), trackedBits(0) {
+        std::fill(bitItems, bitItems + 32, NO_ITEM);
+        for (ItemId item = 1; item < w.itemTotal; ++item) {
+            if ((w.items[item].flags & ITEM_GOAL) != 0) {
+                track(item);
+                goalBits |= itemBits[item];
+                track(w.items[item].needs);
+            }
+        }
+        for (ItemId item = 1; item < w.itemTotal; ++item) {
+            track(w.items[item].needs);
+        }
+        for (uint32_t i = 0; i < w.ruleTotal; ++i) {
+            const Rule& rule = w.rules[i];
+            for (uint32_t j = 0; j < rule.opCount; ++j) {
+                const RuleOp& op = w.ruleOps[rule.firstOp + j];
+                if (op.code == RULE_HAS_ITEM || op.code == RULE_LACKS_ITEM || op.code == RULE_ITEM_HERE || op.code == RULE_GIVE_ITEM) {
+                    track(op.value);
+                }
+            }
+        }
+        // Holding more never hurts unless a rule tests for an item the player lacks, and
+        // only then can dropping one help
+        for (uint32_t i = 0; i < w.ruleTotal; ++i) {
+            const Rule& rule = w.rules[i];
+            for (uint32_t j = 0; j < rule.opCount; ++j) {
+                const RuleOp& op = w.ruleOps[rule.firstOp + j];
+                if ((op.code == RULE_LACKS_ITEM || op.code == RULE_ITEM_HERE) && op.value < itemBits.size()) {
+                    droppable |= itemBits[op.value];
+                }
+            }
+        }
+        // Locked rooms the rules unlock: 1 when every rule doing so lies next to the room,
+        // 2 when one lies elsewhere. Items the rules opening the way test for are keys.
+        std::vector<uint8_t> unlockable(w.roomTotal, 0);
+        for (RoomId room = 0; room < w.roomTotal; ++room) {
+            for (uint32_t r = w.ruleStart[room]; r < w.ruleStart[room + 1]; ++r) {
+                const Rule& rule = w.rules[r];
+                bool opens = false;
+                for (uint32_t i = 0; i < rule.opCount; ++i) {
+                    const RuleOp& op = w.ruleOps[rule.firstOp + i];
+                    opens = opens || op.code == RULE_REVEAL_EXIT || op.code == RULE_UNLOCK_ROOM;
+                    if (op.code == RULE_UNLOCK_ROOM && op.value < w.roomTotal && w.roomLocked[op.value] != 0) {
+                        bool nextTo = false;
+                        for (uint32_t e = w.edgeStart[room]; e < w.edgeStart[room + 1]; ++e) {
+                            nextTo = nextTo || w.edgeTarget[e] == op.value;
+                        }
+                        unlockable[op.value] = std::max<uint8_t>(unlockable[op.value], nextTo ? 1 : 2);
+                    }
+                }
+                for (uint32_t i = 0; i < rule.opCount && opens; ++i) {
+                    const RuleOp& op = w.ruleOps[rule.firstOp + i];
+                    if (op.code == RULE_HAS_ITEM && op.value < itemBits.size()) {
+                        keyBits |= itemBits[op.value];
+                    }
+                }
+            }
+        }
+        // A locked room is unlocked on the way in by a rule where the player stands, and is
+        // open when entered from rooms only reachable through it. A room unlocked from
+        // elsewhere, or with another way in, has to be remembered as open.
+        entersBehind.assign((w.edgeTotal + 63) / 64, 0);
+        std::vector<uint8_t> reached;
+        for (RoomId room = 0; room < w.roomTotal; ++room) {
+            if (unlockable[room] != 0 && (markBehind(room, reached) || unlockable[room] == 2)) {
+                trackRoom(room);
+            }
+        }
+        withheld = withoutKeys ? keyBits : 0;
+    }
+
+    // Items that rules revealing exits or unlocking rooms test for
+    size_t keyCount() const {
+        size_t count = 0;
+        for (uint32_t bits = keyBits; bits != 0; bits &= bits - 1) {
+            count++;
+        }
+        return count;
+    }
+
+    // Whether the last search stopped because the state table filled up
+    bool overflowed() const { return overflow.load(); }
+
+    // Whether the search covers every state the game can reach. The solver does not pick
+    // dropped items up again, so a world where dropping can help is not covered.
+    bool exhaustive() const { return droppable == 0; }
+
+    // Searches from the start room; returns false only if the state table filled up
+    bool solve(SolverResult& result, std::string& error) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        result.solved = false;
+        result.moves = 0;
+        result.commands.clear();
+        result.keys = keyCount();
+        result.exhaustive = exhaustive();
+        if (trackedBits > 32) {
+            std::ostringstream message;
+            message << trackedBits << " items and locked rooms matter to winning; the solver tracks at most 32";
+            error = message.str();
+            return false;
+        }
+
+        uint64_t initial = packState(world.startRoom, 0);
+        visited.insert(initial, initial, 0);
+        explored.store(1);
+        std::vector<uint64_t> level(1, initial);
+        int moves = 0;
+        while (!level.empty() && goal.load() == ~0ull && !overflow.load()) {
+            // Close the level under the verbs that cost no moves
+            std::vector<uint64_t> added = level;
+            while (!added.empty() && goal.load() == ~0ull) {
+                added = expandAll(added, false);
+                level.insert(level.end(), added.begin(), added.end());
+            }
+            if (goal.load() != ~0ull) {
+                break;
+            }
+            level = expandAll(level, true);
+            moves++;
+        }
+
+        result.states = explored.load();
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (overflow.load()) {
+            error = "state table is full; the world has more reachable states than expected";
+            return false;
+        }
+        if (goal.load() == ~0ull) {
+            return true;
+        }
+
+        // Walk back from the winning state to recover the commands
+        std::vector<uint8_t> path;
+        uint64_t state = goal.load();
+        while (state != initial) {
+            uint64_t parent = initial;
+            uint8_t action = 0;
+            visited.find(state, parent, action);
+            path.push_back(action);
+            state = parent;
+        }
+        std::reverse(path.begin(), path.end());
+        for (size_t i = 0; i < path.size(); ++i) {
+            static const char* const verbs[] = { "look", "talk", "fight", "take" };
+            uint8_t action = path[i];
+            if ((action & AFTER_VERB) != 0) {
+                result.commands.push_back(verbs[(action >> 3) & 15]);
+                action &= 7;
+            }
+            if ((action & DROP) != 0) {
+                result.commands.push_back("drop " + itemName(world, bitItems[action & 31]));
+            } else if (action >= VERB_LOOK) {
+                result.commands.push_back(verbs[action - VERB_LOOK]);
+            } else {
+                result.commands.push_back(directionToString(static_cast<Direction>(action)));
+            }
+        }
+        result.solved = true;
+        result.moves = moves;
+        return true;
+    }
+};
+
+// Solves the world, growing the state table as needed. Returns false with the reason
+// in `error` if the solver gave up.
+bool solveWorld(const World& world, unsigned threads, bool withoutKeys, SolverResult& result, std::string& error) {
+    // Worlds where items can be gathered in many orders, such as generated worlds with
+    // several keys, fill the state table; they get a larger one, up to 2^27 states
+    for (uint64_t statesPerRoom = 8; ; statesPerRoom *= 8) {
+        WorldSolver solver(world, threads, statesPerRoom, withoutKeys);
+        if (solver.solve(result, error)) {
+            return true;
+        }
+        if (!solver.overflowed() || static_cast<uint64_t>(world.roomCount()) * statesPerRoom * 8 > (1ull << 27)) {
+            return false;
+        }
+    }
+}
+
+// Solves the world, printing the winning transcript to stdout and a summary to stderr.
+// A world with keys is solved a second time without them, to check that its locks
+// and hidden exits really stand in the way. Returns 0 when the world can be won,
+// 3 when it is proven unwinnable and 4 when it can be won without its keys. When
+// the search does not cover every state, finding no win is not a proof and returns 1.
+int runSolver(const World& world, unsigned threads) {
+    SolverResult result;
+    std::string error;
+    if (!solveWorld(world, threads, false, result, error)) {
+        std::cerr << "Solver failed: " << error << std::endl;
+        return 1;
+    }
+    if (!result.solved && !result.exhaustive) {
+        std::cerr << "No win found, which proves nothing: rules test for items the player lacks, and the solver does not"
+                  << " take dropped items back (" << result.states << " states explored in " << result.seconds * 1000.0 << " ms)" << std::endl;
+        return 1;
+    }
+    if (!result.solved) {
+        std::cerr << "Unwinnable: the treasure cannot be taken (" << result.states << " states explored in "
+                  << result.seconds * 1000.0 << " ms)" << std::endl;
+        return 3;
+    }
+    for (size_t i = 0; i < result.commands.size(); ++i) {
+        std::cout << result.commands[i] << "\n";
+    }
+    std::cout.flush();
+    unsigned used = threads == 0 ? 1 : threads;
+    std::cerr << "Solved in " << result.moves << " moves (" << result.commands.size() << " commands, "
+              << result.states << " states explored with " << used << (used == 1 ? " thread" : " threads") << " in "
+              << result.seconds * 1000.0 << " ms)" << std::endl;
+    if (result.keys == 0) {
+        return 0;
+    }
+    SolverResult keyless;
+    if (!solveWorld(world, threads, true, keyless, error)) {
+        std::cerr << "Solver failed without the keys: " << error << std::endl;
+        return 1;
+    }
+    if (keyless.solved) {
+        std::cerr << "Locks guard nothing: the treasure can be taken in " << keyless.moves << " moves without the "
+                  << result.keys << (result.keys == 1 ? " key" : " keys") << std::endl;
+        return 4;
+    }
+    std::cerr << (keyless.exhaustive ? "The treasure cannot be taken without the " : "No win found without the ")
+              << result.keys << (result.keys == 1 ? " key" : " keys") << " (" << keyless.states << " states explored)" << std::endl;
+    return 0;
+}
+
+// How a playtest agent chooses its next command
+enum AgentPolicy {
+    POLICY_RANDOM,  // Any verb at random, like a player mashing keys
+    POLICY_GREEDY   // Takes and fights when it can, prefers unexplored exits, otherwise tries any direction
+};
+
+// Outcome of one playtest agent
+struct AgentResult {
+    bool won;                    // Whether the agent found the treasure
+    int moveCount;               // Moves made by the end of the run
+    bool monsterBeforeSword;     // Whether it entered a monster's room before holding the sword
+};
+
+// Totals gathered by one worker thread and merged once all agents have run
+struct PlaytestTotals {
+    std::vector<uint64_t> roomVisits;   // Turns ended in each room
+    std::vector<uint32_t> winningMoves; // moveCount of every agent that won
+    uint64_t agents;
+    uint64_t monsterBeforeSword;
+    uint64_t turns;
+
+    PlaytestTotals() : agents(0), monsterBeforeSword(0), turns(0) {}
+};
+
+// Picks the next command for an agent. `visited` marks the rooms this agent has been in;
+// `mayTake` is false once taking has been tried in the current room, in case a rule blocks it.
+const char* chooseAgentCommand(const World& world, const Player& player, AgentPolicy policy, uint32_t& rng,
+                               const std::vector<uint8_t>& visited, bool mayTake) {
+    static const char* const verbs[] = { "north", "east", "south", "west", "up", "down", "take", "fight", "talk", "look" };
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    if (policy == POLICY_RANDOM) {
+        return verbs[rng % (sizeof(verbs) / sizeof(verbs[0]))];
+    }
+
+    RoomId room = player.currentRoom;
+    if (mayTake && !itemsInRoom(world, player, room).empty()) {
+        return "take";
+    }
+    NpcId npc = world.roomNpc[room];
+    if (npc != NO_NPC_ID && world.npcType[npc] == MONSTER && !isNpcDefeated(player, npc) && canFight(world, player)) {
+        return "fight";
+    }
+    // Head for a visible exit into an unexplored room, starting from a random direction
+    unsigned exits = visibleExits(world, player, room);
+    for (int i = 0; i < DIRECTION_COUNT; ++i) {
+        int dir = (rng + i) % DIRECTION_COUNT;
+        if (exits & (1u << dir)) {
+            RoomId next = world.neighbor(room, static_cast<Direction>(dir));
+            if (next != NO_ROOM && !visited[next]) {
+                return verbs[dir];
+            }
+        }
+    }
+    // Everything in sight is explored: now and then look around, which may reveal a
+    // hidden passage, and otherwise wander off in any direction
+    if ((rng >> 8) % 4 == 0) {
+        return "look";
+    }
+    return verbs[(rng >> 10) % DIRECTION_COUNT];
+}
+
+// Plays one agent through the same command dispatcher as interactive play
+AgentResult runAgent(const CommandTable& commands, const World& world, AgentPolicy policy, uint32_t seed, size_t maxTurns,
+                     std::vector<uint8_t>& visited, PlaytestTotals& totals) {
+    Player player(world.startRoom);
+    FrameBuffer discarded;
+    std::ostream out(&discarded);
+    std::string line;
+    AgentResult result = { false, 0, false };
+    bool seenMonster = false;
+    uint32_t rng = seed;
+    RoomId triedTake = NO_ROOM;  // Room where taking was last tried
+
+    std::fill(visited.begin(), visited.end(), 0);
+    visited[player.currentRoom] = 1;
+    totals.roomVisits[player.currentRoom]++;
+    for (size_t turn = 0; turn < maxTurns; ++turn) {
+        RoomId before = player.currentRoom;
+        line = chooseAgentCommand(world, player, policy, rng, visited, triedTake != before);
+        if (line == "take") {
+            triedTake = before;
+        }
+        bool redraw;
+        TurnResult outcome = processCommand(commands, world, player, line, out, redraw);
+        discarded.clear();
+        totals.turns++;
+        if (outcome == TURN_WON) {
+            result.won = true;
+            break;
+        }
+        RoomId room = player.currentRoom;
+        if (room != before) {
+            triedTake = NO_ROOM;
+        }
+        visited[room] = 1;
+        totals.roomVisits[room]++;
+        NpcId npc = world.roomNpc[room];
+        if (!seenMonster && npc != NO_NPC_ID && world.npcType[npc] == MONSTER) {
+            seenMonster = true;
+            result.monsterBeforeSword = !canFight(world, player);
+        }
+    }
+    result.moveCount = player.moveCount;
+    return result;
+}
+
+// Prints one bar of a text histogram
+void printBar(std::ostream& out, uint64_t value, uint64_t largest) {
+    size_t width = largest == 0 ? 0 : static_cast<size_t>(40.0 * value / largest + 0.5);
+    out << std::string(width, '#');
+}
+
+// Runs `agents` independent agents on a pool of worker threads and reports the distribution
+// of moves to win, how often the monster was met before the sword, and which rooms get visited.
+// Agent i is seeded from `seed` and i alone, so the totals do not depend on the thread count.
+int runPlaytest(std::ostream& out, const CommandTable& commands, const World& world, size_t agents, AgentPolicy policy,
+                unsigned threads, unsigned seed, size_t maxTurns) {
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+    unsigned workerCount = std::max(1u, threads);
+    std::vector<PlaytestTotals> totals(workerCount);
+    std::atomic<size_t> nextAgent(0);
+
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < workerCount; ++t) {
+        workers.push_back(std::thread([&, t]() {
+            PlaytestTotals& mine = totals[t];
+            mine.roomVisits.assign(world.roomCount(), 0);
+            std::vector<uint8_t> visited(world.roomCount());
+            // Agents are handed out one at a time so slow agents do not leave threads idle
+            for (size_t agent = nextAgent++; agent < agents; agent = nextAgent++) {
+                uint64_t mixed = (static_cast<uint64_t>(seed) << 32 | agent) * 0x9E3779B97F4A7C15ull;
+                uint32_t agentSeed = static_cast<uint32_t>(mixed >> 32) | 1;
+                AgentResult result = runAgent(commands, world, policy, agentSeed, maxTurns, visited, mine);
+                mine.agents++;
+                if (result.won) {
+                    mine.winningMoves.push_back(static_cast<uint32_t>(result.moveCount));
+                }
+                if (result.monsterBeforeSword) {
+                    mine.monsterBeforeSword++;
+                }
+            }
+        }));
+    }
+    for (size_t t = 0; t < workers.size(); ++t) {
+        workers[t].join();
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    PlaytestTotals all;
+    all.roomVisits.assign(world.roomCount(), 0);
+    for (size_t t = 0; t < totals.size(); ++t) {
+        all.agents += totals[t].agents;
+        all.monsterBeforeSword += totals[t].monsterBeforeSword;
+        all.turns += totals[t].turns;
+        all.winningMoves.insert(all.winningMoves.end(), totals[t].winningMoves.begin(), totals[t].winningMoves.end());
+        for (RoomId r = 0; r < world.roomCount(); ++r) {
+            all.roomVisits[r] += totals[t].roomVisits[r];
+        }
+    }
+    std::vector<uint64_t> moves(all.winningMoves.begin(), all.winningMoves.end());
+    std::sort(moves.begin(), moves.end());
+
+    out << "Playtest (" << all.agents << " " << (policy == POLICY_RANDOM ? "random" : "greedy") << " agents, "
+        << workerCount << " threads, up to " << maxTurns << " turns each)\n"
+        << "  time:         " << seconds * 1000.0 << " ms (" << static_cast<uint64_t>(all.turns / seconds) << " turns/s)\n"
+        << "  won:          " << moves.size() << " (" << 100.0 * moves.size() / std::max<uint64_t>(all.agents, 1) << "%)\n"
+        << "  monster met before sword: " << 100.0 * all.monsterBeforeSword / std::max<uint64_t>(all.agents, 1) << "% of agents\n";
+
+    // Histogram of moves to win, ten buckets between the fastest and slowest winner
+    if (!moves.empty()) {
+        out << "  moves to win: min " << moves.front() << ", p10 " << percentile(moves, 10) << ", p50 " << percentile(moves, 50)
+            << ", p90 " << percentile(moves, 90) << ", max " << moves.back() << "\n";
+        const size_t bucketCount = 10;
+        uint64_t low = moves.front();
+        uint64_t width = std::max<uint64_t>(1, (moves.back() - low) / bucketCount + 1);
+        std::vector<uint64_t> buckets(bucketCount, 0);
+        for (size_t i = 0; i < moves.size(); ++i) {
+            buckets[std::min<size_t>((moves[i] - low) / width, bucketCount - 1)]++;
+        }
+        uint64_t largest = *std::max_element(buckets.begin(), buckets.end());
+        for (size_t b = 0; b < bucketCount; ++b) {
+            out << "    " << std::setw(7) << low + b * width << "-" << std::left << std::setw(7) << low + (b + 1) * width - 1
+                << std::right << std::setw(8) << buckets[b] << "  ";
+            printBar(out, buckets[b], largest);
+            out << "\n";
+        }
+    }
+
+    // Heatmap of turns spent in each room; large worlds list only the busiest rooms
+    uint64_t totalVisits = 0;
+    uint32_t neverVisited = 0;
+    std::vector<RoomId> order;
+    for (RoomId r = 0; r < world.roomCount(); ++r) {
+        totalVisits += all.roomVisits[r];
+        neverVisited += all.roomVisits[r] == 0 ? 1 : 0;
+        order.push_back(r);
+    }
+    std::stable_sort(order.begin(), order.end(), [&all](RoomId a, RoomId b) { return all.roomVisits[a] > all.roomVisits[b]; });
+    const size_t shown = std::min<size_t>(order.size(), 20);
+    out << "  room visits:  " << neverVisited << " of " << world.roomCount() << " rooms never visited"
+        << (shown < order.size() ? "; busiest rooms:" : "") << "\n";
+    uint64_t largest = order.empty() ? 0 : all.roomVisits[order[0]];
+    std::ios::fmtflags flags = out.flags();
+    for (size_t i = 0; i < shown; ++i) {
+        RoomId r = order[i];
+        out << "    " << std::left << std::setw(20) << stripAnsi(world.textString(world.roomName[r])) << std::right
+            << std::setw(7) << std::fixed << std::setprecision(2) << 100.0 * all.roomVisits[r] / std::max<uint64_t>(totalVisits, 1) << "%  ";
+        printBar(out, all.roomVisits[r], largest);
+        out << "\n";
+    }
+    out.flags(flags);
+    out << std::flush;
+    return 0;
+}
+
+// Measures generation and build time, memory per room and movement cost on a large generated world
+void runWorldBenchmark(std::ostream& out, uint32_t rooms, unsigned seed, unsigned threads) {
+    typedef std::chrono::steady_clock Clock;
+    GeneratorOptions options;
+    options.rooms = rooms;
+    options.seed = seed;
+    options.threads = threads;
+    WorldPlan plan;
+    std::string error;
+    if (!planWorld(options, plan, error)) {
+        out << error << std::endl;
+        return;
+    }
+    Clock::time_point start = Clock::now();
+    World world;
+    {
+        WorldBuilder builder;
+        buildGeneratedWorld(plan, builder);
+        if (!world.load(builder, error)) {
+            out << error << std::endl;
+            return;
+        }
+    }
+    double buildSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    // Random walk: pick a direction each step and follow it if there is an exit
+    const size_t steps = 10000000;
+    uint32_t state = seed != 0 ? seed : 1;
+    RoomId room = world.startRoom;
+    size_t moves = 0;
+    start = Clock::now();
+    for (size_t i = 0; i < steps; ++i) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        RoomId next = world.neighbor(room, static_cast<Direction>(state % 4));
+        if (next != NO_ROOM) {
+            room = next;
+            ++moves;
+        }
+    }
+    double walkSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    out << "World benchmark (" << world.roomCount() << " rooms, " << world.edgeTotal << " edges)\n"
+        << "  plan:         " << plan.planSeconds * 1000.0 << " ms on " << threads << " threads\n"
+        << "  build:        " << buildSeconds * 1000.0 << " ms\n"
+        << "  memory:       " << world.memoryBytes() / (1024.0 * 1024.0) << " MiB ("
+        << static_cast<double>(world.memoryBytes()) / world.roomCount() << " bytes/room, text included)\n"
+        << "  random walk:  " << walkSeconds / steps * 1e9 << " ns/step (" << moves << " moves, ended in room " << room << ")" << std::endl;
+}
+
+// Measures the cost of journaling every turn, of writing a snapshot and of recovering a session
+void runSaveBenchmark(std::ostream& out, const CommandTable& commands, const World& world, size_t turns, unsigned seed) {
+    typedef std::chrono::steady_clock Clock;
+    std::string path = "/tmp/eldara-save-bench-" + std::to_string(getpid()) + ".sav";
+    std::istringstream transcript(generateTranscript(turns, seed));
+    std::vector<std::string> lines;
+    for (std::string line; std::getline(transcript, line); ) {
+        lines.push_back(line);
+    }
+    FrameBuffer discarded;
+    std::ostream sink(&discarded);
+
+    // The same session twice: without a save slot, then journaling every turn
+    double seconds[2];
+    SaveSlot slot(commands, path);
+    Player player(world.startRoom);
+    for (int pass = 0; pass < 2; ++pass) {
+        player = Player(world.startRoom);
+        std::string error;
+        if (pass == 1) {
+            player.saveSlot = &slot;
+            if (!slot.save(world, player, error)) {
+                out << "Save benchmark failed: " << error << std::endl;
+                return;
+            }
+        }
+        Clock::time_point start = Clock::now();
+        for (size_t i = 0; i < lines.size(); ++i) {
+            bool redraw;
+            processCommand(commands, world, player, lines[i], sink, redraw);
+            discarded.clear();
+        }
+        seconds[pass] = std::chrono::duration<double>(Clock::now() - start).count();
+    }
+    uint64_t journalBytes = slot.journalBytes;
+    uint64_t journaledTurns = slot.journaledTurns;
+
+    const int snapshots = 1000;
+    std::string error;
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < snapshots; ++i) {
+        slot.save(world, player, error);
+    }
+    double snapshotSeconds = std::chrono::duration<double>(Clock::now() - start).count() / snapshots;
+
+    // Recover from the last snapshot plus a journal of 500 turns
+    for (size_t i = 0; i < 500 && i < lines.size(); ++i) {
+        bool redraw;
+        processCommand(commands, world, player, lines[i], sink, redraw);
+        discarded.clear();
+    }
+    Player recovered(world.startRoom);
+    recovered.saveSlot = &slot;
+    uint32_t replayed = 0;
+    start = Clock::now();
+    bool loaded = slot.load(world, recovered, replayed, error);
+    double loadSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+    bool matches = loaded && recovered.currentRoom == player.currentRoom && recovered.moveCount == player.moveCount;
+
+    ::unlink(path.c_str());
+    ::unlink((path + ".journal").c_str());
+    out << "Save benchmark (" << lines.size() << " turns)\n"
+        << "  journal:      " << (seconds[1] - seconds[0]) / lines.size() * 1e6 << " us/turn, "
+        << static_cast<double>(journalBytes) / std::max<uint64_t>(journaledTurns, 1) << " bytes/record ("
+        << journaledTurns << " of the turns changed state and were journaled)\n"
+        << "  snapshot:     " << snapshotSeconds * 1e6 << " us, " << slot.snapshotBytes << " bytes\n"
+        << "  recovery:     " << loadSeconds * 1e6 << " us (" << replayed << " turns replayed, state "
+        << (matches ? "matches" : "DIFFERS") << ")" << std::endl;
+}
+
+// Measures what batching saves: the same generated commands run as bare state
+// transitions (no rendering), through the game loop one per line, and through the
+// game loop several to a line
+void runBatchBenchmark(std::ostream& out, const CommandTable& commands, const World& world, size_t count, unsigned seed) {
+    typedef std::chrono::steady_clock Clock;
+    const size_t perLine = 20;
+    std::string single = generateTranscript(count, seed);
+    std::string batched;
+    size_t onLine = 0;
+    for (size_t i = 0; i < single.size(); ++i) {
+        if (single[i] != '\n') {
+            batched += single[i];
+        } else if (++onLine == perLine) {
+            batched += '\n';
+            onLine = 0;
+        } else {
+            batched += "; ";
+        }
+    }
+
+    // Every command handled with nothing rendered
+    FrameBuffer discarded;
+    std::ostream sink(&discarded);
+    Player bare(world.startRoom);
+    std::istringstream lines(single);
+    Clock::time_point start = Clock::now();
+    for (std::string line; std::getline(lines, line); ) {
+        bool redraw;
+        processCommand(commands, world, bare, line, sink, redraw);
+        discarded.clear();
+    }
+    double bareSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    out << "Batch benchmark (" << count << " commands)\n"
+        << "                  ns/command   frames   bytes/command\n"
+        << "  state only    " << std::setw(12) << bareSeconds / count * 1e9 << "\n";
+    const char* names[] = { "one per line  ", "20 per line   " };
+    const std::string* inputs[] = { &single, &batched };
+    for (int mode = 0; mode < 2; ++mode) {
+        Player player(world.startRoom);
+        RenderCache cache(world.roomCount());
+        player.renderCache = &cache;
+        Renderer renderer(-1, false);
+        std::istringstream in(*inputs[mode]);
+        ReplayStats stats;
+        runGameLoop(commands, world, player, in, renderer, &stats);
+        bool same = player.currentRoom == bare.currentRoom && player.moveCount == bare.moveCount;
+        out << "  " << names[mode] << std::setw(12) << stats.totalSeconds / std::max<uint64_t>(stats.commands, 1) * 1e9
+            << std::setw(9) << renderer.frames << std::setw(16)
+            << static_cast<double>(renderer.bytes) / std::max<uint64_t>(stats.commands, 1)
+            << (same ? "" : "   (final state DIFFERS)") << "\n";
+    }
+    out << std::flush;
+}
+
+// Measures the turn history over a long session on a generated world with items:
+// the cost of snapshotting each turn, the memory the whole session's history holds
+// against copying the player's state every turn, and the cost of going back
+void runUndoBenchmark(std::ostream& out, const CommandTable& commands, size_t turns, unsigned seed) {
+    typedef std::chrono::steady_clock Clock;
+    const uint32_t rooms = 100000;
+    uint32_t state = seed != 0 ? seed : 1;
+    World world;
+    {
+        WorldBuilder builder;
+        buildBenchmarkWorld(builder, rooms, seed);
+        for (uint32_t i = 1; i < 64; ++i) {
+            builder.addItem("item" + std::to_string(i), std::string(), std::string(), std::string(), 0, NO_ITEM);
+        }
+        for (uint32_t r = 0; r < rooms; ++r) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            if (state % 3 == 0) {
+                builder.placeItem(r, 1 + state % 63, 1 + state % 4);
+            }
+        }
+        std::string error;
+        if (!world.load(builder, error)) {
+            out << error << std::endl;
+            return;
+        }
+    }
+
+    // Like the item benchmark's player: fights become takes and talks become drops
+    std::istringstream transcript(generateTranscript(turns, seed));
+    Player player(world.startRoom);
+    TurnHistory history(turns);
+    history.reset(player);
+    FrameBuffer discarded;
+    std::ostream sink(&discarded);
+    double snapshotSeconds = 0;
+    size_t played = 0, snapshots = 0;
+    double copyBytes = 0;  // What a full copy of the player's state every turn would hold
+    for (std::string line; std::getline(transcript, line); ++played) {
+        bool redraw;
+        if (line == "fight") {
+            line = "take";
+        } else if (line == "talk" && !player.inventory.contents().empty()) {
+            line = "drop " + itemName(world, player.inventory.contents().begin()->item);
+        }
+        processCommand(commands, world, player, line, sink, redraw);
+        discarded.clear();
+        Clock::time_point start = Clock::now();
+        bool taken = history.record(player);
+        snapshotSeconds += std::chrono::duration<double>(Clock::now() - start).count();
+        snapshots += taken ? 1 : 0;
+        if (taken && snapshots % 64 == 0) {
+            copyBytes += 64.0 * (sizeof(Player) + player.changes.memoryBytes() + player.inventory.memoryBytes());
+        }
+    }
+    size_t historyBytes = history.memoryBytes();
+    size_t overlayBytes = player.changes.memoryBytes();
+
+    // Undo one turn at a time, then jump back in large steps
+    const size_t undos = std::min<size_t>(1000, history.available() / 2);
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < undos; ++i) {
+        history.rewind(player, 1);
+    }
+    double undoSeconds = std::chrono::duration<double>(Clock::now() - start).count() / std::max<size_t>(undos, 1);
+    size_t jump = history.available() / 2;
+    start = Clock::now();
+    bool rewound = history.rewind(player, jump);
+    double jumpSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    out << "Undo benchmark (" << played << " turns, " << snapshots << " changed state, " << world.roomCount() << " rooms)\n"
+        << "  snapshot:     " << snapshotSeconds / std::max<size_t>(played, 1) * 1e9 << " ns/turn (player changed "
+        << player.changes.size() + player.changes.itemRooms() << " things, " << overlayBytes << " bytes of overlay)\n"
+        << "  history:      " << historyBytes / 1048576.0 << " MiB for " << snapshots << " snapshots, "
+        << static_cast<double>(historyBytes) / std::max<size_t>(snapshots, 1) << " bytes each (full copies: "
+        << copyBytes / 1048576.0 << " MiB)\n"
+        << "  undo:         " << undoSeconds * 1e9 << " ns per turn undone (" << undos << " undos)\n"
+        << "  rewind:       " << jumpSeconds * 1e9 << " ns to go back " << jump << " turns"
+        << (rewound ? "" : " (FAILED)") << std::endl;
+}
+
+// Measures turn cost as the number of rules in a world grows. Rules are spread over
+// the rooms of a generated world and each turn runs through the full command dispatcher.
+void runRuleBenchmark(std::ostream& out, const CommandTable& commands, uint32_t maxRules, unsigned seed) {
+    typedef std::chrono::steady_clock Clock;
+    const uint32_t rooms = 100000;
+    const size_t turns = 1000000;
+    std::istringstream transcript(generateTranscript(turns, seed));
+    std::vector<std::string> lines;
+    for (std::string line; std::getline(transcript, line); ) {
+        lines.push_back(line);
+    }
+    FrameBuffer discarded;
+    std::ostream sink(&discarded);
+
+    out << "Rule benchmark (" << rooms << "-room world, " << lines.size() << " turns)\n";
+    for (uint32_t ruleCount = 0; ; ruleCount = ruleCount == 0 ? 1000 : ruleCount * 10) {
+        ruleCount = std::min(ruleCount, maxRules);
+        World world;
+        {
+            WorldBuilder builder;
+            buildBenchmarkWorld(builder, rooms, seed);
+            ItemId sword = builder.addItem("sword", std::string(), std::string(), std::string(), ITEM_WEAPON);
+            ItemId key = builder.addItem("key");
+            for (uint32_t i = 0; i < ruleCount; ++i) {
+                // Every verb in the transcript gets rules; most need a sword the player never finds
+                builder.addRule(static_cast<RoomId>((i * 2654435761u) % rooms), static_cast<RuleVerb>(i % VERB_COUNT), i % 3 == 0 ? RULE_INSTEAD : 0);
+                builder.addRuleOp(RULE_LACKS_ITEM, i % 2 == 0 ? sword : key);
+                builder.addRuleOp(RULE_HAS_ITEM, sword);
+                builder.addRulePrint("Nothing happens.");
+            }
+            std::string error;
+            if (!world.load(builder, error)) {
+                out << error << std::endl;
+                return;
+            }
+        }
+        Player player(world.startRoom);
+        Clock::time_point start = Clock::now();
+        for (size_t i = 0; i < lines.size(); ++i) {
+            bool redraw;
+            processCommand(commands, world, player, lines[i], sink, redraw);
+            discarded.clear();
+        }
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        out << "  " << std::setw(9) << ruleCount << " rules: " << seconds / lines.size() * 1e9 << " ns/turn" << std::endl;
+        if (ruleCount >= maxRules) {
+            break;
+        }
+    }
+}
+
+// Measures the cost of a simulation tick as the number of wandering actors grows.
+// Actors start in random rooms of a million-room generated world, half villagers and half
+// monsters, and a few monsters are defeated every turn to keep respawns flowing.
+void runActorBenchmark(std::ostream& out, uint32_t maxActors, unsigned seed) {
+    typedef std::chrono::steady_clock Clock;
+    const uint32_t rooms = 1000000;
+    const size_t ticks = 1000;
+    uint32_t state = seed != 0 ? seed : 1;
+
+    out << "Actor benchmark (" << rooms << "-room world, " << ticks << " ticks)\n";
+    for (uint32_t actorCount = std::min<uint32_t>(1000, maxActors); ; actorCount = std::min(actorCount * 10, maxActors)) {
+        World world;
+        {
+            WorldBuilder builder;
+            buildBenchmarkWorld(builder, rooms, seed);
+            NpcId villager = builder.defineNPC(VILLAGER, "Safe travels!");
+            NpcId monster = builder.defineNPC(MONSTER, "The monster snarls.");
+            for (uint32_t i = 0; i < actorCount; ++i) {
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                builder.addActor(state % rooms, i % 2 == 0 ? villager : monster);
+            }
+            std::string error;
+            if (!world.load(builder, error)) {
+                out << error << std::endl;
+                return;
+            }
+        }
+        ActorSimulation simulation(world, seed);
+        std::vector<uint64_t> tickNanos;
+        tickNanos.reserve(ticks);
+        for (size_t t = 0; t < ticks; ++t) {
+            for (int k = 0; k < 4; ++k) {
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                simulation.defeat(state % actorCount | 1);  // Odd actors are the monsters
+            }
+            Clock::time_point start = Clock::now();
+            simulation.tick();
+            tickNanos.push_back(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count()));
+        }
+
+        // Asking who is in a room walks the lists for that room, not every actor
+        const size_t queries = 1000;
+        uint32_t seen = 0;
+        Clock::time_point start = Clock::now();
+        for (size_t q = 0; q < queries; ++q) {
+            uint32_t villagers, monsters;
+            simulation.countIn(static_cast<RoomId>((q * 7919) % rooms), villagers, monsters);
+            seen += villagers + monsters;
+        }
+        double querySeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        uint64_t total = 0;
+        for (size_t t = 0; t < tickNanos.size(); ++t) {
+            total += tickNanos[t];
+        }
+        std::sort(tickNanos.begin(), tickNanos.end());
+        out << "  " << std::setw(7) << actorCount << " actors: tick mean " << total / 1000.0 / ticks << " us, p99 "
+            << percentile(tickNanos, 99) / 1000.0 << " us, " << simulation.moves / ticks << " moves/tick, "
+            << simulation.respawnsPending() << " awaiting respawn, room query " << querySeconds / queries * 1e6 << " us ("
+            << seen << " seen), " << simulation.memoryBytes() / 1024 << " KiB" << std::endl;
+        if (actorCount >= maxActors) {
+            break;
+        }
+    }
+}
+
+// Measures inventory queries with `itemTypes` kinds of item registered, holding from
+// a few kinds up to half of them, against a linear scan of an unsorted stack list.
+// Also carries items around a generated world to see how often a room's item list has
+// to leave its inline buffer.
+void runItemBenchmark(std::ostream& out, uint32_t itemTypes, unsigned seed) {
+    typedef std::chrono::steady_clock Clock;
+    const uint32_t rooms = 100000;
+    const size_t queries = 1000000;
+    uint32_t state = seed != 0 ? seed : 1;
+    World world;
+    {
+        WorldBuilder builder;
+        buildBenchmarkWorld(builder, rooms, seed);
+        for (uint32_t i = 1; i < itemTypes; ++i) {
+            // One kind in a hundred is a weapon, and every tenth needs the kind before it
+            builder.addItem("item" + std::to_string(i), std::string(), std::string(), std::string(),
+                            i % 100 == 0 ? ITEM_WEAPON : 0, i % 10 == 0 ? i - 1 : NO_ITEM);
+        }
+        for (uint32_t r = 0; r < rooms; ++r) {
+            // Most rooms hold nothing or a stack or two; one in a thousand is a hoard
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            uint32_t stacks = r % 1000 == 0 ? 12 : state % 4 == 0 ? state % 3 + 1 : 0;
+            for (uint32_t k = 0; k < stacks; ++k) {
+                builder.placeItem(r, 1 + (state + k * 7919) % (itemTypes - 1), 1 + k % 3);
+            }
+        }
+        std::string error;
+        if (!world.load(builder, error)) {
+            out << error << std::endl;
+            return;
+        }
+    }
+
+    std::vector<ItemId> probes(4096);
+    for (size_t i = 0; i < probes.size(); ++i) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        probes[i] = 1 + state % (itemTypes - 1);
+    }
+    out << "Item benchmark (" << itemTypes << " item types, " << queries << " queries each)\n"
+        << "      held   has ns  count ns  weapons held ns  canFight ns  needs ns  scan has ns\n";
+    uint64_t checksum = 0;  // Every query folds its result in, so none can be optimized away
+    for (uint32_t held = 10; ; held = std::min(held * 10, itemTypes / 2)) {
+        Player player(world.startRoom);
+        std::vector<ItemStack> scanned;  // The same inventory as an unsorted list, searched linearly
+        while (player.inventory.kinds() < held) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            ItemId item = 1 + state % (itemTypes - 1);
+            if (!player.inventory.has(item)) {
+                ItemStack stack = { item, 1 + state % 5 };
+                scanned.push_back(stack);
+            }
+            gainItem(world, player, item, 1);
+        }
+
+        double ns[6];
+        for (int test = 0; test < 6; ++test) {
+            Clock::time_point start = Clock::now();
+            for (size_t q = 0; q < queries; ++q) {
+                ItemId item = probes[q & (probes.size() - 1)];
+                switch (test) {
+                    case 0: checksum += player.inventory.has(item); break;
+                    case 1: checksum += player.inventory.count(item); break;
+                    case 2: checksum += player.inventory.countHeld(world.weaponItems); break;
+                    case 3: checksum += canFight(world, player); break;
+                    case 4: checksum += meetsItemNeeds(world, player, item); break;
+                    default: {
+                        bool found = false;
+                        for (size_t i = 0; i < scanned.size() && !found; ++i) {
+                            found = scanned[i].item == item;
+                        }
+                        checksum += found;
+                        break;
+                    }
+                }
+            }
+            ns[test] = std::chrono::duration<double>(Clock::now() - start).count() / queries * 1e9;
+        }
+        out << "  " << std::setw(8) << held << std::fixed << std::setprecision(1)
+            << std::setw(9) << ns[0] << std::setw(10) << ns[1] << std::setw(17) << ns[2]
+            << std::setw(13) << ns[3] << std::setw(10) << ns[4] << std::setw(13) << ns[5] << std::endl;
+        out.unsetf(std::ios::fixed);
+        out << std::setprecision(6);
+        if (held >= itemTypes / 2) {
+            break;
+        }
+    }
+
+    // A player wanders the world taking everything and dropping a stack now and then
+    // (the generated transcript's fights become takes and its talks become drops)
+    std::istringstream transcript(generateTranscript(100000, seed));
+    CommandTable commands;
+    registerGameCommands(commands);
+    Player player(world.startRoom);
+    FrameBuffer discarded;
+    std::ostream sink(&discarded);
+    uint32_t drops = 0;
+    Clock::time_point start = Clock::now();
+    size_t turns = 0;
+    for (std::string line; std::getline(transcript, line); ++turns) {
+        bool redraw;
+        if (line == "fight") {
+            line = "take";
+        } else if (line == "talk" && !player.inventory.contents().empty()) {
+            line = "drop " + itemName(world, player.inventory.contents().begin()->item);
+            drops++;
+        }
+        processCommand(commands, world, player, line, sink, redraw);
+        discarded.clear();
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    size_t spilled = 0;
+    player.changes.forEachItemRoom([&spilled](RoomId, const ItemStacks& stacks) {
+        spilled += stacks.onHeap() ? 1 : 0;
+    });
+    out << "Room items: " << world.roomItemStart[rooms] << " stacks in " << rooms << " rooms; after " << turns
+        << " turns (" << drops << " drops, " << seconds / turns * 1e9 << " ns/turn) the player holds "
+        << player.inventory.kinds() << " kinds, " << player.changes.itemRooms() << " rooms changed, " << spilled
+        << " of them on the heap, " << sizeof(ItemStacks) << " bytes per room list\n"
+        << "  checksum: " << (checksum & 0xffff) << std::endl;
+}
+
+// Measures route index preprocessing and query time on generated worlds of growing size
+void runRouteBenchmark(std::ostream& out, uint32_t maxRooms, unsigned seed) {
+    typedef std::chrono::steady_clock Clock;
+    static const uint32_t sizes[] = { 1000, 2000, 10000, 100000, 1000000, 10000000 };
+    out << "Route benchmark\n"
+        << "     rooms  index      build ms   index MiB   query us   avg moves\n";
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]) && sizes[s] <= maxRooms; ++s) {
+        World world;
+        {
+            WorldBuilder builder;
+            buildBenchmarkWorld(builder, sizes[s], seed);
+            std::string error;
+            if (!world.load(builder, error)) {
+                out << error << std::endl;
+                return;
+            }
+        }
+        Clock::time_point start = Clock::now();
+        RoutePlanner routes(world);
+        double buildSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        // Routes between random pairs of rooms
+        const size_t queries = 2000;
+        uint32_t state = seed != 0 ? seed : 1;
+        std::vector<uint8_t> route;
+        uint64_t totalMoves = 0;
+        start = Clock::now();
+        for (size_t q = 0; q < queries; ++q) {
+            RoomId ends[2];
+            for (int i = 0; i < 2; ++i) {
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                ends[i] = state % world.roomCount();
+            }
+            routes.findRoute(ends[0], ends[1], route);
+            totalMoves += route.size();
+        }
+        double querySeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        out << std::setw(10) << world.roomCount() << "  " << std::setw(9) << std::left
+            << (routes.usesTable() ? "next-hop" : "clusters") << std::right
+            << std::setw(10) << std::fixed << std::setprecision(1) << buildSeconds * 1000.0
+            << std::setw(12) << std::setprecision(2) << routes.memoryBytes() / (1024.0 * 1024.0)
+            << std::setw(11) << std::setprecision(2) << querySeconds / queries * 1e6
+            << std::setw(12) << std::setprecision(0) << static_cast<double>(totalMoves) / queries << std::endl;
+        out.unsetf(std::ios::floatfield);
+        out << std::setprecision(6);
+    }
+}
+
+// Measures text index build time and query latency on generated worlds of growing size
+void runSearchBenchmark(std::ostream& out, uint32_t maxRooms, unsigned seed, unsigned threads) {
+    typedef std::chrono::steady_clock Clock;
+    static const uint32_t sizes[] = { 1000, 10000, 100000, 1000000, 10000000 };
+    // Common words, words that occur together, and words that never do
+    static const char* const phrases[] = {
+        "pines", "cottages", "fungus", "reeds", "tall pines", "broken columns", "bare grey peaks",
+        "still water", "cottages well dog", "pines cottages", "fungus reeds", "woodpecker cairns"
+    };
+    const size_t phraseCount = sizeof(phrases) / sizeof(phrases[0]);
+    out << "Search benchmark (" << threads << (threads == 1 ? " thread" : " threads") << ")\n"
+        << "     rooms       words     terms  build ms 1T  build ms  index MiB   query us   worst us\n";
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]) && sizes[s] <= maxRooms; ++s) {
+        World world;
+        {
+            WorldBuilder builder;
+            buildBenchmarkWorld(builder, sizes[s], seed);
+            std::string error;
+            if (!world.load(builder, error)) {
+                out << error << std::endl;
+                return;
+            }
+        }
+        Clock::time_point start = Clock::now();
+        double serialSeconds = 0;
+        if (threads > 1) {
+            TextIndex serial(world, 1);
+            serialSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+            start = Clock::now();
+        }
+        TextIndex index(world, threads);
+        double buildSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+        if (threads == 1) {
+            serialSeconds = buildSeconds;
+        }
+
+        // Alternate fixed phrases with room names, which pair a rare number with a common word
+        const size_t queries = 2000;
+        uint32_t state = seed != 0 ? seed : 1;
+        TextIndex::Hit hits[SEARCH_RESULTS];
+        uint64_t checksum = 0;
+        double total = 0, worst = 0;
+        for (size_t q = 0; q < queries; ++q) {
+            std::string query;
+            if (q % 2 == 0) {
+                query = phrases[(q / 2) % phraseCount];
+            } else {
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                query = stripAnsi(world.textString(world.roomName[state % world.roomCount()]));
+            }
+            start = Clock::now();
+            size_t found = index.search(query.data(), query.size(), SEARCH_RESULTS, [](uint32_t) { return true; }, hits, nullptr);
+            double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+            total += seconds;
+            worst = std::max(worst, seconds);
+            checksum += found > 0 ? hits[0].document + found : 0;
+        }
+
+        out << std::setw(10) << world.roomCount() << std::setw(12) << index.wordCount() << std::setw(10) << index.termCount()
+            << std::fixed << std::setprecision(1) << std::setw(13) << serialSeconds * 1000.0
+            << std::setw(10) << buildSeconds * 1000.0
+            << std::setw(11) << std::setprecision(2) << index.memoryBytes() / (1024.0 * 1024.0)
+            << std::setw(11) << total / queries * 1e6 << std::setw(11) << worst * 1e6 << std::endl;
+        out.unsetf(std::ios::floatfield);
+        out << std::setprecision(6) << "  checksum: " << (checksum & 0xffff) << std::endl;
+    }
+}
+
+// Matches a command the way the original main loop did, with a chain of string
+// comparisons. Kept only as the baseline for the dispatcher benchmark.
+int legacyMatchCommand(const std::string& command) {
+    if (command == "look") return 1;
+    if (command == "help") return 2;
+    if (command == "quit") return 3;
+    if (command == "talk") return 4;
+    if (command == "fight") return 5;
+    if (command == "take") return 6;
+    if (command == "n" || command == "north") return 7;
+    if (command == "e" || command == "east") return 8;
+    if (command == "s" || command == "south") return 9;
+    if (command == "w" || command == "west") return 10;
+    return 0;
+}
+
+// Times loading the built-in world both ways: attaching the tables compiled into the
+// program, and building the same world at run time through a WorldBuilder
+void runStartupBenchmark(std::ostream& out, size_t loads) {
+    typedef std::chrono::steady_clock Clock;
+    uint64_t checksum = 0;
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < loads; ++i) {
+        World world;
+        world.attach(CompiledWorld<Eldara>::tables());
+        checksum += world.checksum + world.roomCount();
+    }
+    double compiledSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    size_t imageBytes = 0;
+    start = Clock::now();
+    for (size_t i = 0; i < loads; ++i) {
+        WorldBuilder builder;
+        buildCompiledWorld<Eldara>(builder);
+        World world;
+        std::string error;
+        if (!world.load(builder, error)) {
+            out << error << std::endl;
+            return;
+        }
+        checksum += world.checksum + world.roomCount();
+        imageBytes = world.memoryBytes();
+    }
+    double builtSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    World world;
+    world.attach(CompiledWorld<Eldara>::tables());
+    out << "Startup benchmark (" << world.roomCount() << " rooms, " << loads << " loads each)\n"
+        << "  compiled tables: " << compiledSeconds / loads * 1e9 << " ns/load, " << world.memoryBytes() << " bytes of read-only data\n"
+        << "  runtime build:   " << builtSeconds / loads * 1e9 << " ns/load, " << imageBytes << " byte image\n"
+        << "  checksum:        " << (checksum & 0xffff) << std::endl;
+}
+
+// Times verb matching through the command table against the legacy if-chain
+void runDispatchBenchmark(std::ostream& out, const CommandTable& commands, size_t passes) {
+    typedef std::chrono::steady_clock Clock;
+    static const char* const inputs[] = {
+        "look", "help", "quit", "talk", "fight", "take", "n", "north", "e", "east",
+        "s", "south", "w", "west", "dance", "jump", "inventory", "xyzzy"
+    };
+    const size_t inputCount = sizeof(inputs) / sizeof(inputs[0]);
+    std::vector<std::string> lines(inputs, inputs + inputCount);
+
+    // Both loops fold their results into a checksum so the work cannot be optimized away
+    uintptr_t checksum = 0;
+    Clock::time_point start = Clock::now();
+    for (size_t pass = 0; pass < passes; ++pass) {
+        for (size_t i = 0; i < inputCount; ++i) {
+            checksum += legacyMatchCommand(lines[i]);
+        }
+    }
+    double legacySeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    start = Clock::now();
+    for (size_t pass = 0; pass < passes; ++pass) {
+        for (size_t i = 0; i < inputCount; ++i) {
+            Token verb, argument;
+            parseCommand(lines[i], verb, argument);
+            checksum += reinterpret_cast<uintptr_t>(commands.find(verb));
+        }
+    }
+    double tableSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    double lookups = static_cast<double>(passes) * inputCount;
+    out << "Dispatch benchmark (" << commands.size() << " spellings, " << inputCount << " inputs, "
+        << static_cast<uint64_t>(lookups) << " lookups each)\n"
+        << "  if-chain:      " << legacySeconds / lookups * 1e9 << " ns/lookup\n"
+        << "  command table: " << tableSeconds / lookups * 1e9 << " ns/lookup (parse + hash)\n"
+        << "  checksum:      " << (checksum & 0xffff) << std::endl;
+}
+
+// Prints command-line usage
+void printUsage(std::ostream& out, const char* program) {
+    out << "Usage: " << program << " [options]\n"
+        << "  (no options)          Play interactively\n"
+        << "  --world <image>       Play a compiled world image instead of the built-in world\n"
+        << "  --save <file>         Resume the game saved in <file> (if any) and save every turn to it\n"
+        << "  --history <n>         Turns a player can undo, 0 to turn undo off (default 1000)\n"
+        << "  --macros <file>       Define the macros in <file>, one '<name> <commands>' per line\n"
+        << "  --compile-world <src> <image>\n"
+        << "                        Compile a world definition file into a binary image\n"
+        << "  --check-builtin <src> Check that a world definition file builds the same world as the built-in one\n"
+        << "  --generate <rooms> <file>\n"
+        << "                        Generate a world: a definition file if <file> ends in .world, else an image\n"
+        << "  --branching <f>       Chance a generated room opens off any earlier room, not the last (default 0.3)\n"
+        << "  --loops <f>           Chance a generated room gets an extra passage (default 0.05)\n"
+        << "  --locks <n>           Locked regions in a generated world, at most 30 (default 3)\n"
+        << "  --monsters <f>        Share of generated rooms with a monster (default 0.02)\n"
+        << "  --villagers <f>       Share of generated rooms with a villager (default 0.02)\n"
+        << "  --serve <address>     Serve players over TCP (<port> or <host>:<port>) or a Unix socket path\n"
+        << "  --loadgen <address>   Load-test a running server (see --sessions, --turns)\n"
+        << "  --sessions <n>        Concurrent load generator sessions (default 1000)\n"
+        << "  --turns <n>           Commands per load generator session (default 100)\n"
+        << "  --solve               Print the fewest-moves winning transcript, or prove the world unwinnable\n"
+        << "  --playtest [agents]   Play the world with simulated agents and report statistics (default 10000)\n"
+        << "  --policy <name>       Playtest agent policy: random (default) or greedy\n"
+        << "  --agent-turns <n>     Turns each playtest agent may take (default 10000)\n"
+        << "  --threads <n>         Worker threads for --solve, --playtest and --generate (default: one per core)\n"
+        << "  --replay <file|->     Run a command transcript headless and report timings\n"
+        << "  --bench [commands]    Replay a generated transcript (default 1000000 commands)\n"
+        << "  --bench-dispatch [n]  Compare command lookup against the old if-chain (n passes)\n"
+        << "  --bench-startup [n]   Compare loading the built-in world from compiled tables and building it (n loads)\n"
+        << "  --bench-world [rooms] Generate a world and time movement over it (default 1000000 rooms)\n"
+        << "  --bench-routes [rooms] Time route indexing and queries on generated worlds up to this size (default 1000000)\n"
+        << "  --bench-search [rooms] Time text indexing and search queries on generated worlds up to this size (default 1000000)\n"
+        << "  --bench-rules [rules] Time turns in worlds with up to this many rules (default 100000)\n"
+        << "  --bench-actors [n]    Time simulation ticks with up to n wandering actors (default 100000)\n"
+        << "  --bench-items [types] Time inventory queries with this many item types registered (default 10000)\n"
+        << "  --bench-save [turns]  Time per-turn journaling, snapshots and recovery (default 100000 turns)\n"
+        << "  --bench-undo [turns]  Time turn snapshots and rewinds and measure the history kept (default 100000 turns)\n"
+        << "  --bench-batch [n]     Compare n commands run one per line, 20 per line and without rendering (default 1000000)\n"
+        << "  --seed <n>            Seed for the generated benchmark transcript\n"
+        << "  --echo                Print game output during --replay/--bench instead of discarding it\n"
+        << "  --plain               Print plain text without color codes (also enabled by NO_COLOR)\n"
+        << "  --render-stats        Report bytes and write() calls per frame when the game ends\n"
+        << "  --stats               Print engine statistics (verbs, phase latencies, rooms) to stderr on exit\n"
+        << "  --stats-file <file>   Write engine statistics as JSON to <file> on exit\n";
+}
+
+int main(int argc, char* argv[]) {
+    std::string replayPath;        // Transcript to replay, "-" for stdin
+    size_t benchCommands = 0;      // Number of generated commands to benchmark with
+    unsigned seed = 1;             // Seed for the generated transcript
+    size_t dispatchIterations = 0; // Lookups per input for the dispatcher microbenchmark
+    size_t startupLoads = 0;       // World loads timed by the startup benchmark
+    uint32_t worldRooms = 0;       // Size of the generated world for the world benchmark
+    uint32_t routeRooms = 0;       // Largest generated world for the route benchmark
+    uint32_t searchRooms = 0;      // Largest generated world for the search benchmark
+    size_t saveTurns = 0;          // Turns journaled by the save benchmark
+    uint32_t benchRules = 0;       // Largest rule count for the rule benchmark
+    uint32_t benchActors = 0;      // Largest actor count for the simulation benchmark
+    uint32_t benchItems = 0;       // Item types registered for the inventory benchmark
+    size_t undoTurns = 0;          // Turns played by the undo benchmark
+    size_t batchCommands = 0;      // Commands run by the batching benchmark
+    std::string savePath;          // Saved game to resume and keep saving to
+    size_t historyDepth = TurnHistory::DEFAULT_DEPTH;  // Turns a player can undo
+    std::string macroPath;         // Macro definitions to start with
+    std::string worldPath;         // Compiled world image to play instead of the built-in world
+    std::string compileSource;     // World definition file to compile
+    std::string compileOutput;     // Where to write the compiled image
+    std::string builtinSource;     // World definition file to check against the built-in world
+    std::string generateOutput;    // Where to write a generated world
+    GeneratorOptions generator;    // Settings for --generate
+    std::string serveAddress;      // Address to serve players on
+    std::string loadgenAddress;    // Server address for the load generator
+    size_t loadSessions = 1000;    // Concurrent sessions opened by the load generator
+    size_t loadTurns = 100;        // Commands each load generator session plays
+    bool solve = false;            // Whether to solve the world instead of playing it
+    size_t playtestAgents = 0;     // Number of agents to playtest the world with
+    AgentPolicy policy = POLICY_RANDOM;  // How playtest agents choose commands
+    size_t agentTurns = 10000;     // Turns each playtest agent may take
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());  // Worker threads for parallel modes
+    bool echo = false;             // Whether headless runs print game output
+    bool renderStats = false;      // Whether to report output statistics on exit
+    bool engineStats = false;      // Whether to print engine statistics on exit
+    std::string statsPath;         // Where to write engine statistics as JSON on exit
+
+    // Honour the NO_COLOR convention (https://no-color.org): any non-empty value disables color
+    const char* noColor = std::getenv("NO_COLOR");
+    bool plain = noColor != nullptr && noColor[0] != '\0';
+
+    // Parse command-line options
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--replay" && i + 1 < argc) {
+            replayPath = argv[++i];
+        } else if (arg == "--bench") {
+            benchCommands = 1000000;
+            if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+                benchCommands = std::strtoul(argv[++i], nullptr, 10);
+            }
+        } else if (arg == "--bench-dispatch") {
+            dispatchIterations = 2000000;
+            if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+                dispatchIterations = std::strtoul(argv[++i], nullptr, 10);
+            }
+        } else if (arg == "--bench-startup") {
+            startupLoads = 100000;
+            if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+                startupLoads = std::max<size_t>(1, std::strtoul(argv[++i], nullptr, 10));
+            }
+        } else if (arg == "--bench-world") {
+            worldRooms = 1000000;
+            if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+                worldRooms = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+            }
+        } else if (arg == "--bench-search") {
+            searchRooms = 1000000;
+            if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+                searchRooms = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+            }
+        } else if (arg == "--bench-routes") {
+            routeRooms = 1000000;
+            if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+                routeRooms = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+            }
+        } else if (arg == "--bench-save") {
+            saveTurns = 100000;
+            if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+                saveTurns = std::strtoul(argv[++i], nullptr, 10);
+            }
+        } else if (arg == "--bench-rules") {
+            benchRules = 100000;
+            if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+                benchRules = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+            }
+        } else if (arg == "--bench-actors") {
+            benchActors = 100000;
+            if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+                benchActors = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+            }
+        } else if (arg == "--bench-items") {
+            benchItems = 10000;
+            if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+                benchItems = std::max<uint32_t>(20, static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10)));
+            }
+        } else if (arg == "--bench-undo") {
+            undoTurns = 100000;
+            if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+                undoTurns = std::max<size_t>(1, std::strtoul(argv[++i], nullptr, 10));
+            }
+        } else if (arg == "--save" && i + 1 < argc) {
+            savePath = argv[++i];
+        } else if (arg == "--bench-batch") {
+            batchCommands = 1000000;
+            if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+                batchCommands = std::max<size_t>(1, std::strtoul(argv[++i], nullptr, 10));
+            }
+        } else if (arg == "--macros" && i + 1 < argc) {
+            macroPath = argv[++i];
+        } else if (arg == "--history" && i + 1 < argc) {
+            historyDepth = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--world" && i + 1 < argc) {
+            worldPath = argv[++i];
+        } else if (arg == "--compile-world" && i + 2 < argc) {
+            compileSource = argv[++i];
+            compileOutput = argv[++i];
+        } else if (arg == "--check-builtin" && i + 1 < argc) {
+            builtinSource = argv[++i];
+        } else if (arg == "--generate" && i + 2 < argc) {
+            generator.rooms = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+            generateOutput = argv[++i];
+        } else if (arg == "--branching" && i + 1 < argc) {
+            generator.branching = std::strtod(argv[++i], nullptr);
+        } else if (arg == "--loops" && i + 1 < argc) {
+            generator.loops = std::strtod(argv[++i], nullptr);
+        } else if (arg == "--locks" && i + 1 < argc) {
+            generator.locks = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--monsters" && i + 1 < argc) {
+            generator.monsters = std::strtod(argv[++i], nullptr);
+        } else if (arg == "--villagers" && i + 1 < argc) {
+            generator.villagers = std::strtod(argv[++i], nullptr);
+        } else if (arg == "--serve" && i + 1 < argc) {
+            serveAddress = argv[++i];
+        } else if (arg == "--loadgen" && i + 1 < argc) {
+            loadgenAddress = argv[++i];
+        } else if (arg == "--sessions" && i + 1 < argc) {
+            loadSessions = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--turns" && i + 1 < argc) {
+            loadTurns = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--solve") {
+            solve = true;
+        } else if (arg == "--playtest") {
+            playtestAgents = 10000;
+            if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+                playtestAgents = std::strtoul(argv[++i], nullptr, 10);
+            }
+        } else if (arg == "--policy" && i + 1 < argc) {
+            std::string name = argv[++i];
+            if (name != "random" && name != "greedy") {
+                printUsage(std::cerr, argv[0]);
+                return 2;
+            }
+            policy = name == "random" ? POLICY_RANDOM : POLICY_GREEDY;
+        } else if (arg == "--agent-turns" && i + 1 < argc) {
+            agentTurns = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threads = static_cast<unsigned>(std::max(1ul, std::strtoul(argv[++i], nullptr, 10)));
+        } else if (arg == "--seed" && i + 1 < argc) {
+            seed = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--echo") {
+            echo = true;
+        } else if (arg == "--plain") {
+            plain = true;
+        } else if (arg == "--render-stats") {
+            renderStats = true;
+        } else if (arg == "--stats") {
+            engineStats = true;
+        } else if (arg == "--stats-file" && i + 1 < argc) {
+            statsPath = argv[++i];
+        } else {
+            printUsage(std::cerr, argv[0]);
+            return 2;
+        }
+    }
+
+    CommandTable commands;
+    registerGameCommands(commands);
+
+    if (benchActors > 0) {
+        runActorBenchmark(std::cout, benchActors, seed);
+        return 0;
+    }
+
+    if (benchItems > 0) {
+        runItemBenchmark(std::cout, benchItems, seed);
+        return 0;
+    }
+
+    if (undoTurns > 0) {
+        runUndoBenchmark(std::cout, commands, undoTurns, seed);
+        return 0;
+    }
+
+    if (benchRules > 0) {
+        runRuleBenchmark(std::cout, commands, benchRules, seed);
+        return 0;
+    }
+
+    if (dispatchIterations > 0) {
+        runDispatchBenchmark(std::cout, commands, dispatchIterations);
+        return 0;
+    }
+
+    if (startupLoads > 0) {
+        runStartupBenchmark(std::cout, startupLoads);
+        return 0;
+    }
+
+    if (!loadgenAddress.empty()) {
+        return runLoadGenerator(loadgenAddress, loadSessions, loadTurns, seed);
+    }
+
+    if (!compileSource.empty()) {
+        std::string error;
+        if (!compileWorldFile(compileSource, compileOutput, error)) {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    if (!builtinSource.empty()) {
+        std::string error;
+        if (!checkBuiltinWorld(builtinSource, error)) {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+        std::cerr << builtinSource << " builds the same world as the built-in one" << std::endl;
+        return 0;
+    }
+
+    if (!generateOutput.empty()) {
+        generator.seed = seed;
+        generator.threads = threads;
+        return runGenerator(std::cout, generator, generateOutput);
+    }
+
+    if (worldRooms > 0) {
+        runWorldBenchmark(std::cout, worldRooms, seed, threads);
+        return 0;
+    }
+
+    if (routeRooms > 0) {
+        runRouteBenchmark(std::cout, routeRooms, seed);
+        return 0;
+    }
+
+    if (searchRooms > 0) {
+        runSearchBenchmark(std::cout, searchRooms, seed, threads);
+        return 0;
+    }
+
+    World world;
+    if (worldPath.empty()) {
+        world.attach(CompiledWorld<Eldara>::tables());
+    } else {
+        std::string error;
+        if (!world.mapFile(worldPath, error)) {
+            std::cerr << worldPath << ": " << error << std::endl;
+            return 1;
+        }
+    }
+
+    if (solve) {
+        return runSolver(world, threads);
+    }
+
+    if (playtestAgents > 0) {
+        int status = runPlaytest(std::cout, commands, world, playtestAgents, policy, threads, seed, agentTurns);
+        return reportEngineStats(world, engineStats, statsPath, status);
+    }
+
+    // Index routes for the go and path commands
+    RoutePlanner routes(world);
+    world.routes = &routes;
+
+    // Index room text and dialogue for the search and hint commands
+    TextIndex textIndex(world, threads);
+    world.textIndex = &textIndex;
+
+    // Wandering NPCs, if the world has any; every player shares them
+    ActorSimulation simulation(world, seed);
+    ActorSimulation* actors = world.actorTotal > 0 ? &simulation : nullptr;
+
+    if (!serveAddress.empty()) {
+        int status = runServer(world, commands, actors, historyDepth, serveAddress, plain);
+        return reportEngineStats(world, engineStats, statsPath, status);
+    }
+
+    if (saveTurns > 0) {
+        runSaveBenchmark(std::cout, commands, world, saveTurns, seed);
+        return 0;
+    }
+
+    if (batchCommands > 0) {
+        runBatchBenchmark(std::cout, commands, world, batchCommands, seed);
+        return 0;
+    }
+
+    // Initialize player at the starting location (forest)
+    Player player(world.startRoom);
+    player.actors = actors;
+    RenderCache renderCache(world.roomCount());
+    player.renderCache = &renderCache;
+    TurnHistory history(historyDepth);
+    if (historyDepth > 0) {
+        player.history = &history;
+        history.reset(player);
+    }
+    MacroTable macros(commands);
+    player.macros = &macros;
+    if (!macroPath.empty()) {
+        std::string error;
+        if (!macros.load(macroPath, error)) {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+    }
+
+    // Interactive games can always be saved; headless runs only when asked to.
+    // With --save, an existing save is resumed and every turn is journaled to it.
+    // The default save is named after the world, so saves of different worlds stay apart
+    std::string defaultSave = "eldara.sav";
+    if (!worldPath.empty()) {
+        std::string name = worldPath.substr(worldPath.find_last_of('/') + 1);
+        size_t dot = name.find_last_of('.');
+        defaultSave = (dot != std::string::npos && dot > 0 ? name.substr(0, dot) : name) + ".sav";
+    }
+    SaveSlot slot(commands, savePath.empty() ? defaultSave : savePath);
+    bool interactive = replayPath.empty() && benchCommands == 0;
+    if (interactive || !savePath.empty()) {
+        player.saveSlot = &slot;
+    }
+    std::string resumeMessage;
+    if (!savePath.empty()) {
+        std::string error;
+        uint32_t replayed = 0;
+        struct stat info;
+        bool resumed = ::stat(savePath.c_str(), &info) == 0;
+        if (resumed ? !slot.load(world, player, replayed, error) : !slot.save(world, player, error)) {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+        if (resumed) {
+            std::ostringstream message;
+            message << GameColors::bold << GameColors::green << "Resumed your saved game from " << savePath << " ("
+                    << player.moveCount << " moves so far)." << GameColors::reset << "\n";
+            resumeMessage = message.str();
+        }
+    }
+
+    // Standard input, when the game reads it, is read ahead on its own thread
+    std::unique_ptr<ReadAheadBuffer> readAhead;
+    if (benchCommands == 0 && (replayPath.empty() || replayPath == "-")) {
+        readAhead.reset(new ReadAheadBuffer(STDIN_FILENO));
+    }
+    std::istream stdinAhead(readAhead.get());
+
+    // Headless modes: replay a transcript file or a generated benchmark transcript
+    if (!replayPath.empty() || benchCommands > 0) {
+        Renderer renderer(echo ? STDOUT_FILENO : -1, plain);
+
+        std::ifstream file;
+        std::istringstream generated;
+        std::istream* in = &stdinAhead;
+        if (benchCommands > 0) {
+            generated.str(generateTranscript(benchCommands, seed));
+            in = &generated;
+        } else if (replayPath != "-") {
+            file.open(replayPath.c_str());
+            if (!file) {
+                std::cerr << "Cannot open transcript: " << replayPath << std::endl;
+                return 1;
+            }
+            in = &file;
+        }
+
+        ReplayStats stats;
+        stats.turnNanos.reserve(benchCommands);
+        TurnResult result = runGameLoop(commands, world, player, *in, renderer, &stats);
+        printReplayReport(std::cout, stats, renderer, world, player, result);
+        return reportEngineStats(world, engineStats, statsPath, 0);
+    }
+
+    Renderer renderer(STDOUT_FILENO, plain);
+    showTitleScreen(renderer.out());
+    renderer.out() << resumeMessage;
+    runGameLoop(commands, world, player, stdinAhead, renderer, nullptr);
+    if (renderStats) {
+        std::cerr << "Output: ";
+        printRenderStats(std::cerr, renderer);
+        std::cerr << std::endl;
+    }
+    return reportEngineStats(world, engineStats, statsPath, 0);
+}
@@ -0,0 +1,47 @@
+#!/bin/sh
+# Replays every transcript in tests/ and compares the output with the expected one.
+#
+#   tests/run.sh [path/to/AdventureGame]
+#
+# Each case is <name>.in, played with --replay --echo --plain, and <name>.out, the
+# expected output. An optional <name>.args holds more arguments, where $WORK is a
+# scratch directory holding every world in tests/worlds compiled to <world>.bin.
+# Timings and the scratch directory are blanked before comparing. Set UPDATE=1 to rewrite the .out files.
+
+TESTS=$(cd "$(dirname "$0")" && pwd)
+BIN=${1:-./AdventureGame}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+for world in "$TESTS"/worlds/*.world; do
+    name=$(basename "$world" .world)
+    if ! "$BIN" --compile-world "$world" "$WORK/$name.bin"; then
+        echo "FAIL compiling $world"
+        exit 1
+    fi
+done
+
+failed=0
+total=0
+for input in "$TESTS"/*.in; do
+    name=$(basename "$input" .in)
+    args=""
+    if [ -f "$TESTS/$name.args" ]; then
+        args=$(eval echo "$(cat "$TESTS/$name.args")")
+    fi
+    # Cases run in the scratch directory, so saves they make land there
+    actual=$(cd "$WORK" && "$BIN" --plain --echo --replay "$input" $args 2>&1; echo "exit status: $?")
+    actual=$(printf '%s\n' "$actual" | sed -e '/^  elapsed: /d' -e '/^  throughput: /d' -e '/^  latency (us): /d' \
+                                           -e 's/ in [0-9.e+-]* ms/ in N ms/' -e "s|$WORK|\$WORK|g")
+    total=$((total + 1))
+    if [ -n "$UPDATE" ]; then
+        printf '%s\n' "$actual" > "$TESTS/$name.out"
+    elif ! printf '%s\n' "$actual" | diff -u "$TESTS/$name.out" - > "$WORK/diff"; then
+        echo "FAIL $name"
+        cat "$WORK/diff"
+        failed=$((failed + 1))
+    fi
+done
+
+echo "$((total - failed)) of $total transcripts passed"
+[ "$failed" -eq 0 ]